@@ -0,0 +1,268 @@
+"""Stand-in collector for local testing of the uploader.
+
+Accepts batches POSTed by the device, or subscribes to the device topics on an
+MQTT broker, decodes the sample blocks and appends them to <devname>.csv in the
+output folder. Blocks are framed with their log position, so retried batches
+are deduplicated per device. After an outage the freshest blocks arrive ahead
+of the backlog, so rows in the CSV are only in time order per stretch.
+Rows are channel, timestamp, value and why the device logged the sample:
+every, or first, change and heartbeat when it reports by exception (see
+main/include/deadband.h). Between those rows the value stayed within the
+deadband of the last row, a gap longer than the heartbeat is lost data.
+Alarms arrive as JSON, are appended to <devname>.alarms.ndjson and printed
+with their sample-to-collector latency. The summary of an outage the device
+sends before its backlog (min, max and mean per bucket) is JSON too, it is
+appended to <devname>.summary.ndjson.
+Metrics snapshots, sent in an X-Metrics header or on their own topic, are
+appended to <devname>.metrics.log.
+
+Usage: python collector.py [port | mqtt://broker[:port]] [output folder]
+
+MQTT mode needs the paho-mqtt package.
+"""
+
+import http.server
+import json
+import os
+import struct
+import sys
+import threading
+import time
+
+BLOCK_MAGIC = 0x424C
+BLOCK_HEADER = struct.Struct("<HHHBBqqii")
+FRAME_POS = struct.Struct("<Q")
+FLAG_TAGGED = 0x01
+REPORTS = ["every", "first", "change", "heartbeat"]
+
+source = sys.argv[1] if len(sys.argv) > 1 else "8080"
+out_dir = sys.argv[2] if len(sys.argv) > 2 else "./collected"
+os.makedirs(out_dir, exist_ok=True)
+
+lock = threading.Lock()
+stored = {}  # device name -> log positions of the stored blocks
+
+
+def read_varint(buf, offset):
+    result = 0
+    shift = 0
+    while True:
+        byte = buf[offset]
+        offset += 1
+        result |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return result, offset
+        shift += 7
+
+
+def zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_block(buf, offset):
+    """Returns (header fields, samples, offset after the block)."""
+    (magic, payload_len, count, channel, flags, first_ts, last_ts, vmin,
+     vmax) = BLOCK_HEADER.unpack_from(buf, offset)
+    if magic != BLOCK_MAGIC:
+        raise ValueError("bad block magic at offset {}".format(offset))
+    cursor = offset + BLOCK_HEADER.size
+    end = cursor + payload_len
+    samples = []
+    timestamp = first_ts
+    delta = 0
+    value = 0
+    tagged = flags & FLAG_TAGGED
+    if tagged:
+        # Deadband and heartbeat the device reported by, see report.
+        _, cursor = read_varint(buf, cursor)
+        _, cursor = read_varint(buf, cursor)
+    for i in range(count):
+        if i > 0:
+            raw, cursor = read_varint(buf, cursor)
+            delta += zigzag(raw)
+            timestamp += delta
+        raw, cursor = read_varint(buf, cursor)
+        kind = 0
+        if tagged:
+            kind = raw & 0x3
+            raw >>= 2
+        value += zigzag(raw)
+        samples.append((channel, timestamp, value, REPORTS[kind]))
+    if cursor != end:
+        raise ValueError("block payload length mismatch")
+    return samples, end
+
+
+def store_batch(device, body):
+    """Returns (new blocks, new samples). Raises ValueError on bad input."""
+    new_blocks = 0
+    new_samples = []
+    offset = 0
+    try:
+        with lock:
+            seen = stored.setdefault(device, set())
+            while offset < len(body):
+                (pos,) = FRAME_POS.unpack_from(body, offset)
+                samples, end = decode_block(body, offset + FRAME_POS.size)
+                offset = end
+                if pos in seen:
+                    continue  # Already stored by an earlier attempt
+                seen.add(pos)
+                new_blocks += 1
+                new_samples.extend(samples)
+            csv_name = os.path.basename(device) + ".csv"
+            with open(os.path.join(out_dir, csv_name), "a") as f:
+                for sample in new_samples:
+                    f.write("{},{},{},{}\n".format(*sample))
+    except (struct.error, IndexError) as e:
+        raise ValueError(str(e))
+    return new_blocks, new_samples
+
+
+def report(device, seq, body, new_blocks, new_samples):
+    # Lag from the newest sample to now, only meaningful once the device clock
+    # is synchronized.
+    lag = ""
+    if new_samples:
+        lag = " lag_ms={}".format(
+            int(time.time() * 1000) - max(s[1] for s in new_samples))
+    print("{} seq={} bytes={} new_blocks={} samples={} B/sample={:.2f}{}".format(
+        device, seq, len(body), new_blocks, len(new_samples),
+        len(body) / max(len(new_samples), 1), lag))
+
+
+def store_alarm(device, body):
+    """Raises ValueError on bad input."""
+    alarm = json.loads(body)
+    if not isinstance(alarm, dict) or "rule" not in alarm or "t" not in alarm:
+        raise ValueError("not an alarm")
+    with lock:
+        name = os.path.basename(device) + ".alarms.ndjson"
+        with open(os.path.join(out_dir, name), "a") as f:
+            f.write(json.dumps(alarm) + "\n")
+    # Sample-to-collector latency, only meaningful once the device clock is
+    # synchronized.
+    print("{} ALARM {} {} v={} lag_ms={}".format(
+        device, alarm["rule"], "raised" if alarm.get("active") else "cleared",
+        alarm.get("v"), int(time.time() * 1000) - alarm["t"]))
+
+
+def store_summary(device, summary):
+    with lock:
+        name = os.path.basename(device) + ".summary.ndjson"
+        with open(os.path.join(out_dir, name), "a") as f:
+            f.write(json.dumps(summary) + "\n")
+    # Lag from the freshest bucket to now, see report.
+    print("{} SUMMARY from={} to={} bucket_ms={} buckets={} lag_ms={}".format(
+        device, summary["from"], summary["to"], summary["bucket_ms"],
+        len(summary["b"]),
+        int(time.time() * 1000) - max(b[1] for b in summary["b"])))
+
+
+def store_json(device, body):
+    """Alarms and summaries. Raises ValueError on bad input."""
+    message = json.loads(body)
+    if isinstance(message, dict) and isinstance(message.get("summary"), dict):
+        store_summary(device, message["summary"])
+        return
+    store_alarm(device, body)
+
+
+def store_metrics(device, snapshot):
+    with lock:
+        name = os.path.basename(device) + ".metrics.log"
+        with open(os.path.join(out_dir, name), "a") as f:
+            f.write("{} {}\n".format(int(time.time()), snapshot))
+    print("{} METRICS {}".format(device, snapshot))
+
+
+class CollectorHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # Keep-alive, like the device expects
+
+    def do_POST(self):
+        device = self.headers.get("X-Device", "unknown")
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        if self.headers.get("Content-Type") == "application/json":
+            try:
+                store_json(device, body)
+            except (ValueError, KeyError, TypeError) as e:
+                self.reply(400, str(e))
+                return
+            self.reply(200, "ok")
+            return
+        try:
+            new_blocks, new_samples = store_batch(device, body)
+        except ValueError as e:
+            self.reply(400, str(e))
+            return
+        report(device, self.headers.get("X-Seq"), body, new_blocks, new_samples)
+        if self.headers.get("X-Metrics"):
+            store_metrics(device, self.headers["X-Metrics"])
+        self.reply(200 if new_blocks else 409, "ok")
+
+    def reply(self, status, text):
+        payload = text.encode("UTF-8")
+        self.send_response(status)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(payload)))
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def collect_mqtt(uri):
+    import paho.mqtt.client as mqtt
+    from urllib.parse import urlparse
+
+    broker = urlparse(uri)
+    started = time.time()
+    received = [0]
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe("level-logger/+/samples", qos=1)
+        client.subscribe("level-logger/+/alarms", qos=1)
+        client.subscribe("level-logger/+/metrics", qos=0)
+        client.subscribe("level-logger/+/summary", qos=1)
+
+    def on_message(client, userdata, msg):
+        device = msg.topic.split("/")[1]
+        if msg.topic.endswith("/alarms"):
+            try:
+                store_alarm(device, msg.payload)
+            except ValueError as e:
+                print("{} bad alarm: {}".format(device, e))
+            return
+        if msg.topic.endswith("/summary"):
+            try:
+                store_json(device, msg.payload)
+            except (ValueError, KeyError, TypeError) as e:
+                print("{} bad summary: {}".format(device, e))
+            return
+        if msg.topic.endswith("/metrics"):
+            store_metrics(device, msg.payload.decode("UTF-8", "replace"))
+            return
+        try:
+            new_blocks, new_samples = store_batch(device, msg.payload)
+        except ValueError as e:
+            print("{} bad batch: {}".format(device, e))
+            return
+        received[0] += 1
+        report(device, msg.mid, msg.payload, new_blocks, new_samples)
+        print("  {:.2f} msg/s".format(received[0] / (time.time() - started)))
+
+    client = mqtt.Client()
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(broker.hostname, broker.port or 1883)
+    print("Collecting from {} into {}".format(uri, out_dir))
+    client.loop_forever()
+
+
+if source.startswith("mqtt://"):
+    collect_mqtt(source)
+else:
+    server = http.server.ThreadingHTTPServer(("", int(source)), CollectorHandler)
+    print("Collecting on port {} into {}".format(source, out_dir))
+    server.serve_forever()
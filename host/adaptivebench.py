@@ -0,0 +1,134 @@
+"""Adaptive sampling benchmark, run against the host simulator.
+
+Samples level traces with the adaptive controller the way the duty cycle
+does (ll_sim -A, see main/include/adaptive.h), and at fixed rates for
+comparison, where the same change detector runs on the fixed samples.
+Reports per run the samples taken, the delay from the start of each kind of
+event to the first detection, and the largest error of the trace rebuilt
+from the samples by linear interpolation.
+
+The generated trace is a reading every 10 s over two weeks, fixed seed, in
+mm: 1 mm noise and slow evaporation, 60 mm/h morning use every other day,
+600 mm fills in 20 min every 4 days and one 700 mm pump-out in 15 min.
+--trace adds recorded traces, "timestamp value" lines, which have no known
+events and only get samples and error. Exits with 1 if the adaptive run
+misses an event of the generated trace.
+
+Usage: python adaptivebench.py --sim build-host/ll_sim [--days 14]
+                               [--fixed-s 30,300,600] [--trace recorded.txt]
+"""
+
+import bisect
+import os
+import random
+import re
+
+import simbench
+
+SAMPLE = re.compile(r"sample (\d+) (-?\d+) (\d) (\d+)")
+ADAPTIVE = re.compile(r"adaptive samples=(\d+) detections=(\d+)")
+STEP_MS = 10 * 1000
+DAY_MS = 24 * 3600 * 1000
+
+parser = simbench.arguments(seed=True, traces=True)
+parser.add_argument("--days", type=int, default=14)
+parser.add_argument("--fixed-s", default="30,300,600")
+args = parser.parse_args()
+
+
+def generated():
+    """Returns (readings, events), events as (kind, start ms, end ms)."""
+    events = []
+    for day in range(0, args.days, 2):
+        start = day * DAY_MS + 7 * 3600 * 1000
+        events.append(("use", start, start + 3600 * 1000, -60))
+    for day in range(1, args.days, 4):
+        start = day * DAY_MS + 14 * 3600 * 1000
+        events.append(("fill", start, start + 20 * 60 * 1000, 600))
+    start = (args.days // 2) * DAY_MS + 20 * 3600 * 1000 + 30 * 60 * 1000
+    events.append(("pump-out", start, start + 15 * 60 * 1000, -700))
+    events.sort(key=lambda e: e[1])
+
+    rng = random.Random(args.seed)
+    readings = []
+    level = 1500.0
+    for t in range(0, args.days * DAY_MS, STEP_MS):
+        level -= 0.0005  # Evaporation, about 4 mm a day
+        for _, start, end, change in events:
+            if start <= t < end:
+                level += change * STEP_MS / (end - start)
+        readings.append((t, round(level + rng.gauss(0, 1))))
+    return readings, [e[:3] for e in events]
+
+
+def sample(readings, fixed_ms):
+    options = ["-A", "-"]
+    if fixed_ms:
+        options += ["-j", fixed_ms]
+    sim = simbench.run(args.sim, options, simbench.trace_text(readings))
+    simbench.result(sim, ADAPTIVE)
+    return [tuple(int(g) for g in m.groups())
+            for m in simbench.matches(sim.stdout, SAMPLE)]
+
+
+def delays(samples, events):
+    """Returns {kind: [delay ms]} to the first detection of each event."""
+    detected = [s[0] for s in samples if s[2]]
+    result = {}
+    for kind, start, end in events:
+        at = bisect.bisect_left(detected, start)
+        if at < len(detected) and detected[at] < end + DAY_MS / 24:
+            result.setdefault(kind, []).append(detected[at] - start)
+        else:
+            result.setdefault(kind, []).append(None)
+    return result
+
+
+def max_error(readings, samples):
+    times = [s[0] for s in samples]
+    worst = 0
+    for t, v in readings:
+        at = bisect.bisect_right(times, t)
+        if at == 0 or at == len(times):
+            continue
+        (t0, v0), (t1, v1) = samples[at - 1][:2], samples[at][:2]
+        rebuilt = v0 + (v1 - v0) * (t - t0) / (t1 - t0)
+        worst = max(worst, abs(v - rebuilt))
+    return worst
+
+
+def describe(values):
+    if any(v is None for v in values):
+        return "{:>9s}".format("missed")
+    return "{:7.0f} s".format(sum(values) / len(values) / 1000)
+
+
+def main():
+    traces = [("generated", generated())]
+    traces += [(os.path.basename(p), (simbench.recorded(p), []))
+               for p in args.trace]
+    runs = [("adaptive", 0)] + [
+        ("fixed {} s".format(s), int(s) * 1000)
+        for s in args.fixed_s.split(",")]
+    problems = []
+    for name, (readings, events) in traces:
+        kinds = sorted(set(e[0] for e in events))
+        print("{}: {} readings, {} events".format(
+            name, len(readings), len(events)))
+        print("  {:12s} {:>8s} {}  {:>9s}".format(
+            "", "samples", " ".join("{:>9s}".format(k) for k in kinds),
+            "max error"))
+        for run, fixed_ms in runs:
+            samples = sample(readings, fixed_ms)
+            found = delays(samples, events)
+            if not fixed_ms:
+                problems += ["{}: adaptive missed a {} event".format(name, k)
+                             for k in kinds if None in found[k]]
+            print("  {:12s} {:8d} {}  {:6.0f} mm".format(
+                run, len(samples),
+                " ".join(describe(found[k]) for k in kinds),
+                max_error(readings, samples)))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,115 @@
+"""Alarm rule benchmark, run against the host simulator.
+
+Evaluates alarm rules against a level trace the way the logger does, a
+sample at a time (ll_sim -E, see main/include/alarm.h), and reports the
+evaluation time per sample and per rule for 0 to ALARM_RULES_MAX rules.
+Checks the state changes against the rules evaluated here, exits with 1
+if they differ.
+
+The generated trace is a reading every second for a day, fixed seed, in
+mm: 3 mm noise on a level that drains slowly, with a 1500 mm fill over 10
+min every 6 hours and a 600 mm draw over 5 min every 4 hours.
+--trace adds recorded traces, "timestamp value" lines.
+
+Usage: python alarmbench.py --sim build-host/ll_sim [--hours 24]
+                            [--trace recorded.txt]
+"""
+
+import random
+import re
+
+import simbench
+
+ALARM = re.compile(r"alarm (-?\d+) (\S+) (\w+) (\d) (-?\d+)")
+ALARMS = re.compile(
+    r"alarms rules=(\d+) samples=(\d+) changes=(\d+) "
+    r"ns_per_sample=([\d.]+) ns_per_rule=([\d.]+)")
+# Every kind, level rules with and without hysteresis, rate rules with the
+# default and a longer window. The first n make the n rule runs.
+RULES = ["overflow:above:2500:50", "dry:below:300", "fill:rise:60",
+         "draw:fall:60:300", "high:above:2000", "low:below:800:20",
+         "surge:rise:20:600", "leak:fall:5"]
+HOUR_MS = 3600 * 1000
+
+parser = simbench.arguments(seed=True, traces=True)
+parser.add_argument("--hours", type=int, default=24)
+args = parser.parse_args()
+
+
+def generated():
+    rng = random.Random(args.seed)
+    readings = []
+    level = 1000.0
+    for t in range(0, args.hours * HOUR_MS, 1000):
+        level -= 0.01
+        if t % (6 * HOUR_MS) < 600 * 1000:
+            level += 1500 / 600
+        if (t + HOUR_MS) % (4 * HOUR_MS) < 300 * 1000:
+            level -= 600 / 300
+        readings.append((t, round(level + rng.gauss(0, 3))))
+    return "generated", readings
+
+
+def reference(readings, rules):
+    """Returns the state changes as (timestamp, rule, active, value)."""
+    changes = []
+    for spec in rules:
+        name, kind, threshold, *param = spec.split(":")
+        threshold = int(threshold)
+        param = int(param[0]) if param else None
+        hysteresis = param or 0
+        window_ms = (param or 60) * 1000
+        active = False
+        anchor = None
+        for t, v in readings:
+            now = active
+            if kind == "above":
+                now = v > threshold - (hysteresis if active else 0)
+            elif kind == "below":
+                now = v < threshold + (hysteresis if active else 0)
+            elif anchor is None or t < anchor[0]:
+                anchor = (t, v)
+            elif t - anchor[0] >= window_ms:
+                rate = simbench.trunc_div((v - anchor[1]) * 60 * 1000,
+                                          t - anchor[0])
+                now = rate > threshold if kind == "rise" else \
+                    rate < -threshold
+                anchor = (t, v)
+            if now != active:
+                active = now
+                changes.append((t, name, int(active), v))
+    return sorted(changes)
+
+
+def evaluate(readings, rules):
+    sim = simbench.run(args.sim, ["-E", "-", "-F", ",".join(rules)],
+                       simbench.trace_text(readings))
+    totals = [float(g) for g in simbench.result(sim, ALARMS)]
+    changes = [(int(m.group(1)), m.group(2), int(m.group(4)),
+                int(m.group(5))) for m in simbench.matches(sim.stdout, ALARM)]
+    return sorted(changes), totals
+
+
+def main():
+    traces = [generated()] + [simbench.recorded_named(path)
+                              for path in args.trace]
+    problems = []
+    for name, readings in traces:
+        print("{}: {} readings".format(name, len(readings)))
+        for n in range(len(RULES) + 1):
+            changes, totals = evaluate(readings, RULES[:n])
+            expected = reference(readings, RULES[:n])
+            if changes != expected:
+                problems.append("{}, {} rules: {} state changes, {} in the "
+                                "reference".format(name, n, len(changes),
+                                                   len(expected)))
+            print("  {} rules: {:6.2f} ns per sample, {:5.2f} ns per rule, "
+                  "{:4d} state changes{}".format(
+                      n, totals[3], totals[4], len(changes),
+                      "" if changes == expected else
+                      "  DIFFERS from the reference ({})".format(
+                          len(expected))))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,126 @@
+"""Calibration benchmark, run against the host simulator.
+
+Converts raw readings through the calibration (ll_sim -L, see
+main/include/calib.h) and checks both steps against references computed
+here:
+- raw to level: random curves of up to CALIB_POINTS_MAX points against
+  exact piecewise linear interpolation, end segments extrapolated and
+  clamped to CALIB_MM_LIMIT, with readings below, between and above the
+  points;
+- level to volume: tanks against the analytic volume, the circular
+  segment for horizontal cylinders, reported in litres and in % of full.
+Reports the time and TSC cycles per conversion of both steps together,
+next to the same conversion in floating point. Exits with 1 if a level is
+off by more than two steps of its fixed point or a volume by more than
+0.1% of full.
+
+Usage: python calibbench.py --sim build-host/ll_sim [--curves 500]
+"""
+
+import math
+import random
+import re
+
+import simbench
+
+CONVERSION = re.compile(r"conversion (-?\d+) (-?[\d.]+) (-?[\d.]+) (-?\d+)")
+CALIBRATE = re.compile(
+    r"calibrate conversions=(\d+) ns=([\d.]+) cycles=([\d.]+) "
+    r"float_ns=([\d.]+) float_cycles=([\d.]+)")
+POINTS_MAX = 16
+MM_LIMIT = 100000
+# Two steps of CALIB_LEVEL_FRAC_BITS.
+LEVEL_TOLERANCE_MM = 2 / 256
+VOLUME_TOLERANCE = 0.001
+TANKS = ["hcyl:1200:3000", "hcyl:2500:8000", "hcyl:300:500",
+         "vcyl:1000:3000", "box:1000:2000:1500"]
+
+parser = simbench.arguments(seed=True)
+parser.add_argument("--curves", type=int, default=500)
+args = parser.parse_args()
+
+
+def convert(points, tank, raws):
+    sim = simbench.run(args.sim, ["-L", points, "-T", tank],
+                       "".join("{}\n".format(r) for r in raws))
+    timing = [float(g) for g in simbench.result(sim, CALIBRATE)]
+    conversions = [(int(m.group(1)), float(m.group(2)), float(m.group(3)),
+                    int(m.group(4)))
+                   for m in simbench.matches(sim.stdout, CONVERSION)]
+    return conversions, timing
+
+
+def interpolate(points, raw):
+    """Levels are clamped to CALIB_MM_LIMIT, like the device does."""
+    i = 0
+    while i < len(points) - 2 and raw >= points[i + 1][0]:
+        i += 1
+    (r0, l0), (r1, l1) = points[i], points[i + 1]
+    level = l0 + (l1 - l0) * (raw - r0) / (r1 - r0)
+    return min(max(level, -MM_LIMIT), MM_LIMIT)
+
+
+def litres(tank, level):
+    kind, *dims = tank.split(":")
+    dims = [int(d) for d in dims]
+    if kind == "hcyl":
+        r, h = dims[0] / 2, min(max(level, 0), dims[0])
+        # Area of the circular segment below the level.
+        area = r * r * math.acos((r - h) / r) - (r - h) * math.sqrt(
+            max(2 * r * h - h * h, 0))
+        return area * dims[1] / 1e6
+    if kind == "vcyl":
+        return math.pi * (dims[0] / 2) ** 2 * min(max(level, 0),
+                                                  dims[1]) / 1e6
+    return dims[0] * dims[1] * min(max(level, 0), dims[2]) / 1e6
+
+
+def check_levels(rng):
+    worst = 0
+    for _ in range(args.curves):
+        count = rng.randint(2, POINTS_MAX)
+        raws = sorted(rng.sample(range(0, 4096), count))
+        levels = sorted(rng.sample(range(0, 3000), count))
+        points = list(zip(raws, levels))
+        spec = ",".join("{}:{}".format(r, l) for r, l in points)
+        readings = [rng.randint(-200, 4300) for _ in range(200)]
+        readings += raws
+        conversions, _ = convert(spec, "", readings)
+        for raw, level, _, _ in conversions:
+            worst = max(worst, abs(level - interpolate(points, raw)))
+    return worst
+
+
+def main():
+    rng = random.Random(args.seed)
+    problems = []
+    worst = check_levels(rng)
+    print("raw to level: {} curves, largest difference {:.4f} mm".format(
+        args.curves, worst))
+    if worst > LEVEL_TOLERANCE_MM:
+        problems.append("levels off by up to {:.4f} mm".format(worst))
+
+    for tank in TANKS:
+        height = int(tank.split(":")[1 if tank[0] == "h" else -1])
+        # Raw counts are mm here, so the volume step sees every level.
+        levels = list(range(0, height + 1))
+        conversions, timing = convert(
+            "0:0,{}:{}".format(height, height), tank, levels)
+        full = litres(tank, height)
+        worst, at = 0, 0
+        for raw, level, volume, _ in conversions:
+            error = abs(volume - litres(tank, level))
+            if error > worst:
+                worst, at = error, level
+        print("{:20s} full {:8.0f} L, largest difference {:6.2f} L "
+              "({:.4f}% of full) at {:.0f} mm, {:.1f} ns {:.1f} cycles per "
+              "conversion, floating point {:.1f} ns {:.1f} cycles".format(
+                  tank, full, worst, 100 * worst / full, at, timing[1],
+                  timing[2], timing[3], timing[4]))
+        if worst > VOLUME_TOLERANCE * full:
+            problems.append("{} volumes off by up to {:.2f} L".format(
+                tank, worst))
+    simbench.finish(problems)
+
+
+main()
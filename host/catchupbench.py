@@ -0,0 +1,189 @@
+"""Catch-up benchmark, run against the host simulator.
+
+Starts a simulator that logged hours of samples it couldn't upload (ll_sim
+-k) and lets it upload them to a local target, see start_catchup in
+main/uploader.c. The device sends a summary of the gap first, then the
+freshest stretch of its log, then the backlog oldest first. The target
+decodes the block headers and reports when the dashboard had something to
+show for the gap and for the time of the reconnect, against when the oldest
+first backlog got there. Blocks that arrive twice (fresh, then again with the
+backlog) are dropped by their log position like collector.py does.
+
+--outage-at-s and --outage-s make the target answer 503 for a while in the
+middle of the catch-up, the device has to back off and resume.
+
+Exits with 1 if the device didn't drain its backlog or a sample of the
+outage never arrived.
+
+Usage: python catchupbench.py --sim build-host/ll_sim [--hours 72]
+                              [--live-ms 50] [--port 8097]
+"""
+
+import json
+import re
+import struct
+import time
+
+import simbench
+
+BLOCK_HEADER = struct.Struct("<HHHBBqqii")
+FRAME_POS = struct.Struct("<Q")
+BACKLOG = re.compile(
+    r"backlog samples=(\d+) bytes=(\d+) from=(\d+) to=(\d+) "
+    r"fresh_ms=(\d+)")
+CATCHUP = re.compile(
+    r"catchup drained=(\d) ms=(\d+) batches=(\d+) failures=(\d+) "
+    r"bytes=(\d+) samples=(\d+) allocs=(\d+)")
+
+parser = simbench.arguments(port=8097)
+parser.add_argument("--hours", type=int, default=72,
+                    help="length of the outage, the device logs a sample "
+                         "per second through it")
+parser.add_argument("--live-ms", type=int, default=50,
+                    help="time between live samples after the reconnect, "
+                         "short so fresh blocks fill up during the run")
+parser.add_argument("--fresh-s", type=int,
+                    help="data this close to the reconnect counts as fresh, "
+                         "UPLOAD_CATCHUP_FRESH_MS of the simulator by "
+                         "default")
+parser.add_argument("--outage-at-s", type=float, default=0,
+                    help="seconds after the first request to start failing "
+                         "batches, 0 for none")
+parser.add_argument("--outage-s", type=float, default=3)
+parser.add_argument("--timeout-s", type=int, default=300)
+args = parser.parse_args()
+
+
+class Server(simbench.Target):
+    started = None
+    # Log position -> [first arrival, last arrival, first ts, last ts,
+    # samples]
+    blocks = {}
+    duplicates = 0
+    duplicate_bytes = 0
+    body_bytes = 0
+    refused = 0
+    summaries = []
+
+    def elapsed(self):
+        now = time.monotonic()
+        if self.started is None:
+            self.started = now
+        return now - self.started
+
+    def down(self, at):
+        return args.outage_at_s > 0 and \
+            args.outage_at_s <= at < args.outage_at_s + args.outage_s
+
+
+class Handler(simbench.Handler):
+    def do_GET(self):
+        # Remote config, always current.
+        self.reply(304 if self.path.endswith("/config") else 404)
+
+    def do_POST(self):
+        body = self.body()
+        srv = self.server
+        with srv.lock:
+            at = srv.elapsed()
+            if srv.down(at):
+                srv.refused += 1
+                self.reply(503)
+                return
+            srv.body_bytes += len(body)
+            if self.headers.get("Content-Type") == "application/json":
+                message = json.loads(body)
+                if "summary" in message:
+                    srv.summaries.append((at, message["summary"]))
+                self.reply(200)
+                return
+            self.store_batch(srv, body, at)
+        self.reply(200)
+
+    @staticmethod
+    def store_batch(srv, body, at):
+        offset = 0
+        while offset < len(body):
+            (pos,) = FRAME_POS.unpack_from(body, offset)
+            (_, payload_len, count, _, _, first_ts, last_ts, _, _) = \
+                BLOCK_HEADER.unpack_from(body, offset + FRAME_POS.size)
+            size = FRAME_POS.size + BLOCK_HEADER.size + payload_len
+            offset += size
+            block = srv.blocks.get(pos)
+            if block is not None:
+                srv.duplicates += 1
+                srv.duplicate_bytes += size
+                block[1] = at
+                continue
+            srv.blocks[pos] = [at, at, first_ts, last_ts, count]
+
+
+def ms(seconds):
+    return "{:8.1f} ms".format(seconds * 1000) if seconds is not None \
+        else "       never"
+
+
+def main():
+    server = Server(args.port, Handler).start()
+    sim = simbench.run(
+        args.sim, ["-q", "-k", server.url(), "-g", args.hours,
+                   "-w", args.timeout_s, "-r", args.live_ms])
+    server.stop()
+    backlog = [int(g) for g in simbench.result(sim, BACKLOG)]
+    catchup = [int(g) for g in simbench.result(sim, CATCHUP)]
+    samples, log_bytes, gap_from, reconnect, fresh_ms = backlog
+    if args.fresh_s is not None:
+        fresh_ms = args.fresh_s * 1000
+    fresh_ts = reconnect - fresh_ms
+
+    blocks = server.blocks
+    summary_at = server.summaries[0][0] if server.summaries else None
+    # The first block of the fresh stretch, fresh-first against when the
+    # backlog got to it.
+    fresh = [b for b in blocks.values() if b[3] >= fresh_ts]
+    fresh_first = min(b[0] for b in fresh) if fresh else None
+    fresh_backlog = min(b[1] for b in fresh) if fresh else None
+    # Both are needed before the dashboard covers the gap and the present.
+    dashboard = None
+    if summary_at is not None and fresh_first is not None:
+        dashboard = max(summary_at, fresh_first)
+    # Every sample of the outage has to be in once, whatever the order.
+    received = sum(b[4] for b in blocks.values() if b[2] < reconnect)
+
+    print("{} h outage, {} samples in {} bytes of log, live samples every "
+          "{} ms".format(args.hours, samples, log_bytes, args.live_ms))
+    print("  times from the first request")
+    if server.summaries:
+        _, s = server.summaries[0]
+        print("  summary:               {}  {} buckets of {} min, ends {} s "
+              "before the reconnect".format(
+                  ms(summary_at), len(s["b"]), s["bucket_ms"] // 60000,
+                  (reconnect - max(b[1] for b in s["b"])) // 1000))
+    else:
+        print("  summary:               no summary, the backlog is too short "
+              "for a catch-up")
+    print("  fresh data (last {} s): {}  first sent ahead of the backlog"
+          .format(fresh_ms // 1000, ms(fresh_first)))
+    print("  dashboard current:     {}".format(ms(dashboard)))
+    print("  backlog reached it:    {}  when oldest first would have shown "
+          "it".format(ms(fresh_backlog)))
+    print("  backlog drained:       {}  device side, drained={}".format(
+        ms(catchup[1] / 1000), catchup[0]))
+    print("  {} samples in blocks started before the reconnect ({} logged "
+          "before it)".format(received, samples))
+    print("  {} blocks, {} body bytes, {} blocks ({} bytes) received twice, "
+          "{} refused requests".format(
+              len(blocks), server.body_bytes,
+              server.duplicates, server.duplicate_bytes, server.refused))
+    print("  device: {} batches, {} failures, {} bytes, {} samples, "
+          "{} allocations".format(*catchup[2:]))
+    problems = []
+    if not catchup[0]:
+        problems.append("the backlog didn't drain")
+    if received < samples:
+        problems.append("{} samples of the outage never arrived".format(
+            samples - received))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,77 @@
+"""Channel scaling benchmark, run against the host simulator.
+
+Times what one scan costs the sampler for 1 to SENSOR_CHANNELS_MAX
+channels (ll_sim -S, see modes/sampler.c): demultiplexing the DMA
+results into the per channel arrays of adc_frame_t, then averaging and
+calibrating every channel. Fits a line through the scan times and reports
+the cost per channel, the fixed cost per scan and how far the measurements
+stray from the line. The simulator checks every channel's mean, exits with
+1 if one is wrong.
+
+Repeats each run and keeps the fastest, the host's noise only adds time.
+
+Usage: python channelbench.py --sim build-host/ll_sim [--channels 8]
+                              [--repeats 5]
+"""
+
+import re
+
+import simbench
+
+CHANNELS = re.compile(
+    r"channels n=(\d+) scan_ns=([\d.]+) demux_ns=([\d.]+) "
+    r"filter_ns=([\d.]+) means_ok=(\d)")
+
+parser = simbench.arguments()
+parser.add_argument("--channels", type=int, default=8)
+parser.add_argument("--repeats", type=int, default=5)
+args = parser.parse_args()
+
+
+def scan():
+    """Returns {channels: (scan ns, demux ns, filter ns, means ok)}."""
+    best = {}
+    for _ in range(args.repeats):
+        sim = simbench.run(args.sim, ["-S", args.channels])
+        simbench.result(sim, CHANNELS)
+        for m in simbench.matches(sim.stdout, CHANNELS):
+            n = int(m.group(1))
+            run = tuple(float(g) for g in m.groups()[1:4])
+            # A wrong mean in any of the repeats counts.
+            ok = m.group(5) == "1" and best.get(n, (0, 0, 0, True))[3]
+            if n in best and best[n][0] <= run[0]:
+                run = best[n][:3]
+            best[n] = run + (ok,)
+    return best
+
+
+def fit(points):
+    """Least squares line through (x, y) points, returns (slope, offset)."""
+    count = len(points)
+    mean_x = sum(x for x, _ in points) / count
+    mean_y = sum(y for _, y in points) / count
+    var = sum((x - mean_x) ** 2 for x, _ in points)
+    if var == 0:
+        return 0, mean_y
+    slope = sum((x - mean_x) * (y - mean_y) for x, y in points) / var
+    return slope, mean_y - slope * mean_x
+
+
+def main():
+    runs = scan()
+    print("  {:>8s} {:>9s} {:>9s} {:>9s} {:>11s}".format(
+        "channels", "scan", "demux", "filter", "per channel"))
+    for n, (scan_ns, demux_ns, filter_ns, ok) in sorted(runs.items()):
+        print("  {:8d} {:6.1f} ns {:6.1f} ns {:6.1f} ns {:8.1f} ns{}".format(
+            n, scan_ns, demux_ns, filter_ns, scan_ns / n,
+            "" if ok else "  WRONG MEANS"))
+    slope, offset = fit([(n, r[0]) for n, r in runs.items()])
+    stray = max(abs(r[0] - (slope * n + offset)) / r[0]
+                for n, r in runs.items())
+    print("{:.1f} ns per channel, {:.1f} ns per scan, measurements within "
+          "{:.0f}% of the line".format(slope, offset, 100 * stray))
+    simbench.finish(["wrong means with {} channels".format(n)
+                     for n, r in sorted(runs.items()) if not r[3]])
+
+
+main()
@@ -0,0 +1,119 @@
+"""Block codec benchmark, run against the host simulator.
+
+Encodes level traces into codec blocks the way the logger does (ll_sim -C,
+see main/include/codec.h), decodes them again and checks every sample came
+back. Reports per trace the bytes per sample, the compression ratio against
+a sample_t per reading and against packed 12-byte timestamp and value
+pairs, and encode and decode throughput in MB of sample_t per second.
+
+Traces are a day, generated with a fixed seed:
+- still: a full tank with 1 mm sensor noise, a reading per second.
+- drain: a slow, steady draw down, a reading per second.
+- pump: flat stretches with fills and sharp draws, a reading per second.
+- noisy: a flat level with 6 mm noise, a reading per second.
+- jitter: still, with readings 1 s apart give or take up to 20 ms, as a
+  loaded sampler task timestamps them.
+- raw: unscaled ADC counts around 2000 with 8 counts of noise, every 100 ms.
+--trace adds recorded traces, "timestamp value" lines. Exits with 1 if a
+trace doesn't come back from its blocks.
+
+Usage: python codecbench.py --sim build-host/ll_sim [--hours 24]
+                            [--trace recorded.txt]
+"""
+
+import random
+import re
+
+import simbench
+
+CODEC = re.compile(
+    r"codec samples=(\d+) blocks=(\d+) bytes=(\d+) struct_bytes=(\d+) "
+    r"bytes_per_sample=([\d.]+) encode_mb_s=([\d.]+) decode_mb_s=([\d.]+) "
+    r"roundtrip=(\d)")
+PACKED_BYTES = 12
+START_MS = 1_700_000_000_000
+
+parser = simbench.arguments(seed=True, traces=True)
+parser.add_argument("--hours", type=int, default=24)
+args = parser.parse_args()
+
+
+def every_second(values):
+    return [(START_MS + i * 1000, v) for i, v in enumerate(values)]
+
+
+def still(rng, seconds):
+    return every_second([900 + round(rng.gauss(0, 1))
+                         for _ in range(seconds)])
+
+
+def drain(rng, seconds):
+    return every_second([round(900 - 600 * t / seconds + rng.gauss(0, 1))
+                         for t in range(seconds)])
+
+
+def pump(rng, seconds):
+    values = []
+    level = 400.0
+    for t in range(seconds):
+        phase = t % 21600
+        if phase < 600:
+            level += 0.8
+        elif 10800 <= phase < 10860:
+            level -= 6
+        else:
+            level -= 0.002
+        values.append(round(level + rng.gauss(0, 1)))
+    return every_second(values)
+
+
+def noisy(rng, seconds):
+    return every_second([500 + round(rng.gauss(0, 6))
+                         for _ in range(seconds)])
+
+
+def jitter(rng, seconds):
+    return [(START_MS + i * 1000 + rng.randint(-20, 20),
+             900 + round(rng.gauss(0, 1))) for i in range(seconds)]
+
+
+def raw(rng, seconds):
+    return [(START_MS + i * 100, 2000 + round(rng.gauss(0, 8)))
+            for i in range(seconds * 10)]
+
+
+def generated():
+    seconds = args.hours * 3600
+    traces = []
+    for make in (still, drain, pump, noisy, jitter, raw):
+        traces.append((make.__name__, make(random.Random(args.seed),
+                                           seconds)))
+    return traces
+
+
+def encode(readings):
+    sim = simbench.run(args.sim, ["-C", "-"], simbench.trace_text(readings))
+    return [float(g) for g in simbench.result(sim, CODEC)]
+
+
+def main():
+    traces = generated() + [simbench.recorded_named(path)
+                            for path in args.trace]
+    problems = []
+    for name, readings in traces:
+        samples, blocks, size, struct_size, per_sample, encode_mb_s, \
+            decode_mb_s, roundtrip = encode(readings)
+        print("{:8s} {:7d} samples in {:4d} blocks: {:5.3f} B/sample, "
+              "{:5.1f}x sample_t, {:5.1f}x packed, encode {:6.0f} MB/s, "
+              "decode {:6.0f} MB/s{}".format(
+                  name, int(samples), int(blocks), per_sample,
+                  struct_size / size, samples * PACKED_BYTES / size,
+                  encode_mb_s, decode_mb_s,
+                  "" if roundtrip else "  ROUND TRIP FAILED"))
+        if not roundtrip:
+            problems.append("{} didn't come back from its blocks".format(
+                name))
+    simbench.finish(problems)
+
+
+main()
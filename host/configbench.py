@@ -0,0 +1,176 @@
+"""Remote configuration benchmark, run against the host simulator.
+
+Starts a fleet of simulators that poll a local upload target for their
+configuration (ll_sim -c), the way the uploader does once per upload cycle,
+see main/remote.c. The target publishes new versions while they run and
+measures how long each version takes to reach the whole fleet, from
+publishing it to the device fetching it. Polls of a device that is current
+are answered with 304 and no body, the report shows how many bytes that
+saves against sending the document every time.
+
+Versions:
+- 2: sampling period only.
+- 3: alarm rules and a new device name, the name differs per device.
+- 4: an invalid sampling period, every device has to reject it and keep 3,
+  and not fetch it again.
+- 5: a firmware update from an http:// target, rejected like 4.
+
+Exits with 1 if a device missed 2 or 3, applied 4 or 5 or didn't reject
+each of them exactly once.
+
+Usage: python configbench.py --sim build-host/ll_sim [--devices 20]
+                             [--poll-ms 1000] [--port 8096]
+"""
+
+import re
+import subprocess
+import time
+
+import simbench
+
+APPLIED = re.compile(r"applied version=(\d+) changed=(0x[0-9a-f]+) ")
+RESULT = re.compile(
+    r"remote version=(\d+) current=(\d+) applied=(\d+) stale=(\d+) "
+    r"invalid=(\d+) unreachable=(\d+) allocs=(\d+)")
+VERSIONS = [
+    (2, "version 2\nsample_ms 5000\n"),
+    (3, "version 3\nsample_ms 5000\nalarms high:above:900:10\n"
+        "devname {device}-b\n"),
+    (4, "version 4\nsample_ms 7\n"),
+    (5, "version 5\nfirmware " + "0" * 64 + " http://127.0.0.1/fw.bin\n"),
+]
+
+parser = simbench.arguments(port=8096)
+parser.add_argument("--devices", type=int, default=20)
+parser.add_argument("--poll-ms", type=int, default=1000,
+                    help="time between polls, stands in for the upload "
+                         "interval")
+parser.add_argument("--settle-s", type=float, default=4.0,
+                    help="time between versions")
+args = parser.parse_args()
+
+
+class Server(simbench.Target):
+    version = 1
+    doc = "version 1\n"
+    published = 0.0
+    # version -> device -> seconds from publishing to the first 200.
+    fetched = {}
+    full = 0
+    not_modified = 0
+    body_bytes = 0
+    # What sending the document on every poll would have cost.
+    naive_bytes = 0
+
+
+class Handler(simbench.Handler):
+    def do_GET(self):
+        if not self.path.endswith("/config"):
+            self.send_error(404)
+            return
+        device = self.headers.get("X-Device", "?")
+        # The device sends its current name, strip what version 3 adds.
+        base = device[:-2] if device.endswith("-b") else device
+        srv = self.server
+        with srv.lock:
+            version = srv.version
+            body = srv.doc.format(device=base).encode()
+            srv.naive_bytes += len(body)
+            # A list, the device adds the version it rejected last.
+            tags = self.headers.get("If-None-Match", "").split(",")
+            current = '"{}"'.format(version) in [t.strip() for t in tags]
+            if current:
+                srv.not_modified += 1
+            else:
+                srv.full += 1
+                srv.body_bytes += len(body)
+                srv.fetched.setdefault(version, {}).setdefault(
+                    base, time.monotonic() - srv.published)
+        if current:
+            self.reply(304)
+        else:
+            self.reply(200, body, "text/plain")
+
+
+def main():
+    server = Server(args.port, Handler).start()
+    target = server.url()
+    seconds = int(args.settle_s * (len(VERSIONS) + 1)) + 1
+    sims = []
+    for i in range(args.devices):
+        sims.append(subprocess.Popen(
+            [args.sim, "-q", "-c", target, "-w", str(seconds),
+             "-i", str(args.poll_ms), "-e", "dev{}".format(i)],
+            stdout=subprocess.PIPE, text=True))
+        # Spread the polls over the interval like a fleet that didn't boot
+        # at once.
+        time.sleep(args.poll_ms / 1000 / args.devices)
+
+    # Every device is current on version 1 before the first change.
+    time.sleep(args.settle_s)
+    for version, doc in VERSIONS:
+        with server.lock:
+            server.version = version
+            server.doc = doc
+            server.published = time.monotonic()
+        time.sleep(args.settle_s)
+
+    applied = {}
+    results = []
+    for sim in sims:
+        out, _ = sim.communicate()
+        for line in out.splitlines():
+            m = APPLIED.match(line)
+            if m:
+                applied.setdefault(int(m.group(1)), []).append(m.group(2))
+            m = RESULT.match(line)
+            if m:
+                results.append([int(g) for g in m.groups()])
+    server.stop()
+
+    print("{} devices polling every {} ms".format(args.devices, args.poll_ms))
+    for version, _ in VERSIONS:
+        delays = [d * 1000 for d in server.fetched.get(version, {}).values()]
+        line = "  version {}: fetched by {:3d}, applied by {:3d}".format(
+            version, len(delays), len(applied.get(version, [])))
+        if delays:
+            line += ", propagation p50 {:6.1f} ms p95 {:6.1f} ms " \
+                    "max {:6.1f} ms".format(
+                        simbench.percentile(delays, 50),
+                        simbench.percentile(delays, 95),
+                        max(delays))
+        changed = sorted(set(applied.get(version, [])))
+        if changed:
+            line += ", changed keys " + " ".join(changed)
+        print(line)
+    polls = server.full + server.not_modified
+    print("  {} polls: {} full, {} not modified, {} body bytes "
+          "({} if every poll got the document)".format(
+              polls, server.full, server.not_modified, server.body_bytes,
+              server.naive_bytes))
+    final = sorted(set(r[0] for r in results))
+    print("  final versions {}, {} rejected documents, {} unreachable polls, "
+          "{} allocations".format(
+              final, sum(r[4] for r in results), sum(r[5] for r in results),
+              max(r[6] for r in results) if results else 0))
+
+    problems = []
+    for version in (2, 3):
+        if len(applied.get(version, [])) != args.devices:
+            problems.append("version {} applied by {} of {} devices".format(
+                version, len(applied.get(version, [])), args.devices))
+    for version in (4, 5):
+        if applied.get(version):
+            problems.append("version {} applied by {} devices".format(
+                version, len(applied[version])))
+    if len(results) != args.devices:
+        problems.append("{} of {} devices reported".format(
+            len(results), args.devices))
+    problems += ["a device ended on version {}".format(v)
+                 for v in final if v != 3]
+    problems += ["a device rejected {} documents".format(r[4])
+                 for r in results if r[4] != 2]
+    simbench.finish(problems)
+
+
+main()
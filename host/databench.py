@@ -0,0 +1,265 @@
+"""Data pull check, run against the host simulator.
+
+Logs a trace into the sample log and the rollup store on erased partitions
+and serves /data on them (ll_sim -D, see main/dataserver.c), then pulls it
+back every way a client can and compares with what is computed here from
+the trace:
+
+- raw, minute and hour resolution in csv, ndjson and bin. Raw bin is the
+  framed blocks of the log, every block that overlaps the window has to be
+  there and nothing but a run of the whole log's blocks. Rollups are the
+  trace grouped by its timestamps rounded down to the period, the open
+  bucket left out.
+- from and to on a reading and a bucket boundary and one ms to either side
+  of it, both ends inclusive. A bucket is in as soon as any of it is in the
+  window.
+- Range requests on a pinned window: the whole output, a pull resumed where
+  the last one stopped, a range in the middle, a range running past the end
+  and one starting past it, which gets 416 with the total.
+
+The trace is generated with a fixed seed, a reading 1 to 20 s apart, values
+-5000 to 5000. --trace uses a recorded one instead, "timestamp value" lines.
+Exits with 1 if anything differs.
+
+Usage: python databench.py --sim build-host/ll_sim [--days 2]
+                           [--trace recorded.txt] [--port 8102]
+"""
+
+import http.client
+import os
+import random
+import re
+import struct
+import subprocess
+import tempfile
+import time
+
+import simbench
+
+BLOCK_HEADER = struct.Struct("<HHHBBqqii")
+FRAME_POS = struct.Struct("<Q")
+ROLLUP = struct.Struct("<HBBIqqii")
+DATASERVER = re.compile(
+    r"dataserver samples=(\d+) blocks=(\d+) minutes=(\d+) hours=(\d+)")
+SERVED = re.compile(r"served allocs=(\d+)")
+PERIODS_MS = {"minute": 60 * 1000, "hour": 3600 * 1000}
+RESOLUTIONS = ["raw", "minute", "hour"]
+FORMATS = ["csv", "ndjson", "bin"]
+DAY_MS = 24 * 3600 * 1000
+START_MS = 1_700_000_000_000
+
+parser = simbench.arguments(port=8102, seed=True, trace=True)
+parser.add_argument("--days", type=int, default=2)
+args = parser.parse_args()
+
+
+def generated():
+    rng = random.Random(args.seed)
+    readings = []
+    t = START_MS
+    while t < START_MS + args.days * DAY_MS:
+        readings.append((t, rng.randint(-5000, 5000)))
+        t += rng.randint(1000, 20000)
+    return readings
+
+
+def buckets(readings, period):
+    """Closed buckets as (start, count, sum, min, max), oldest first."""
+    groups = {}
+    for t, v in readings:
+        groups.setdefault(t // period * period, []).append(v)
+    starts = sorted(groups)[:-1]
+    return [(s, len(groups[s]), sum(groups[s]), min(groups[s]),
+             max(groups[s])) for s in starts]
+
+
+def frames(body):
+    """Framed blocks of a raw bin pull as (pos, first ts, last ts, count)."""
+    found = []
+    offset = 0
+    while offset < len(body):
+        (pos,) = FRAME_POS.unpack_from(body, offset)
+        (_, payload_len, count, channel, _, first_ts, last_ts, _, _) = \
+            BLOCK_HEADER.unpack_from(body, offset + FRAME_POS.size)
+        found.append((pos, first_ts, last_ts, count))
+        offset += FRAME_POS.size + BLOCK_HEADER.size + payload_len
+    if offset != len(body):
+        raise ValueError("bin pull ends in the middle of a block")
+    return found
+
+
+def expected_text(readings, res, fmt, lo, hi):
+    if res == "raw":
+        rows = [(t, v) for t, v in readings if lo <= t <= hi]
+        if fmt == "csv":
+            return "timestamp,value\n" + "".join(
+                "{},{}\n".format(t, v) for t, v in rows)
+        return "".join('{{"t":{},"v":{}}}\n'.format(t, v) for t, v in rows)
+    period = PERIODS_MS[res]
+    rows = [b for b in buckets(readings, period)
+            if b[0] + period > lo and b[0] <= hi]
+    if fmt == "csv":
+        return "start,count,min,max,mean\n" + "".join(
+            "{},{},{},{},{}\n".format(s, n, mn, mx,
+                                      simbench.trunc_div(total, n))
+            for s, n, total, mn, mx in rows)
+    return "".join(
+        '{{"start":{},"count":{},"min":{},"max":{},"mean":{}}}\n'.format(
+            s, n, mn, mx, simbench.trunc_div(total, n))
+        for s, n, total, mn, mx in rows)
+
+
+def check_pull(readings, all_frames, res, fmt, lo, hi, body):
+    """Returns what is wrong with the body of a pull, None if nothing."""
+    if fmt != "bin":
+        expected = expected_text(readings, res, fmt, lo, hi)
+        if body.decode() == expected:
+            return None
+        return "{} lines, expected {}".format(
+            body.decode().count("\n"), expected.count("\n"))
+    if res == "raw":
+        got = frames(body)
+        overlapping = [f for f in all_frames if f[2] >= lo and f[1] <= hi]
+        if not got or not overlapping:
+            return None if got == overlapping else "{} blocks, expected " \
+                "{}".format(len(got), len(overlapping))
+        first = all_frames.index(got[0]) if got[0] in all_frames else -1
+        if first < 0 or all_frames[first:first + len(got)] != got:
+            return "blocks aren't a run of the log's"
+        if not all(f in got for f in overlapping):
+            return "blocks overlapping the window are missing"
+        return None
+    period = PERIODS_MS[res]
+    expected = [b for b in buckets(readings, period)
+                if b[0] + period > lo and b[0] <= hi]
+    got = []
+    for offset in range(0, len(body), ROLLUP.size):
+        _, channel, _, count, start, total, mn, mx = \
+            ROLLUP.unpack_from(body, offset)
+        got.append((start, count, total, mn, mx))
+    return None if got == expected else "{} records, expected {}".format(
+        len(got), len(expected))
+
+
+def get(path, range_header=None):
+    conn = http.client.HTTPConnection(simbench.HOST, args.port, timeout=30)
+    headers = {"Range": range_header} if range_header else {}
+    conn.request("GET", path, headers=headers)
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    return response.status, response.getheader("Content-Range"), body
+
+
+def query(res, fmt, lo=None, hi=None):
+    path = "/data?res={}&format={}".format(res, fmt)
+    if lo is not None:
+        path += "&from={}".format(lo)
+    if hi is not None:
+        path += "&to={}".format(hi)
+    return path
+
+
+def windows(readings):
+    """(from, to) pairs on and next to readings and bucket boundaries."""
+    t = [r[0] for r in readings]
+    a, b = t[len(t) // 4], t[3 * len(t) // 4]
+    minute = a // 60000 * 60000 + 60000
+    hour = b // 3600000 * 3600000
+    return [(None, None), (a, b), (a + 1, b - 1), (a - 1, b + 1),
+            (minute, hour), (minute - 1, hour - 1), (minute + 1, hour + 1),
+            (t[0], t[0]), (t[-1] + 1, None)]
+
+
+def check_ranges(path):
+    """Range requests against the whole output, returns the problems."""
+    problems = []
+    status, _, full = get(path)
+    n = len(full)
+    if status != 200 or n == 0:
+        return ["whole pull got {} with {} bytes".format(status, n)]
+    k = n // 3
+    cases = [
+        ("bytes=0-", full, "bytes 0-{}/{}".format(n - 1, n)),
+        ("bytes=0-{}".format(k - 1), full[:k],
+         "bytes 0-{}/{}".format(k - 1, n)),
+        ("bytes={}-".format(k), full[k:],
+         "bytes {}-{}/{}".format(k, n - 1, n)),
+        ("bytes={}-{}".format(k, 2 * k), full[k:2 * k + 1],
+         "bytes {}-{}/{}".format(k, 2 * k, n)),
+        ("bytes={}-{}".format(n - 1, n + 100), full[n - 1:],
+         "bytes {}-{}/{}".format(n - 1, n - 1, n)),
+    ]
+    for header, expected, content_range in cases:
+        status, got_range, body = get(path, header)
+        if status != 206 or got_range != content_range or body != expected:
+            problems.append("{}: {} {} with {} bytes".format(
+                header, status, got_range, len(body)))
+    status, got_range, _ = get(path, "bytes={}-".format(n))
+    if status != 416 or got_range != "bytes */{}".format(n):
+        problems.append("past the end: {} {}".format(status, got_range))
+    return problems
+
+
+def main():
+    readings = simbench.recorded(args.trace) if args.trace else generated()
+    with tempfile.NamedTemporaryFile("w", suffix=".txt", delete=False) as f:
+        f.write(simbench.trace_text(readings))
+        path = f.name
+    sim = subprocess.Popen(
+        [args.sim, "-q", "-D", path, "-p", str(args.port)],
+        stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+    try:
+        m = DATASERVER.match(sim.stdout.readline())
+        if m is None:
+            raise SystemExit("simulator failed")
+        samples, blocks, minutes, hours = [int(g) for g in m.groups()]
+        problems = []
+        for res, stored in (("minute", minutes), ("hour", hours)):
+            closed = len(buckets(readings, PERIODS_MS[res]))
+            if stored != closed:
+                problems.append("{} {} records stored, expected {}".format(
+                    stored, res, closed))
+
+        started = time.monotonic()
+        _, _, whole = get(query("raw", "bin"))
+        all_frames = frames(whole)
+        if sum(f[3] for f in all_frames) != samples:
+            problems.append("the log's blocks don't hold every reading")
+        pulls = 0
+        for res in RESOLUTIONS:
+            for fmt in FORMATS:
+                wrong = 0
+                for lo, hi in windows(readings):
+                    status, _, body = get(query(res, fmt, lo, hi))
+                    pulls += 1
+                    found = "status {}".format(status) if status != 200 \
+                        else check_pull(
+                            readings, all_frames, res, fmt,
+                            lo if lo is not None else -2 ** 63,
+                            hi if hi is not None else 2 ** 63 - 1, body)
+                    if found:
+                        wrong += 1
+                        problems.append("{} {} from={} to={}: {}".format(
+                            res, fmt, lo, hi, found))
+                ranges = check_ranges(query(res, fmt, hi=readings[-1][0]))
+                problems += ["{} {} {}".format(res, fmt, p) for p in ranges]
+                print("  {:6s} {:6s} {} windows{}, ranges {}".format(
+                    res, fmt, len(windows(readings)),
+                    " {} wrong".format(wrong) if wrong else " match",
+                    "wrong" if ranges else "match"))
+        took = time.monotonic() - started
+    finally:
+        sim.stdin.close()
+        out = sim.stdout.read()
+        sim.wait()
+        os.unlink(path)
+    m = SERVED.search(out)
+    print("{} readings in {} blocks, {} minutes, {} hours; {} pulls and the "
+          "range requests in {:.1f} s, {} allocations".format(
+              samples, blocks, minutes, hours, pulls, took,
+              m.group(1) if m else "?"))
+    simbench.finish(problems)
+
+
+main()
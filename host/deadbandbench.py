@@ -0,0 +1,144 @@
+"""Report-by-exception benchmark, run against the host simulator.
+
+Replays level traces through the deadband filter and the codec the way the
+logger does (ll_sim -b, see main/include/deadband.h) and rebuilds each trace
+from what went into the log the way the collector would, holding the last
+reported value. Reports, per trace and deadband, how many readings and
+bytes the log saves against logging every reading, the error of the rebuilt
+trace, which has to stay within the deadband, and the longest silence,
+which has to stay within the heartbeat.
+
+Traces are a reading per second, generated with a fixed seed:
+- still: a full tank with sensor noise.
+- drain: a slow, steady draw down over the day.
+- pump: flat stretches with fills and sharp draws, the events the log has
+  to keep.
+- noisy: a flat level with noise well past the smaller deadbands.
+--trace adds recorded traces, "timestamp value" lines. Exits with 1 if an
+error or a silence runs past its bound.
+
+Usage: python deadbandbench.py --sim build-host/ll_sim [--hours 24]
+                               [--deadbands 2,5,10,20] [--heartbeat-ms 600000]
+                               [--trace recorded.txt]
+"""
+
+import random
+import re
+
+import simbench
+
+REPORT = re.compile(r"report (\d+) (-?\d+) (\d)")
+DEADBAND = re.compile(
+    r"deadband readings=(\d+) reports=(\d+) blocks=(\d+) bytes=(\d+) "
+    r"every_blocks=(\d+) every_bytes=(\d+) filter_ns=([\d.]+)")
+
+parser = simbench.arguments(seed=True, traces=True)
+parser.add_argument("--hours", type=int, default=24)
+parser.add_argument("--deadbands", default="2,5,10,20")
+parser.add_argument("--heartbeat-ms", type=int, default=10 * 60 * 1000)
+args = parser.parse_args()
+
+START_MS = 1_700_000_000_000
+
+
+def still(rng, seconds):
+    return [900 + round(rng.gauss(0, 1)) for _ in range(seconds)]
+
+
+def drain(rng, seconds):
+    return [round(900 - 600 * t / seconds + rng.gauss(0, 1))
+            for t in range(seconds)]
+
+
+def pump(rng, seconds):
+    values = []
+    level = 400.0
+    for t in range(seconds):
+        phase = t % 21600
+        if phase < 600:
+            level += 0.8  # A fill, 480 in 10 minutes
+        elif 10800 <= phase < 10860:
+            level -= 6  # A sharp draw, 360 in a minute
+        else:
+            level -= 0.002
+        values.append(round(level + rng.gauss(0, 1)))
+    return values
+
+
+def noisy(rng, seconds):
+    return [500 + round(rng.gauss(0, 6)) for _ in range(seconds)]
+
+
+def generated():
+    seconds = args.hours * 3600
+    traces = []
+    for make in (still, drain, pump, noisy):
+        rng = random.Random(args.seed)
+        values = make(rng, seconds)
+        traces.append((make.__name__, [
+            (START_MS + i * 1000, v) for i, v in enumerate(values)]))
+    return traces
+
+
+def replay(readings, deadband):
+    sim = simbench.run(
+        args.sim, ["-b", "-", "-z", deadband, "-y", args.heartbeat_ms],
+        simbench.trace_text(readings))
+    totals = [float(g) for g in simbench.result(sim, DEADBAND)]
+    reports = [tuple(int(g) for g in m.groups())
+               for m in simbench.matches(sim.stdout, REPORT)]
+    return reports, totals
+
+
+def rebuild(readings, reports):
+    """Returns (errors, longest silence in ms) of the held trace."""
+    errors = []
+    held = None
+    at = 0
+    for t, v in readings:
+        while at < len(reports) and reports[at][0] <= t:
+            held = reports[at][1]
+            at += 1
+        errors.append(abs(v - held) if held is not None else 0)
+    gaps = [b[0] - a[0] for a, b in zip(reports, reports[1:])]
+    if reports:
+        gaps.append(readings[-1][0] - reports[-1][0])
+    return errors, max(gaps) if gaps else 0
+
+
+def main():
+    traces = generated() + [simbench.recorded_named(path)
+                            for path in args.trace]
+    problems = []
+    deadbands = [int(d) for d in args.deadbands.split(",")]
+    print("heartbeat {} ms, deadbands {}".format(
+        args.heartbeat_ms, deadbands))
+    for name, readings in traces:
+        print("{}: {} readings".format(name, len(readings)))
+        for deadband in deadbands:
+            reports, totals = replay(readings, deadband)
+            errors, silence = rebuild(readings, reports)
+            kinds = [0, 0, 0, 0]
+            for r in reports:
+                kinds[r[2]] += 1
+            count, logged, _, size, _, every_size, filter_ns = totals
+            within = max(errors) <= deadband and \
+                silence <= args.heartbeat_ms
+            print("  deadband {:3d}: {:6d} reports ({:5.1f}% fewer), "
+                  "{:7d} bytes ({:5.1f}% fewer), {} changes {} heartbeats, "
+                  "error max {} p99 {}, silence max {:.0f} s, "
+                  "{:.0f} ns/reading{}".format(
+                      deadband, int(logged), 100 * (1 - logged / count),
+                      int(size), 100 * (1 - size / every_size), kinds[2],
+                      kinds[3], max(errors),
+                      simbench.percentile(errors, 99),
+                      silence / 1000, filter_ns,
+                      "" if within else "  OUT OF BOUNDS"))
+            if not within:
+                problems.append("{}, deadband {}: error up to {}, silence "
+                                "up to {} ms".format(name, deadband,
+                                                     max(errors), silence))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,172 @@
+"""Formats the deferred log of a device.
+
+The device records only where its format strings and tags are and the raw
+arguments, see main/include/dlog.h. This reads the strings out of the ELF of
+the same build and formats the records the way ESP_LOG would have.
+
+Usage: python dlog_decode.py <firmware.elf> <dump file | http://device/log>
+
+Works with the host simulator binary (build-host/ll_sim) as well.
+"""
+
+import re
+import struct
+import sys
+import urllib.request
+
+ANCHOR = b"ll_dlog_anchor"
+LEVELS = "?EWIDV"
+TRUNCATED = 0x80
+CONVERSION = re.compile(
+    r"%([-+ #0]*)(\d*|\*)(\.\d+)?(hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("{} is not an ELF file".format(path))
+        self.wide = self.data[4] == 2
+        self.endian = "<" if self.data[5] == 1 else ">"
+        if self.wide:
+            shoff, = self.unpack("Q", 0x28)
+            shentsize, shnum = self.unpack("HH", 0x3A)
+        else:
+            shoff, = self.unpack("I", 0x20)
+            shentsize, shnum = self.unpack("HH", 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            at = shoff + i * shentsize
+            if self.wide:
+                _, kind, _, addr, offset, size, link, _, _, entsize = \
+                    self.unpack("IIQQQQIIQQ", at)
+            else:
+                _, kind, _, addr, offset, size, link, _, _, entsize = \
+                    self.unpack("IIIIIIIIII", at)
+            self.sections.append((kind, addr, offset, size, link, entsize))
+
+    def unpack(self, fmt, offset):
+        return struct.unpack_from(self.endian + fmt, self.data, offset)
+
+    def symbol(self, name):
+        for kind, _, offset, size, link, entsize in self.sections:
+            if kind != 2:  # SHT_SYMTAB
+                continue
+            strtab = self.sections[link][2]
+            for at in range(offset, offset + size, entsize):
+                if self.wide:
+                    name_at, _, _, _, value, _ = self.unpack("IBBHQQ", at)
+                else:
+                    name_at, value, _, _, _, _ = self.unpack("IIIBBH", at)
+                start = strtab + name_at
+                if self.data[start:self.data.index(b"\0", start)] == name:
+                    return value
+        raise ValueError("no {} symbol, is this the right ELF?".format(
+            name.decode()))
+
+    def string(self, addr):
+        for kind, start, offset, size, _, _ in self.sections:
+            if kind == 1 and start <= addr < start + size:  # SHT_PROGBITS
+                at = offset + addr - start
+                return self.data[at:self.data.index(b"\0", at)].decode(
+                    "UTF-8", "replace")
+        return "<no string at 0x{:x}>".format(addr)
+
+
+def read_args(record, count):
+    args = []
+    at = 16
+    for _ in range(count):
+        kind = chr(record[at])
+        at += 1
+        if kind in "ip":
+            args.append((kind, struct.unpack_from("<I", record, at)[0]))
+            at += 4
+        elif kind == "q":
+            args.append((kind, struct.unpack_from("<Q", record, at)[0]))
+            at += 8
+        elif kind == "d":
+            args.append((kind, struct.unpack_from("<d", record, at)[0]))
+            at += 8
+        elif kind == "s":
+            length = record[at]
+            args.append((kind, record[at + 1:at + 1 + length].decode(
+                "UTF-8", "replace")))
+            at += 1 + length
+        elif kind == "r":
+            args.append((kind, record[at]))
+            at += 1
+        else:
+            raise ValueError("unknown argument type {!r}".format(kind))
+    return args
+
+
+def format_record(fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, _, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if not args:
+            return "<missing>"
+        kind, value = args.pop(0)
+        if kind == "r":
+            return "<redacted {} chars>".format(value)
+        spec = "%" + flags + width + (precision or "")
+        bits = 64 if kind == "q" else 32
+        if conv in "di":
+            if kind in "iq" and value >= 1 << (bits - 1):
+                value -= 1 << bits
+            return (spec + "d") % value
+        if conv == "u":
+            return (spec + "d") % value
+        if conv == "p":
+            return "0x{:x}".format(value)
+        if conv == "c":
+            return chr(value & 0xFF)
+        if conv == "s" and kind != "s":
+            return str(value)
+        try:
+            return (spec + conv) % value
+        except TypeError:
+            return str(value)
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(elf, dump):
+    if dump[:4] != b"DLOG":
+        raise ValueError("not a deferred log dump")
+    anchor = elf.symbol(ANCHOR)
+    dropped, = struct.unpack_from("<I", dump, 4)
+    if dropped:
+        print("({} older records were overwritten)".format(dropped))
+    at = 8
+    while at + 16 <= len(dump):
+        length, level, count, fmt_at, tag_at, ms = struct.unpack_from(
+            "<HBBiiI", dump, at)
+        record = dump[at:at + length]
+        at += length
+        message = format_record(
+            elf.string(anchor + fmt_at), read_args(record, count))
+        if level & TRUNCATED:
+            message += " <truncated>"
+        print("{} ({}) {}: {}".format(
+            LEVELS[level & 0x7] if (level & 0x7) < len(LEVELS) else "?",
+            ms, elf.string(anchor + tag_at), message))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print(__doc__.strip())
+        sys.exit(2)
+    source = sys.argv[2]
+    if source.startswith("http://"):
+        with urllib.request.urlopen(source) as response:
+            dump = response.read()
+    else:
+        with open(source, "rb") as f:
+            dump = f.read()
+    decode(Elf(sys.argv[1]), dump)
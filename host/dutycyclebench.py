@@ -0,0 +1,104 @@
+"""Duty cycle benchmark, run against the host simulator.
+
+Runs the duty cycle's wake, upload and sleep decisions (ll_sim -o, see
+main/include/dutycycle.h) over simulated days with fixed intervals and
+reports the mAh per day at each reporting interval, next to the estimate
+the device logs. Checks what the decisions promise:
+- wakes stay on the sample interval's grid, work time doesn't shift them;
+- no reading waits longer than a reporting interval and a wake for its
+  upload;
+- during an outage the attempts back off, doubling from the sample interval
+  up to the reporting interval, and the first upload after it comes within
+  that cap.
+Exits with 1 if one of them doesn't hold.
+
+Wakes take 200 ms, uploads 4 s and failed ones 10 s (SIM_DUTYCYCLE_* in
+modes/dutycycle.c), power figures are DUTYCYCLE_* in const.h.
+
+Usage: python dutycyclebench.py --sim build-host/ll_sim [--days 2]
+                                [--sample-ms 600000] [--reports-h 1,3,6,12]
+                                [--outage-h 5:20]
+"""
+
+import re
+
+import simbench
+
+UPLOAD = re.compile(r"upload t_ms=(\d+) ok=(\d) unsent=(\d+) age_ms=(\d+)")
+DUTYCYCLE = re.compile(r"dutycycle (.*)")
+
+parser = simbench.arguments()
+parser.add_argument("--days", type=int, default=2)
+parser.add_argument("--sample-ms", type=int, default=10 * 60 * 1000)
+parser.add_argument("--reports-h", default="1,3,6,12")
+parser.add_argument("--outage-h", default="5:20",
+                    help="hours into the run the uploads fail, from:to")
+args = parser.parse_args()
+
+
+def run(upload_ms, outage=None):
+    options = ["-o", "{}:{}:{}".format(
+        args.days * 24, args.sample_ms, upload_ms)]
+    if outage:
+        options += ["-f", outage]
+    sim = simbench.run(args.sim, options)
+    totals = simbench.fields(simbench.result(sim, DUTYCYCLE)[0])
+    uploads = [tuple(int(g) for g in m.groups())
+               for m in simbench.matches(sim.stdout, UPLOAD)]
+    return uploads, totals
+
+
+def backoff_problems(uploads, upload_ms, outage_to_ms):
+    problems = []
+    failed = [u[0] for u in uploads if not u[1]]
+    gaps = [b - a for a, b in zip(failed, failed[1:])]
+    if any(b < a for a, b in zip(gaps, gaps[1:])):
+        problems.append("attempts came closer together")
+    cap = upload_ms + args.sample_ms
+    if any(g > cap for g in gaps):
+        problems.append("attempts further apart than the cap")
+    after = [u[0] for u in uploads if u[1] and u[0] >= outage_to_ms]
+    if not after or after[0] - outage_to_ms > cap:
+        problems.append("first upload after the outage came late")
+    return problems
+
+
+def main():
+    print("{} days, a wake every {:.0f} s".format(
+        args.days, args.sample_ms / 1000))
+    found = []
+    for hours in (float(h) for h in args.reports_h.split(",")):
+        upload_ms = int(hours * 3600 * 1000)
+        _, totals = run(upload_ms)
+        problems = []
+        if totals["max_drift_ms"] != 0:
+            problems.append("wakes left the grid")
+        if totals["max_age_ms"] > upload_ms + args.sample_ms:
+            problems.append("a reading waited too long")
+        print("  report every {:4.1f} h: {:6.3f} mAh/day (estimate {:.3f}), "
+              "{:.0f} wakes {:.0f} uploads, oldest reading {:.1f} h{}".format(
+                  hours, totals["mah_per_day"],
+                  totals["estimate_mah_per_day"], totals["wakes"],
+                  totals["uploads"], totals["max_age_ms"] / 3600000,
+                  "  " + ", ".join(problems) if problems else ""))
+        found += ["reports every {} h: {}".format(hours, p)
+                  for p in problems]
+
+    upload_ms = int(float(args.reports_h.split(",")[-1]) * 3600 * 1000)
+    _, baseline = run(upload_ms)
+    uploads, totals = run(upload_ms, args.outage_h)
+    outage_to_ms = float(args.outage_h.split(":")[1]) * 3600 * 1000
+    problems = backoff_problems(uploads, upload_ms, outage_to_ms)
+    failed = [u[0] / 3600000 for u in uploads if not u[1]]
+    print("  outage {} h at {:.1f} h reports: {:.0f} attempts at {} h, "
+          "{:.3f} mAh/day against {:.3f}{}".format(
+              args.outage_h, upload_ms / 3600000,
+              totals["outage_attempts"],
+              ",".join("{:.1f}".format(t) for t in failed),
+              totals["mah_per_day"], baseline["mah_per_day"],
+              "  " + ", ".join(problems) if problems else ""))
+    found += ["outage: " + p for p in problems]
+    simbench.finish(found)
+
+
+main()
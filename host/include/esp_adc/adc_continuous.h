@@ -0,0 +1,60 @@
+#ifndef SIM_ADC_CONTINUOUS_H
+#define SIM_ADC_CONTINUOUS_H
+
+#include "esp_adc/adc_oneshot.h"
+#include "esp_err.h"
+
+#include <stdint.h>
+
+// Conversions come out in the C3's type2 layout as soon as they are read, at
+// the level the simulator set with sim_adc_set_level.
+#define SOC_ADC_PATT_LEN_MAX 8
+#define SOC_ADC_DIGI_MAX_BITWIDTH 12
+#define SOC_ADC_DIGI_RESULT_BYTES 4
+
+typedef enum adc_digi_convert_mode_t {
+    ADC_CONV_SINGLE_UNIT_1 = 1,
+} adc_digi_convert_mode_t;
+
+typedef enum adc_digi_output_format_t {
+    ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+} adc_digi_output_format_t;
+
+typedef struct adc_digi_pattern_config_t {
+    uint8_t atten;
+    uint8_t channel;
+    uint8_t unit;
+    uint8_t bit_width;
+} adc_digi_pattern_config_t;
+
+typedef struct adc_continuous_handle_cfg_t {
+    uint32_t max_store_buf_size;
+    uint32_t conv_frame_size;
+} adc_continuous_handle_cfg_t;
+
+typedef struct adc_continuous_config_t {
+    uint32_t pattern_num;
+    adc_digi_pattern_config_t *adc_pattern;
+    uint32_t sample_freq_hz;
+    adc_digi_convert_mode_t conv_mode;
+    adc_digi_output_format_t format;
+} adc_continuous_config_t;
+
+typedef struct adc_continuous_ctx_t *adc_continuous_handle_t;
+
+esp_err_t adc_continuous_new_handle(
+    const adc_continuous_handle_cfg_t *config,
+    adc_continuous_handle_t *handle);
+esp_err_t adc_continuous_config(
+    adc_continuous_handle_t handle, const adc_continuous_config_t *config);
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle);
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle);
+esp_err_t adc_continuous_read(
+    adc_continuous_handle_t handle,
+    uint8_t *buf,
+    uint32_t length_max,
+    uint32_t *out_length,
+    uint32_t timeout_ms);
+
+#endif // SIM_ADC_CONTINUOUS_H
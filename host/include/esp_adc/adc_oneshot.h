@@ -0,0 +1,22 @@
+#ifndef SIM_ADC_ONESHOT_H
+#define SIM_ADC_ONESHOT_H
+
+// Only the types the continuous driver shares, see adc_continuous.h.
+typedef enum adc_unit_t { ADC_UNIT_1, ADC_UNIT_2 } adc_unit_t;
+
+typedef enum adc_channel_t {
+    ADC_CHANNEL_0,
+    ADC_CHANNEL_1,
+    ADC_CHANNEL_2,
+    ADC_CHANNEL_3,
+    ADC_CHANNEL_4,
+} adc_channel_t;
+
+typedef enum adc_atten_t {
+    ADC_ATTEN_DB_0,
+    ADC_ATTEN_DB_2_5,
+    ADC_ATTEN_DB_6,
+    ADC_ATTEN_DB_11,
+} adc_atten_t;
+
+#endif // SIM_ADC_ONESHOT_H
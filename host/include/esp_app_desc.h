@@ -0,0 +1,16 @@
+#ifndef SIM_ESP_APP_DESC_H
+#define SIM_ESP_APP_DESC_H
+
+#include <stdint.h>
+
+// Only the fields the firmware reads.
+typedef struct esp_app_desc_t {
+    char version[32];
+    char project_name[32];
+    uint8_t app_elf_sha256[32];
+} esp_app_desc_t;
+
+// The simulator's own description, see shim/ota.c.
+const esp_app_desc_t *esp_app_get_description(void);
+
+#endif // SIM_ESP_APP_DESC_H
@@ -0,0 +1,11 @@
+#ifndef SIM_ESP_ATTR_H
+#define SIM_ESP_ATTR_H
+
+// There is no RTC memory or IRAM, everything is plain RAM that a restart of
+// the simulator loses.
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif // SIM_ESP_ATTR_H
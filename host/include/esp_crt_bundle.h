@@ -0,0 +1,10 @@
+#ifndef SIM_ESP_CRT_BUNDLE_H
+#define SIM_ESP_CRT_BUNDLE_H
+
+#include "esp_err.h"
+
+// Trusts the CA file of the simulator (ll_sim -a) instead of the bundle, the
+// system CAs without one.
+esp_err_t esp_crt_bundle_attach(void *conf);
+
+#endif // SIM_ESP_CRT_BUNDLE_H
@@ -0,0 +1,37 @@
+#ifndef SIM_ESP_ERR_H
+#define SIM_ESP_ERR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+const char *esp_err_to_name(esp_err_t code);
+
+#define ESP_ERROR_CHECK(X)                                                     \
+    do {                                                                       \
+        esp_err_t err_ = (X);                                                  \
+        if (err_ != ESP_OK) {                                                  \
+            fprintf(                                                           \
+                stderr,                                                        \
+                "ESP_ERROR_CHECK failed: %s (0x%x) at %s:%d\n",                \
+                esp_err_to_name(err_),                                         \
+                err_,                                                          \
+                __FILE__,                                                      \
+                __LINE__);                                                     \
+            abort();                                                           \
+        }                                                                      \
+    } while (0)
+
+#endif // SIM_ESP_ERR_H
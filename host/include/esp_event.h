@@ -0,0 +1,35 @@
+#ifndef SIM_ESP_EVENT_H
+#define SIM_ESP_EVENT_H
+
+#include "esp_err.h"
+#include "esp_event_base.h"
+#include "freertos/FreeRTOS.h"
+
+#include <stddef.h>
+
+// Only the default loop exists, dispatched by its own thread like the event
+// task on the device.
+extern esp_event_base_t WIFI_EVENT;
+extern esp_event_base_t IP_EVENT;
+
+typedef enum ip_event_t {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_register(
+    esp_event_base_t base,
+    int32_t id,
+    esp_event_handler_t handler,
+    void *handler_data);
+esp_err_t esp_event_handler_unregister(
+    esp_event_base_t base, int32_t id, esp_event_handler_t handler);
+esp_err_t esp_event_post(
+    esp_event_base_t base,
+    int32_t id,
+    const void *event_data,
+    size_t event_data_size,
+    TickType_t ticks_to_wait);
+
+#endif // SIM_ESP_EVENT_H
@@ -0,0 +1,13 @@
+#ifndef SIM_ESP_EVENT_BASE_H
+#define SIM_ESP_EVENT_BASE_H
+
+#include <stdint.h>
+
+typedef const char *esp_event_base_t;
+typedef void *esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(
+    void *handler_data, esp_event_base_t base, int32_t id, void *event_data);
+
+#define ESP_EVENT_ANY_ID -1
+
+#endif // SIM_ESP_EVENT_BASE_H
@@ -0,0 +1,51 @@
+#ifndef SIM_ESP_HTTP_CLIENT_H
+#define SIM_ESP_HTTP_CLIENT_H
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The streaming subset of the client over POSIX sockets, served by
+// shim/http_client.c. https:// goes through the TLS shim, see shim/tls.c.
+// One request per connection, GET or POST.
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum esp_http_client_method_t {
+    HTTP_METHOD_GET,
+    HTTP_METHOD_POST,
+} esp_http_client_method_t;
+
+typedef struct esp_http_client_config_t {
+    const char *url;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    int buffer_size;
+    bool keep_alive_enable;
+    // Required for https://, loads the simulator's CA, see ll_sim -a.
+    esp_err_t (*crt_bundle_attach)(void *conf);
+} esp_http_client_config_t;
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t
+esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+esp_err_t esp_http_client_set_header(
+    esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_delete_header(
+    esp_http_client_handle_t client, const char *key);
+esp_err_t esp_http_client_set_post_field(
+    esp_http_client_handle_t client, const char *data, int len);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int esp_http_client_read(
+    esp_http_client_handle_t client, char *buffer, int len);
+bool esp_http_client_is_complete_data_received(
+    esp_http_client_handle_t client);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#endif // SIM_ESP_HTTP_CLIENT_H
@@ -0,0 +1,39 @@
+#ifndef SIM_ESP_LOG_H
+#define SIM_ESP_LOG_H
+
+#include <inttypes.h>
+#include <stdint.h>
+
+typedef enum esp_log_level_t {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// One level for every tag. Sources raise their own tags to debug, which would
+// drown the simulator output, so esp_log_level_set is ignored.
+extern esp_log_level_t sim_log_level;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+// No printf format attribute, the sources use the format specifiers of the
+// 32 bit target.
+void esp_log_write(
+    esp_log_level_t level, const char *tag, const char *format, ...);
+
+#define SIM_LOG(LEVEL, TAG, ...)                                               \
+    do {                                                                       \
+        if ((LEVEL) <= sim_log_level) {                                        \
+            esp_log_write(LEVEL, TAG, __VA_ARGS__);                            \
+        }                                                                      \
+    } while (0)
+
+#define ESP_LOGE(TAG, ...) SIM_LOG(ESP_LOG_ERROR, TAG, __VA_ARGS__)
+#define ESP_LOGW(TAG, ...) SIM_LOG(ESP_LOG_WARN, TAG, __VA_ARGS__)
+#define ESP_LOGI(TAG, ...) SIM_LOG(ESP_LOG_INFO, TAG, __VA_ARGS__)
+#define ESP_LOGD(TAG, ...) SIM_LOG(ESP_LOG_DEBUG, TAG, __VA_ARGS__)
+#define ESP_LOGV(TAG, ...) SIM_LOG(ESP_LOG_VERBOSE, TAG, __VA_ARGS__)
+
+#endif // SIM_ESP_LOG_H
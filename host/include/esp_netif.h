@@ -0,0 +1,15 @@
+#ifndef SIM_ESP_NETIF_H
+#define SIM_ESP_NETIF_H
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+esp_err_t esp_netif_init(void);
+void esp_netif_set_ip4_addr(
+    esp_ip4_addr_t *addr, uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+esp_err_t esp_netif_dhcps_start(esp_netif_t *netif);
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *netif);
+esp_err_t esp_netif_set_ip_info(
+    esp_netif_t *netif, const esp_netif_ip_info_t *ip_info);
+
+#endif // SIM_ESP_NETIF_H
@@ -0,0 +1,25 @@
+#ifndef SIM_ESP_NETIF_TYPES_H
+#define SIM_ESP_NETIF_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct esp_ip4_addr_t {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct esp_netif_ip_info_t {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct ip_event_got_ip_t {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+#endif // SIM_ESP_NETIF_TYPES_H
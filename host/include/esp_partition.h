@@ -0,0 +1,41 @@
+#ifndef SIM_ESP_PARTITION_H
+#define SIM_ESP_PARTITION_H
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+
+// Partitions live in RAM, registered by the simulator with sim_partition_add.
+// Writes behave like NOR flash, they only clear bits, and erases work on
+// whole sectors.
+typedef struct esp_partition_t {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    uint8_t *data;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    const char *label);
+esp_err_t esp_partition_read(
+    const esp_partition_t *partition,
+    size_t src_offset,
+    void *dst,
+    size_t size);
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition,
+    size_t dst_offset,
+    const void *src,
+    size_t size);
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t *partition, size_t offset, size_t size);
+
+#endif // SIM_ESP_PARTITION_H
@@ -0,0 +1,16 @@
+#ifndef SIM_ESP_SYSTEM_H
+#define SIM_ESP_SYSTEM_H
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+// Exits the simulator.
+void esp_restart(void);
+
+// A nominal heap less what the TLS shim holds, the rest of the host heap
+// has no fixed size.
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif // SIM_ESP_SYSTEM_H
@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_WIFI_DEFAULT_H
+#define SIM_ESP_WIFI_DEFAULT_H
+
+#include "esp_netif.h"
+
+esp_netif_t *esp_netif_create_default_wifi_ap(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+
+#endif // SIM_ESP_WIFI_DEFAULT_H
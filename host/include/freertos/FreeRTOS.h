@@ -0,0 +1,15 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include "freertos/portmacro.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#endif // SIM_FREERTOS_H
@@ -0,0 +1,13 @@
+#ifndef SIM_PORTMACRO_H
+#define SIM_PORTMACRO_H
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+
+#endif // SIM_PORTMACRO_H
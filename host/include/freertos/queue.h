@@ -0,0 +1,39 @@
+#ifndef SIM_QUEUE_H
+#define SIM_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+#include <pthread.h>
+
+// Dynamically created queues are static ones on the heap of the shims, so
+// they don't count against the firmware. Timeouts are simulated time like
+// vTaskDelay.
+typedef struct StaticQueue_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    // SYNCHRONIZED FIELDS
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+} StaticQueue_t;
+
+typedef StaticQueue_t *QueueHandle_t;
+
+QueueHandle_t xQueueCreateStatic(
+    UBaseType_t length,
+    UBaseType_t item_size,
+    uint8_t *storage,
+    StaticQueue_t *queue);
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t
+xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+#endif // SIM_QUEUE_H
@@ -0,0 +1,35 @@
+#ifndef SIM_TASK_H
+#define SIM_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+// Tasks are pthreads on the host, a handle is only good for telling them
+// apart.
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// A detached pthread, stack size and priority are ignored.
+BaseType_t xTaskCreate(
+    TaskFunction_t task,
+    const char *name,
+    uint32_t stack_depth,
+    void *arg,
+    UBaseType_t priority,
+    TaskHandle_t *created);
+void vTaskDelete(TaskHandle_t task);
+
+// Sleeps for the simulated time, see sim_sleep_ms.
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment);
+// Simulated milliseconds since the simulator started.
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+// Counting notifications, only tasks created by xTaskCreate take them.
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+// Bytes of the stack_depth given to xTaskCreate the task never used, from
+// the host's stack use, which is more than the device's. 0 for other threads.
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+const char *pcTaskGetName(TaskHandle_t task);
+
+#endif // SIM_TASK_H
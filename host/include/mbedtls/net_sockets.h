@@ -0,0 +1,27 @@
+#ifndef SIM_MBEDTLS_NET_SOCKETS_H
+#define SIM_MBEDTLS_NET_SOCKETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_ERR_NET_SOCKET_FAILED -0x0042
+#define MBEDTLS_ERR_NET_CONNECT_FAILED -0x0044
+#define MBEDTLS_ERR_NET_RECV_FAILED -0x004C
+#define MBEDTLS_ERR_NET_SEND_FAILED -0x004E
+#define MBEDTLS_ERR_NET_UNKNOWN_HOST -0x0052
+
+#define MBEDTLS_NET_PROTO_TCP 0
+
+typedef struct mbedtls_net_context {
+    int fd;
+} mbedtls_net_context;
+
+void mbedtls_net_init(mbedtls_net_context *ctx);
+int mbedtls_net_connect(
+    mbedtls_net_context *ctx, const char *host, const char *port, int proto);
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len);
+int mbedtls_net_recv_timeout(
+    void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+void mbedtls_net_free(mbedtls_net_context *ctx);
+
+#endif // SIM_MBEDTLS_NET_SOCKETS_H
@@ -0,0 +1,106 @@
+#ifndef SIM_MBEDTLS_SSL_H
+#define SIM_MBEDTLS_SSL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The mbedtls 3 client calls tls.c makes, over OpenSSL, see shim/tls.c.
+// TLS 1.2 only, like the device config.
+
+#define MBEDTLS_PRIVATE(member) member
+
+#define MBEDTLS_ERR_SSL_BAD_INPUT_DATA -0x7100
+#define MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY -0x7880
+#define MBEDTLS_ERR_SSL_ALLOC_FAILED -0x7F00
+#define MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL -0x6A00
+#define MBEDTLS_ERR_SSL_INTERNAL_ERROR -0x6C00
+#define MBEDTLS_ERR_SSL_TIMEOUT -0x6800
+#define MBEDTLS_ERR_X509_CERT_VERIFY_FAILED -0x2700
+
+#define MBEDTLS_SSL_IS_CLIENT 0
+#define MBEDTLS_SSL_TRANSPORT_STREAM 0
+#define MBEDTLS_SSL_PRESET_DEFAULT 0
+#define MBEDTLS_SSL_VERIFY_NONE 0
+#define MBEDTLS_SSL_VERIFY_REQUIRED 2
+#define MBEDTLS_SSL_SESSION_TICKETS_DISABLED 0
+#define MBEDTLS_SSL_SESSION_TICKETS_ENABLED 1
+
+// The shim only goes through the states tls.c looks at, see
+// mbedtls_ssl_handshake_step.
+typedef enum mbedtls_ssl_states {
+    MBEDTLS_SSL_HELLO_REQUEST,
+    MBEDTLS_SSL_CLIENT_HELLO,
+    MBEDTLS_SSL_SERVER_HELLO,
+    MBEDTLS_SSL_SERVER_CERTIFICATE,
+    MBEDTLS_SSL_HANDSHAKE_OVER,
+} mbedtls_ssl_states;
+
+typedef int mbedtls_ssl_send_t(void *ctx, const unsigned char *buf, size_t len);
+typedef int mbedtls_ssl_recv_t(void *ctx, unsigned char *buf, size_t len);
+typedef int mbedtls_ssl_recv_timeout_t(
+    void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+
+typedef struct mbedtls_ssl_config {
+    // SSL_CTX
+    void *ctx;
+    uint32_t read_timeout;
+} mbedtls_ssl_config;
+
+typedef struct mbedtls_ssl_session {
+    // SSL_SESSION
+    void *session;
+} mbedtls_ssl_session;
+
+typedef struct mbedtls_ssl_context {
+    int state;
+    const mbedtls_ssl_config *conf;
+    // SSL
+    void *ssl;
+    int fd;
+} mbedtls_ssl_context;
+
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf);
+int mbedtls_ssl_config_defaults(
+    mbedtls_ssl_config *conf, int endpoint, int transport, int preset);
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode);
+void mbedtls_ssl_conf_rng(
+    mbedtls_ssl_config *conf,
+    int (*f_rng)(void *, unsigned char *, size_t),
+    void *p_rng);
+void mbedtls_ssl_conf_read_timeout(mbedtls_ssl_config *conf, uint32_t timeout);
+void mbedtls_ssl_conf_session_tickets(
+    mbedtls_ssl_config *conf, int use_tickets);
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf);
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl);
+int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf);
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname);
+int mbedtls_ssl_set_session(
+    mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session);
+void mbedtls_ssl_set_bio(
+    mbedtls_ssl_context *ssl,
+    void *p_bio,
+    mbedtls_ssl_send_t *f_send,
+    mbedtls_ssl_recv_t *f_recv,
+    mbedtls_ssl_recv_timeout_t *f_recv_timeout);
+int mbedtls_ssl_handshake_step(mbedtls_ssl_context *ssl);
+int mbedtls_ssl_is_handshake_over(mbedtls_ssl_context *ssl);
+int mbedtls_ssl_get_session(
+    const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session);
+int mbedtls_ssl_write(
+    mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len);
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len);
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl);
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl);
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session);
+int mbedtls_ssl_session_save(
+    const mbedtls_ssl_session *session,
+    unsigned char *buf,
+    size_t buf_len,
+    size_t *olen);
+int mbedtls_ssl_session_load(
+    mbedtls_ssl_session *session, const unsigned char *buf, size_t len);
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session);
+
+#endif // SIM_MBEDTLS_SSL_H
@@ -0,0 +1,88 @@
+#ifndef SIM_MQTT_CLIENT_H
+#define SIM_MQTT_CLIENT_H
+
+#include "esp_event.h"
+
+#include <stdbool.h>
+
+// Only enough to link the MQTT uploader, the simulator uploads over HTTP.
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum esp_mqtt_event_id_t {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct esp_mqtt_event_t {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    char *topic;
+    int topic_len;
+    int msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct esp_mqtt_client_config_t {
+    struct {
+        struct {
+            const char *uri;
+        } address;
+        struct {
+            esp_err_t (*crt_bundle_attach)(void *conf);
+        } verification;
+    } broker;
+    struct {
+        const char *username;
+        const char *client_id;
+    } credentials;
+    struct {
+        int keepalive;
+        bool disable_clean_session;
+    } session;
+    struct {
+        int reconnect_timeout_ms;
+        int timeout_ms;
+    } network;
+    struct {
+        int size;
+        int out_size;
+    } buffer;
+} esp_mqtt_client_config_t;
+
+// Logs and aborts, nothing should get this far in the simulator.
+esp_mqtt_client_handle_t
+esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain);
+int esp_mqtt_client_enqueue(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain,
+    bool store);
+esp_err_t esp_mqtt_client_register_event(
+    esp_mqtt_client_handle_t client,
+    esp_mqtt_event_id_t event,
+    esp_event_handler_t handler,
+    void *handler_arg);
+
+#endif // SIM_MQTT_CLIENT_H
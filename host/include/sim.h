@@ -0,0 +1,64 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "esp_partition.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct sim_config_t {
+    // Every server binds here instead of its configured port.
+    uint16_t http_port;
+    // Simulated delays run this many times faster than real time.
+    double time_scale;
+    // CA certificates HTTPS targets are checked against, NULL for the
+    // system ones.
+    const char *ca_file;
+} sim_config_t;
+
+extern sim_config_t glob_sim;
+
+int64_t sim_now_ms();
+void sim_sleep_ms(int64_t ms);
+
+// Wait until every posted event has been handled.
+void sim_event_flush();
+
+// Load the scan results and connection behaviour of the simulated driver,
+// NULL for the built in scenario.
+void sim_wifi_load_scenario(const char *path);
+
+// Heap use of the firmware sources, the shims aren't counted.
+typedef struct sim_heap_stats_t {
+    uint64_t allocs;
+    uint64_t frees;
+    int64_t live;
+} sim_heap_stats_t;
+
+void sim_heap_stats(sim_heap_stats_t *stats);
+
+// CPU time the tasks created with this name used so far, tasks that
+// deleted themselves don't count. Only from the simulator's own threads.
+int64_t sim_task_cpu_us(const char *name);
+
+// Most stack a task created with this name used so far, in bytes of the
+// host's stack, see SIM_TASK_STACK_SIZE.
+uint32_t sim_task_stack_used(const char *name);
+
+// Bytes OpenSSL holds, the TLS shim stands in for mbedtls.
+size_t sim_tls_heap_used();
+
+// The image the next boot would start, NULL if no update went in.
+void sim_ota_boot_image(const uint8_t **data, size_t *len);
+
+// Raw ADC reading the channel converts to from now on, noise is added.
+void sim_adc_set_level(int channel, int raw);
+
+void sim_partition_add(
+    const char *label,
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    uint8_t *data,
+    size_t size);
+
+#endif // SIM_H
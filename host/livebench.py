@@ -0,0 +1,220 @@
+"""Live stream benchmark, run against the host simulator.
+
+Has the simulator publish a simulated probe to /live (ll_sim -l), which goes
+through the same per-client queues as the device, see main/live.c, and
+watches it with WebSocket clients. For every client it reports the readings
+delivered per second, the readings lost to the drop-oldest queue (gaps in the
+sequence numbers) and the latency from the reading's timestamp to its
+arrival. Timestamps are whole milliseconds, so latencies read up to 1 ms
+high.
+
+Cases:
+- full: one client at the full live rate.
+- decimated: one client asking for 10 Hz.
+- stalled: a client at the full rate that stops reading, next to one that
+  keeps up. The one that keeps up has to see no loss, and publishing must
+  not slow down.
+- slow: like stalled, but the slow client reads a little every 500 ms.
+
+Exits with 1 if a client that keeps up lost readings or the simulator
+didn't report.
+
+Usage: python livebench.py --sim build-host/ll_sim [--seconds 5]
+                           [--port 8095]
+"""
+
+import base64
+import hashlib
+import os
+import re
+import socket
+import struct
+import subprocess
+import threading
+import time
+
+import simbench
+
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+FULL_HZ = 50
+HEADER = struct.Struct("<IqBB")
+READING = struct.Struct("<Hi")
+RESULT = re.compile(
+    r"live scans=(\d+) published=(\d+) publish_us_max=(\d+) "
+    r"late_us_max=(\d+) allocs=(\d+) (.*)")
+
+parser = simbench.arguments(port=8095)
+parser.add_argument("--seconds", type=float, default=5.0)
+args = parser.parse_args()
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("closed")
+        data += chunk
+    return data
+
+
+class Client:
+    def __init__(self, name, hz, rcvbuf=None):
+        self.name = name
+        self.hz = hz
+        self.sock = socket.socket()
+        if rcvbuf:
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.connect((simbench.HOST, args.port))
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall((
+            "GET /live?hz={} HTTP/1.1\r\nHost: sim\r\n"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\n\r\n"
+        ).format(hz, key).encode())
+        head = b""
+        while b"\r\n\r\n" not in head:
+            head += recv_exact(self.sock, 1)
+        accept = base64.b64encode(
+            hashlib.sha1((key + GUID).encode()).digest()).decode()
+        if not head.startswith(b"HTTP/1.1 101") or accept.encode() not in head:
+            raise RuntimeError("handshake failed: {!r}".format(head))
+        self.readings = 0
+        self.frames = 0
+        self.lost = 0
+        self.next_seq = None
+        self.latencies = []
+        self.first_at = None
+        self.last_at = None
+        # Readings of a client that doesn't read along only arrive at the
+        # end, there is no rate to speak of.
+        self.reading_along = False
+
+    def read_frame(self):
+        head = recv_exact(self.sock, 2)
+        length = head[1] & 0x7F
+        if length == 126:
+            length, = struct.unpack(">H", recv_exact(self.sock, 2))
+        elif length == 127:
+            length, = struct.unpack(">Q", recv_exact(self.sock, 8))
+        payload = recv_exact(self.sock, length)
+        now_ms = time.time() * 1000
+        if head[0] & 0x0F != 0x2:
+            return
+        seq, start, _, count = HEADER.unpack_from(payload)
+        if self.next_seq is not None:
+            self.lost += seq - self.next_seq
+        self.next_seq = seq + count
+        for i in range(count):
+            offset, _ = READING.unpack_from(payload, HEADER.size + 6 * i)
+            self.latencies.append(now_ms - (start + offset))
+        self.readings += count
+        self.frames += 1
+        self.first_at = self.first_at or time.monotonic()
+        self.last_at = time.monotonic()
+
+    def run(self, until, pause=0.0):
+        self.reading_along = True
+        self.sock.settimeout(0.5)
+        while time.monotonic() < until:
+            if pause:
+                time.sleep(pause)
+            try:
+                self.read_frame()
+            except socket.timeout:
+                pass
+
+    def drain(self):
+        # Whatever the queue held on to and the socket buffered, until the
+        # sim is done. After a long stall TCP backs off probing the window,
+        # so sending can take seconds to pick up again.
+        self.sock.settimeout(15.0)
+        try:
+            while True:
+                self.read_frame()
+        except (socket.timeout, ConnectionError):
+            pass
+
+    def close(self):
+        try:
+            mask = os.urandom(4)
+            self.sock.sendall(b"\x88\x80" + mask)
+        except OSError:
+            pass
+        self.sock.close()
+
+    def report(self):
+        span = (self.last_at - self.first_at) if self.frames > 1 else 0
+        rate = "{:6.1f}".format((self.readings - 1) / span) \
+            if span and self.reading_along else "     -"
+        lat = sorted(self.latencies) or [0]
+        print("  {:<8} asked {:>2} Hz: {} readings/s, {:5} readings in "
+              "{:5} frames, {:4} lost, latency p50 {:5.1f} ms p99 {:6.1f} ms "
+              "max {:6.1f} ms".format(
+                  self.name, self.hz, rate, self.readings, self.frames,
+                  self.lost, lat[len(lat) // 2],
+                  lat[min(len(lat) - 1, len(lat) * 99 // 100)], lat[-1]))
+
+
+def run_case(name, clients):
+    """Returns what went wrong."""
+    sim = subprocess.Popen(
+        [args.sim, "-q", "-p", str(args.port), "-l",
+         str(int(args.seconds) + 15)],
+        stdout=subprocess.PIPE, text=True)
+    time.sleep(0.3)
+    connected = [Client(*spec[:3]) for spec in clients]
+    until = time.monotonic() + args.seconds
+    threads = []
+    for client, spec in zip(connected, clients):
+        mode = spec[3]
+        if mode == "stall":
+            continue
+        pause = 0.5 if mode == "slow" else 0.0
+        thread = threading.Thread(target=client.run, args=(until, pause))
+        thread.start()
+        threads.append(thread)
+    time.sleep(max(0, until - time.monotonic()))
+    for thread in threads:
+        thread.join()
+    # All at once, the sim stops publishing soon after.
+    drains = [threading.Thread(target=client.drain) for client in connected]
+    for thread in drains:
+        thread.start()
+    for thread in drains:
+        thread.join()
+    for client in connected:
+        client.close()
+    out, _ = sim.communicate(timeout=10)
+    result = RESULT.search(out)
+    print("{}:".format(name))
+    problems = []
+    for client, spec in zip(connected, clients):
+        client.report()
+        if spec[3] == "read" and client.lost:
+            problems.append("{}: {} lost {} readings".format(
+                name, client.name, client.lost))
+    if result is None:
+        problems.append("{}: the simulator didn't report".format(name))
+    else:
+        scans, published, publish_us, late_us, allocs, metrics = \
+            result.groups()
+        dropped = re.search(r"live_dropped_total=(\d+)", metrics)
+        print("  sim: {} scans, {} published, publish took at most {} us, "
+              "scans at most {} us late, {} allocations, {} dropped".format(
+                  scans, published, publish_us, late_us, allocs,
+                  dropped.group(1) if dropped else "?"))
+    return problems
+
+
+def main():
+    problems = run_case("full", [("fast", FULL_HZ, None, "read")])
+    problems += run_case("decimated", [("fast", 10, None, "read")])
+    problems += run_case("stalled", [("fast", FULL_HZ, None, "read"),
+                                     ("stalled", FULL_HZ, 4096, "stall")])
+    problems += run_case("slow", [("fast", FULL_HZ, None, "read"),
+                                  ("slow", FULL_HZ, 4096, "slow")])
+    simbench.finish(problems)
+
+
+main()
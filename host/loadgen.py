@@ -0,0 +1,286 @@
+"""Load generator for the provisioning flow, run against the host simulator.
+
+Measures two things:
+- Provisioning latency: the time from POSTing the setup form until GET /
+  shows the outcome, Success! or Error!. Every round submits a wrong
+  password, an unknown network and a target nothing listens on before the
+  right credentials, unless --no-failures is given. Setup probes the target
+  (see main/include/probe.h), by default a stand-in listener of the load
+  generator.
+- Handler throughput: concurrent keep-alive GET / while the server waits for
+  network info, which is the form render path.
+- With --sim, the heap use of the firmware code the simulator traces per
+  round. Allocations that keep coming after the first round fragment the
+  heap of a device that runs for months; run many rounds with --seconds 0
+  as a soak test.
+
+Latencies include the simulated radio delays from the scenario divided by the
+time scale, so compare runs with the same scenario and scale.
+
+Usage: python loadgen.py [--sim build/ll_sim] [--port 8080] [--scenario file]
+                         [--time-scale 10] [--rounds 5] [--clients 4]
+                         [--seconds 5]
+
+Without --sim, a simulator already listening on --port is used, started with
+-n 0 so it keeps provisioning.
+
+Exits with 1 if a request of the throughput run failed or the firmware kept
+allocating after the first round.
+"""
+
+import argparse
+import http.client
+import socket
+import statistics
+import subprocess
+import threading
+import time
+import urllib.parse
+
+import simbench
+
+POLL_INTERVAL_S = 0.005
+STARTUP_TIMEOUT_S = 30
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--sim", help="simulator binary to start")
+parser.add_argument("--port", type=int, default=8080)
+parser.add_argument("--scenario", help="scenario file for the simulator")
+parser.add_argument("--time-scale", type=float, default=10.0)
+parser.add_argument("--rounds", type=int, default=5)
+parser.add_argument("--clients", type=int, default=4)
+parser.add_argument("--seconds", type=float, default=5.0)
+parser.add_argument("--ssid", default="HomeNetwork")
+parser.add_argument("--psk", default="correct-horse")
+parser.add_argument("--target",
+                    help="upload target to submit, default a local stand-in")
+parser.add_argument("--no-failures", action="store_true")
+args = parser.parse_args()
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def summary(values):
+    return "n={} min={:.1f} p50={:.1f} p95={:.1f} max={:.1f} ms".format(
+        len(values),
+        min(values) * 1000,
+        statistics.median(values) * 1000,
+        percentile(values, 0.95) * 1000,
+        max(values) * 1000)
+
+
+def request(method, path, body=None):
+    """One request on a fresh connection, returns (status, body) or None when
+    the server isn't listening."""
+    conn = http.client.HTTPConnection("127.0.0.1", args.port, timeout=10)
+    try:
+        headers = {}
+        if body is not None:
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        return response.status, response.read().decode("utf-8", "replace")
+    except (ConnectionError, OSError):
+        return None
+    finally:
+        conn.close()
+
+
+def wait_for_form(timeout):
+    """Polls until the setup server serves the form, the start of a round."""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        result = request("GET", "/")
+        if result is not None and "<form" in result[1]:
+            return True
+        time.sleep(POLL_INTERVAL_S)
+    return False
+
+
+def stand_in_target():
+    """A listener the setup probe can connect to, connections are accepted by
+    the kernel and never served. Returns the socket and a target URL."""
+    listener = socket.socket()
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(64)
+    return listener, "http://127.0.0.1:{}/ingest".format(
+        listener.getsockname()[1])
+
+
+def dead_target():
+    """A target URL with a port nothing listens on."""
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return "http://127.0.0.1:{}/ingest".format(sock.getsockname()[1])
+
+
+def provision(ssid, psk, devname, target):
+    """Submits the form, returns (outcome, seconds until it was shown)."""
+    body = urllib.parse.urlencode({
+        "ssid": ssid,
+        "psk": psk,
+        "target": target,
+        "devname": devname,
+        "alarms": "",
+    })
+    started = time.monotonic()
+    result = request("POST", "/", body)
+    if result is None or result[0] != 302:
+        raise RuntimeError("form POST failed: {}".format(result))
+    while True:
+        result = request("GET", "/")
+        if result is not None:
+            if "Success!" in result[1]:
+                return "success", time.monotonic() - started
+            if "Error!" in result[1]:
+                return "error", time.monotonic() - started
+        time.sleep(POLL_INTERVAL_S)
+
+
+def measure_provisioning():
+    latencies = {}
+    restarts = []
+    attempts = []
+    if not args.no_failures:
+        attempts.append(
+            ("wrong password", args.ssid, args.psk + "x", target, "error"))
+        attempts.append(
+            ("unknown network", "Nowhere", args.psk, target, "error"))
+        attempts.append(
+            ("dead target", args.ssid, args.psk, dead_target(), "error"))
+    attempts.append(("success", args.ssid, args.psk, target, "success"))
+
+    for round_index in range(args.rounds):
+        for name, ssid, psk, url, expected in attempts:
+            outcome, latency = provision(ssid, psk, "loadgen{}".format(
+                round_index), url)
+            if outcome != expected:
+                raise RuntimeError("{} attempt ended in {}".format(
+                    name, outcome))
+            latencies.setdefault(name, []).append(latency)
+            if outcome == "error":
+                # The error page resets the server, the form is next.
+                continue
+            started = time.monotonic()
+            if not wait_for_form(STARTUP_TIMEOUT_S):
+                raise RuntimeError("setup server didn't come back")
+            restarts.append(time.monotonic() - started)
+
+    print("Provisioning latency, POST to outcome page:")
+    for name, values in latencies.items():
+        print("  {:16s} {}".format(name, summary(values)))
+    print("  {:16s} {}".format("server restart", summary(restarts)))
+
+
+def report_heap(lines):
+    """Returns the allocations per round after the first."""
+    rounds = [dict(field.split("=") for field in line.split()[1:])
+              for line in lines]
+    if not rounds:
+        print("No heap reports from the simulator")
+        return 0
+    print("Firmware heap, traced by the simulator:")
+    for fields in (rounds[0], rounds[-1]):
+        print("  after round {round:>4} allocs={allocs} frees={frees} "
+              "live={live}".format(**fields))
+    if len(rounds) > 1:
+        per_round = (int(rounds[-1]["allocs"]) - int(rounds[0]["allocs"])) \
+            / (len(rounds) - 1)
+        print("  {:.1f} allocations per round after the first".format(
+            per_round))
+        return per_round
+    return 0
+
+
+def measure_throughput():
+    """Returns the number of failed requests."""
+    lock = threading.Lock()
+    latencies = []
+    errors = [0]
+    deadline = time.monotonic() + args.seconds
+
+    def client():
+        conn = http.client.HTTPConnection("127.0.0.1", args.port, timeout=10)
+        mine = []
+        failed = 0
+        while time.monotonic() < deadline:
+            started = time.monotonic()
+            try:
+                conn.request("GET", "/")
+                response = conn.getresponse()
+                response.read()
+                if response.status != 200:
+                    failed += 1
+                    continue
+            except (ConnectionError, OSError, http.client.HTTPException):
+                failed += 1
+                conn.close()
+                conn = http.client.HTTPConnection(
+                    "127.0.0.1", args.port, timeout=10)
+                continue
+            mine.append(time.monotonic() - started)
+        conn.close()
+        with lock:
+            latencies.extend(mine)
+            errors[0] += failed
+
+    threads = [threading.Thread(target=client) for _ in range(args.clients)]
+    started = time.monotonic()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - started
+
+    print("Form handler throughput, {} keep-alive clients:".format(
+        args.clients))
+    print("  {:.0f} requests/s, {} errors".format(
+        len(latencies) / elapsed, errors[0]))
+    if latencies:
+        print("  {:16s} {}".format("latency", summary(latencies)))
+    return errors[0]
+
+
+listener = None
+target = args.target
+if target is None:
+    listener, target = stand_in_target()
+sim = None
+if args.sim:
+    command = [args.sim, "-p", str(args.port), "-n", "0", "-q",
+               "-t", str(args.time_scale)]
+    if args.scenario:
+        command += ["-s", args.scenario]
+    sim = subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+    heap_lines = []
+
+    def read_sim():
+        for line in sim.stdout:
+            if line.startswith("heap "):
+                heap_lines.append(line)
+
+    threading.Thread(target=read_sim, daemon=True).start()
+try:
+    if not wait_for_form(STARTUP_TIMEOUT_S):
+        raise SystemExit("no setup server on port {}".format(args.port))
+    measure_provisioning()
+    problems = []
+    if args.seconds > 0:
+        failed = measure_throughput()
+        if failed:
+            problems.append("{} requests failed".format(failed))
+    if sim is not None:
+        per_round = report_heap(heap_lines)
+        if per_round > 0:
+            problems.append("{:.1f} allocations per round after the "
+                            "first".format(per_round))
+    simbench.finish(problems)
+finally:
+    if sim is not None:
+        sim.terminate()
+        sim.wait()
+    if listener is not None:
+        listener.close()
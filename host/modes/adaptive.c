@@ -0,0 +1,69 @@
+#include "modes.h"
+
+#include "adaptive.h"
+#include "const.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "sim";
+
+// Samples a trace of "timestamp value" lines the way the duty cycle does
+// with the adaptive controller, see adaptive.h, holding the last reading at
+// or before each sample time. With fixed_ms the samples come that often
+// instead and the controller only detects. Prints a "sample" line per
+// sample and an "adaptive" line with the totals.
+int sim_run_adaptive(const char *path, int64_t fixed_ms) {
+    FILE *trace = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (trace == NULL) {
+        ESP_LOGE(TAG, "Couldn't open trace %s", path);
+        return 1;
+    }
+    const adaptive_config_t config = {
+        .min_interval_ms = ADAPTIVE_MIN_INTERVAL_MS,
+        .max_interval_ms = ADAPTIVE_MAX_INTERVAL_MS,
+        .min_report_ms = ADAPTIVE_MIN_REPORT_MS,
+        .max_report_ms = DUTYCYCLE_UPLOAD_INTERVAL_MS,
+        .drift = ADAPTIVE_DRIFT,
+        .threshold = ADAPTIVE_THRESHOLD,
+        .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+    };
+    adaptive_state_t state;
+    ll_adaptive_reset(&config, &state);
+
+    uint64_t samples = 0;
+    long long timestamp;
+    long value;
+    bool held = false;
+    long held_value = 0;
+    int64_t next = -1;
+    while (fscanf(trace, "%lld %ld", &timestamp, &value) == 2) {
+        if (next < 0) {
+            next = timestamp;
+        }
+        // Every sample time up to this reading gets the one before it.
+        while (held && timestamp > next) {
+            bool detected = ll_adaptive_update(&config, &state, held_value);
+            samples++;
+            printf(
+                "sample %lld %ld %d %lld\n",
+                (long long)next,
+                held_value,
+                detected,
+                (long long)state.interval_ms);
+            next += fixed_ms > 0 ? fixed_ms : state.interval_ms;
+        }
+        held = true;
+        held_value = value;
+    }
+    if (trace != stdin) {
+        fclose(trace);
+    }
+    printf(
+        "adaptive samples=%llu detections=%lu\n",
+        (unsigned long long)samples,
+        (unsigned long)state.detections);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "modes.h"
+
+#include "alarm.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The alarm mode repeats evaluating the trace for at least this long.
+#define SIM_ALARM_TIMED_NS 200000000
+
+static const char *TAG = "sim";
+
+// Evaluates the alarm rules against a trace of "timestamp value" lines the
+// way the logger does, then times evaluating it again from fresh rule
+// states. Prints an "alarm" line per state change and an "alarms" line with
+// the totals and the time per sample and per rule.
+int sim_run_alarms(const char *path, const char *rules) {
+    static alarm_engine_t engine;
+    if (!ll_alarm_parse(rules, &engine)) {
+        ESP_LOGE(TAG, "Invalid alarm rules %s", rules);
+        return 2;
+    }
+    size_t count = 0;
+    sample_t *samples = sim_read_trace(path, &count);
+    if (samples == NULL) {
+        return 1;
+    }
+
+    alarm_event_t events[ALARM_RULES_MAX];
+    uint64_t changes = 0;
+    for (size_t i = 0; i < count; i++) {
+        int fired = ll_alarm_evaluate(&engine, &samples[i], events);
+        for (int e = 0; e < fired; e++) {
+            printf(
+                "alarm %lld %s %s %d %ld\n",
+                (long long)events[e].timestamp,
+                events[e].rule,
+                ll_alarm_kind_name(events[e].kind),
+                events[e].active,
+                (long)events[e].value);
+        }
+        changes += fired;
+    }
+
+    uint64_t rounds = 0;
+    int64_t eval_ns = 0;
+    volatile int sink = 0;
+    do {
+        ll_alarm_parse(rules, &engine);
+        int64_t started = sim_thread_cpu_ns();
+        for (size_t i = 0; i < count; i++) {
+            sink += ll_alarm_evaluate(&engine, &samples[i], events);
+        }
+        eval_ns += sim_thread_cpu_ns() - started;
+        rounds++;
+    } while (eval_ns < SIM_ALARM_TIMED_NS && count > 0);
+    (void)sink;
+    double per_sample = count > 0 ? (double)eval_ns / (rounds * count) : 0.0;
+
+    printf(
+        "alarms rules=%d samples=%zu changes=%llu ns_per_sample=%.2f "
+        "ns_per_rule=%.2f\n",
+        engine.count,
+        count,
+        (unsigned long long)changes,
+        per_sample,
+        engine.count > 0 ? per_sample / engine.count : 0.0);
+    fflush(stdout);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "modes.h"
+
+#include "calib.h"
+#include "esp_log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <stdio.h>
+
+// Raw readings the calibration mode converts, and how often it converts
+// them all for the timing.
+#define SIM_CALIB_INPUTS_MAX 65536
+#define SIM_CALIB_TIMED_ROUNDS 64
+
+static const char *TAG = "sim";
+
+static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// The same conversion in floating point, a linear search over the points
+// and the exact geometry, for comparison.
+static double calibrate_float(
+    const calib_t *calib, const int32_t *dims, int32_t raw) {
+    double level = raw;
+    if (calib->points > 0) {
+        int i = 0;
+        while (i < calib->points - 2 && raw >= calib->raw[i + 1]) {
+            i++;
+        }
+        double l0 = calib->level[i] / 256.0;
+        double l1 = calib->level[i + 1] / 256.0;
+        level = l0 + (l1 - l0) * (raw - calib->raw[i]) /
+                         (calib->raw[i + 1] - calib->raw[i]);
+    }
+    if (calib->output != co_Volume) {
+        return level;
+    }
+    return ll_calib_tank_litres(calib->shape, dims, level);
+}
+
+// Converts raw readings from stdin, one per line, through the calibration,
+// see calib.h. Prints a "conversion" line per reading with the level and
+// the volume before rounding, and a "calibrate" line with the time and TSC
+// cycles (0 off x86) per conversion of ll_calib_apply and of the same in
+// floating point.
+int sim_run_calibrate(const char *points, const char *tank) {
+    static calib_t calib;
+    if (!ll_calib_parse(points, tank, &calib)) {
+        ESP_LOGE(TAG, "Invalid calibration %s / %s", points, tank);
+        return 1;
+    }
+    int32_t dims[3] = {0, 0, 0};
+    if (*tank != '\0') {
+        char kind[8];
+        long a = 0, b = 0, c = 0;
+        if (sscanf(tank, "%7[a-z]:%ld:%ld:%ld", kind, &a, &b, &c) >= 3) {
+            dims[0] = (int32_t)a;
+            dims[1] = (int32_t)b;
+            dims[2] = (int32_t)c;
+        }
+    }
+    static int32_t raws[SIM_CALIB_INPUTS_MAX];
+    size_t count = 0;
+    long raw;
+    while (count < SIM_CALIB_INPUTS_MAX && scanf("%ld", &raw) == 1) {
+        raws[count++] = (int32_t)raw;
+    }
+    for (size_t i = 0; i < count; i++) {
+        int32_t level = ll_calib_level(&calib, raws[i]);
+        int32_t volume =
+            calib.output == co_Volume ? ll_calib_volume(&calib, level) : 0;
+        printf(
+            "conversion %ld %.4f %.4f %ld\n",
+            (long)raws[i],
+            level / 256.0,
+            volume / 256.0,
+            (long)ll_calib_apply(&calib, raws[i]));
+    }
+
+    const uint64_t conversions = (uint64_t)count * SIM_CALIB_TIMED_ROUNDS;
+    volatile int64_t sink = 0;
+    int64_t started = sim_thread_cpu_ns();
+    uint64_t started_cycles = cycles();
+    for (int round = 0; round < SIM_CALIB_TIMED_ROUNDS; round++) {
+        for (size_t i = 0; i < count; i++) {
+            sink += ll_calib_apply(&calib, raws[i]);
+        }
+    }
+    uint64_t fixed_cycles = cycles() - started_cycles;
+    int64_t fixed_ns = sim_thread_cpu_ns() - started;
+    volatile double float_sink = 0;
+    started = sim_thread_cpu_ns();
+    started_cycles = cycles();
+    for (int round = 0; round < SIM_CALIB_TIMED_ROUNDS; round++) {
+        for (size_t i = 0; i < count; i++) {
+            float_sink += calibrate_float(&calib, dims, raws[i]);
+        }
+    }
+    uint64_t float_cycles = cycles() - started_cycles;
+    int64_t float_ns = sim_thread_cpu_ns() - started;
+    (void)sink;
+    (void)float_sink;
+    double n = conversions > 0 ? (double)conversions : 1;
+    printf(
+        "calibrate conversions=%llu ns=%.2f cycles=%.1f float_ns=%.2f "
+        "float_cycles=%.1f\n",
+        (unsigned long long)conversions,
+        fixed_ns / n,
+        fixed_cycles / n,
+        float_ns / n,
+        float_cycles / n);
+    fflush(stdout);
+    return 0;
+}
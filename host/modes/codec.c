@@ -0,0 +1,143 @@
+#include "modes.h"
+
+#include "codec.h"
+#include "esp_log.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The codec mode repeats encoding and decoding for at least this long.
+#define SIM_CODEC_TIMED_NS 200000000
+
+static const char *TAG = "sim";
+
+typedef struct codec_run_t {
+    uint8_t *blocks;
+    size_t *lens;
+    size_t block_count;
+    size_t bytes;
+} codec_run_t;
+
+// Encodes the samples into blocks the way the logger does, back to back in
+// run->blocks at CODEC_BLOCK_SIZE strides.
+static void codec_encode(
+    const sample_t *samples, size_t count, codec_run_t *run) {
+    static codec_encoder_t enc;
+    run->block_count = 0;
+    run->bytes = 0;
+    ll_codec_encoder_reset(&enc, 0);
+    for (size_t i = 0; i <= count; i++) {
+        if (i < count && ll_codec_encoder_append(&enc, &samples[i])) {
+            continue;
+        }
+        if (enc.header.count > 0) {
+            size_t len = 0;
+            const uint8_t *block = ll_codec_encoder_finish(&enc, &len);
+            memcpy(
+                run->blocks + run->block_count * CODEC_BLOCK_SIZE,
+                block,
+                len);
+            run->lens[run->block_count++] = len;
+            run->bytes += len;
+        }
+        ll_codec_encoder_reset(&enc, 0);
+        if (i < count) {
+            ll_codec_encoder_append(&enc, &samples[i]);
+        }
+    }
+}
+
+// Decodes every block, into out if it isn't NULL. Returns the samples.
+static size_t codec_decode(const codec_run_t *run, sample_t *out) {
+    size_t decoded = 0;
+    codec_decoder_t dec;
+    sample_t sample;
+    for (size_t b = 0; b < run->block_count; b++) {
+        const uint8_t *block = run->blocks + b * CODEC_BLOCK_SIZE;
+        if (!ll_codec_decoder_init(&dec, block, run->lens[b])) {
+            ESP_LOGE(TAG, "Block %zu doesn't decode!", b);
+            abort();
+        }
+        while (ll_codec_decoder_next(&dec, &sample)) {
+            if (out != NULL) {
+                // The channel is the block's.
+                sample.channel = dec.header.channel;
+                out[decoded] = sample;
+            }
+            decoded++;
+        }
+    }
+    return decoded;
+}
+
+// Encodes a trace of "timestamp value" lines into codec blocks, decodes
+// them again and compares, then times both directions. Prints a "codec"
+// line with the sizes, the throughput in MB of sample_t per second and
+// whether every sample came back.
+int sim_run_codec(const char *path) {
+    size_t count = 0;
+    sample_t *samples = sim_read_trace(path, &count);
+    if (samples == NULL) {
+        return 1;
+    }
+
+    // A block holds at least one sample.
+    codec_run_t run = {
+        .blocks = malloc((count + 1) * CODEC_BLOCK_SIZE),
+        .lens = malloc((count + 1) * sizeof(size_t)),
+    };
+    sample_t *decoded = malloc((count + 1) * sizeof(sample_t));
+    NPC(run.blocks);
+    NPC(run.lens);
+    NPC(decoded);
+    codec_encode(samples, count, &run);
+    bool same = codec_decode(&run, decoded) == count;
+    for (size_t i = 0; same && i < count; i++) {
+        same = decoded[i].timestamp == samples[i].timestamp &&
+               decoded[i].value == samples[i].value &&
+               decoded[i].channel == samples[i].channel;
+    }
+
+    uint64_t rounds = 0;
+    int64_t started = sim_thread_cpu_ns();
+    int64_t encode_ns = 0;
+    do {
+        codec_encode(samples, count, &run);
+        rounds++;
+        encode_ns = sim_thread_cpu_ns() - started;
+    } while (encode_ns < SIM_CODEC_TIMED_NS && count > 0);
+    double encoded_mb = (double)rounds * count * sizeof(sample_t) / 1e6;
+    volatile size_t sink = 0;
+    uint64_t decode_rounds = 0;
+    started = sim_thread_cpu_ns();
+    int64_t decode_ns = 0;
+    do {
+        sink += codec_decode(&run, NULL);
+        decode_rounds++;
+        decode_ns = sim_thread_cpu_ns() - started;
+    } while (decode_ns < SIM_CODEC_TIMED_NS && count > 0);
+    double decoded_mb = (double)decode_rounds * count * sizeof(sample_t) / 1e6;
+    (void)sink;
+
+    printf(
+        "codec samples=%zu blocks=%zu bytes=%zu struct_bytes=%zu "
+        "bytes_per_sample=%.3f encode_mb_s=%.1f decode_mb_s=%.1f "
+        "roundtrip=%d\n",
+        count,
+        run.block_count,
+        run.bytes,
+        count * sizeof(sample_t),
+        count > 0 ? (double)run.bytes / count : 0.0,
+        encode_ns > 0 ? encoded_mb * 1e9 / encode_ns : 0.0,
+        decode_ns > 0 ? decoded_mb * 1e9 / decode_ns : 0.0,
+        same);
+    fflush(stdout);
+    free(samples);
+    free(run.blocks);
+    free(run.lens);
+    free(decoded);
+    return same ? 0 : 1;
+}
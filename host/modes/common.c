@@ -0,0 +1,133 @@
+#include "modes.h"
+
+#include "const.h"
+#include "esp_log.h"
+#include "sim.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Same sizes as partitions.csv.
+#define SIM_SAMPLE_LOG_SIZE (1024 * 1024)
+#define SIM_ROLLUP_MINUTE_SIZE (256 * 1024)
+#define SIM_ROLLUP_HOUR_SIZE (64 * 1024)
+
+static const char *TAG = "sim";
+
+static uint8_t glob_sample_log[SIM_SAMPLE_LOG_SIZE];
+static uint8_t glob_rollup_minute[SIM_ROLLUP_MINUTE_SIZE];
+static uint8_t glob_rollup_hour[SIM_ROLLUP_HOUR_SIZE];
+
+// Erased flash, the log and the rollups start out empty.
+void sim_add_storage() {
+    memset(glob_sample_log, 0xFF, sizeof(glob_sample_log));
+    memset(glob_rollup_minute, 0xFF, sizeof(glob_rollup_minute));
+    memset(glob_rollup_hour, 0xFF, sizeof(glob_rollup_hour));
+    sim_partition_add(
+        SAMPLE_LOG_PART_NAME,
+        SAMPLE_LOG_PART_TYPE,
+        SAMPLE_LOG_PART_SUBTYPE,
+        glob_sample_log,
+        sizeof(glob_sample_log));
+    sim_partition_add(
+        ROLLUP_MINUTE_PART_NAME,
+        ROLLUP_PART_TYPE,
+        ROLLUP_PART_SUBTYPE,
+        glob_rollup_minute,
+        sizeof(glob_rollup_minute));
+    sim_partition_add(
+        ROLLUP_HOUR_PART_NAME,
+        ROLLUP_PART_TYPE,
+        ROLLUP_PART_SUBTYPE,
+        glob_rollup_hour,
+        sizeof(glob_rollup_hour));
+}
+
+int64_t sim_clock_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t sim_thread_cpu_ns() {
+    struct timespec used;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &used);
+    return (int64_t)used.tv_sec * 1000000000 + used.tv_nsec;
+}
+
+int64_t sim_epoch_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// A tank that drains over the day and is refilled every morning, with some
+// sensor noise.
+int32_t sim_tank_level(int64_t timestamp) {
+    const int64_t day_ms = 24 * 60 * 60 * 1000LL;
+    double day = (double)(timestamp % day_ms) / day_ms;
+    int32_t noise = (int32_t)((timestamp / SAMPLE_PERIOD_MS * 7919) % 7) - 3;
+    return 1800 - (int32_t)(1200 * day) + noise;
+}
+
+// Provisioned network info with only a target and a device name.
+void sim_remote_netinfo(
+    network_info_t *netinfo, const char *target, const char *devname) {
+    const char *fields[] = {"sim", "", target, devname, "", "", ""};
+    char **aliases[] = {
+        &netinfo->ssid,
+        &netinfo->password,
+        &netinfo->target,
+        &netinfo->devname,
+        &netinfo->alarms,
+        &netinfo->levelcal,
+        &netinfo->tank,
+    };
+    char *cursor = netinfo->buffer;
+    for (int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        size_t len = strlen(fields[i]) + 1;
+        if (cursor + len > netinfo->buffer + sizeof(netinfo->buffer)) {
+            ESP_LOGE(TAG, "Target and device name don't fit");
+            abort();
+        }
+        memcpy(cursor, fields[i], len);
+        *aliases[i] = cursor;
+        cursor += len;
+    }
+}
+
+sample_t *sim_read_trace(const char *path, size_t *count) {
+    NPC(path);
+    NPC(count);
+    FILE *trace = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (trace == NULL) {
+        ESP_LOGE(TAG, "Couldn't open trace %s", path);
+        return NULL;
+    }
+    size_t capacity = 4096;
+    *count = 0;
+    sample_t *samples = malloc(capacity * sizeof(sample_t));
+    NPC(samples);
+    long long timestamp;
+    long value;
+    while (fscanf(trace, "%lld %ld", &timestamp, &value) == 2) {
+        if (*count == capacity) {
+            capacity *= 2;
+            samples = realloc(samples, capacity * sizeof(sample_t));
+            NPC(samples);
+        }
+        samples[(*count)++] = (sample_t){
+            .timestamp = timestamp,
+            .value = (int32_t)value,
+            .channel = 0,
+        };
+    }
+    if (trace != stdin) {
+        fclose(trace);
+    }
+    return samples;
+}
@@ -0,0 +1,78 @@
+#include "modes.h"
+
+#include "codec.h"
+#include "dataserver.h"
+#include "esp_log.h"
+#include "rollupstore.h"
+#include "samplelog.h"
+#include "sim.h"
+
+#include <stdio.h>
+
+static const char *TAG = "sim";
+
+static void dataserver_flush(codec_encoder_t *enc, uint64_t *blocks) {
+    if (enc->header.count == 0) {
+        return;
+    }
+    size_t len = 0;
+    const uint8_t *block = ll_codec_encoder_finish(enc, &len);
+    ll_samplelog_append(block, len);
+    ll_codec_encoder_reset(enc, 0);
+    (*blocks)++;
+}
+
+// Logs a trace of "timestamp value" lines into the sample log and the rollup
+// store on erased partitions, the way the logger does, and serves /data on
+// them until stdin closes. Prints a "dataserver" line with what was stored
+// once it serves, and a "served" line when done.
+int sim_run_dataserver(const char *path) {
+    FILE *trace = fopen(path, "r");
+    if (trace == NULL) {
+        ESP_LOGE(TAG, "Couldn't open trace %s", path);
+        return 1;
+    }
+    sim_add_storage();
+    ll_samplelog_init();
+    ll_rollupstore_init();
+    static codec_encoder_t enc;
+    ll_codec_encoder_reset(&enc, 0);
+    uint64_t samples = 0;
+    uint64_t blocks = 0;
+    long long timestamp;
+    long value;
+    while (fscanf(trace, "%lld %ld", &timestamp, &value) == 2) {
+        const sample_t sample = {
+            .timestamp = timestamp,
+            .value = (int32_t)value,
+            .channel = 0,
+        };
+        ll_rollupstore_add(&sample);
+        if (!ll_codec_encoder_append(&enc, &sample)) {
+            dataserver_flush(&enc, &blocks);
+            ll_codec_encoder_append(&enc, &sample);
+        }
+        samples++;
+    }
+    fclose(trace);
+    dataserver_flush(&enc, &blocks);
+
+    ll_dataserver_start();
+    printf(
+        "dataserver samples=%llu blocks=%llu minutes=%lu hours=%lu\n",
+        (unsigned long long)samples,
+        (unsigned long long)blocks,
+        (unsigned long)(ll_rollupstore_head(rt_Minute) -
+                        ll_rollupstore_tail(rt_Minute)),
+        (unsigned long)(ll_rollupstore_head(rt_Hour) -
+                        ll_rollupstore_tail(rt_Hour)));
+    fflush(stdout);
+    char discard[64];
+    while (fread(discard, 1, sizeof(discard), stdin) > 0) {
+    }
+    sim_heap_stats_t heap;
+    sim_heap_stats(&heap);
+    printf("served allocs=%llu\n", (unsigned long long)heap.allocs);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "modes.h"
+
+#include "codec.h"
+#include "deadband.h"
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "sim";
+
+typedef struct replay_log_t {
+    codec_encoder_t enc;
+    uint64_t blocks;
+    uint64_t bytes;
+    // Prints the samples of every block it finishes.
+    bool print;
+} replay_log_t;
+
+// Finishes the block, decodes it again the way the collector would, and
+// starts the next one.
+static void replay_flush(replay_log_t *log, const deadband_config_t *config) {
+    if (log->enc.header.count == 0) {
+        return;
+    }
+    size_t len = 0;
+    const uint8_t *block = ll_codec_encoder_finish(&log->enc, &len);
+    log->blocks++;
+    log->bytes += len;
+    codec_decoder_t dec;
+    if (!ll_codec_decoder_init(&dec, block, len)) {
+        ESP_LOGE(TAG, "Replayed block doesn't decode!");
+        abort();
+    }
+    sample_t sample;
+    while (ll_codec_decoder_next(&dec, &sample)) {
+        if (log->print) {
+            printf(
+                "report %lld %ld %d\n",
+                (long long)sample.timestamp,
+                (long)sample.value,
+                sample.report);
+        }
+    }
+    ll_codec_encoder_reset(&log->enc, 0);
+    if (config != NULL && config->heartbeat_ms > 0) {
+        ll_codec_encoder_tag(&log->enc, config->deadband, config->heartbeat_ms);
+    }
+}
+
+static void replay_append(
+    replay_log_t *log,
+    const deadband_config_t *config,
+    const sample_t *sample) {
+    if (!ll_codec_encoder_append(&log->enc, sample)) {
+        replay_flush(log, config);
+        ll_codec_encoder_append(&log->enc, sample);
+    }
+}
+
+// Replays a trace of "timestamp value" lines through the deadband filter
+// and the codec the way the logger does, see logger.c. Prints a "report"
+// line per reading that goes into the log, as decoded from its block, and
+// a "deadband" line with the totals against logging every reading.
+int sim_run_deadband(const char *path, int32_t deadband, int heartbeat_ms) {
+    FILE *trace = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (trace == NULL) {
+        ESP_LOGE(TAG, "Couldn't open trace %s", path);
+        return 1;
+    }
+    const deadband_config_t config = {
+        .deadband = deadband,
+        .heartbeat_ms = heartbeat_ms,
+    };
+    static replay_log_t filtered = {.print = true};
+    static replay_log_t every;
+    deadband_state_t state;
+    ll_deadband_reset(&state);
+    ll_codec_encoder_reset(&filtered.enc, 0);
+    ll_codec_encoder_reset(&every.enc, 0);
+    if (heartbeat_ms > 0) {
+        ll_codec_encoder_tag(&filtered.enc, deadband, heartbeat_ms);
+    }
+
+    uint64_t readings = 0;
+    uint64_t reports = 0;
+    int64_t filter_us = 0;
+    long long timestamp;
+    long value;
+    while (fscanf(trace, "%lld %ld", &timestamp, &value) == 2) {
+        sample_t sample = {
+            .timestamp = timestamp,
+            .value = (int32_t)value,
+            .channel = 0,
+        };
+        replay_append(&every, NULL, &sample);
+        readings++;
+        int64_t started = sim_clock_us();
+        bool report = ll_deadband_update(&config, &state, &sample);
+        filter_us += sim_clock_us() - started;
+        if (report) {
+            replay_append(&filtered, &config, &sample);
+            reports++;
+        }
+    }
+    if (trace != stdin) {
+        fclose(trace);
+    }
+    replay_flush(&filtered, &config);
+    replay_flush(&every, NULL);
+    printf(
+        "deadband readings=%llu reports=%llu blocks=%llu bytes=%llu "
+        "every_blocks=%llu every_bytes=%llu filter_ns=%.1f\n",
+        (unsigned long long)readings,
+        (unsigned long long)reports,
+        (unsigned long long)filtered.blocks,
+        (unsigned long long)filtered.bytes,
+        (unsigned long long)every.blocks,
+        (unsigned long long)every.bytes,
+        readings > 0 ? filter_us * 1000.0 / readings : 0.0);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "modes.h"
+
+#include "const.h"
+#include "dutycycle.h"
+
+#include <stdio.h>
+
+// Time a duty cycle wake spends on boot and the burst, on an upload that
+// gets through, and on one that waits out the connection attempt.
+#define SIM_DUTYCYCLE_AWAKE_MS 200
+#define SIM_DUTYCYCLE_UPLOAD_MS 4000
+#define SIM_DUTYCYCLE_FAILED_MS 10000
+
+// Runs the duty cycle's decisions the way do_duty_cycle in level-sensor.c
+// does, over hours of simulated time with fixed intervals. Wakes, bursts and
+// uploads take the SIM_DUTYCYCLE_* times, uploads fail between outage_from_h
+// and outage_to_h. Prints an "upload" line per attempt and a "dutycycle"
+// line with the totals: the largest distance of a wake from its grid, the
+// oldest reading an upload carried, the attempts during the outage, and the
+// measured mAh per day next to the estimate for the same awake times.
+int sim_run_dutycycle(
+    double hours,
+    int64_t sample_ms,
+    int64_t upload_ms,
+    double outage_from_h,
+    double outage_to_h) {
+    const dutycycle_config_t config = {
+        .sample_interval_ms = sample_ms,
+        .upload_interval_ms = upload_ms,
+        .min_sleep_ms = DUTYCYCLE_MIN_SLEEP_MS,
+        .upload_threshold = DUTYCYCLE_UPLOAD_THRESHOLD,
+        .burst_samples = DUTYCYCLE_BURST_SAMPLES,
+    };
+    const dutycycle_power_t power = {
+        .sleep_ua = DUTYCYCLE_SLEEP_UA,
+        .active_ma = DUTYCYCLE_ACTIVE_MA,
+        .radio_ma = DUTYCYCLE_RADIO_MA,
+    };
+    const int64_t end = (int64_t)(hours * 3600 * 1000);
+    const int64_t outage_from = (int64_t)(outage_from_h * 3600 * 1000);
+    const int64_t outage_to = (int64_t)(outage_to_h * 3600 * 1000);
+    dutycycle_state_t state;
+    ll_dutycycle_reset(&state, 0);
+
+    int64_t now = 0;
+    int64_t oldest = -1;
+    int64_t max_drift = 0;
+    int64_t max_age = 0;
+    uint32_t failed = 0;
+    uint32_t outage_attempts = 0;
+    while (now < end) {
+        int64_t woke = now;
+        ll_dutycycle_woke(&state, woke);
+        int64_t drift = woke % sample_ms;
+        if (drift > sample_ms / 2) {
+            drift = sample_ms - drift;
+        }
+        max_drift = drift > max_drift ? drift : max_drift;
+        if (oldest < 0) {
+            oldest = woke;
+        }
+        ll_dutycycle_sampled(&state, DUTYCYCLE_BURST_SAMPLES);
+        now += SIM_DUTYCYCLE_AWAKE_MS;
+
+        dutycycle_decision_t decision =
+            ll_dutycycle_decide(&config, &state, now);
+        if (decision.upload) {
+            bool down = now >= outage_from && now < outage_to;
+            int64_t radio_ms =
+                down ? SIM_DUTYCYCLE_FAILED_MS : SIM_DUTYCYCLE_UPLOAD_MS;
+            now += radio_ms;
+            printf(
+                "upload t_ms=%lld ok=%d unsent=%lu age_ms=%lld\n",
+                (long long)now,
+                !down,
+                (unsigned long)state.unsent,
+                (long long)(now - oldest));
+            if (down) {
+                outage_attempts++;
+                failed++;
+                ll_dutycycle_upload_failed(&config, &state, now);
+            } else {
+                max_age = now - oldest > max_age ? now - oldest : max_age;
+                oldest = -1;
+                ll_dutycycle_uploaded(&state, now);
+            }
+            ll_dutycycle_radio_used(&state, radio_ms);
+            decision = ll_dutycycle_decide(&config, &state, now);
+        }
+        ll_dutycycle_slept(&state, now - woke);
+        now += decision.sleep_ms;
+    }
+
+    int64_t wakes = state.wakes > 0 ? state.wakes : 1;
+    printf(
+        "dutycycle wakes=%lu uploads=%lu failed=%lu outage_attempts=%lu "
+        "awake_ms=%lld radio_ms=%lld max_drift_ms=%lld max_age_ms=%lld "
+        "mah_per_day=%.3f estimate_mah_per_day=%.3f\n",
+        (unsigned long)state.wakes,
+        (unsigned long)state.uploads,
+        (unsigned long)failed,
+        (unsigned long)outage_attempts,
+        (long long)state.awake_ms,
+        (long long)state.radio_ms,
+        (long long)max_drift,
+        (long long)max_age,
+        ll_dutycycle_measured_mah_per_day(&config, &power, &state),
+        ll_dutycycle_estimate_mah_per_day(
+            &config,
+            &power,
+            (state.awake_ms - state.radio_ms) / wakes,
+            SIM_DUTYCYCLE_UPLOAD_MS));
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "modes.h"
+
+#include "const.h"
+#include "esp_http_server.h"
+#include "live.h"
+#include "metrics.h"
+#include "sim.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Live readings of a simulated probe, the sim takes the sampler's part and
+// publishes a scan every LIVE_PERIOD_MS while anyone is watching, see
+// sampler.c. Prints one "live" line to stdout when done.
+int sim_run_live(int seconds) {
+    httpd_handle_t server = NULL;
+    const httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    ESP_EC(httpd_start(&server, &config));
+    ll_live_serve(server);
+
+    uint64_t scans = 0;
+    uint64_t published = 0;
+    int64_t publish_us_max = 0;
+    int64_t late_us_max = 0;
+    int64_t started = sim_clock_us();
+    int64_t due = started;
+    while (due - started < (int64_t)seconds * 1000000) {
+        // Timestamps in the epoch like a synchronized device, so clients
+        // can tell the latency.
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        sample_t sample = {
+            .timestamp = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000,
+            .value = 1000 + (int32_t)(500 * sin(scans * 0.05)),
+            .channel = 0,
+        };
+        int64_t before = sim_clock_us();
+        if (before - due > late_us_max) {
+            late_us_max = before - due;
+        }
+        if (ll_live_active()) {
+            ll_live_publish(&sample, 1);
+            published++;
+        }
+        int64_t took = sim_clock_us() - before;
+        if (took > publish_us_max) {
+            publish_us_max = took;
+        }
+        scans++;
+        due += LIVE_PERIOD_MS * 1000;
+        int64_t wait = due - sim_clock_us();
+        if (wait > 0) {
+            usleep(wait);
+        }
+    }
+
+    char metrics[METRICS_SNAPSHOT_SIZE];
+    ll_metrics_snapshot(metrics, sizeof(metrics));
+    sim_heap_stats_t heap;
+    sim_heap_stats(&heap);
+    printf(
+        "live scans=%llu published=%llu publish_us_max=%lld late_us_max=%lld "
+        "allocs=%llu %s\n",
+        (unsigned long long)scans,
+        (unsigned long long)published,
+        (long long)publish_us_max,
+        (long long)late_us_max,
+        (unsigned long long)heap.allocs,
+        metrics);
+    fflush(stdout);
+    return 0;
+}
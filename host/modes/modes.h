@@ -0,0 +1,62 @@
+#ifndef SIM_MODES_H
+#define SIM_MODES_H
+
+#include "sample.h"
+#include "setup.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The modes of the simulator, one source per subsystem, see usage in sim.c.
+// Each runs the sources from main/ on the shims, prints what it measured to
+// stdout and returns the exit status.
+
+// Provisions through the setup server rounds times, 0 runs forever, see
+// setup.c.
+int sim_run_setup(const char *scenario, const char *page_dir, int rounds);
+int sim_run_update(const char *url, const uint8_t *sha256);
+int sim_run_live(int seconds);
+int sim_run_remote(
+    const char *target, const char *devname, int seconds, int poll_ms);
+int sim_run_catchup(
+    const char *target,
+    const char *devname,
+    int hours,
+    int seconds,
+    int live_ms);
+int sim_run_pipeline(
+    const char *target, const char *devname, int seconds, int rate);
+int sim_run_channels(int max_channels);
+int sim_run_deadband(const char *path, int32_t deadband, int heartbeat_ms);
+int sim_run_dutycycle(
+    double hours,
+    int64_t sample_ms,
+    int64_t upload_ms,
+    double outage_from_h,
+    double outage_to_h);
+int sim_run_adaptive(const char *path, int64_t fixed_ms);
+int sim_run_calibrate(const char *points, const char *tank);
+int sim_run_codec(const char *path);
+int sim_run_alarms(const char *path, const char *rules);
+int sim_run_rollup(const char *path);
+int sim_run_dataserver(const char *path);
+
+// What the modes share, see common.c.
+
+// Erased sample log and rollup partitions.
+void sim_add_storage();
+// Monotonic, for intervals.
+int64_t sim_clock_us();
+int64_t sim_thread_cpu_ns();
+// Wall clock, for timestamps like a synchronized device's.
+int64_t sim_epoch_ms();
+// A tank that drains over the day and is refilled every morning.
+int32_t sim_tank_level(int64_t timestamp);
+// Provisioned network info with only a target and a device name.
+void sim_remote_netinfo(
+    network_info_t *netinfo, const char *target, const char *devname);
+// A trace of "timestamp value" lines, "-" for stdin, on channel 0. Returns
+// an array of count samples to free, NULL if the trace can't be opened.
+sample_t *sim_read_trace(const char *path, size_t *count);
+
+#endif // SIM_MODES_H
@@ -0,0 +1,39 @@
+#include "modes.h"
+
+#include "mbedtls/sha256.h"
+#include "ota.h"
+#include "sim.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// One firmware update, prints an "ota" line to stdout. The image that went
+// into the boot slot is hashed again, so a pipeline that got the order of
+// its buffers wrong fails even though the streamed hash matched.
+int sim_run_update(const char *url, const uint8_t *sha256) {
+    ota_result_t result;
+    ll_ota_update(url, sha256, &result);
+    const uint8_t *image = NULL;
+    size_t len = 0;
+    sim_ota_boot_image(&image, &len);
+    bool image_ok = false;
+    if (image != NULL) {
+        uint8_t digest[32];
+        mbedtls_sha256_context sha;
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        mbedtls_sha256_update(&sha, image, len);
+        mbedtls_sha256_finish(&sha, digest);
+        image_ok = memcmp(digest, sha256, sizeof(digest)) == 0;
+    }
+    printf(
+        "ota error=\"%s\" bytes=%lu ms=%lu resumes=%lu image_ok=%d\n",
+        ll_ota_error_explain(result.error),
+        (unsigned long)result.bytes,
+        (unsigned long)result.ms,
+        (unsigned long)result.resumes,
+        image_ok);
+    fflush(stdout);
+    return result.error == oe_None && image_ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+#include "modes.h"
+
+#include "adcframe.h"
+#include "calib.h"
+#include "codec.h"
+#include "const.h"
+#include "freertos/queue.h"
+#include "logger.h"
+#include "remote.h"
+#include "rollupstore.h"
+#include "samplelog.h"
+#include "sampler.h"
+#include "sim.h"
+#include "uploader.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// The pipeline mode times one sample in this many, reading the thread's CPU
+// clock costs about as much as a stage.
+#define SIM_PIPELINE_TIMED_EVERY 16
+// Frames and samples of the isolated stage timings of the pipeline mode.
+#define SIM_PIPELINE_BREAKDOWN_RUNS 200000
+
+// What the stages of the sampler cost without the ADC, which is DMA on the
+// device and the shim here. Runs them on their own over conversions laid out
+// like the shim's, and the encoder over a series like the pipeline's, in ns
+// per sample.
+typedef struct pipeline_breakdown_t {
+    double decimate_ns;
+    double filter_ns;
+    double calibrate_ns;
+    double encode_ns;
+} pipeline_breakdown_t;
+
+static void pipeline_breakdown(
+    const calib_t *calib, pipeline_breakdown_t *breakdown) {
+    static uint8_t buf[SENSOR_CONV_FRAME_SIZE];
+    static adc_frame_t frame;
+    static codec_encoder_t enc;
+    uint32_t noise = 1;
+    for (size_t i = 0; i < sizeof(buf); i += SOC_ADC_DIGI_RESULT_BYTES) {
+        noise ^= noise << 13;
+        noise ^= noise >> 17;
+        noise ^= noise << 5;
+        uint32_t word = (2000 + noise % 17) | SENSOR_ADC_CHANNEL << 13;
+        memcpy(buf + i, &word, sizeof(word));
+    }
+    const uint8_t channels[] = {SENSOR_ADC_CHANNEL};
+    ll_adcframe_init(&frame, channels, 1);
+    const adc_calib_t adc_calib = {.gain_num = 1, .gain_den = 1};
+    const int runs = SIM_PIPELINE_BREAKDOWN_RUNS;
+    volatile int32_t sink = 0;
+
+    int64_t started = sim_thread_cpu_ns();
+    for (int i = 0; i < runs; i++) {
+        ll_adcframe_reset(&frame);
+        sink = ll_adcframe_demux(&frame, buf, sizeof(buf));
+    }
+    breakdown->decimate_ns = (double)(sim_thread_cpu_ns() - started) / runs;
+
+    started = sim_thread_cpu_ns();
+    for (int i = 0; i < runs; i++) {
+        frame.raw[0][i % SENSOR_OVERSAMPLE] = (uint16_t)(2000 + i % 7);
+        sink = ll_adcframe_mean(&frame, 0);
+    }
+    breakdown->filter_ns = (double)(sim_thread_cpu_ns() - started) / runs;
+
+    started = sim_thread_cpu_ns();
+    for (int i = 0; i < runs; i++) {
+        int32_t raw = ll_adcframe_calibrate(&adc_calib, 1000 + i % 2048);
+        sink = ll_calib_apply(calib, raw);
+    }
+    breakdown->calibrate_ns = (double)(sim_thread_cpu_ns() - started) / runs;
+
+    // Many readings to the millisecond, like the unpaced pipeline.
+    int64_t timestamp = sim_epoch_ms();
+    ll_codec_encoder_reset(&enc, 0);
+    started = sim_thread_cpu_ns();
+    for (int i = 0; i < runs; i++) {
+        sample_t sample = {
+            .timestamp = timestamp + i / 64,
+            .value = sim_tank_level(timestamp + i * 10),
+            .channel = 0,
+        };
+        if (!ll_codec_encoder_append(&enc, &sample)) {
+            size_t len;
+            ll_codec_encoder_finish(&enc, &len);
+            ll_codec_encoder_reset(&enc, 0);
+            ll_codec_encoder_append(&enc, &sample);
+        }
+    }
+    breakdown->encode_ns = (double)(sim_thread_cpu_ns() - started) / runs;
+    (void)sink;
+}
+
+// The whole data path as fast as it goes, or at rate readings a second: the
+// sampler reads the simulated ADC, decimates, filters and calibrates, the
+// readings go through the sample queue to the logger, which encodes them
+// into the flash log, and the uploader sends the log to the target. Runs for
+// seconds, then waits up to as long again for the uploader to drain, and
+// prints one "pipeline" line to stdout. CPU times are per sample, from the
+// CPU clocks of the sampler's stand-in and the logger task. The uploader's
+// is a total, fresh data sent while catching up isn't in its stats, what a
+// reading costs it takes what the target got.
+int sim_run_pipeline(
+    const char *target, const char *devname, int seconds, int rate) {
+    sim_add_storage();
+    ll_samplelog_init();
+    ll_rollupstore_init();
+    static remote_config_t config;
+    config.version = 0;
+    config.sample_ms = SAMPLE_PERIOD_MS;
+    config.deadband = DEADBAND_DEFAULT;
+    config.heartbeat_ms = DEADBAND_HEARTBEAT_DEFAULT_MS;
+    sim_remote_netinfo(&config.netinfo, target, devname);
+    ll_remote_init(&config);
+
+    // Raw counts to level to volume, both steps of the calibration.
+    static calib_t calib;
+    if (!ll_calib_parse("0:0,4095:3000", "vcyl:1000:3000", &calib)) {
+        abort();
+    }
+    ll_sampler_init(&calib);
+    static StaticQueue_t queue_buf;
+    static uint8_t queue_storage[SAMPLE_QUEUE_LEN * sizeof(sample_t)];
+    QueueHandle_t queue = xQueueCreateStatic(
+        SAMPLE_QUEUE_LEN,
+        sizeof(sample_t),
+        queue_storage,
+        &queue_buf);
+    static alarm_engine_t alarms;
+    const deadband_config_t deadband = {
+        .deadband = (int32_t)config.deadband,
+        .heartbeat_ms = config.heartbeat_ms,
+    };
+    ll_uploader_start(&config.netinfo);
+    ll_logger_start(queue, &alarms, &deadband);
+
+    uint64_t samples = 0;
+    uint64_t timed = 0;
+    uint64_t queue_full = 0;
+    int64_t acquire_ns = 0;
+    int64_t ring_ns = 0;
+    int64_t started = sim_clock_us();
+    while (sim_clock_us() - started < (int64_t)seconds * 1000000) {
+        // The level moves slowly, like a tank.
+        if (samples % 1024 == 0) {
+            sim_adc_set_level(
+                SENSOR_ADC_CHANNEL,
+                2000 + (int)(1500 * sin(samples * 1e-5)));
+        }
+        bool time_it = samples % SIM_PIPELINE_TIMED_EVERY == 0;
+        int64_t before = time_it ? sim_thread_cpu_ns() : 0;
+        sample_t reading[SENSOR_CHANNEL_COUNT];
+        ll_sampler_read(reading);
+        int64_t read = time_it ? sim_thread_cpu_ns() : 0;
+        // The sampler drops readings on a full queue, this waits so every
+        // reading counts.
+        if (xQueueSend(queue, &reading[0], 0) != pdTRUE) {
+            queue_full++;
+            xQueueSend(queue, &reading[0], portMAX_DELAY);
+        }
+        if (time_it) {
+            acquire_ns += read - before;
+            ring_ns += sim_thread_cpu_ns() - read;
+            timed++;
+        }
+        samples++;
+        // Paced, the readings come at a steady rate like the sampler's.
+        if (rate > 0 && samples % 64 == 0) {
+            int64_t due = started + (int64_t)(samples * 1e6 / rate);
+            int64_t ahead = due - sim_clock_us();
+            if (ahead > 0) {
+                usleep(ahead);
+            }
+        }
+    }
+    while (uxQueueMessagesWaiting(queue) > 0) {
+        usleep(1000);
+    }
+    int64_t produced_us = sim_clock_us() - started;
+    bool drained = ll_uploader_drain(seconds * 1000);
+    int64_t total_us = sim_clock_us() - started;
+
+    uploader_stats_t stats;
+    ll_uploader_get_stats(&stats);
+    int64_t logger_us = sim_task_cpu_us("ll_logger");
+    int64_t uploader_us = sim_task_cpu_us("ll_uploader");
+    pipeline_breakdown_t breakdown;
+    pipeline_breakdown(&calib, &breakdown);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    sim_heap_stats_t heap;
+    sim_heap_stats(&heap);
+    double acquire = timed > 0 ? (double)acquire_ns / timed : 0;
+    printf(
+        "pipeline seconds=%.3f total_seconds=%.3f samples=%llu "
+        "samples_per_s=%.0f acked=%llu drained=%d batches=%lu failures=%lu "
+        "bytes=%llu queue_full=%llu acquire_ns=%.1f adc_ns=%.1f "
+        "decimate_ns=%.1f filter_ns=%.1f calibrate_ns=%.1f ring_ns=%.1f "
+        "logger_ns=%.1f encode_ns=%.1f uploader_us=%lld rss_peak_kb=%ld "
+        "allocs=%llu\n",
+        produced_us / 1e6,
+        total_us / 1e6,
+        (unsigned long long)samples,
+        samples * 1e6 / produced_us,
+        (unsigned long long)stats.samples,
+        drained,
+        (unsigned long)stats.batches,
+        (unsigned long)stats.failures,
+        (unsigned long long)stats.bytes,
+        (unsigned long long)queue_full,
+        acquire,
+        acquire - breakdown.decimate_ns - breakdown.filter_ns -
+            breakdown.calibrate_ns,
+        breakdown.decimate_ns,
+        breakdown.filter_ns,
+        breakdown.calibrate_ns,
+        timed > 0 ? (double)ring_ns / timed : 0,
+        samples > 0 ? logger_us * 1000.0 / samples : 0,
+        breakdown.encode_ns,
+        (long long)uploader_us,
+        usage.ru_maxrss,
+        (unsigned long long)heap.allocs);
+    fflush(stdout);
+    return drained ? 0 : 1;
+}
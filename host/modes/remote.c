@@ -0,0 +1,60 @@
+#include "modes.h"
+
+#include "const.h"
+#include "remote.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+// Stands in for the device's subscribers, prints one "applied" line to
+// stdout per applied version.
+static void remote_applied(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    printf(
+        "applied version=%lu changed=0x%lx ms=%lld devname=%s sample_ms=%lu "
+        "alarms=%s\n",
+        (unsigned long)config->version,
+        (unsigned long)changed,
+        (long long)sim_now_ms(),
+        config->netinfo.devname,
+        (unsigned long)config->sample_ms,
+        config->netinfo.alarms);
+    fflush(stdout);
+}
+
+// One device of a fleet, polls the target the way the uploader does after
+// every batch. Prints a "remote" line to stdout when done.
+int sim_run_remote(
+    const char *target, const char *devname, int seconds, int poll_ms) {
+    static remote_config_t config;
+    config.version = 0;
+    config.sample_ms = SAMPLE_PERIOD_MS;
+    config.deadband = DEADBAND_DEFAULT;
+    config.heartbeat_ms = DEADBAND_HEARTBEAT_DEFAULT_MS;
+    sim_remote_netinfo(&config.netinfo, target, devname);
+    ll_remote_init(&config);
+    ll_remote_subscribe(REMOTE_KEYS_ALL, remote_applied, NULL);
+
+    uint32_t counts[rr_Unreachable + 1] = {0};
+    int64_t started = sim_clock_us();
+    while (sim_clock_us() - started < (int64_t)seconds * 1000000) {
+        counts[ll_remote_poll()]++;
+        usleep(poll_ms * 1000);
+    }
+    ll_remote_get(&config);
+    sim_heap_stats_t heap;
+    sim_heap_stats(&heap);
+    printf(
+        "remote version=%lu current=%lu applied=%lu stale=%lu invalid=%lu "
+        "unreachable=%lu allocs=%llu\n",
+        (unsigned long)config.version,
+        (unsigned long)counts[rr_Current],
+        (unsigned long)counts[rr_Applied],
+        (unsigned long)counts[rr_Stale],
+        (unsigned long)counts[rr_Invalid],
+        (unsigned long)counts[rr_Unreachable],
+        (unsigned long long)heap.allocs);
+    fflush(stdout);
+    return 0;
+}
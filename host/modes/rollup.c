@@ -0,0 +1,79 @@
+#include "modes.h"
+
+#include "esp_log.h"
+#include "rollupstore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *TAG = "sim";
+
+static void print_rollup(
+    const char *kind, rollup_tier_t tier, const rollup_t *rollup) {
+    printf(
+        "%s %d %lld %lu %lld %ld %ld\n",
+        kind,
+        (int)tier,
+        (long long)rollup->start,
+        (unsigned long)rollup->count,
+        (long long)rollup->sum,
+        (long)rollup->min_value,
+        (long)rollup->max_value);
+}
+
+// Feeds a trace of "timestamp value" lines into the rollup store on erased
+// partitions, then reads back every stored record of both tiers, oldest
+// first, and the open buckets. Prints a "rollup" line per record, an "open"
+// line per open bucket and a "rollupstore" line with the totals, the time
+// per sample added and whether ll_rollupstore_find lands on every record.
+int sim_run_rollup(const char *path) {
+    size_t count = 0;
+    sample_t *samples = sim_read_trace(path, &count);
+    if (samples == NULL) {
+        return 1;
+    }
+
+    sim_add_storage();
+    ll_rollupstore_init();
+    int64_t started = sim_thread_cpu_ns();
+    for (size_t i = 0; i < count; i++) {
+        ll_rollupstore_add(&samples[i]);
+    }
+    int64_t add_ns = sim_thread_cpu_ns() - started;
+
+    rollup_index_t stored[rt_Count];
+    uint64_t finds = 0;
+    uint64_t finds_ok = 0;
+    for (rollup_tier_t tier = 0; tier < rt_Count; tier++) {
+        rollup_index_t tail = ll_rollupstore_tail(tier);
+        rollup_index_t head = ll_rollupstore_head(tier);
+        stored[tier] = head - tail;
+        rollup_t rollup;
+        for (rollup_index_t i = tail; i < head; i++) {
+            if (!ll_rollupstore_read(tier, i, &rollup)) {
+                ESP_LOGE(TAG, "Record %lu of tier %d unreadable", i, tier);
+                continue;
+            }
+            print_rollup("rollup", tier, &rollup);
+            // Earlier buckets all end by this one's start.
+            finds++;
+            finds_ok += ll_rollupstore_find(tier, rollup.start) == i;
+        }
+        if (ll_rollupstore_current(tier, 0, &rollup)) {
+            print_rollup("open", tier, &rollup);
+        }
+    }
+
+    printf(
+        "rollupstore samples=%zu minutes=%lu hours=%lu finds=%llu "
+        "find_ok=%d add_ns=%.1f\n",
+        count,
+        (unsigned long)stored[rt_Minute],
+        (unsigned long)stored[rt_Hour],
+        (unsigned long long)finds,
+        finds_ok == finds,
+        count > 0 ? (double)add_ns / count : 0.0);
+    fflush(stdout);
+    free(samples);
+    return finds_ok == finds ? 0 : 1;
+}
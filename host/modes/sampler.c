@@ -0,0 +1,79 @@
+#include "modes.h"
+
+#include "adcframe.h"
+#include "const.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Scans the channel scaling mode times for each channel count.
+#define SIM_CHANNELS_SCANS 200000
+
+// What a scan costs the sampler per channel count, without the ADC: the
+// pattern's conversions, SENSOR_OVERSAMPLE per channel interleaved the way
+// the DMA delivers them, demultiplexed in SENSOR_CONV_FRAME_SIZE reads, then
+// averaged and calibrated per channel. Each channel reads its base plus 0 to
+// 3 counts, so its mean has to come out at base + 1. Prints a "channels" line
+// per count, in ns per scan.
+int sim_run_channels(int max_channels) {
+    static uint8_t buf[SENSOR_CHANNELS_MAX * SENSOR_OVERSAMPLE * 4];
+    static adc_frame_t frame;
+    const adc_calib_t calib = {.gain_num = 3, .gain_den = 2, .offset = -7};
+    const int scans = SIM_CHANNELS_SCANS;
+    bool all_ok = true;
+    for (int n = 1; n <= max_channels; n++) {
+        uint8_t adc_channels[SENSOR_CHANNELS_MAX];
+        for (int ch = 0; ch < n; ch++) {
+            adc_channels[ch] = (uint8_t)ch;
+        }
+        size_t len = 0;
+        for (int k = 0; k < n * SENSOR_OVERSAMPLE; k++) {
+            uint32_t word = (uint32_t)(1000 + 100 * (k % n) + k / n % 4) |
+                            (uint32_t)(k % n) << 13;
+            memcpy(buf + len, &word, sizeof(word));
+            len += sizeof(word);
+        }
+        ll_adcframe_init(&frame, adc_channels, n);
+        volatile int32_t sink = 0;
+
+        int64_t started = sim_thread_cpu_ns();
+        for (int i = 0; i < scans; i++) {
+            ll_adcframe_reset(&frame);
+            for (size_t at = 0; at < len; at += SENSOR_CONV_FRAME_SIZE) {
+                size_t chunk = len - at < SENSOR_CONV_FRAME_SIZE
+                                   ? len - at
+                                   : SENSOR_CONV_FRAME_SIZE;
+                sink = ll_adcframe_demux(&frame, buf + at, chunk);
+            }
+        }
+        int64_t demux_ns = sim_thread_cpu_ns() - started;
+
+        started = sim_thread_cpu_ns();
+        for (int i = 0; i < scans; i++) {
+            for (int ch = 0; ch < n; ch++) {
+                sink = ll_adcframe_calibrate(
+                    &calib,
+                    ll_adcframe_mean(&frame, ch));
+            }
+        }
+        int64_t filter_ns = sim_thread_cpu_ns() - started;
+        (void)sink;
+
+        bool ok = frame.full == n;
+        for (int ch = 0; ch < n; ch++) {
+            ok = ok && ll_adcframe_mean(&frame, ch) == 1000 + 100 * ch + 1;
+        }
+        all_ok = all_ok && ok;
+        printf(
+            "channels n=%d scan_ns=%.1f demux_ns=%.1f filter_ns=%.1f "
+            "means_ok=%d\n",
+            n,
+            (double)(demux_ns + filter_ns) / scans,
+            (double)demux_ns / scans,
+            (double)filter_ns / scans,
+            ok);
+    }
+    fflush(stdout);
+    return all_ok ? 0 : 1;
+}
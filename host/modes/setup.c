@@ -0,0 +1,195 @@
+#include "modes.h"
+
+#include "access_point.h"
+#include "boot.h"
+#include "const.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "metrics.h"
+#include "render.h"
+#include "setup.h"
+#include "sim.h"
+#include "station.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "sim";
+
+#define SIM_PAGES_MAX 16
+#define SIM_PAGE_CONTENT_MAX (16 * 1024)
+#define SIM_PAGE_TABLE_MAX 1024
+
+static uint8_t glob_page_table[SIM_PAGE_TABLE_MAX];
+static uint8_t glob_page_content[SIM_PAGE_CONTENT_MAX];
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Drop the line breaks and the indentation after them, which is most of what
+// minify does to these pages.
+static size_t minify(char *html, size_t len) {
+    size_t out = 0;
+    for (size_t in = 0; in < len; in++) {
+        if (html[in] == '\n' || html[in] == '\r') {
+            while (in + 1 < len &&
+                   (html[in + 1] == ' ' || html[in + 1] == '\t')) {
+                in++;
+            }
+            continue;
+        }
+        html[out++] = html[in];
+    }
+    return out;
+}
+
+// Same layout as upload_pages.py writes to the page partitions.
+static void load_pages(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Can't open page directory %s", dir_path);
+        abort();
+    }
+    char *names[SIM_PAGES_MAX];
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > 5 && strcmp(entry->d_name + len - 5, ".html") == 0) {
+            if (count >= SIM_PAGES_MAX) {
+                ESP_LOGE(TAG, "Too many pages in %s", dir_path);
+                abort();
+            }
+            names[count] = strdup(entry->d_name);
+            NPC(names[count]);
+            count++;
+        }
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char *), compare_names);
+
+    // 32 bit table length and entry count, then a newline before the rows.
+    size_t table_len = 9;
+    size_t content_len = 0;
+    for (int i = 0; i < count; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, names[i]);
+        FILE *file = fopen(path, "rb");
+        NPC(file);
+        char *page = (char *)glob_page_content + content_len;
+        size_t len =
+            fread(page, 1, sizeof(glob_page_content) - content_len, file);
+        fclose(file);
+        len = minify(page, len);
+
+        *strrchr(names[i], '.') = '\0';
+        table_len += snprintf(
+            (char *)glob_page_table + table_len,
+            sizeof(glob_page_table) - table_len,
+            "%s %zu %zu\n",
+            names[i],
+            content_len,
+            len);
+        if (table_len >= sizeof(glob_page_table)) {
+            ESP_LOGE(TAG, "Page table doesn't fit in its buffer");
+            abort();
+        }
+        content_len += len;
+        free(names[i]);
+    }
+    uint32_t header[2] = {table_len - 9, count};
+    memcpy(glob_page_table, header, sizeof(header));
+    glob_page_table[8] = '\n';
+
+    sim_partition_add(
+        PAGE_TABLE_PART_NAME,
+        PAGE_PART_TYPE,
+        PAGE_PART_SUBTYPE,
+        glob_page_table,
+        table_len);
+    sim_partition_add(
+        PAGE_CONTENT_PART_NAME,
+        PAGE_PART_TYPE,
+        PAGE_PART_SUBTYPE,
+        glob_page_content,
+        content_len);
+}
+
+// Mirrors start_wifi in level-sensor.c for the setup mode.
+static void start_wifi() {
+    ESP_EC(esp_netif_init());
+    ESP_EC(esp_event_loop_create_default());
+    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_EC(esp_wifi_init(&wifi_config));
+    ESP_EC(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    ll_access_point_init();
+    ll_station_init();
+    ESP_EC(esp_wifi_start());
+    ll_boot_mark(bp_WifiStarted);
+}
+
+// The phases the setup flow got to, in ms since the simulator started.
+static void print_boot() {
+    boot_report_t report;
+    ll_boot_report(&report);
+    printf("boot");
+    for (int i = 0; i < bp_Count; i++) {
+        if (report.at_us[i] != 0) {
+            printf(
+                " %s=%.1f",
+                ll_boot_phase_name(i),
+                (double)report.at_us[i] / 1000);
+        }
+    }
+    printf("\n");
+}
+
+// Every round runs do_setup to completion and prints a "provisioned", a
+// "metrics" and a "heap" line to stdout, the first a "boot" line too.
+int sim_run_setup(const char *scenario, const char *page_dir, int rounds) {
+    sim_wifi_load_scenario(scenario);
+    load_pages(page_dir);
+    // Same as app_main, the pages load while the radio starts and scans
+    preload_page_table();
+    start_wifi();
+
+    for (int round = 1; rounds == 0 || round <= rounds; round++) {
+        int64_t started = sim_now_ms();
+        network_info_t netinfo;
+        do_setup(&netinfo);
+        printf(
+            "provisioned round=%d ms=%lld ssid=%s target=%s devname=%s "
+            "alarms=%s levelcal=%s tank=%s\n",
+            round,
+            (long long)(sim_now_ms() - started),
+            netinfo.ssid,
+            netinfo.target,
+            netinfo.devname,
+            netinfo.alarms,
+            netinfo.levelcal,
+            netinfo.tank);
+        // Handler and page read timings of the setup server so far
+        char metrics[METRICS_SNAPSHOT_SIZE];
+        ll_metrics_snapshot(metrics, sizeof(metrics));
+        printf("metrics round=%d %s\n", round, metrics);
+        if (round == 1) {
+            print_boot();
+        }
+        sim_heap_stats_t heap;
+        sim_heap_stats(&heap);
+        printf(
+            "heap round=%d allocs=%llu frees=%llu live=%lld\n",
+            round,
+            (unsigned long long)heap.allocs,
+            (unsigned long long)heap.frees,
+            (long long)heap.live);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "modes.h"
+
+#include "const.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "logger.h"
+#include "remote.h"
+#include "rollupstore.h"
+#include "samplelog.h"
+#include "sim.h"
+#include "tls.h"
+#include "uploader.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct sim_feed_t {
+    QueueHandle_t queue;
+    int live_ms;
+    atomic_bool stop;
+} sim_feed_t;
+
+// Stands in for the sampler once the backlog is logged.
+static void feed_task(void *arg) {
+    sim_feed_t *feed = (sim_feed_t *)arg;
+    while (!atomic_load(&feed->stop)) {
+        int64_t now = sim_epoch_ms();
+        sample_t sample = {
+            .timestamp = now,
+            .value = sim_tank_level(now),
+            .channel = 0,
+        };
+        xQueueSend(feed->queue, &sample, portMAX_DELAY);
+        usleep(feed->live_ms * 1000);
+    }
+    vTaskDelete(NULL);
+}
+
+// A device coming back after an outage. Logs hours of samples that never
+// went out, up to now, then starts the uploader against the target with
+// live samples every live_ms, and waits for the backlog to drain. Prints a
+// "backlog" line once the samples are logged, and a "catchup" and a "tls"
+// line to stdout when done.
+int sim_run_catchup(
+    const char *target,
+    const char *devname,
+    int hours,
+    int seconds,
+    int live_ms) {
+    sim_add_storage();
+    ll_samplelog_init();
+    ll_rollupstore_init();
+    static remote_config_t config;
+    config.version = 0;
+    config.sample_ms = SAMPLE_PERIOD_MS;
+    config.deadband = DEADBAND_DEFAULT;
+    config.heartbeat_ms = DEADBAND_HEARTBEAT_DEFAULT_MS;
+    sim_remote_netinfo(&config.netinfo, target, devname);
+    ll_remote_init(&config);
+
+    static StaticQueue_t queue_buf;
+    static uint8_t queue_storage[SAMPLE_QUEUE_LEN * sizeof(sample_t)];
+    static alarm_engine_t alarms;
+    static sim_feed_t feed;
+    feed.queue = xQueueCreateStatic(
+        SAMPLE_QUEUE_LEN,
+        sizeof(sample_t),
+        queue_storage,
+        &queue_buf);
+    feed.live_ms = live_ms;
+    const deadband_config_t deadband = {
+        .deadband = (int32_t)config.deadband,
+        .heartbeat_ms = config.heartbeat_ms,
+    };
+    ll_logger_start(feed.queue, &alarms, &deadband);
+
+    int64_t now = sim_epoch_ms();
+    int64_t from = now - (int64_t)hours * 60 * 60 * 1000;
+    uint64_t samples = 0;
+    for (int64_t t = from; t < now; t += SAMPLE_PERIOD_MS) {
+        sample_t sample = {
+            .timestamp = t,
+            .value = sim_tank_level(t),
+            .channel = 0,
+        };
+        xQueueSend(feed.queue, &sample, portMAX_DELAY);
+        samples++;
+    }
+    while (uxQueueMessagesWaiting(feed.queue) > 0) {
+        usleep(1000);
+    }
+    printf(
+        "backlog samples=%llu bytes=%llu from=%lld to=%lld fresh_ms=%d\n",
+        (unsigned long long)samples,
+        (unsigned long long)(ll_samplelog_head() - ll_samplelog_tail()),
+        (long long)from,
+        (long long)now,
+        UPLOAD_CATCHUP_FRESH_MS);
+    fflush(stdout);
+
+    if (xTaskCreate(feed_task, "sim_feed", 2048, &feed, 5, NULL) != pdPASS) {
+        abort();
+    }
+    network_info_t *netinfo = &config.netinfo;
+    int64_t started = sim_clock_us();
+    ll_uploader_start(netinfo);
+    bool drained = ll_uploader_drain(seconds * 1000);
+    int64_t took_ms = (sim_clock_us() - started) / 1000;
+    atomic_store(&feed.stop, true);
+
+    uploader_stats_t stats;
+    ll_uploader_get_stats(&stats);
+    sim_heap_stats_t heap;
+    sim_heap_stats(&heap);
+    printf(
+        "catchup drained=%d ms=%lld batches=%lu failures=%lu bytes=%llu "
+        "samples=%llu allocs=%llu\n",
+        drained,
+        (long long)took_ms,
+        (unsigned long)stats.batches,
+        (unsigned long)stats.failures,
+        (unsigned long long)stats.bytes,
+        (unsigned long long)stats.samples,
+        (unsigned long long)heap.allocs);
+    // Zeros for http:// targets.
+    tls_stats_t tls;
+    ll_tls_get_stats(&tls);
+    printf(
+        "tls full=%lu resumed=%lu reused=%lu handshake_us=%lld "
+        "heap_peak=%lu stack_used=%lu\n",
+        (unsigned long)tls.full,
+        (unsigned long)tls.resumed,
+        (unsigned long)tls.reused,
+        (long long)tls.handshake_us,
+        (unsigned long)tls.heap_peak,
+        (unsigned long)sim_task_stack_used("ll_uploader"));
+    fflush(stdout);
+    return drained ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+"""Firmware update benchmark, run against the host simulator.
+
+Serves a generated image from a local HTTP server at a fixed rate and has the
+simulator update from it (ll_sim -u), which goes through the same download
+and flash write pipeline as the device, see main/ota.c. Flash writes take
+the erase and program time of the real flash, so the figure that matters is
+the end-to-end time per MiB against what the link and the flash take on
+their own.
+
+Cases:
+- clean: one connection for the whole image.
+- drops: the server cuts the connection --drops times, the download has to
+  resume with Range requests.
+- no-range: like drops, but the server ignores Range and resends the image.
+- bad-hash: the expected SHA-256 is wrong, the update has to be refused.
+
+Exits with 1 if a case ends otherwise.
+
+Usage: python otabench.py --sim build-host/ll_sim [--size-kib 512]
+                          [--rate-kib 300] [--drops 3] [--port 8090]
+"""
+
+import hashlib
+import os
+import random
+import re
+import socket
+import subprocess
+import time
+
+import simbench
+
+CHUNK = 1024
+SEND_BUFFER = 2048
+RESULT = re.compile(
+    r'ota error="([^"]*)" bytes=(\d+) ms=(\d+) resumes=(\d+) image_ok=(\d)')
+
+parser = simbench.arguments(port=8090, seed=True)
+parser.add_argument("--size-kib", type=int, default=512)
+parser.add_argument("--rate-kib", type=float, default=300.0,
+                    help="link throughput, KiB/s")
+parser.add_argument("--drops", type=int, default=3)
+args = parser.parse_args()
+
+random.seed(args.seed)
+# Application images start with the 0xE9 magic, the rest doesn't matter here.
+IMAGE = b"\xe9" + os.urandom(args.size_kib * 1024 - 1)
+SHA256 = hashlib.sha256(IMAGE).hexdigest()
+
+
+class Server(simbench.Target):
+    # Per case: byte offsets at which to cut the next connections, and
+    # whether Range is honoured.
+    cuts = []
+    ranges = True
+    requests = 0
+
+
+class Handler(simbench.Handler):
+    def setup(self):
+        super().setup()
+        # A small send buffer, so the rate holds when the reader stalls
+        # instead of the kernel soaking up the image.
+        self.connection.setsockopt(
+            socket.SOL_SOCKET, socket.SO_SNDBUF, SEND_BUFFER)
+
+    def do_GET(self):
+        self.server.requests += 1
+        first = 0
+        header = self.headers.get("Range")
+        if header and self.server.ranges and header.startswith("bytes="):
+            first = int(header[6:].split("-")[0])
+        body = IMAGE[first:]
+        self.send_response(206 if first else 200)
+        if first:
+            self.send_header("Content-Range", "bytes {}-{}/{}".format(
+                first, len(IMAGE) - 1, len(IMAGE)))
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Connection", "close")
+        self.end_headers()
+        cut = self.server.cuts.pop(0) if self.server.cuts else None
+        # Each piece takes its time on the link. Time the reader spent not
+        # reading is lost, a link doesn't make up for it later.
+        free_at = time.monotonic()
+        sent = 0
+        while sent < len(body):
+            if cut is not None and first + sent >= cut:
+                # Drop the connection mid-body, like a lost link.
+                self.connection.shutdown(2)
+                return
+            piece = body[sent:sent + CHUNK]
+            self.wfile.write(piece)
+            sent += len(piece)
+            free_at = max(free_at, time.monotonic()) + \
+                len(piece) / (args.rate_kib * 1024)
+            time.sleep(max(0.0, free_at - time.monotonic()))
+
+
+def run_case(server, name, cuts, ranges=True, sha256=SHA256):
+    """Returns whether the image was taken."""
+    server.cuts = list(cuts)
+    server.ranges = ranges
+    server.requests = 0
+    started = time.monotonic()
+    out = subprocess.run(
+        [args.sim, "-q", "-u", server.url("/firmware.bin"), "-x", sha256],
+        stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    wall = time.monotonic() - started
+    match = RESULT.search(out.stdout)
+    if match is None:
+        print("  {:<9} no result, exit code {}".format(name, out.returncode))
+        return None
+    error, _, ms, resumes, image_ok = match.groups()
+    ms = int(ms)
+    print("  {:<9} {:<32} requests={} resumes={} image_ok={} {:>6} ms "
+          "{:>6.0f} ms/MiB (wall {:.1f} s)".format(
+              name, error, server.requests, resumes, image_ok, ms,
+              ms / (len(IMAGE) / (1024 * 1024)), wall))
+    return image_ok == "1"
+
+
+def main():
+    server = Server(args.port, Handler).start()
+
+    size = len(IMAGE)
+    link_ms = size / (args.rate_kib * 1024) * 1000
+    # The erase and program time of the simulated flash, see shim/ota.c.
+    flash_ms = size / 4096 * 45 + size / 256 * 0.7
+    print("Image {} KiB, link {:.0f} KiB/s".format(
+        size // 1024, args.rate_kib))
+    print("  link alone {:.0f} ms, flash alone {:.0f} ms, one after the "
+          "other {:.0f} ms".format(link_ms, flash_ms, link_ms + flash_ms))
+    cuts = sorted(random.randrange(size // 8, size * 7 // 8)
+                  for _ in range(args.drops))
+    taken = {
+        "clean": run_case(server, "clean", []),
+        "drops": run_case(server, "drops", cuts),
+        "no-range": run_case(server, "no-range", cuts[:1], ranges=False),
+        "bad-hash": run_case(server, "bad-hash", [], sha256="0" * 64),
+    }
+    server.stop()
+    simbench.finish([
+        "{} {}".format(name, "didn't finish" if ok is None else
+                       "took the image" if ok else "refused the image")
+        for name, ok in taken.items() if ok != (name != "bad-hash")])
+
+
+main()
@@ -0,0 +1,198 @@
+"""Data path throughput benchmark, run against the host simulator.
+
+Runs the whole data path of the firmware (ll_sim -m, see modes/pipeline.c):
+simulated ADC frames through the sampler's decimation, filter and calibration,
+the sample queue, the logger's encoder and flash log on an emulated partition,
+and the uploader, into a loopback collector here that decodes the block
+headers like collector.py.
+
+Run as fast as it goes, the sampler outruns the uploader: the log wraps over
+what wasn't sent yet and the uploader catches up, fresh data ahead of the
+backlog, which the collector sees twice. That run only bounds the search,
+the headline is the highest paced rate (ll_sim -P) that the uploader keeps
+up with: drained within a tenth of the run after the last reading, every
+reading collected once but the ones the logger still holds in its open
+block. The search halves that run's rate until the uploader keeps up, then
+halves the range up to the rate above it --steps times, --rate skips it.
+Prints one JSON object:
+
+- rate: readings per second into the data path, the sustained rate.
+- delivered_per_s: distinct readings the collector got per second, from
+  the start until the uploader drained.
+- cpu_ns_per_sample: CPU time per reading by stage. adc is the simulated
+  ADC, DMA on the device; decimate, filter, calibrate and encode are timed
+  on their own, ring is the sample queue, logger and uploader are the CPU
+  clocks of their tasks, the logger's including the encoder and the flash
+  log, the uploader's over the readings the collector got.
+- rss_peak_kb: peak resident memory of the simulator, the emulated flash
+  included. The firmware itself allocates nothing after startup, allocs
+  counts what it did allocate.
+- wire_bytes_per_sample: what the collector received per reading, request
+  heads included, next to the block bytes alone.
+- unsent_samples: readings the collector didn't get, the logger's open
+  blocks at the end, less than a block a run.
+- unpaced: the run as fast as it goes, what was lost and sent twice.
+
+Exits with 1 if a run at the sustained rate didn't drain in time, lost more
+than the open block or sent blocks twice. Compare runs on the same machine,
+--repeat takes the median of several at the sustained rate.
+
+Usage: python pipelinebench.py --sim build-host/ll_sim [--seconds 5]
+                               [--repeat 3] [--rate 50000] [--port 8100]
+"""
+
+import json
+import re
+import statistics
+import struct
+
+import simbench
+
+BLOCK_HEADER = struct.Struct("<HHHBBqqii")
+FRAME_POS = struct.Struct("<Q")
+PIPELINE = re.compile(r"pipeline (.*)")
+STAGES = ["adc", "decimate", "filter", "calibrate", "ring", "logger",
+          "encode"]
+
+parser = simbench.arguments(port=8100)
+parser.add_argument("--seconds", type=int, default=5)
+parser.add_argument("--repeat", type=int, default=1)
+parser.add_argument("--rate", type=int, default=0,
+                    help="readings per second, searched for by default")
+parser.add_argument("--steps", type=int, default=6)
+args = parser.parse_args()
+
+
+class Server(simbench.Target):
+    def __init__(self, port):
+        super().__init__(port, Handler)
+        self.positions = set()
+        self.samples = 0
+        self.wire_bytes = 0
+        self.block_bytes = 0
+        self.duplicates = 0
+        # Readings in the fullest block, what the logger may still hold.
+        self.block_max = 0
+
+
+class Handler(simbench.Handler):
+    def head_bytes(self):
+        return len(self.requestline) + 2 + len(bytes(self.headers)) + 2
+
+    def do_GET(self):
+        # Remote config polls, the device is always current.
+        with self.server.lock:
+            self.server.wire_bytes += self.head_bytes()
+        self.reply(304)
+
+    def do_POST(self):
+        body = self.body()
+        srv = self.server
+        samples = 0
+        fresh = []
+        if self.headers.get("Content-Type") != "application/json":
+            offset = 0
+            while offset < len(body):
+                (pos,) = FRAME_POS.unpack_from(body, offset)
+                header = BLOCK_HEADER.unpack_from(body, offset + 8)
+                end = offset + 8 + BLOCK_HEADER.size + header[1]
+                fresh.append((pos, header[2], end - offset))
+                offset = end
+        with srv.lock:
+            srv.wire_bytes += self.head_bytes() + len(body)
+            for pos, count, size in fresh:
+                if pos in srv.positions:
+                    srv.duplicates += 1
+                    continue
+                srv.positions.add(pos)
+                srv.samples += count
+                srv.block_max = max(srv.block_max, count)
+                srv.block_bytes += size
+                samples += count
+        self.reply(200)
+
+
+def run(rate):
+    server = Server(args.port).start()
+    sim = simbench.run(args.sim, ["-q", "-m", server.url(),
+                                  "-w", args.seconds, "-P", rate])
+    server.stop()
+    fields = simbench.fields(simbench.result(sim, PIPELINE)[0])
+    samples = max(server.samples, 1)
+    fields["delivered_per_s"] = server.samples / fields["total_seconds"]
+    fields["uploader_ns"] = fields["uploader_us"] * 1000 / samples
+    fields["lost"] = fields["samples"] - server.samples
+    return fields, server
+
+
+def kept_up(fields, server):
+    return fields["drained"] == 1 and server.duplicates == 0 and \
+        fields["total_seconds"] <= fields["seconds"] * 1.1 and \
+        0 <= fields["lost"] < max(server.block_max, 1)
+
+
+def search(unpaced):
+    """Highest rate the uploader keeps up with, 0 if none."""
+    high = int(unpaced)
+    low = high // 2
+    while low > 0 and not kept_up(*run(low)):
+        low, high = low // 2, low
+    for _ in range(args.steps):
+        rate = (low + high) // 2
+        if rate == low:
+            break
+        if kept_up(*run(rate)):
+            low = rate
+        else:
+            high = rate
+    return low
+
+
+def main():
+    fields, server = run(0)
+    unpaced = {
+        "samples_per_s": round(fields["samples_per_s"]),
+        "delivered_per_s": round(fields["delivered_per_s"]),
+        "drained": fields["drained"] == 1,
+        "lost_samples": round(fields["lost"]),
+        "duplicate_blocks": server.duplicates,
+    }
+    rate = args.rate or search(fields["samples_per_s"])
+    if rate == 0:
+        print(json.dumps({"unpaced": unpaced}, indent=2))
+        raise SystemExit("no rate the uploader keeps up with")
+    runs = [run(rate) for _ in range(args.repeat)]
+
+    def median(key):
+        return statistics.median(r[0][key] for r in runs)
+
+    collected = [r[1] for r in runs]
+    samples = sum(c.samples for c in collected)
+    result = {
+        "seconds": args.seconds,
+        "repeat": args.repeat,
+        "rate": rate,
+        "delivered_per_s": round(median("delivered_per_s")),
+        "drained": all(r[0]["drained"] == 1 for r in runs),
+        "queue_full_waits": round(median("queue_full")),
+        "cpu_ns_per_sample": {
+            stage: round(median(stage + "_ns"), 1)
+            for stage in STAGES + ["uploader"]},
+        "rss_peak_kb": round(median("rss_peak_kb")),
+        "allocs": round(median("allocs")),
+        "collected_samples": samples,
+        "unsent_samples": round(sum(r[0]["lost"] for r in runs)),
+        "duplicate_blocks": sum(c.duplicates for c in collected),
+        "wire_bytes_per_sample": round(
+            sum(c.wire_bytes for c in collected) / max(samples, 1), 3),
+        "block_bytes_per_sample": round(
+            sum(c.block_bytes for c in collected) / max(samples, 1), 3),
+        "unpaced": unpaced,
+    }
+    print(json.dumps(result, indent=2))
+    if not all(kept_up(*r) for r in runs):
+        raise SystemExit("the uploader didn't keep up at {} readings per "
+                         "second".format(rate))
+
+
+main()
@@ -0,0 +1,186 @@
+"""Target verification benchmark, run against the host simulator.
+
+Provisions the simulator with targets that fail in each way the setup probe
+tells apart (see main/include/probe.h), then with one that answers, and
+reports the time to the probe's verdict from the device log next to what the
+user sees: the time from POSTing the form to the outcome page, and for the
+target that answers, how long the success page stays up before setup ends.
+The probe runs while the success countdown does, so setup ends as soon as it
+did before the probe.
+
+Targets, all local stand-ins:
+- reachable: a listener the kernel accepts connections for.
+- unresolved: a host name under .invalid, which never resolves.
+- unreachable: a port nothing listens on.
+- timeout: a listener with a full accept queue, connection attempts get no
+  answer and the probe's deadline decides.
+
+Runs at time scale 1, the verdict times are real time. Exits with 1 if a
+target ends in the wrong page or the probe logs the wrong verdict for it.
+
+Usage: python probebench.py --sim build-host/ll_sim [--rounds 3]
+                            [--port 8099] [--scenario file]
+"""
+
+import http.client
+import re
+import socket
+import subprocess
+import threading
+import time
+import urllib.parse
+
+import simbench
+
+VERDICT = re.compile(r"Target probe: (\w+) after (\d+) us")
+POLL_INTERVAL_S = 0.005
+STARTUP_TIMEOUT_S = 30
+
+parser = simbench.arguments(port=8099)
+parser.add_argument("--scenario", help="scenario file for the simulator")
+parser.add_argument("--rounds", type=int, default=3)
+parser.add_argument("--ssid", default="HomeNetwork")
+parser.add_argument("--psk", default="correct-horse")
+args = parser.parse_args()
+
+
+def request(method, path, body=None):
+    conn = http.client.HTTPConnection(simbench.HOST, args.port, timeout=10)
+    try:
+        headers = {}
+        if body is not None:
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        return response.status, response.read().decode("utf-8", "replace")
+    except (ConnectionError, OSError):
+        return None
+    finally:
+        conn.close()
+
+
+def wait_for_form():
+    deadline = time.monotonic() + STARTUP_TIMEOUT_S
+    while time.monotonic() < deadline:
+        result = request("GET", "/")
+        if result is not None and "<form" in result[1]:
+            return
+        time.sleep(POLL_INTERVAL_S)
+    raise SystemExit("no setup server on port {}".format(args.port))
+
+
+def provision(target):
+    """Returns (outcome, seconds to the outcome page, seconds to the end of
+    setup or None)."""
+    body = urllib.parse.urlencode({
+        "ssid": args.ssid, "psk": args.psk, "target": target,
+        "devname": "probebench", "alarms": ""})
+    started = time.monotonic()
+    result = request("POST", "/", body)
+    if result is None or result[0] != 302:
+        raise SystemExit("form POST failed: {}".format(result))
+    outcome = None
+    while True:
+        result = request("GET", "/")
+        if result is None:
+            # The server stopped, setup is over.
+            return outcome, shown, time.monotonic() - started
+        if outcome is None and "Success!" in result[1]:
+            outcome, shown = "success", time.monotonic() - started
+        if "Error!" in result[1]:
+            return "error", time.monotonic() - started, None
+        time.sleep(POLL_INTERVAL_S)
+
+
+def listener(backlog):
+    sock = socket.socket()
+    sock.bind((simbench.HOST, 0))
+    sock.listen(backlog)
+    return sock, sock.getsockname()[1]
+
+
+def url(host, port):
+    return "http://{}:{}/ingest".format(host, port)
+
+
+def summary(values):
+    values = sorted(values)
+    return "p50 {:7.1f} max {:7.1f} ms".format(
+        values[len(values) // 2] * 1000, values[-1] * 1000)
+
+
+def main():
+    live, live_port = listener(64)
+    full, full_port = listener(0)
+    # Fill the accept queue, the kernel drops later connection attempts.
+    fillers = []
+    for _ in range(3):
+        sock = socket.socket()
+        sock.setblocking(False)
+        sock.connect_ex((simbench.HOST, full_port))
+        fillers.append(sock)
+    with socket.socket() as sock:
+        sock.bind((simbench.HOST, 0))
+        dead_port = sock.getsockname()[1]
+    targets = [
+        ("unresolved", url("ll-probebench.invalid", 80), "error"),
+        ("unreachable", url(simbench.HOST, dead_port), "error"),
+        ("timeout", url(simbench.HOST, full_port), "error"),
+        ("reachable", url(simbench.HOST, live_port), "success"),
+    ]
+
+    command = [args.sim, "-p", str(args.port), "-n", "0", "-t", "1"]
+    if args.scenario:
+        command += ["-s", args.scenario]
+    sim = subprocess.Popen(command, stdout=subprocess.DEVNULL,
+                           stderr=subprocess.PIPE, text=True)
+    verdicts = []
+
+    def read_log():
+        for line in sim.stderr:
+            m = VERDICT.search(line)
+            if m:
+                verdicts.append((m.group(1), int(m.group(2))))
+
+    threading.Thread(target=read_log, daemon=True).start()
+    results = {name: [] for name, _, _ in targets}
+    try:
+        for _ in range(args.rounds):
+            wait_for_form()
+            for name, target, expected in targets:
+                seen = len(verdicts)
+                outcome, shown, ended = provision(target)
+                if outcome != expected:
+                    raise SystemExit("{} target ended in {}".format(
+                        name, outcome))
+                # The verdict is logged before the page changes.
+                deadline = time.monotonic() + 1
+                while len(verdicts) == seen and time.monotonic() < deadline:
+                    time.sleep(POLL_INTERVAL_S)
+                verdict = verdicts[seen] if len(verdicts) > seen else None
+                results[name].append((verdict, shown, ended))
+    finally:
+        sim.terminate()
+        sim.wait()
+        for sock in fillers + [live, full]:
+            sock.close()
+
+    print("{} rounds, time scale 1".format(args.rounds))
+    problems = []
+    for name, rounds in results.items():
+        kinds = sorted(set(r[0][0] for r in rounds if r[0]))
+        line = "  {:11s} verdict {} {}, outcome page {}".format(
+            name, ",".join(kinds) or "missing",
+            summary([r[0][1] / 1e6 for r in rounds if r[0]] or [0]),
+            summary([r[1] for r in rounds]))
+        ended = [r[2] for r in rounds if r[2] is not None]
+        if ended:
+            line += ", setup ended {}".format(summary(ended))
+        print(line)
+        if kinds != [name] or not all(r[0] for r in rounds):
+            problems.append("{} target: verdicts {}".format(
+                name, ",".join(kinds) or "missing"))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,149 @@
+"""Symbolizes a CPU profile of a device.
+
+The device counts the interrupted PC and task of every sample, see
+main/include/profiler.h. This maps the PCs to functions of the ELF of the same
+build and prints a flat profile per function, and optionally folded stacks for
+flamegraph.pl. The samples hold no call stacks, so the flame graph is one
+level of functions under each task.
+
+Usage: python profile_decode.py <firmware.elf> <dump | http://device/profile |
+                                console log> [folded output]
+
+A console log is whatever the device printed after POST /profile "print",
+the "PROFILE" lines are picked out of it.
+"""
+
+import bisect
+import collections
+import re
+import struct
+import sys
+import urllib.request
+
+from dlog_decode import Elf
+
+HEADER = struct.Struct("<4s9I")
+ENTRY = struct.Struct("<III")
+NAME_SIZE = 16
+TASK_OTHER = 0xFF
+LOG_LINE = re.compile(r"PROFILE ([0-9a-f]+)\s*$")
+STT_FUNC = 2
+
+
+class Symbols:
+    def __init__(self, elf):
+        functions = {}
+        for kind, _, offset, size, link, entsize in elf.sections:
+            if kind != 2:  # SHT_SYMTAB
+                continue
+            strtab = elf.sections[link][2]
+            for at in range(offset, offset + size, entsize):
+                if elf.wide:
+                    name_at, info, _, _, value, length = elf.unpack(
+                        "IBBHQQ", at)
+                else:
+                    name_at, value, length, info, _, _ = elf.unpack(
+                        "IIIBBH", at)
+                if info & 0xF != STT_FUNC or value == 0:
+                    continue
+                start = strtab + name_at
+                name = elf.data[start:elf.data.index(b"\0", start)].decode(
+                    "UTF-8", "replace")
+                # Prefer the sized symbol of aliases at the same address.
+                if value not in functions or functions[value][1] == 0:
+                    functions[value] = (name, length)
+        self.starts = sorted(functions)
+        self.functions = [functions[start] for start in self.starts]
+
+    def lookup(self, pc):
+        i = bisect.bisect_right(self.starts, pc) - 1
+        if i < 0:
+            return "0x{:x}".format(pc)
+        name, length = self.functions[i]
+        if length and pc >= self.starts[i] + length:
+            # Past the end of the nearest function, e.g. in ROM or a stub.
+            return "{}+0x{:x}?".format(name, pc - self.starts[i])
+        return name
+
+
+def read_dump(source):
+    if source.startswith("http://"):
+        with urllib.request.urlopen(source) as response:
+            return response.read()
+    with open(source, "rb") as f:
+        data = f.read()
+    if data[:4] == b"PROF":
+        return data
+    dump = b""
+    for line in data.decode("UTF-8", "replace").splitlines():
+        match = LOG_LINE.search(line)
+        if match:
+            chunk = bytes.fromhex(match.group(1))
+            # A dump starts on a line of its own, keep the last one.
+            dump = chunk if chunk[:4] == b"PROF" else dump + chunk
+    if not dump:
+        raise ValueError("no profile in {}".format(source))
+    return dump
+
+
+def decode(elf, dump, folded_path):
+    if len(dump) < HEADER.size or dump[:4] != b"PROF":
+        raise ValueError("not a profile dump")
+    (_, hz, elapsed_ms, samples, dropped, in_isr, cycles, cpu_mhz,
+     task_count, entry_count) = HEADER.unpack_from(dump)
+    at = HEADER.size
+    tasks = []
+    for _ in range(task_count):
+        name = dump[at:at + NAME_SIZE].split(b"\0")[0]
+        tasks.append(name.decode("UTF-8", "replace"))
+        at += NAME_SIZE
+    if len(dump) < at + entry_count * ENTRY.size:
+        raise ValueError("truncated profile dump")
+
+    symbols = Symbols(elf)
+    by_function = collections.Counter()
+    by_task = collections.Counter()
+    folded = collections.Counter()
+    for _ in range(entry_count):
+        pc, task, count = ENTRY.unpack_from(dump, at)
+        at += ENTRY.size
+        function = symbols.lookup(pc)
+        task = "(other)" if task == TASK_OTHER else tasks[task]
+        by_function[function] += count
+        by_task[task] += count
+        folded["{};{}".format(task, function)] += count
+    if in_isr:
+        folded["(isr)"] += in_isr
+
+    seconds = elapsed_ms / 1000
+    print("{} samples in {:.1f} s, {:.0f} Hz effective of {} Hz".format(
+        samples, seconds, samples / seconds if seconds else 0, hz))
+    if elapsed_ms and cpu_mhz:
+        print("sampling overhead {:.3f}% of the CPU, {:.0f} cycles a sample"
+              .format(100 * cycles / (elapsed_ms * 1000 * cpu_mhz),
+                      cycles / samples if samples else 0))
+    print("{} samples in other ISRs, {} dropped (table full)".format(
+        in_isr, dropped))
+    counted = sum(by_function.values()) or 1
+    print()
+    print("{:>8} {:>7}  task".format("samples", "%"))
+    for task, count in by_task.most_common():
+        print("{:>8} {:>6.2f}%  {}".format(count, 100 * count / counted, task))
+    print()
+    print("{:>8} {:>7}  function".format("samples", "%"))
+    for function, count in by_function.most_common():
+        print("{:>8} {:>6.2f}%  {}".format(
+            count, 100 * count / counted, function))
+
+    if folded_path:
+        with open(folded_path, "w") as f:
+            for stack, count in sorted(folded.items()):
+                f.write("{} {}\n".format(stack, count))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) not in (3, 4):
+        print(__doc__.strip())
+        sys.exit(2)
+    decode(Elf(sys.argv[1]), read_dump(sys.argv[2]),
+           sys.argv[3] if len(sys.argv) == 4 else None)
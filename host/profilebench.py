@@ -0,0 +1,170 @@
+"""Profile decoder check, run against the host simulator binary.
+
+Builds a profile dump the way main/profiler.c lays it out, with PCs picked
+from the simulator's own functions as nm lists them, and decodes it with
+profile_decode.py against the simulator's ELF. Compares the flat profile and
+the folded stacks with the counts that went into the dump:
+
+- the first, a middle and the last byte of a function map to its name.
+- the byte after a function with a gap behind it maps to name+offset?.
+- a PC below every function maps to the bare address.
+- samples of untracked tasks count as (other), in_isr as (isr).
+
+Then prints the same dump to a console log the way POST /profile "print"
+does, after a stale dump and between other log lines, and checks that the
+decoder picks out the same dump.
+
+Exits with 1 if anything differs.
+
+Usage: python profilebench.py --sim build-host/ll_sim [--functions 200]
+"""
+
+import collections
+import contextlib
+import io
+import os
+import random
+import re
+import subprocess
+import tempfile
+
+from dlog_decode import Elf
+import profile_decode
+import simbench
+
+HEADER = profile_decode.HEADER
+ENTRY = profile_decode.ENTRY
+NAME_SIZE = profile_decode.NAME_SIZE
+TASK_OTHER = profile_decode.TASK_OTHER
+TASKS = ["IDLE", "ll_sampler", "ll_logger", "ll_uploader", "httpd"]
+LINE_BYTES = 32
+FLAT = re.compile(r"\s*(\d+)\s+[\d.]+%\s+(.+)$")
+NM = re.compile(r"([0-9a-f]+) ([0-9a-f]+) ([tTwW]) (\S+)$")
+
+parser = simbench.arguments(seed=True)
+parser.add_argument("--functions", type=int, default=200)
+args = parser.parse_args()
+
+
+def functions():
+    """Returns (start, size, name, next start) of the sized functions."""
+    nm = subprocess.run(["nm", "-S", "--defined-only", args.sim],
+                        capture_output=True, text=True, check=True)
+    symbols = collections.defaultdict(list)
+    for line in nm.stdout.splitlines():
+        m = NM.match(line)
+        if m and int(m.group(1), 16):
+            symbols[int(m.group(1), 16)].append(
+                (int(m.group(2), 16), m.group(4)))
+    starts = sorted(symbols)
+    found = []
+    for i, start in enumerate(starts[:-1]):
+        # Aliases leave it to the decoder which name it shows.
+        if len(symbols[start]) == 1 and symbols[start][0][0] > 0:
+            size, name = symbols[start][0]
+            found.append((start, size, name, starts[i + 1]))
+    return found
+
+
+def samples(rng):
+    """Returns [(pc, task, count)] and the function they should map to."""
+    picked = rng.sample(functions(), args.functions)
+    entries = []
+    for start, size, name, next_start in picked:
+        for pc in {start, start + size // 2, start + size - 1}:
+            entries.append((pc, rng.randrange(len(TASKS)), name))
+        if next_start > start + size:
+            entries.append((start + size, TASK_OTHER,
+                            "{}+0x{:x}?".format(name, size)))
+    entries.append((1, TASK_OTHER, "0x1"))
+    return [(pc, task, rng.randint(1, 1000), name)
+            for pc, task, name in entries]
+
+
+def dump(entries, in_isr):
+    total = sum(count for _, _, count, _ in entries) + in_isr
+    data = HEADER.pack(b"PROF", 1000, total, total, 0, in_isr, total * 900,
+                       160, len(TASKS), len(entries))
+    for task in TASKS:
+        data += task.encode().ljust(NAME_SIZE, b"\0")
+    for pc, task, count, _ in entries:
+        data += ENTRY.pack(pc, task, count)
+    return data
+
+
+def console(stale, data):
+    """The dumps as the device prints them, the last one counts."""
+    lines = ["I (1200) ll_main: started", "PROFILE " + stale.hex()]
+    for at in range(0, len(data), LINE_BYTES):
+        lines.append("PROFILE " + data[at:at + LINE_BYTES].hex())
+        if at % (4 * LINE_BYTES) == 0:
+            lines.append("W (5310) ll_uploader: upload failed")
+    return "\n".join(lines) + "\n"
+
+
+def decoded(elf, data):
+    """Returns the flat profile per function and the folded stacks."""
+    with tempfile.TemporaryDirectory() as tmp:
+        folded_path = os.path.join(tmp, "folded")
+        out = io.StringIO()
+        with contextlib.redirect_stdout(out):
+            profile_decode.decode(elf, data, folded_path)
+        with open(folded_path) as f:
+            folded = {}
+            for line in f:
+                stack, count = line.rsplit(" ", 1)
+                folded[stack] = int(count)
+    flat = {}
+    table = out.getvalue().split("function\n", 1)[1]
+    for line in table.splitlines():
+        m = FLAT.match(line)
+        if m:
+            flat[m.group(2)] = int(m.group(1))
+    return flat, folded
+
+
+def main():
+    rng = random.Random(args.seed)
+    entries = samples(rng)
+    in_isr = rng.randint(1, 1000)
+    data = dump(entries, in_isr)
+    flat = collections.Counter()
+    folded = collections.Counter({"(isr)": in_isr})
+    for _, task, count, name in entries:
+        flat[name] += count
+        folded["{};{}".format(
+            "(other)" if task == TASK_OTHER else TASKS[task], name)] += count
+
+    elf = Elf(args.sim)
+    problems = []
+    got_flat, got_folded = decoded(elf, data)
+    for what, got, expected in (("flat", got_flat, flat),
+                                ("folded", got_folded, folded)):
+        wrong = sorted(set(got) ^ set(expected) |
+                       {k for k in got if got[k] != expected.get(k)})
+        problems += ["{} {}: {} samples, expected {}".format(
+            what, k, got.get(k), expected.get(k)) for k in wrong]
+
+    stale = dump(entries[:3], 0)
+    with tempfile.NamedTemporaryFile("w", suffix=".log", delete=False) as f:
+        f.write(console(stale, data))
+        path = f.name
+    try:
+        if profile_decode.read_dump(path) != data:
+            problems.append("console log doesn't give the last dump")
+    finally:
+        os.unlink(path)
+
+    print("{} PCs in {} functions, {} samples: flat {}, folded {}, console "
+          "log {}".format(
+              len(entries), args.functions, sum(flat.values()),
+              "differs" if any(p.startswith("flat") for p in problems)
+              else "matches",
+              "differs" if any(p.startswith("folded") for p in problems)
+              else "matches",
+              "differs" if any(p.startswith("console") for p in problems)
+              else "matches"))
+    simbench.finish(problems)
+
+
+main()
@@ -0,0 +1,155 @@
+"""Rollup benchmark, run against the host simulator.
+
+Feeds sample series into the rollup store on erased partitions (ll_sim -R,
+see main/include/rollupstore.h), reads every stored minute and hour record
+back and compares them with buckets computed here by brute force: every
+sample grouped by its timestamp rounded down to the period, count, sum, min
+and max summed up again per group. Checks that the tiers keep the newest
+buckets once they wrap, that the open buckets hold the rest and that
+ll_rollupstore_find lands on every record. Reports the time per sample
+added.
+
+Series are generated with a fixed seed, values -5000 to 5000:
+- steady: a reading every 10 s for two weeks, wraps the minute tier.
+- gaps: readings 1 to 60 s apart with gaps of up to a day.
+- negative: gaps, starting three days before the epoch, as a clock that
+  was never set.
+- stepped: steady with the clock stepped back by up to two minutes now and
+  then. Samples from before the open bucket count towards it.
+--trace adds recorded traces, "timestamp value" lines. Exits with 1 if a
+record differs or a find misses.
+
+Usage: python rollupbench.py --sim build-host/ll_sim [--days 14]
+                             [--trace recorded.txt]
+"""
+
+import random
+import re
+
+import simbench
+
+RECORD = re.compile(
+    r"(rollup|open) (\d) (-?\d+) (\d+) (-?\d+) (-?\d+) (-?\d+)")
+ROLLUPSTORE = re.compile(
+    r"rollupstore samples=(\d+) minutes=(\d+) hours=(\d+) finds=(\d+) "
+    r"find_ok=(\d) add_ns=([\d.]+)")
+PERIODS_MS = [60 * 1000, 3600 * 1000]
+TIERS = ["minute", "hour"]
+DAY_MS = 24 * 3600 * 1000
+START_MS = 1_700_000_000_000
+
+parser = simbench.arguments(seed=True, traces=True)
+parser.add_argument("--days", type=int, default=14)
+args = parser.parse_args()
+
+
+def value(rng):
+    return rng.randint(-5000, 5000)
+
+
+def steady(rng, start=START_MS):
+    return [(start + i * 10000, value(rng))
+            for i in range(args.days * DAY_MS // 10000)]
+
+
+def gaps(rng, start=START_MS):
+    readings = []
+    t = start
+    while t < start + args.days * DAY_MS:
+        readings.append((t, value(rng)))
+        t += rng.randint(1000, 60000)
+        if rng.random() < 0.001:
+            t += rng.randint(0, DAY_MS)
+    return readings
+
+
+def negative(rng):
+    return gaps(rng, -3 * DAY_MS)
+
+
+def stepped(rng):
+    readings = steady(rng)
+    offset = 0
+    for i in range(len(readings)):
+        if rng.random() < 0.0005:
+            offset -= rng.randint(1000, 120000)
+        readings[i] = (readings[i][0] + offset, readings[i][1])
+    return readings
+
+
+def generated():
+    return [(make.__name__, make(random.Random(args.seed)))
+            for make in (steady, gaps, negative, stepped)]
+
+
+def brute_force(readings, period):
+    """Returns [start, count, sum, min, max] per bucket, the last one open."""
+    groups = {}
+    starts = []
+    for t, v in readings:
+        start = t // period * period
+        # A clock stepped back doesn't reopen buckets.
+        if starts and start < starts[-1]:
+            start = starts[-1]
+        if start not in groups:
+            starts.append(start)
+            groups[start] = []
+        groups[start].append(v)
+    return [[s, len(groups[s]), sum(groups[s]), min(groups[s]),
+             max(groups[s])] for s in starts]
+
+
+def roll_up(readings):
+    sim = simbench.run(args.sim, ["-R", "-"], simbench.trace_text(readings))
+    totals = [float(g) for g in simbench.result(sim, ROLLUPSTORE)]
+    stored = [[] for _ in TIERS]
+    opened = [None for _ in TIERS]
+    for m in simbench.matches(sim.stdout, RECORD):
+        tier = int(m.group(2))
+        record = [int(g) for g in m.groups()[2:]]
+        if m.group(1) == "rollup":
+            stored[tier].append(record)
+        else:
+            opened[tier] = record
+    return stored, opened, totals
+
+
+def problems(readings, stored, opened):
+    found = []
+    for tier, name in enumerate(TIERS):
+        expected = brute_force(readings, PERIODS_MS[tier])
+        if expected[-1:] != ([opened[tier]] if opened[tier] else []):
+            found.append("open {} bucket differs".format(name))
+        # Wrapped tiers keep the newest closed buckets.
+        closed = expected[:-1]
+        kept = closed[len(closed) - len(stored[tier]):] if stored[tier] \
+            else []
+        if len(stored[tier]) > len(closed) or kept != stored[tier]:
+            wrong = sum(a != b for a, b in zip(kept, stored[tier]))
+            found.append("{} of {} {} records differ".format(
+                max(wrong, 1), len(stored[tier]), name))
+    return found
+
+
+def main():
+    traces = generated() + [simbench.recorded_named(path)
+                            for path in args.trace]
+    wrong = []
+    for name, readings in traces:
+        stored, opened, totals = roll_up(readings)
+        samples, minutes, hours, finds, find_ok, add_ns = totals
+        found = problems(readings, stored, opened)
+        if not find_ok:
+            found.append("find missed records")
+        first = stored[0][0][0] if stored[0] else 0
+        print("{:8s} {:7d} samples: {:5d} minutes from day {:.1f}, {:4d} "
+              "hours, {:5d} finds, {:.0f} ns per sample{}".format(
+                  name, int(samples), int(minutes),
+                  max(first - readings[0][0], 0) / DAY_MS if readings else 0,
+                  int(hours), int(finds), add_ns,
+                  "  " + ", ".join(found) if found else "  all match"))
+        wrong += ["{}: {}".format(name, f) for f in found]
+    simbench.finish(wrong)
+
+
+main()
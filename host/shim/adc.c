@@ -0,0 +1,124 @@
+#include "esp_adc/adc_continuous.h"
+#include "sim.h"
+#include "util.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+// The C3 has 5 channels on unit 1.
+#define SIM_ADC_CHANNELS 5
+#define SIM_ADC_RAW_MAX 0xFFF
+// Conversions scatter this far around the level, like the real noise floor.
+#define SIM_ADC_NOISE 8
+
+// The one driver instance, the sampler only makes one.
+typedef struct adc_continuous_ctx_t {
+    // UNSYNCHRONIZED FIELDS (sampler task only)
+    uint32_t frame_size;
+    adc_digi_pattern_config_t pattern[SOC_ADC_PATT_LEN_MAX];
+    uint32_t pattern_num;
+    uint32_t next;
+    bool running;
+    uint32_t noise;
+} adc_continuous_ctx_t;
+
+static adc_continuous_ctx_t glob_adc;
+static bool glob_adc_taken = false;
+static atomic_int glob_levels[SIM_ADC_CHANNELS];
+
+void sim_adc_set_level(int channel, int raw) {
+    if (channel < 0 || channel >= SIM_ADC_CHANNELS) {
+        abort();
+    }
+    atomic_store(&glob_levels[channel], raw);
+}
+
+esp_err_t adc_continuous_new_handle(
+    const adc_continuous_handle_cfg_t *config,
+    adc_continuous_handle_t *handle) {
+    if (config == NULL || handle == NULL || glob_adc_taken) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    glob_adc_taken = true;
+    memset(&glob_adc, 0, sizeof(glob_adc));
+    glob_adc.frame_size = config->conv_frame_size;
+    glob_adc.noise = 1;
+    *handle = &glob_adc;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(
+    adc_continuous_handle_t handle, const adc_continuous_config_t *config) {
+    if (handle == NULL || config == NULL || config->pattern_num == 0 ||
+        config->pattern_num > SOC_ADC_PATT_LEN_MAX ||
+        config->format != ADC_DIGI_OUTPUT_FORMAT_TYPE2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(
+        handle->pattern,
+        config->adc_pattern,
+        config->pattern_num * sizeof(adc_digi_pattern_config_t));
+    handle->pattern_num = config->pattern_num;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle) {
+    if (handle == NULL || handle->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->running = true;
+    handle->next = 0;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle) {
+    if (handle == NULL || !handle->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->running = false;
+    return ESP_OK;
+}
+
+// One conversion of the next pattern entry, data in bits 0-11, the channel
+// in 13-15 and the unit in 16.
+static uint32_t convert(adc_continuous_handle_t handle) {
+    const adc_digi_pattern_config_t *entry =
+        &handle->pattern[handle->next++ % handle->pattern_num];
+    int level = entry->channel < SIM_ADC_CHANNELS
+                    ? atomic_load(&glob_levels[entry->channel])
+                    : 0;
+    // xorshift, deterministic so runs compare.
+    handle->noise ^= handle->noise << 13;
+    handle->noise ^= handle->noise >> 17;
+    handle->noise ^= handle->noise << 5;
+    int raw = level + (int)(handle->noise % (2 * SIM_ADC_NOISE + 1)) -
+              SIM_ADC_NOISE;
+    raw = raw < 0 ? 0 : raw > SIM_ADC_RAW_MAX ? SIM_ADC_RAW_MAX : raw;
+    return (uint32_t)raw | (uint32_t)(entry->channel & 0x7) << 13 |
+           (uint32_t)(entry->unit & 0x1) << 16;
+}
+
+esp_err_t adc_continuous_read(
+    adc_continuous_handle_t handle,
+    uint8_t *buf,
+    uint32_t length_max,
+    uint32_t *out_length,
+    uint32_t timeout_ms) {
+    (void)timeout_ms;
+    if (handle == NULL || buf == NULL || out_length == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!handle->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t len = length_max < handle->frame_size ? length_max
+                                                   : handle->frame_size;
+    len -= len % SOC_ADC_DIGI_RESULT_BYTES;
+    for (uint32_t i = 0; i < len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        uint32_t word = convert(handle);
+        memcpy(buf + i, &word, sizeof(word));
+    }
+    *out_length = len;
+    return ESP_OK;
+}
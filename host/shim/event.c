@@ -0,0 +1,187 @@
+#include "esp_event.h"
+#include "sim.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define SIM_HANDLERS_MAX 16
+#define SIM_EVENT_QUEUE_LEN 16
+#define SIM_EVENT_DATA_MAX 64
+
+static const char *TAG = "sim_event";
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+
+typedef struct sim_handler_t {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *handler_data;
+} sim_handler_t;
+
+typedef struct sim_event_t {
+    esp_event_base_t base;
+    int32_t id;
+    uint8_t data[SIM_EVENT_DATA_MAX];
+} sim_event_t;
+
+typedef struct sim_event_loop_t {
+    pthread_mutex_t mutex;
+    // Signalled when an event is posted, or when dispatching one finished.
+    pthread_cond_t changed;
+
+    // SYNCHRONIZED FIELDS
+    bool created;
+    sim_handler_t handlers[SIM_HANDLERS_MAX];
+    int handler_count;
+    sim_event_t queue[SIM_EVENT_QUEUE_LEN];
+    int queue_head;
+    int queue_count;
+    bool dispatching;
+} sim_event_loop_t;
+
+static sim_event_loop_t glob_loop = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+
+static void *event_task(void *arg) {
+    sim_event_loop_t *loop = &glob_loop;
+    while (true) {
+        POSIX_EC(pthread_mutex_lock(&loop->mutex));
+        while (loop->queue_count == 0) {
+            POSIX_EC(pthread_cond_wait(&loop->changed, &loop->mutex));
+        }
+        sim_event_t event = loop->queue[loop->queue_head];
+        loop->queue_head = (loop->queue_head + 1) % SIM_EVENT_QUEUE_LEN;
+        loop->queue_count--;
+        loop->dispatching = true;
+
+        // Handlers may register and unregister, call a snapshot of them
+        // without holding the lock.
+        sim_handler_t matched[SIM_HANDLERS_MAX];
+        int matched_count = 0;
+        for (int i = 0; i < loop->handler_count; i++) {
+            sim_handler_t *h = &loop->handlers[i];
+            if (h->base == event.base &&
+                (h->id == ESP_EVENT_ANY_ID || h->id == event.id)) {
+                matched[matched_count++] = *h;
+            }
+        }
+        POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+
+        for (int i = 0; i < matched_count; i++) {
+            matched[i].handler(
+                matched[i].handler_data,
+                event.base,
+                event.id,
+                event.data);
+        }
+
+        POSIX_EC(pthread_mutex_lock(&loop->mutex));
+        loop->dispatching = false;
+        POSIX_EC(pthread_cond_broadcast(&loop->changed));
+        POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+    }
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    sim_event_loop_t *loop = &glob_loop;
+    POSIX_EC(pthread_mutex_lock(&loop->mutex));
+    bool created = loop->created;
+    loop->created = true;
+    POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+    if (created) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_t task;
+    POSIX_EC(pthread_create(&task, NULL, event_task, NULL));
+    POSIX_EC(pthread_detach(task));
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(
+    esp_event_base_t base,
+    int32_t id,
+    esp_event_handler_t handler,
+    void *handler_data) {
+    NPC(handler);
+    sim_event_loop_t *loop = &glob_loop;
+    esp_err_t err = ESP_OK;
+    POSIX_EC(pthread_mutex_lock(&loop->mutex));
+    if (loop->handler_count >= SIM_HANDLERS_MAX) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        loop->handlers[loop->handler_count++] = (sim_handler_t){
+            .base = base,
+            .id = id,
+            .handler = handler,
+            .handler_data = handler_data,
+        };
+    }
+    POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+    return err;
+}
+
+esp_err_t esp_event_handler_unregister(
+    esp_event_base_t base, int32_t id, esp_event_handler_t handler) {
+    sim_event_loop_t *loop = &glob_loop;
+    POSIX_EC(pthread_mutex_lock(&loop->mutex));
+    int kept = 0;
+    for (int i = 0; i < loop->handler_count; i++) {
+        sim_handler_t *h = &loop->handlers[i];
+        if (h->base == base && h->id == id && h->handler == handler) {
+            continue;
+        }
+        loop->handlers[kept++] = *h;
+    }
+    loop->handler_count = kept;
+    POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(
+    esp_event_base_t base,
+    int32_t id,
+    const void *event_data,
+    size_t event_data_size,
+    TickType_t ticks_to_wait) {
+    (void)ticks_to_wait;
+    if (event_data_size > SIM_EVENT_DATA_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_event_loop_t *loop = &glob_loop;
+    esp_err_t err = ESP_OK;
+    POSIX_EC(pthread_mutex_lock(&loop->mutex));
+    if (!loop->created) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (loop->queue_count >= SIM_EVENT_QUEUE_LEN) {
+        ESP_LOGW(TAG, "Event queue full, dropping %s %d", base, (int)id);
+        err = ESP_ERR_TIMEOUT;
+    } else {
+        int tail = (loop->queue_head + loop->queue_count) % SIM_EVENT_QUEUE_LEN;
+        sim_event_t *event = &loop->queue[tail];
+        event->base = base;
+        event->id = id;
+        memset(event->data, 0, sizeof(event->data));
+        if (event_data != NULL) {
+            memcpy(event->data, event_data, event_data_size);
+        }
+        loop->queue_count++;
+        POSIX_EC(pthread_cond_broadcast(&loop->changed));
+    }
+    POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+    return err;
+}
+
+void sim_event_flush() {
+    sim_event_loop_t *loop = &glob_loop;
+    POSIX_EC(pthread_mutex_lock(&loop->mutex));
+    while (loop->queue_count > 0 || loop->dispatching) {
+        POSIX_EC(pthread_cond_wait(&loop->changed, &loop->mutex));
+    }
+    POSIX_EC(pthread_mutex_unlock(&loop->mutex));
+}
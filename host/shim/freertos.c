@@ -0,0 +1,469 @@
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sim.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_TASKS_MAX 16
+// Host stacks of the tasks. The host takes more than the device for the same
+// code, 64-bit frames, glibc and OpenSSL for mbedtls, so no task may run out.
+#define SIM_TASK_STACK_SIZE (1024 * 1024)
+// Fills a task's stack before it runs, the high-water mark is where the fill
+// ends.
+#define SIM_STACK_PAINT 0xA5
+// Free heap of a C3 with the radio up, see esp_get_free_heap_size.
+#define SIM_HEAP_SIZE (200 * 1024)
+
+static const char *TAG = "sim_freertos";
+
+static int64_t glob_started_ms = -1;
+static atomic_uint glob_min_free_heap = SIM_HEAP_SIZE;
+
+int64_t sim_now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if (glob_started_ms < 0) {
+        glob_started_ms = ms;
+    }
+    return ms - glob_started_ms;
+}
+
+void sim_sleep_ms(int64_t ms) {
+    double scaled_ns = (double)ms * 1e6 / glob_sim.time_scale;
+    struct timespec wait = {
+        .tv_sec = (time_t)(scaled_ns / 1e9),
+        .tv_nsec = (long)((int64_t)scaled_ns % 1000000000),
+    };
+    while (nanosleep(&wait, &wait) < 0 && errno == EINTR) {
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    sim_sleep_ms((int64_t)ticks * portTICK_PERIOD_MS);
+}
+
+typedef struct sim_task_t {
+    TaskFunction_t task;
+    void *arg;
+    int index;
+} sim_task_t;
+
+// The notification value of a task, see ulTaskNotifyTake.
+typedef struct sim_notify_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t given;
+
+    // SYNCHRONIZED FIELDS
+    uint32_t count;
+} sim_notify_t;
+
+// Handles only have to be told apart, see pcTaskGetName.
+static char glob_handles[SIM_TASKS_MAX];
+static sim_notify_t glob_notify[SIM_TASKS_MAX];
+// Names and threads of the tasks, for sim_task_cpu_us.
+static const char *glob_names[SIM_TASKS_MAX];
+static pthread_t glob_threads[SIM_TASKS_MAX];
+// The painted stacks, the top is where the task function's frame starts, for
+// sim_task_stack_used.
+static uint8_t *glob_stacks[SIM_TASKS_MAX];
+static uint8_t *_Atomic glob_stack_tops[SIM_TASKS_MAX];
+static uint32_t glob_stack_depths[SIM_TASKS_MAX];
+static atomic_bool glob_exited[SIM_TASKS_MAX];
+static int glob_task_count = 0;
+// The task running on this thread, -1 for threads the simulator started.
+static _Thread_local int glob_current = -1;
+
+static void *task_main(void *arg) {
+    sim_task_t task = *(sim_task_t *)arg;
+    free(arg);
+    glob_current = task.index;
+    atomic_store(
+        &glob_stack_tops[task.index],
+        (uint8_t *)__builtin_frame_address(0));
+    task.task(task.arg);
+    atomic_store(&glob_exited[task.index], true);
+    return NULL;
+}
+
+static void init_cond(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    POSIX_EC(pthread_condattr_init(&attr));
+    POSIX_EC(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC));
+    POSIX_EC(pthread_cond_init(cond, &attr));
+    POSIX_EC(pthread_condattr_destroy(&attr));
+}
+
+BaseType_t xTaskCreate(
+    TaskFunction_t task,
+    const char *name,
+    uint32_t stack_depth,
+    void *arg,
+    UBaseType_t priority,
+    TaskHandle_t *created) {
+    if (glob_task_count >= SIM_TASKS_MAX) {
+        return pdFAIL;
+    }
+    int index = glob_task_count++;
+    sim_notify_t *notify = &glob_notify[index];
+    POSIX_EC(pthread_mutex_init(&notify->mutex, NULL));
+    init_cond(&notify->given);
+    notify->count = 0;
+    sim_task_t *start = malloc(sizeof(sim_task_t));
+    NPC(start);
+    start->task = task;
+    start->arg = arg;
+    start->index = index;
+    uint8_t *stack = malloc(SIM_TASK_STACK_SIZE);
+    NPC(stack);
+    memset(stack, SIM_STACK_PAINT, SIM_TASK_STACK_SIZE);
+    glob_stacks[index] = stack;
+    glob_stack_depths[index] = stack_depth;
+    pthread_attr_t attr;
+    POSIX_EC(pthread_attr_init(&attr));
+    POSIX_EC(pthread_attr_setstack(&attr, stack, SIM_TASK_STACK_SIZE));
+    pthread_t thread;
+    glob_names[index] = name;
+    POSIX_EC(pthread_create(&thread, &attr, task_main, start));
+    POSIX_EC(pthread_attr_destroy(&attr));
+    POSIX_EC(pthread_detach(thread));
+    glob_threads[index] = thread;
+    if (created != NULL) {
+        *created = &glob_handles[index];
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // Only ever called by tasks on themselves.
+    if (task == NULL) {
+        if (glob_current >= 0) {
+            atomic_store(&glob_exited[glob_current], true);
+        }
+        pthread_exit(NULL);
+    }
+}
+
+static uint32_t stack_used(int index) {
+    uint8_t *top = atomic_load(&glob_stack_tops[index]);
+    if (top == NULL) {
+        return 0;
+    }
+    // Stacks grow down.
+    uint8_t *lowest = glob_stacks[index];
+    while (lowest < top && *lowest == SIM_STACK_PAINT) {
+        lowest++;
+    }
+    return (uint32_t)(top - lowest);
+}
+
+uint32_t sim_task_stack_used(const char *name) {
+    NPC(name);
+    uint32_t used = 0;
+    for (int i = 0; i < glob_task_count; i++) {
+        if (strcmp(glob_names[i], name) == 0 && stack_used(i) > used) {
+            used = stack_used(i);
+        }
+    }
+    return used;
+}
+
+int64_t sim_task_cpu_us(const char *name) {
+    NPC(name);
+    int64_t us = 0;
+    for (int i = 0; i < glob_task_count; i++) {
+        if (strcmp(glob_names[i], name) != 0 || atomic_load(&glob_exited[i])) {
+            continue;
+        }
+        clockid_t clock;
+        struct timespec used;
+        if (pthread_getcpuclockid(glob_threads[i], &clock) == 0 &&
+            clock_gettime(clock, &used) == 0) {
+            us += (int64_t)used.tv_sec * 1000000 + used.tv_nsec / 1000;
+        }
+    }
+    return us;
+}
+
+void esp_restart(void) {
+    ESP_LOGI(TAG, "Restart requested, exiting");
+    exit(0);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)((double)sim_now_ms() * glob_sim.time_scale /
+                        portTICK_PERIOD_MS);
+}
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment) {
+    NPC(previous);
+    *previous += increment;
+    TickType_t now = xTaskGetTickCount();
+    // Late wakes don't sleep, like the kernel.
+    if ((int32_t)(*previous - now) > 0) {
+        vTaskDelay(*previous - now);
+    }
+}
+
+// Waits on the queue's condition until the simulated timeout runs out.
+static bool queue_wait(QueueHandle_t queue, struct timespec *until) {
+    if (until == NULL) {
+        POSIX_EC(pthread_cond_wait(&queue->changed, &queue->mutex));
+        return true;
+    }
+    int err = pthread_cond_timedwait(&queue->changed, &queue->mutex, until);
+    if (err == ETIMEDOUT) {
+        return false;
+    }
+    POSIX_EC(err);
+    return true;
+}
+
+static struct timespec *wait_deadline(TickType_t wait, struct timespec *at) {
+    if (wait == portMAX_DELAY) {
+        return NULL;
+    }
+    double scaled_ns =
+        (double)wait * portTICK_PERIOD_MS * 1e6 / glob_sim.time_scale;
+    clock_gettime(CLOCK_MONOTONIC, at);
+    int64_t ns = (int64_t)at->tv_nsec + (int64_t)scaled_ns;
+    at->tv_sec += (time_t)(ns / 1000000000);
+    at->tv_nsec = (long)(ns % 1000000000);
+    return at;
+}
+
+static sim_notify_t *task_notify(TaskHandle_t task) {
+    NPC(task);
+    int index = (int)((char *)task - glob_handles);
+    if (index < 0 || index >= glob_task_count) {
+        ESP_LOGE(TAG, "Notifying a task the simulator didn't create!");
+        abort();
+    }
+    return &glob_notify[index];
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    sim_notify_t *notify = task_notify(task);
+    POSIX_EC(pthread_mutex_lock(&notify->mutex));
+    notify->count++;
+    POSIX_EC(pthread_cond_broadcast(&notify->given));
+    POSIX_EC(pthread_mutex_unlock(&notify->mutex));
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    if (glob_current < 0) {
+        ESP_LOGE(TAG, "Only tasks can take notifications!");
+        abort();
+    }
+    sim_notify_t *notify = &glob_notify[glob_current];
+    struct timespec at;
+    struct timespec *until = wait_deadline(wait, &at);
+    POSIX_EC(pthread_mutex_lock(&notify->mutex));
+    while (notify->count == 0 && wait != 0) {
+        if (until == NULL) {
+            POSIX_EC(pthread_cond_wait(&notify->given, &notify->mutex));
+            continue;
+        }
+        int err = pthread_cond_timedwait(&notify->given, &notify->mutex, until);
+        if (err == ETIMEDOUT) {
+            break;
+        }
+        POSIX_EC(err);
+    }
+    uint32_t count = notify->count;
+    if (count > 0) {
+        notify->count = clear ? 0 : count - 1;
+    }
+    POSIX_EC(pthread_mutex_unlock(&notify->mutex));
+    return count;
+}
+
+QueueHandle_t xQueueCreateStatic(
+    UBaseType_t length,
+    UBaseType_t item_size,
+    uint8_t *storage,
+    StaticQueue_t *queue) {
+    NPC(storage);
+    NPC(queue);
+    init_cond(&queue->changed);
+    POSIX_EC(pthread_mutex_init(&queue->mutex, NULL));
+    queue->items = storage;
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+// Never freed, the firmware creates its queues once at startup.
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    StaticQueue_t *queue = malloc(sizeof(StaticQueue_t));
+    uint8_t *storage = malloc(length * item_size);
+    if (queue == NULL || storage == NULL) {
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+    return xQueueCreateStatic(length, item_size, storage, queue);
+}
+
+static BaseType_t queue_send(
+    QueueHandle_t queue, const void *item, TickType_t wait, bool front) {
+    NPC(queue);
+    struct timespec at;
+    struct timespec *until = wait_deadline(wait, &at);
+    BaseType_t sent = pdTRUE;
+    POSIX_EC(pthread_mutex_lock(&queue->mutex));
+    while (queue->count == queue->length) {
+        if (wait == 0 || !queue_wait(queue, until)) {
+            sent = pdFALSE;
+            break;
+        }
+    }
+    if (sent) {
+        UBaseType_t slot = (queue->head + queue->count) % queue->length;
+        if (front) {
+            queue->head = (queue->head + queue->length - 1) % queue->length;
+            slot = queue->head;
+        }
+        memcpy(
+            queue->items + slot * queue->item_size,
+            item,
+            queue->item_size);
+        queue->count++;
+        POSIX_EC(pthread_cond_broadcast(&queue->changed));
+    }
+    POSIX_EC(pthread_mutex_unlock(&queue->mutex));
+    return sent;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    return queue_send(queue, item, wait, false);
+}
+
+BaseType_t
+xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait) {
+    return queue_send(queue, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    NPC(queue);
+    struct timespec at;
+    struct timespec *until = wait_deadline(wait, &at);
+    BaseType_t received = pdTRUE;
+    POSIX_EC(pthread_mutex_lock(&queue->mutex));
+    while (queue->count == 0) {
+        if (wait == 0 || !queue_wait(queue, until)) {
+            received = pdFALSE;
+            break;
+        }
+    }
+    if (received) {
+        memcpy(
+            item,
+            queue->items + queue->head * queue->item_size,
+            queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        POSIX_EC(pthread_cond_broadcast(&queue->changed));
+    }
+    POSIX_EC(pthread_mutex_unlock(&queue->mutex));
+    return received;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait) {
+    NPC(queue);
+    struct timespec at;
+    struct timespec *until = wait_deadline(wait, &at);
+    BaseType_t received = pdTRUE;
+    POSIX_EC(pthread_mutex_lock(&queue->mutex));
+    while (queue->count == 0) {
+        if (wait == 0 || !queue_wait(queue, until)) {
+            received = pdFALSE;
+            break;
+        }
+    }
+    if (received) {
+        memcpy(
+            item,
+            queue->items + queue->head * queue->item_size,
+            queue->item_size);
+    }
+    POSIX_EC(pthread_mutex_unlock(&queue->mutex));
+    return received;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    NPC(queue);
+    POSIX_EC(pthread_mutex_lock(&queue->mutex));
+    UBaseType_t count = queue->count;
+    POSIX_EC(pthread_mutex_unlock(&queue->mutex));
+    return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    NPC(queue);
+    POSIX_EC(pthread_mutex_lock(&queue->mutex));
+    queue->head = 0;
+    queue->count = 0;
+    POSIX_EC(pthread_cond_broadcast(&queue->changed));
+    POSIX_EC(pthread_mutex_unlock(&queue->mutex));
+    return pdPASS;
+}
+
+int64_t esp_timer_get_time(void) {
+    static int64_t started_us = -1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if (started_us < 0) {
+        started_us = us;
+    }
+    return us - started_us;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    static _Thread_local char task;
+    return glob_current >= 0 ? &glob_handles[glob_current] : &task;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    char *handle = (char *)task;
+    if (handle < glob_handles || handle >= glob_handles + glob_task_count) {
+        // Threads the simulator started.
+        return 0;
+    }
+    int index = (int)(handle - glob_handles);
+    uint32_t used = stack_used(index);
+    return used < glob_stack_depths[index] ? glob_stack_depths[index] - used
+                                           : 0;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) { return "sim"; }
+
+uint32_t esp_get_free_heap_size(void) {
+    uint32_t free_now = SIM_HEAP_SIZE - (uint32_t)sim_tls_heap_used();
+    uint32_t min = atomic_load(&glob_min_free_heap);
+    while (free_now < min &&
+           !atomic_compare_exchange_weak(&glob_min_free_heap, &min, free_now)) {
+    }
+    return free_now;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    esp_get_free_heap_size();
+    return atomic_load(&glob_min_free_heap);
+}
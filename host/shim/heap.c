@@ -0,0 +1,57 @@
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The firmware sources are compiled with malloc and friends renamed to these,
+// see CMakeLists.txt, so only their allocations are counted. The shims
+// allocate like the IDF components they replace and aren't traced.
+static pthread_mutex_t glob_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sim_heap_stats_t glob_stats;
+
+static void count(bool allocated, bool freed) {
+    pthread_mutex_lock(&glob_mutex);
+    if (allocated) {
+        glob_stats.allocs++;
+        glob_stats.live++;
+    }
+    if (freed) {
+        glob_stats.frees++;
+        glob_stats.live--;
+    }
+    pthread_mutex_unlock(&glob_mutex);
+}
+
+void *sim_traced_malloc(size_t size) {
+    void *ptr = malloc(size);
+    count(ptr != NULL, false);
+    return ptr;
+}
+
+void *sim_traced_calloc(size_t count_, size_t size) {
+    void *ptr = calloc(count_, size);
+    count(ptr != NULL, false);
+    return ptr;
+}
+
+void *sim_traced_realloc(void *ptr, size_t size) {
+    // Whether ptr was an allocation has to be known before realloc frees it.
+    bool freed = ptr != NULL;
+    void *moved = realloc(ptr, size);
+    if (moved != NULL) {
+        count(true, freed);
+    }
+    return moved;
+}
+
+void sim_traced_free(void *ptr) {
+    count(false, ptr != NULL);
+    free(ptr);
+}
+
+void sim_heap_stats(sim_heap_stats_t *stats) {
+    pthread_mutex_lock(&glob_mutex);
+    *stats = glob_stats;
+    pthread_mutex_unlock(&glob_mutex);
+}
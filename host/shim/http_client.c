@@ -0,0 +1,425 @@
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "util.h"
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SIM_CLIENT_HOST_MAX 128
+#define SIM_CLIENT_PATH_MAX 256
+#define SIM_CLIENT_HEADERS_MAX 512
+#define SIM_CLIENT_HEAD_MAX 4096
+// CONFIG_LWIP_TCP_WND_DEFAULT, a stalled reader stops the sender about as
+// soon as it would on the device.
+#define SIM_CLIENT_TCP_WND 5744
+
+static const char *TAG = "sim_http_client";
+
+struct esp_http_client {
+    bool https;
+    char host[SIM_CLIENT_HOST_MAX];
+    char port[8];
+    char path[SIM_CLIENT_PATH_MAX];
+    esp_http_client_method_t method;
+    int timeout_ms;
+    esp_err_t (*crt_bundle_attach)(void *conf);
+    // Extra request headers, "Key: value\r\n" each.
+    char headers[SIM_CLIENT_HEADERS_MAX];
+    // Body of esp_http_client_perform, owned by the caller.
+    const char *post_data;
+    int post_len;
+
+    int fd;
+    // https:// connections go through the TLS shim, a full handshake each
+    // like esp-tls without a session cache.
+    bool configured;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    int status;
+    int64_t content_length;
+    int64_t body_read;
+    // Body bytes that came in with the headers.
+    char head[SIM_CLIENT_HEAD_MAX];
+    size_t head_len;
+    size_t head_at;
+};
+
+// Splits an http:// or https:// URL into the client's host, port and path.
+static esp_err_t parse_url(esp_http_client_handle_t client, const char *url) {
+    bool https = url != NULL && strncmp(url, "https://", 8) == 0;
+    if (url == NULL || (!https && strncmp(url, "http://", 7) != 0)) {
+        ESP_LOGE(TAG, "Only http:// and https:// URLs are simulated");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (https && client->crt_bundle_attach == NULL) {
+        // esp-tls refuses to connect without a way to verify the server.
+        ESP_LOGE(TAG, "No server verification for %s", url);
+        return ESP_ERR_INVALID_ARG;
+    }
+    client->https = https;
+    const char *authority = url + (https ? 8 : 7);
+    size_t authority_len = strcspn(authority, "/");
+    const char *path = authority + authority_len;
+    snprintf(client->path, sizeof(client->path), "%s", *path ? path : "/");
+    snprintf(
+        client->host,
+        sizeof(client->host),
+        "%.*s",
+        (int)authority_len,
+        authority);
+    char *colon = strchr(client->host, ':');
+    snprintf(
+        client->port,
+        sizeof(client->port),
+        "%s",
+        colon != NULL ? colon + 1 : https ? "443" : "80");
+    if (colon != NULL) {
+        *colon = '\0';
+    }
+    return ESP_OK;
+}
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config) {
+    if (config == NULL) {
+        return NULL;
+    }
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    NPC(client);
+    client->fd = -1;
+    client->method = config->method;
+    client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : 5000;
+    client->crt_bundle_attach = config->crt_bundle_attach;
+    mbedtls_ssl_init(&client->ssl);
+    if (parse_url(client, config->url) != ESP_OK) {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+// Takes effect with the next open.
+esp_err_t
+esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return parse_url(client, url);
+}
+
+esp_err_t esp_http_client_set_header(
+    esp_http_client_handle_t client, const char *key, const char *value) {
+    if (client == NULL || key == NULL || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Replace an earlier value of the same header.
+    esp_http_client_delete_header(client, key);
+    size_t used = strlen(client->headers);
+    int n = snprintf(
+        client->headers + used,
+        sizeof(client->headers) - used,
+        "%s: %s\r\n",
+        key,
+        value);
+    if (n < 0 || (size_t)n >= sizeof(client->headers) - used) {
+        client->headers[used] = '\0';
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(
+    esp_http_client_handle_t client, const char *key) {
+    if (client == NULL || key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t key_len = strlen(key);
+    char *line = client->headers;
+    while (*line != '\0') {
+        char *end = strstr(line, "\r\n") + 2;
+        if (strncasecmp(line, key, key_len) == 0 && line[key_len] == ':') {
+            memmove(line, end, strlen(end) + 1);
+        } else {
+            line = end;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(
+    esp_http_client_handle_t client, const char *data, int len) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    client->post_data = data;
+    client->post_len = data != NULL ? len : 0;
+    return ESP_OK;
+}
+
+static int client_send(
+    esp_http_client_handle_t client, const void *data, size_t len) {
+    if (client->https) {
+        return mbedtls_ssl_write(&client->ssl, data, len);
+    }
+    return (int)send(client->fd, data, len, MSG_NOSIGNAL);
+}
+
+// 0 once the server closed the connection, -1 on errors.
+static int
+client_recv(esp_http_client_handle_t client, void *data, size_t len) {
+    if (!client->https) {
+        return (int)recv(client->fd, data, len, 0);
+    }
+    int n = mbedtls_ssl_read(&client->ssl, data, len);
+    return n >= 0 ? n : n == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ? 0 : -1;
+}
+
+static bool configure_tls(esp_http_client_handle_t client) {
+    mbedtls_ssl_config *conf = &client->conf;
+    mbedtls_ssl_config_init(conf);
+    client->configured = true;
+    if (mbedtls_ssl_config_defaults(
+            conf,
+            MBEDTLS_SSL_IS_CLIENT,
+            MBEDTLS_SSL_TRANSPORT_STREAM,
+            MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return false;
+    }
+    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_read_timeout(conf, (uint32_t)client->timeout_ms);
+    return client->crt_bundle_attach(conf) == ESP_OK;
+}
+
+static bool start_tls(esp_http_client_handle_t client) {
+    if (!client->configured && !configure_tls(client)) {
+        ESP_LOGE(TAG, "Can't set up TLS for %s", client->host);
+        return false;
+    }
+    mbedtls_net_context net = {.fd = client->fd};
+    mbedtls_ssl_context *ssl = &client->ssl;
+    int ret = mbedtls_ssl_setup(ssl, &client->conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(ssl, client->host);
+    }
+    if (ret == 0) {
+        mbedtls_ssl_set_bio(
+            ssl,
+            &net,
+            mbedtls_net_send,
+            NULL,
+            mbedtls_net_recv_timeout);
+    }
+    while (ret == 0 && !mbedtls_ssl_is_handshake_over(ssl)) {
+        ret = mbedtls_ssl_handshake_step(ssl);
+    }
+    if (ret != 0) {
+        ESP_LOGE(
+            TAG,
+            "TLS handshake with %s failed: -0x%04x",
+            client->host,
+            -ret);
+        return false;
+    }
+    return true;
+}
+
+// Connects and sends the request head, with a Content-Length if a body of
+// write_len bytes follows.
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_http_client_close(client);
+    client->status = 0;
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *found = NULL;
+    if (getaddrinfo(client->host, client->port, &hints, &found) != 0) {
+        return ESP_FAIL;
+    }
+    int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    int window = SIM_CLIENT_TCP_WND;
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+    }
+    if (fd < 0 || connect(fd, found->ai_addr, found->ai_addrlen) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        freeaddrinfo(found);
+        return ESP_FAIL;
+    }
+    freeaddrinfo(found);
+    struct timeval timeout = {
+        .tv_sec = client->timeout_ms / 1000,
+        .tv_usec = client->timeout_ms % 1000 * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    client->fd = fd;
+    if (client->https && !start_tls(client)) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    client->content_length = -1;
+    client->body_read = 0;
+    client->head_len = 0;
+    client->head_at = 0;
+
+    char request[SIM_CLIENT_PATH_MAX + SIM_CLIENT_HOST_MAX +
+                 SIM_CLIENT_HEADERS_MAX + 96];
+    char length[40] = "";
+    if (write_len > 0) {
+        snprintf(length, sizeof(length), "Content-Length: %d\r\n", write_len);
+    }
+    int len = snprintf(
+        request,
+        sizeof(request),
+        "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n%s%s\r\n",
+        client->method == HTTP_METHOD_POST ? "POST" : "GET",
+        client->path,
+        client->host,
+        length,
+        client->headers);
+    if (client_send(client, request, len) != len) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+    if (client == NULL || client->fd < 0) {
+        return ESP_FAIL;
+    }
+    char *end = NULL;
+    while (end == NULL) {
+        if (client->head_len == sizeof(client->head) - 1) {
+            return ESP_FAIL;
+        }
+        int n = client_recv(
+            client,
+            client->head + client->head_len,
+            sizeof(client->head) - 1 - client->head_len);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        client->head_len += n;
+        client->head[client->head_len] = '\0';
+        end = strstr(client->head, "\r\n\r\n");
+    }
+    if (sscanf(client->head, "HTTP/1.%*d %d", &client->status) != 1) {
+        return ESP_FAIL;
+    }
+    for (char *line = strstr(client->head, "\r\n"); line < end;
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            client->content_length = atoll(line + 17);
+        }
+    }
+    client->head_at = end + 4 - client->head;
+    return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    return client == NULL ? -1 : client->status;
+}
+
+int esp_http_client_read(
+    esp_http_client_handle_t client, char *buffer, int len) {
+    if (client == NULL || client->fd < 0) {
+        return -1;
+    }
+    if (client->content_length >= 0 &&
+        len > client->content_length - client->body_read) {
+        len = (int)(client->content_length - client->body_read);
+    }
+    if (len == 0) {
+        return 0;
+    }
+    ssize_t n = 0;
+    if (client->head_at < client->head_len) {
+        n = client->head_len - client->head_at;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buffer, client->head + client->head_at, n);
+        client->head_at += n;
+    } else {
+        n = client_recv(client, buffer, len);
+        if (n < 0) {
+            return -1;
+        }
+    }
+    client->body_read += n;
+    return (int)n;
+}
+
+bool esp_http_client_is_complete_data_received(
+    esp_http_client_handle_t client) {
+    return client != NULL && client->content_length >= 0 &&
+           client->body_read == client->content_length;
+}
+
+// The whole exchange on a connection of its own: the head, the post field,
+// the response headers and the body, which is dropped.
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_http_client_open(client, client->post_len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (client->post_len > 0 &&
+        client_send(client, client->post_data, client->post_len) !=
+            client->post_len) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    // A response without a length reads -1 as well, only the status tells.
+    esp_http_client_fetch_headers(client);
+    if (client->status == 0) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    char drain[256];
+    while (esp_http_client_read(client, drain, sizeof(drain)) > 0) {
+    }
+    esp_http_client_close(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->fd >= 0) {
+        mbedtls_ssl_close_notify(&client->ssl);
+        mbedtls_ssl_free(&client->ssl);
+        close(client->fd);
+        client->fd = -1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_http_client_close(client);
+    if (client->configured) {
+        mbedtls_ssl_config_free(&client->conf);
+    }
+    free(client);
+    return ESP_OK;
+}
@@ -0,0 +1,1042 @@
+#include "esp_http_server.h"
+#include "sim.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SIM_HTTPD_HEADER_MAX 2048
+#define SIM_HTTPD_HANDLERS_MAX 16
+#define SIM_HTTPD_SOCKETS_MAX 16
+#define SIM_HTTPD_RESP_HEADERS_MAX 16
+#define SIM_HTTPD_WORK_MAX 32
+// Written to the wake pipe by httpd_queue_work, anything else stops.
+#define SIM_HTTPD_WAKE_WORK 'w'
+// lwIP's TCP_SND_BUF, so a slow WebSocket client backs up like on the device.
+#define SIM_HTTPD_WS_SND_BUF 5744
+#define SIM_HTTPD_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static const char *TAG = "sim_httpd";
+
+typedef struct sim_httpd_work_t {
+    httpd_work_fn_t work;
+    void *arg;
+} sim_httpd_work_t;
+
+typedef struct sim_httpd_t {
+    httpd_config_t config;
+    pthread_t task;
+    int listen_fd;
+    // Written to by httpd_stop and httpd_queue_work to wake the server task.
+    int wake_pipe[2];
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    httpd_uri_t handlers[SIM_HTTPD_HANDLERS_MAX];
+    int handler_count;
+    sim_httpd_work_t work[SIM_HTTPD_WORK_MAX];
+    int work_head;
+    int work_count;
+
+    // SERVER TASK FIELDS
+    int clients[SIM_HTTPD_SOCKETS_MAX];
+    // The handler of a client that switched to WebSocket, its frames go
+    // there.
+    bool websocket[SIM_HTTPD_SOCKETS_MAX];
+    httpd_uri_t ws_handlers[SIM_HTTPD_SOCKETS_MAX];
+    int client_count;
+} sim_httpd_t;
+
+// Per request state, pointed to by httpd_req_t.aux.
+typedef struct sim_req_aux_t {
+    sim_httpd_t *server;
+    int fd;
+    // The request line and headers, followed by whatever part of the body
+    // arrived with them.
+    char header[SIM_HTTPD_HEADER_MAX + 1];
+    size_t header_len;
+    size_t buffered_offset;
+    size_t buffered_len;
+    // Body bytes the handler hasn't received yet.
+    size_t remaining;
+
+    const char *status;
+    const char *type;
+    const char *hdr_fields[SIM_HTTPD_RESP_HEADERS_MAX];
+    const char *hdr_values[SIM_HTTPD_RESP_HEADERS_MAX];
+    int hdr_count;
+    bool headers_sent;
+    bool chunked;
+    bool finished;
+    bool keep_alive;
+    bool failed;
+
+    // The WebSocket frame being received, ws_len is what is left of its
+    // payload.
+    httpd_ws_type_t ws_type;
+    bool ws_final;
+    uint8_t ws_mask[4];
+    uint64_t ws_len;
+    uint64_t ws_offset;
+} sim_req_aux_t;
+
+static bool send_raw(int fd, const void *data, size_t len) {
+    const char *buf = (const char *)data;
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+static bool recv_raw(int fd, void *data, size_t len) {
+    char *buf = (char *)data;
+    while (len > 0) {
+        ssize_t got = recv(fd, buf, len, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
+static bool send_all(sim_req_aux_t *aux, const char *buf, size_t len) {
+    if (!aux->failed && !send_raw(aux->fd, buf, len)) {
+        aux->failed = true;
+    }
+    return !aux->failed;
+}
+
+static bool send_headers(sim_req_aux_t *aux, size_t content_len) {
+    char head[1024];
+    int len = snprintf(
+        head,
+        sizeof(head),
+        "HTTP/1.1 %s\r\nContent-Type: %s\r\n",
+        aux->status,
+        aux->type);
+    if (aux->chunked) {
+        len += snprintf(
+            head + len,
+            sizeof(head) - len,
+            "Transfer-Encoding: chunked\r\n");
+    } else {
+        len += snprintf(
+            head + len,
+            sizeof(head) - len,
+            "Content-Length: %zu\r\n",
+            content_len);
+    }
+    for (int i = 0; i < aux->hdr_count; i++) {
+        len += snprintf(
+            head + len,
+            sizeof(head) - len,
+            "%s: %s\r\n",
+            aux->hdr_fields[i],
+            aux->hdr_values[i]);
+    }
+    if (!aux->keep_alive) {
+        len += snprintf(
+            head + len,
+            sizeof(head) - len,
+            "Connection: close\r\n");
+    }
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+    if (len >= sizeof(head)) {
+        ESP_LOGE(TAG, "Response headers don't fit in the buffer!");
+        aux->failed = true;
+        return false;
+    }
+    aux->headers_sent = true;
+    return send_all(aux, head, len);
+}
+
+// Case insensitive header lookup, NULL when the request doesn't have it.
+static const char *find_header(sim_req_aux_t *aux, const char *field) {
+    size_t field_len = strlen(field);
+    const char *line = strstr(aux->header, "\r\n");
+    while (line != NULL && line[2] != '\r') {
+        line += 2;
+        if (strncasecmp(line, field, field_len) == 0 &&
+            line[field_len] == ':') {
+            const char *value = line + field_len + 1;
+            while (*value == ' ') {
+                value++;
+            }
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+static bool parse_method(const char *name, int *method) {
+    static const struct {
+        const char *name;
+        httpd_method_t method;
+    } METHODS[] = {
+        {"DELETE", HTTP_DELETE},
+        {"GET", HTTP_GET},
+        {"HEAD", HTTP_HEAD},
+        {"POST", HTTP_POST},
+        {"PUT", HTTP_PUT},
+    };
+    for (size_t i = 0; i < sizeof(METHODS) / sizeof(METHODS[0]); i++) {
+        if (strcmp(name, METHODS[i].name) == 0) {
+            *method = METHODS[i].method;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void send_status_only(sim_req_aux_t *aux, const char *status) {
+    aux->status = status;
+    aux->type = HTTPD_TYPE_TEXT;
+    aux->keep_alive = false;
+    if (send_headers(aux, strlen(status))) {
+        send_all(aux, status, strlen(status));
+    }
+}
+
+static uint32_t rotl(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// Only for the handshake, short inputs.
+static void sha1(const uint8_t *data, size_t len, uint8_t digest[20]) {
+    uint32_t h[5] = {
+        0x67452301,
+        0xEFCDAB89,
+        0x98BADCFE,
+        0x10325476,
+        0xC3D2E1F0,
+    };
+    uint8_t padded[256] = {0};
+    size_t padded_len = (len + 8) / 64 * 64 + 64;
+    if (padded_len > sizeof(padded)) {
+        ESP_LOGE(TAG, "SHA-1 input too long!");
+        abort();
+    }
+    memcpy(padded, data, len);
+    padded[len] = 0x80;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        padded[padded_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    for (size_t block = 0; block < padded_len; block += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *word = padded + block + 4 * i;
+            w[i] = (uint32_t)word[0] << 24 | (uint32_t)word[1] << 16 |
+                   (uint32_t)word[2] << 8 | word[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 20; i++) {
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static void base64(const uint8_t *data, size_t len, char *out) {
+    static const char DIGITS[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < len) {
+            group |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < len) {
+            group |= data[i + 2];
+        }
+        *out++ = DIGITS[group >> 18 & 0x3F];
+        *out++ = DIGITS[group >> 12 & 0x3F];
+        *out++ = i + 1 < len ? DIGITS[group >> 6 & 0x3F] : '=';
+        *out++ = i + 2 < len ? DIGITS[group & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+// Answers the handshake of a WebSocket upgrade request.
+static bool accept_websocket(sim_req_aux_t *aux) {
+    const char *upgrade = find_header(aux, "Upgrade");
+    const char *key = find_header(aux, "Sec-WebSocket-Key");
+    if (upgrade == NULL || strncasecmp(upgrade, "websocket", 9) != 0 ||
+        key == NULL) {
+        return false;
+    }
+    size_t key_len = strcspn(key, "\r\n");
+    char input[64 + sizeof(SIM_HTTPD_WS_GUID)];
+    if (key_len > 64) {
+        return false;
+    }
+    memcpy(input, key, key_len);
+    memcpy(input + key_len, SIM_HTTPD_WS_GUID, sizeof(SIM_HTTPD_WS_GUID));
+    uint8_t digest[20];
+    sha1((const uint8_t *)input, strlen(input), digest);
+    char accept[29];
+    base64(digest, sizeof(digest), accept);
+
+    char head[256];
+    int len = snprintf(
+        head,
+        sizeof(head),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n",
+        accept);
+    aux->headers_sent = true;
+    return send_all(aux, head, len);
+}
+
+// Reads up to len bytes of the payload of the current frame, unmasked.
+static bool ws_read(sim_req_aux_t *aux, uint8_t *buf, size_t len) {
+    if (len > aux->ws_len) {
+        len = aux->ws_len;
+    }
+    if (!recv_raw(aux->fd, buf, len)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buf[i] ^= aux->ws_mask[(aux->ws_offset + i) % 4];
+    }
+    aux->ws_offset += len;
+    aux->ws_len -= len;
+    return true;
+}
+
+static bool ws_send(
+    int fd, bool final, httpd_ws_type_t type, const void *data, size_t len) {
+    uint8_t head[10];
+    size_t head_len = 2;
+    head[0] = (final ? 0x80 : 0) | type;
+    if (len < 126) {
+        head[1] = len;
+    } else if (len <= UINT16_MAX) {
+        head[1] = 126;
+        head[2] = len >> 8;
+        head[3] = len;
+        head_len = 4;
+    } else {
+        head[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            head[2 + i] = (uint64_t)len >> (56 - 8 * i);
+        }
+        head_len = 10;
+    }
+    return send_raw(fd, head, head_len) &&
+           (len == 0 || send_raw(fd, data, len));
+}
+
+// Reads one frame off a WebSocket and hands data frames to the handler that
+// accepted it. Returns whether the connection stays open.
+static bool serve_frame(sim_httpd_t *server, int index) {
+    sim_req_aux_t aux = {
+        .server = server,
+        .fd = server->clients[index],
+    };
+    uint8_t head[2];
+    if (!recv_raw(aux.fd, head, sizeof(head))) {
+        return false;
+    }
+    aux.ws_final = head[0] & 0x80;
+    aux.ws_type = head[0] & 0x0F;
+    aux.ws_len = head[1] & 0x7F;
+    uint8_t extended[8];
+    if (aux.ws_len >= 126) {
+        size_t size = aux.ws_len == 126 ? 2 : 8;
+        if (!recv_raw(aux.fd, extended, size)) {
+            return false;
+        }
+        aux.ws_len = 0;
+        for (size_t i = 0; i < size; i++) {
+            aux.ws_len = aux.ws_len << 8 | extended[i];
+        }
+    }
+    // Clients have to mask their frames.
+    if (!(head[1] & 0x80) || !recv_raw(aux.fd, aux.ws_mask, 4)) {
+        return false;
+    }
+
+    bool open = true;
+    uint8_t payload[125];
+    switch (aux.ws_type) {
+    case HTTPD_WS_TYPE_CLOSE:
+        ws_send(aux.fd, true, HTTPD_WS_TYPE_CLOSE, NULL, 0);
+        return false;
+    case HTTPD_WS_TYPE_PING: {
+        size_t len = aux.ws_len;
+        open = len <= sizeof(payload) && ws_read(&aux, payload, len) &&
+               ws_send(aux.fd, true, HTTPD_WS_TYPE_PONG, payload, len);
+        break;
+    }
+    case HTTPD_WS_TYPE_PONG:
+        break;
+    default: {
+        // Like on the device, data frames come in with a zero method.
+        httpd_req_t req = {
+            .handle = server,
+            .aux = &aux,
+            .user_ctx = server->ws_handlers[index].user_ctx,
+        };
+        open = server->ws_handlers[index].handler(&req) == ESP_OK;
+        break;
+    }
+    }
+    // Skip whatever part of the payload wasn't read.
+    while (open && aux.ws_len > 0) {
+        open = ws_read(&aux, payload, sizeof(payload));
+    }
+    return open;
+}
+
+// Reads one request off the socket and runs its handler. Returns whether the
+// connection stays open.
+static bool serve_request(sim_httpd_t *server, int index) {
+    int fd = server->clients[index];
+    sim_req_aux_t aux = {
+        .server = server,
+        .fd = fd,
+        .status = HTTPD_200,
+        .type = HTTPD_TYPE_TEXT,
+        .keep_alive = true,
+    };
+
+    // Read up to the end of the headers.
+    size_t received = 0;
+    char *header_end = NULL;
+    while (header_end == NULL) {
+        if (received >= SIM_HTTPD_HEADER_MAX) {
+            send_status_only(&aux, "431 Request Header Fields Too Large");
+            return false;
+        }
+        ssize_t got = recv(
+            fd,
+            aux.header + received,
+            SIM_HTTPD_HEADER_MAX - received,
+            0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            // Closed by the client, or the receive timeout ran out.
+            return false;
+        }
+        received += got;
+        aux.header[received] = '\0';
+        header_end = strstr(aux.header, "\r\n\r\n");
+    }
+    aux.header_len = header_end + 4 - aux.header;
+    aux.buffered_offset = aux.header_len;
+    aux.buffered_len = received - aux.header_len;
+
+    httpd_req_t req = {
+        .handle = server,
+        .aux = &aux,
+    };
+    char method[8];
+    char version[16];
+    if (sscanf(
+            aux.header,
+            "%7s %512s %15s",
+            method,
+            (char *)req.uri,
+            version) != 3 ||
+        !parse_method(method, &req.method)) {
+        send_status_only(&aux, HTTPD_400);
+        return false;
+    }
+    const char *content_len = find_header(&aux, "Content-Length");
+    req.content_len = content_len ? strtoul(content_len, NULL, 10) : 0;
+    aux.remaining = req.content_len;
+    const char *connection = find_header(&aux, "Connection");
+    if (strcmp(version, "HTTP/1.1") == 0) {
+        aux.keep_alive =
+            connection == NULL || strncasecmp(connection, "close", 5) != 0;
+    } else {
+        aux.keep_alive = connection != NULL &&
+                         strncasecmp(connection, "keep-alive", 10) == 0;
+    }
+    if (aux.buffered_len > req.content_len) {
+        // Pipelined requests aren't supported, the next request would be lost.
+        aux.buffered_len = req.content_len;
+        aux.keep_alive = false;
+    }
+
+    // Handlers match on the path, without the query.
+    size_t path_len = strcspn(req.uri, "?");
+    httpd_uri_t handler = {0};
+    bool path_known = false;
+    POSIX_EC(pthread_mutex_lock(&server->mutex));
+    for (int i = 0; i < server->handler_count; i++) {
+        httpd_uri_t *h = &server->handlers[i];
+        if (strlen(h->uri) != path_len ||
+            strncmp(h->uri, req.uri, path_len) != 0) {
+            continue;
+        }
+        path_known = true;
+        if (h->method == req.method) {
+            handler = *h;
+            break;
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&server->mutex));
+
+    if (handler.handler == NULL) {
+        send_status_only(
+            &aux,
+            path_known ? "405 Method Not Allowed" : HTTPD_404);
+        return false;
+    }
+    req.user_ctx = handler.user_ctx;
+    if (handler.is_websocket) {
+        if (req.method != HTTP_GET || !accept_websocket(&aux)) {
+            send_status_only(&aux, HTTPD_400);
+            return false;
+        }
+        server->websocket[index] = true;
+        server->ws_handlers[index] = handler;
+        int send_buf = SIM_HTTPD_WS_SND_BUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buf, sizeof(send_buf));
+        return handler.handler(&req) == ESP_OK;
+    }
+    if (handler.handler(&req) != ESP_OK) {
+        // Same as the device server, a failing handler loses its socket.
+        ESP_LOGD(TAG, "Handler for %s failed, closing socket %d", req.uri, fd);
+        return false;
+    }
+    if (!aux.headers_sent || (aux.chunked && !aux.finished)) {
+        ESP_LOGW(TAG, "Handler for %s left its response unfinished", req.uri);
+        return false;
+    }
+
+    // Skip whatever part of the body the handler didn't read.
+    char scratch[256];
+    while (aux.remaining > 0) {
+        if (httpd_req_recv(&req, scratch, sizeof(scratch)) <= 0) {
+            return false;
+        }
+    }
+    return aux.keep_alive && !aux.failed;
+}
+
+static void close_client(sim_httpd_t *server, int index) {
+    close(server->clients[index]);
+    int last = --server->client_count;
+    server->clients[index] = server->clients[last];
+    server->websocket[index] = server->websocket[last];
+    server->ws_handlers[index] = server->ws_handlers[last];
+}
+
+static void run_work(sim_httpd_t *server) {
+    while (true) {
+        POSIX_EC(pthread_mutex_lock(&server->mutex));
+        if (server->work_count == 0) {
+            POSIX_EC(pthread_mutex_unlock(&server->mutex));
+            return;
+        }
+        sim_httpd_work_t work = server->work[server->work_head];
+        server->work_head = (server->work_head + 1) % SIM_HTTPD_WORK_MAX;
+        server->work_count--;
+        POSIX_EC(pthread_mutex_unlock(&server->mutex));
+        work.work(work.arg);
+    }
+}
+
+static void *server_task(void *arg) {
+    sim_httpd_t *server = (sim_httpd_t *)arg;
+    while (true) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(server->listen_fd, &readable);
+        FD_SET(server->wake_pipe[0], &readable);
+        int max_fd = server->listen_fd > server->wake_pipe[0]
+                         ? server->listen_fd
+                         : server->wake_pipe[0];
+        for (int i = 0; i < server->client_count; i++) {
+            FD_SET(server->clients[i], &readable);
+            if (server->clients[i] > max_fd) {
+                max_fd = server->clients[i];
+            }
+        }
+        if (select(max_fd + 1, &readable, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            POSIX_EC(-1);
+        }
+        if (FD_ISSET(server->wake_pipe[0], &readable)) {
+            char wake = 0;
+            POSIX_EC(read(server->wake_pipe[0], &wake, 1));
+            if (wake != SIM_HTTPD_WAKE_WORK) {
+                break;
+            }
+            run_work(server);
+        }
+
+        // Serve one request or frame per readable socket each round, so one
+        // busy client can't starve the others.
+        for (int i = server->client_count - 1; i >= 0; i--) {
+            if (!FD_ISSET(server->clients[i], &readable)) {
+                continue;
+            }
+            bool open = server->websocket[i] ? serve_frame(server, i)
+                                             : serve_request(server, i);
+            if (!open) {
+                close_client(server, i);
+            }
+        }
+
+        if (FD_ISSET(server->listen_fd, &readable)) {
+            int fd = accept(server->listen_fd, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            if (server->client_count >= server->config.max_open_sockets) {
+                ESP_LOGW(TAG, "Out of sockets, refusing connection");
+                close(fd);
+                continue;
+            }
+            struct timeval recv_timeout = {
+                .tv_sec = server->config.recv_wait_timeout,
+            };
+            struct timeval send_timeout = {
+                .tv_sec = server->config.send_wait_timeout,
+            };
+            setsockopt(
+                fd,
+                SOL_SOCKET,
+                SO_RCVTIMEO,
+                &recv_timeout,
+                sizeof(recv_timeout));
+            setsockopt(
+                fd,
+                SOL_SOCKET,
+                SO_SNDTIMEO,
+                &send_timeout,
+                sizeof(send_timeout));
+            // Headers and body go out in separate sends, without this the
+            // delayed ACK of the client dominates every measurement.
+            int nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            server->websocket[server->client_count] = false;
+            server->clients[server->client_count++] = fd;
+        }
+    }
+
+    while (server->client_count > 0) {
+        close_client(server, server->client_count - 1);
+    }
+    return NULL;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    if (handle == NULL || config == NULL ||
+        config->max_open_sockets > SIM_HTTPD_SOCKETS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_httpd_t *server = calloc(1, sizeof(sim_httpd_t));
+    NPC(server);
+    server->config = *config;
+    POSIX_EC(pthread_mutex_init(&server->mutex, NULL));
+    POSIX_EC(pipe(server->wake_pipe));
+
+    uint16_t port =
+        glob_sim.http_port ? glob_sim.http_port : config->server_port;
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    POSIX_EC(server->listen_fd);
+    int reuse = 1;
+    POSIX_EC(setsockopt(
+        server->listen_fd,
+        SOL_SOCKET,
+        SO_REUSEADDR,
+        &reuse,
+        sizeof(reuse)));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, config->backlog_conn) < 0) {
+        ESP_LOGE(TAG, "Can't listen on port %d: %s", port, strerror(errno));
+        close(server->listen_fd);
+        close(server->wake_pipe[0]);
+        close(server->wake_pipe[1]);
+        free(server);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Listening on 127.0.0.1:%d", port);
+
+    POSIX_EC(pthread_create(&server->task, NULL, server_task, server));
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+    sim_httpd_t *server = (sim_httpd_t *)handle;
+    if (server == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(write(server->wake_pipe[1], "", 1));
+    POSIX_EC(pthread_join(server->task, NULL));
+    close(server->listen_fd);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    for (int i = 0; i < server->handler_count; i++) {
+        free((char *)server->handlers[i].uri);
+    }
+    POSIX_EC(pthread_mutex_destroy(&server->mutex));
+    free(server);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(
+    httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+    sim_httpd_t *server = (sim_httpd_t *)handle;
+    if (server == NULL || uri_handler == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    POSIX_EC(pthread_mutex_lock(&server->mutex));
+    if (server->handler_count >= server->config.max_uri_handlers ||
+        server->handler_count >= SIM_HTTPD_HANDLERS_MAX) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        httpd_uri_t *h = &server->handlers[server->handler_count++];
+        *h = *uri_handler;
+        h->uri = strdup(uri_handler->uri);
+        NPC(h->uri);
+    }
+    POSIX_EC(pthread_mutex_unlock(&server->mutex));
+    return err;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+    if (r == NULL || buf == NULL) {
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    sim_req_aux_t *aux = (sim_req_aux_t *)r->aux;
+    size_t want = buf_len < aux->remaining ? buf_len : aux->remaining;
+    if (want == 0) {
+        return 0;
+    }
+    if (aux->buffered_len > 0) {
+        size_t got = want < aux->buffered_len ? want : aux->buffered_len;
+        memcpy(buf, aux->header + aux->buffered_offset, got);
+        aux->buffered_offset += got;
+        aux->buffered_len -= got;
+        aux->remaining -= got;
+        return got;
+    }
+    ssize_t got;
+    do {
+        got = recv(aux->fd, buf, want, 0);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+    if (got <= 0) {
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    aux->remaining -= got;
+    return got;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+    if (r == NULL || status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ((sim_req_aux_t *)r->aux)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    if (r == NULL || type == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ((sim_req_aux_t *)r->aux)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(
+    httpd_req_t *r, const char *field, const char *value) {
+    if (r == NULL || field == NULL || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_req_aux_t *aux = (sim_req_aux_t *)r->aux;
+    if (aux->hdr_count >= aux->server->config.max_resp_headers ||
+        aux->hdr_count >= SIM_HTTPD_RESP_HEADERS_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Like the device server, the strings have to outlive the response.
+    aux->hdr_fields[aux->hdr_count] = field;
+    aux->hdr_values[aux->hdr_count] = value;
+    aux->hdr_count++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_req_aux_t *aux = (sim_req_aux_t *)r->aux;
+    if (aux->headers_sent) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (buf == NULL) {
+        buf = "";
+        buf_len = 0;
+    } else if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = strlen(buf);
+    }
+    if (!send_headers(aux, buf_len) || !send_all(aux, buf, buf_len)) {
+        return ESP_FAIL;
+    }
+    aux->finished = true;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(
+    httpd_req_t *r, const char *buf, ssize_t buf_len) {
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_req_aux_t *aux = (sim_req_aux_t *)r->aux;
+    if (aux->finished || (aux->headers_sent && !aux->chunked)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (buf == NULL) {
+        buf_len = 0;
+    } else if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = strlen(buf);
+    }
+    if (!aux->headers_sent) {
+        aux->chunked = true;
+        if (!send_headers(aux, 0)) {
+            return ESP_FAIL;
+        }
+    }
+    char size_line[16];
+    int size_len =
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)buf_len);
+    if (!send_all(aux, size_line, size_len) ||
+        (buf_len > 0 && !send_all(aux, buf, buf_len)) ||
+        !send_all(aux, "\r\n", 2)) {
+        return ESP_FAIL;
+    }
+    aux->finished = buf_len == 0;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(
+    httpd_req_t *r, httpd_err_code_t error, const char *msg) {
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char *status;
+    switch (error) {
+    case HTTPD_400_BAD_REQUEST:
+        status = HTTPD_400;
+        break;
+    case HTTPD_404_NOT_FOUND:
+        status = HTTPD_404;
+        break;
+    default:
+        status = HTTPD_500;
+        break;
+    }
+    httpd_resp_set_status(r, status);
+    httpd_resp_set_type(r, HTTPD_TYPE_TEXT);
+    return httpd_resp_send(r, msg ? msg : status, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_req_get_url_query_str(
+    httpd_req_t *r, char *buf, size_t buf_len) {
+    if (r == NULL || buf == NULL || buf_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char *query = strchr(r->uri, '?');
+    if (query == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(buf, buf_len, "%s", query + 1);
+    return strlen(query + 1) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(
+    const char *qry, const char *key, char *val, size_t val_size) {
+    if (qry == NULL || key == NULL || val == NULL || val_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t key_len = strlen(key);
+    const char *pair = qry;
+    while (*pair != '\0') {
+        size_t pair_len = strcspn(pair, "&");
+        if (pair_len > key_len && strncmp(pair, key, key_len) == 0 &&
+            pair[key_len] == '=') {
+            size_t len = pair_len - key_len - 1;
+            size_t copy = len < val_size ? len : val_size - 1;
+            memcpy(val, pair + key_len + 1, copy);
+            val[copy] = '\0';
+            return copy == len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        pair += pair_len;
+        if (*pair == '&') {
+            pair++;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(
+    httpd_req_t *r, const char *field, char *val, size_t val_size) {
+    if (r == NULL || field == NULL || val == NULL || val_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char *value = find_header((sim_req_aux_t *)r->aux, field);
+    if (value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t len = strcspn(value, "\r");
+    size_t copy = len < val_size ? len : val_size - 1;
+    memcpy(val, value, copy);
+    val[copy] = '\0';
+    return copy == len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r) {
+    return r == NULL ? -1 : ((sim_req_aux_t *)r->aux)->fd;
+}
+
+esp_err_t httpd_queue_work(
+    httpd_handle_t handle, httpd_work_fn_t work, void *arg) {
+    sim_httpd_t *server = (sim_httpd_t *)handle;
+    if (server == NULL || work == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&server->mutex));
+    bool full = server->work_count == SIM_HTTPD_WORK_MAX;
+    if (!full) {
+        int at = (server->work_head + server->work_count++) %
+                 SIM_HTTPD_WORK_MAX;
+        server->work[at] = (sim_httpd_work_t){.work = work, .arg = arg};
+    }
+    POSIX_EC(pthread_mutex_unlock(&server->mutex));
+    if (full) {
+        return ESP_FAIL;
+    }
+    char wake = SIM_HTTPD_WAKE_WORK;
+    POSIX_EC(write(server->wake_pipe[1], &wake, 1));
+    return ESP_OK;
+}
+
+// The server task finds the socket shut on its next read and closes it.
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd) {
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    shutdown(sockfd, SHUT_RDWR);
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_recv_frame(
+    httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len) {
+    if (req == NULL || pkt == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_req_aux_t *aux = (sim_req_aux_t *)req->aux;
+    pkt->final = aux->ws_final;
+    pkt->fragmented = !aux->ws_final;
+    pkt->type = aux->ws_type;
+    if (max_len == 0) {
+        // Only the length, the payload is read by the next call.
+        pkt->len = aux->ws_len;
+        return ESP_OK;
+    }
+    if (pkt->payload == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t len = max_len < aux->ws_len ? max_len : aux->ws_len;
+    if (!ws_read(aux, pkt->payload, len)) {
+        return ESP_FAIL;
+    }
+    pkt->len = len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_frame_async(
+    httpd_handle_t hd, int fd, httpd_ws_frame_t *frame) {
+    if (hd == NULL || frame == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool final = !frame->fragmented || frame->final;
+    return ws_send(fd, final, frame->type, frame->payload, frame->len)
+               ? ESP_OK
+               : ESP_FAIL;
+}
+
+// Only from the server task, e.g. in work from httpd_queue_work.
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd) {
+    sim_httpd_t *server = (sim_httpd_t *)hd;
+    if (server == NULL) {
+        return HTTPD_WS_CLIENT_INVALID;
+    }
+    for (int i = 0; i < server->client_count; i++) {
+        if (server->clients[i] == fd) {
+            return server->websocket[i] ? HTTPD_WS_CLIENT_WEBSOCKET
+                                        : HTTPD_WS_CLIENT_HTTP;
+        }
+    }
+    return HTTPD_WS_CLIENT_INVALID;
+}
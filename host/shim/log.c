@@ -0,0 +1,58 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+esp_log_level_t sim_log_level = ESP_LOG_INFO;
+
+static const char LEVEL_LETTERS[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    (void)tag;
+    (void)level;
+}
+
+void esp_log_write(
+    esp_log_level_t level, const char *tag, const char *format, ...) {
+    // Same layout as the device console, one fprintf per line so lines from
+    // different threads don't interleave.
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    fprintf(
+        stderr,
+        "%c (%lld) %s: %s\n",
+        LEVEL_LETTERS[level],
+        (long long)sim_now_ms(),
+        tag,
+        line);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
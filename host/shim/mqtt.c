@@ -0,0 +1,48 @@
+#include "esp_log.h"
+#include "mqtt_client.h"
+
+#include <stdlib.h>
+
+static const char *TAG = "sim_mqtt";
+
+esp_mqtt_client_handle_t
+esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    (void)config;
+    ESP_LOGE(TAG, "MQTT isn't simulated, use an HTTP target!");
+    abort();
+}
+
+// The rest can't be reached without a client.
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    abort();
+}
+
+int esp_mqtt_client_publish(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain) {
+    abort();
+}
+
+int esp_mqtt_client_enqueue(
+    esp_mqtt_client_handle_t client,
+    const char *topic,
+    const char *data,
+    int len,
+    int qos,
+    int retain,
+    bool store) {
+    abort();
+}
+
+esp_err_t esp_mqtt_client_register_event(
+    esp_mqtt_client_handle_t client,
+    esp_mqtt_event_id_t event,
+    esp_event_handler_t handler,
+    void *handler_arg) {
+    abort();
+}
@@ -0,0 +1,59 @@
+#include "esp_netif.h"
+#include "esp_wifi_default.h"
+
+// Interfaces only exist so the application gets non NULL handles back.
+struct esp_netif_obj {
+    esp_netif_ip_info_t ip_info;
+    bool dhcps_running;
+};
+
+static struct esp_netif_obj glob_ap_netif;
+static struct esp_netif_obj glob_sta_netif;
+
+esp_err_t esp_netif_init(void) {
+    return ESP_OK;
+}
+
+void esp_netif_set_ip4_addr(
+    esp_ip4_addr_t *addr, uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    // lwIP keeps addresses in network byte order.
+    addr->addr = (uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 |
+                 (uint32_t)d << 24;
+}
+
+esp_err_t esp_netif_dhcps_start(esp_netif_t *netif) {
+    if (netif == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    netif->dhcps_running = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *netif) {
+    if (netif == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    netif->dhcps_running = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(
+    esp_netif_t *netif, const esp_netif_ip_info_t *ip_info) {
+    if (netif == NULL || ip_info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Same as the device, the address can't change under a running server.
+    if (netif->dhcps_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    netif->ip_info = *ip_info;
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_ap(void) {
+    return &glob_ap_netif;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+    return &glob_sta_netif;
+}
@@ -0,0 +1,138 @@
+#include "esp_log.h"
+#include "nvs.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define SIM_NVS_NAMESPACES_MAX 8
+#define SIM_NVS_KEYS_MAX 32
+// Same limit as the device.
+#define SIM_NVS_NAME_SIZE 16
+
+static const char *TAG = "sim_nvs";
+
+typedef struct sim_nvs_key_t {
+    // Handle of the namespace, 0 for a free key.
+    nvs_handle_t ns;
+    char name[SIM_NVS_NAME_SIZE];
+    uint64_t value;
+} sim_nvs_key_t;
+
+typedef struct sim_nvs_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    // Handles are the index of the namespace plus one.
+    char namespaces[SIM_NVS_NAMESPACES_MAX][SIM_NVS_NAME_SIZE];
+    int namespace_count;
+    sim_nvs_key_t keys[SIM_NVS_KEYS_MAX];
+} sim_nvs_t;
+
+static sim_nvs_t glob_nvs = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *out) {
+    if (ns == NULL || out == NULL || strlen(ns) >= SIM_NVS_NAME_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_nvs_t *nvs = &glob_nvs;
+    esp_err_t err = ESP_OK;
+    POSIX_EC(pthread_mutex_lock(&nvs->mutex));
+    int i = 0;
+    while (i < nvs->namespace_count && strcmp(nvs->namespaces[i], ns) != 0) {
+        i++;
+    }
+    if (i == nvs->namespace_count) {
+        if (i == SIM_NVS_NAMESPACES_MAX) {
+            ESP_LOGE(TAG, "Too many namespaces!");
+            err = ESP_ERR_NO_MEM;
+        } else {
+            strcpy(nvs->namespaces[i], ns);
+            nvs->namespace_count++;
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&nvs->mutex));
+    *out = i + 1;
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    (void)handle;
+    return ESP_OK;
+}
+
+// The key, or a free one to set it in if create, NULL if there is neither.
+// Called with the mutex held.
+static sim_nvs_key_t *
+find_key(nvs_handle_t handle, const char *name, bool create) {
+    sim_nvs_key_t *free_key = NULL;
+    for (int i = 0; i < SIM_NVS_KEYS_MAX; i++) {
+        sim_nvs_key_t *key = &glob_nvs.keys[i];
+        if (key->ns == handle && strcmp(key->name, name) == 0) {
+            return key;
+        }
+        if (key->ns == 0 && free_key == NULL) {
+            free_key = key;
+        }
+    }
+    return create ? free_key : NULL;
+}
+
+static esp_err_t
+set_key(nvs_handle_t handle, const char *name, uint64_t value) {
+    if (name == NULL || strlen(name) >= SIM_NVS_NAME_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_nvs_t *nvs = &glob_nvs;
+    POSIX_EC(pthread_mutex_lock(&nvs->mutex));
+    sim_nvs_key_t *key = find_key(handle, name, true);
+    if (key != NULL) {
+        key->ns = handle;
+        strcpy(key->name, name);
+        key->value = value;
+    }
+    POSIX_EC(pthread_mutex_unlock(&nvs->mutex));
+    return key != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t
+get_key(nvs_handle_t handle, const char *name, uint64_t *value) {
+    if (name == NULL || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_nvs_t *nvs = &glob_nvs;
+    POSIX_EC(pthread_mutex_lock(&nvs->mutex));
+    sim_nvs_key_t *key = find_key(handle, name, false);
+    if (key != NULL) {
+        *value = key->value;
+    }
+    POSIX_EC(pthread_mutex_unlock(&nvs->mutex));
+    return key != NULL ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    return set_key(handle, key, value);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value) {
+    NPC(value);
+    uint64_t stored = 0;
+    esp_err_t err = get_key(handle, key, &stored);
+    if (err == ESP_OK) {
+        *value = (uint32_t)stored;
+    }
+    return err;
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value) {
+    return set_key(handle, key, value);
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value) {
+    return get_key(handle, key, value);
+}
@@ -0,0 +1,211 @@
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "sim.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Typical figures of the SPI flash the devices ship with.
+#define SIM_FLASH_SECTOR_SIZE 4096
+#define SIM_FLASH_ERASE_US 45000
+#define SIM_FLASH_PAGE_SIZE 256
+#define SIM_FLASH_PAGE_US 700
+#define SIM_SLOT_SIZE (1024 * 1024)
+#define SIM_IMAGE_MAGIC 0xE9
+
+static const char *TAG = "sim_ota";
+
+typedef struct sim_ota_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    esp_partition_t slots[2];
+    esp_ota_img_states_t states[2];
+    uint8_t data[2][SIM_SLOT_SIZE];
+    int running;
+    int boot;
+    // The update in progress, -1 for none.
+    int writing;
+    size_t written;
+    size_t image_len;
+} sim_ota_t;
+
+static sim_ota_t glob_ota = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .slots =
+        {
+            {
+                .subtype = 0x10,
+                .address = 0x10000,
+                .size = SIM_SLOT_SIZE,
+                .label = "ota_0",
+            },
+            {
+                .subtype = 0x11,
+                .address = 0x110000,
+                .size = SIM_SLOT_SIZE,
+                .label = "ota_1",
+            },
+        },
+    .states = {ESP_OTA_IMG_VALID, ESP_OTA_IMG_UNDEFINED},
+    .writing = -1,
+};
+
+static int slot_index(const esp_partition_t *partition) {
+    for (int i = 0; i < 2; i++) {
+        if (partition == &glob_ota.slots[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return &glob_ota.slots[glob_ota.running];
+}
+
+const esp_partition_t *
+esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    return &glob_ota.slots[1 - glob_ota.running];
+}
+
+esp_err_t esp_ota_begin(
+    const esp_partition_t *partition,
+    size_t image_size,
+    esp_ota_handle_t *out_handle) {
+    int slot = slot_index(partition);
+    if (slot < 0 || slot == glob_ota.running || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (image_size != OTA_WITH_SEQUENTIAL_WRITES) {
+        // Only sequential writes are simulated, they erase as they go.
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    esp_err_t err = ESP_OK;
+    if (glob_ota.writing >= 0) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        glob_ota.writing = slot;
+        glob_ota.written = 0;
+        glob_ota.states[slot] = ESP_OTA_IMG_UNDEFINED;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    *out_handle = 1;
+    return err;
+}
+
+esp_err_t
+esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+    if (data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    int slot = glob_ota.writing;
+    size_t at = glob_ota.written;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    if (slot < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint8_t *bytes = data;
+    if (at == 0 && size > 0 && bytes[0] != SIM_IMAGE_MAGIC) {
+        ESP_LOGW(TAG, "Image doesn't start with the app image magic");
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    if (size > SIM_SLOT_SIZE - at) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Sectors are erased when the write first reaches them.
+    size_t sectors = (at + size + SIM_FLASH_SECTOR_SIZE - 1) /
+                         SIM_FLASH_SECTOR_SIZE -
+                     (at + SIM_FLASH_SECTOR_SIZE - 1) / SIM_FLASH_SECTOR_SIZE;
+    size_t pages = (size + SIM_FLASH_PAGE_SIZE - 1) / SIM_FLASH_PAGE_SIZE;
+    sim_sleep_ms(
+        (sectors * SIM_FLASH_ERASE_US + pages * SIM_FLASH_PAGE_US) / 1000);
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    memcpy(glob_ota.data[slot] + at, data, size);
+    glob_ota.written = at + size;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    int slot = glob_ota.writing;
+    esp_err_t err = ESP_OK;
+    if (slot < 0) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (glob_ota.written == 0) {
+        err = ESP_ERR_OTA_VALIDATE_FAILED;
+    } else {
+        glob_ota.states[slot] = ESP_OTA_IMG_NEW;
+        glob_ota.image_len = glob_ota.written;
+    }
+    glob_ota.writing = -1;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return err;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    glob_ota.writing = -1;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    int slot = slot_index(partition);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    esp_err_t err = ESP_OK;
+    if (glob_ota.states[slot] == ESP_OTA_IMG_NEW ||
+        glob_ota.states[slot] == ESP_OTA_IMG_VALID) {
+        glob_ota.boot = slot;
+    } else {
+        err = ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return err;
+}
+
+esp_err_t esp_ota_get_state_partition(
+    const esp_partition_t *partition, esp_ota_img_states_t *ota_state) {
+    int slot = slot_index(partition);
+    if (slot < 0 || ota_state == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    *ota_state = glob_ota.states[slot];
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return *ota_state == ESP_OTA_IMG_UNDEFINED ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void) {
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    glob_ota.states[glob_ota.running] = ESP_OTA_IMG_VALID;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+    return ESP_OK;
+}
+
+void sim_ota_boot_image(const uint8_t **data, size_t *len) {
+    NPC(data);
+    NPC(len);
+    POSIX_EC(pthread_mutex_lock(&glob_ota.mutex));
+    bool updated = glob_ota.boot != glob_ota.running;
+    *data = updated ? glob_ota.data[glob_ota.boot] : NULL;
+    *len = updated ? glob_ota.image_len : 0;
+    POSIX_EC(pthread_mutex_unlock(&glob_ota.mutex));
+}
+
+const esp_app_desc_t *esp_app_get_description(void) {
+    static const esp_app_desc_t desc = {
+        .version = "sim",
+        .project_name = "level-sensor",
+    };
+    return &desc;
+}
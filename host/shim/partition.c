@@ -0,0 +1,98 @@
+#include "esp_partition.h"
+#include "sim.h"
+#include "util.h"
+
+#include <string.h>
+
+#define SIM_PARTITIONS_MAX 8
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+static const char *TAG = "sim_partition";
+
+static esp_partition_t glob_partitions[SIM_PARTITIONS_MAX];
+static int glob_partition_count = 0;
+
+void sim_partition_add(
+    const char *label,
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    uint8_t *data,
+    size_t size) {
+    NPC(label);
+    NPC(data);
+    if (glob_partition_count >= SIM_PARTITIONS_MAX) {
+        ESP_LOGE(TAG, "Too many partitions!");
+        abort();
+    }
+    esp_partition_t *part = &glob_partitions[glob_partition_count++];
+    memset(part, 0, sizeof(esp_partition_t));
+    part->type = type;
+    part->subtype = subtype;
+    part->size = size;
+    strncpy(part->label, label, sizeof(part->label) - 1);
+    part->data = data;
+}
+
+const esp_partition_t *esp_partition_find_first(
+    esp_partition_type_t type,
+    esp_partition_subtype_t subtype,
+    const char *label) {
+    for (int i = 0; i < glob_partition_count; i++) {
+        esp_partition_t *part = &glob_partitions[i];
+        if (part->type == type && part->subtype == subtype &&
+            (label == NULL || strcmp(part->label, label) == 0)) {
+            return part;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(
+    const esp_partition_t *partition,
+    size_t src_offset,
+    void *dst,
+    size_t size) {
+    if (partition == NULL || dst == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, partition->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition,
+    size_t dst_offset,
+    const void *src,
+    size_t size) {
+    if (partition == NULL || src == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dst_offset > partition->size || size > partition->size - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Programming can only clear bits.
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++) {
+        partition->data[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t *partition, size_t offset, size_t size) {
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset % SIM_FLASH_SECTOR_SIZE != 0 ||
+        size % SIM_FLASH_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(partition->data + offset, 0xFF, size);
+    return ESP_OK;
+}
@@ -0,0 +1,418 @@
+#include "esp_crt_bundle.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "sim.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The mbedtls client calls of tls.c over OpenSSL. The handshake runs on a
+// non-blocking socket, one flight per mbedtls_ssl_handshake_step, so tls.c
+// samples the heap between flights like on the device. The heap is
+// OpenSSL's, counted through CRYPTO_set_mem_functions, and what
+// esp_get_free_heap_size reports goes down by it.
+
+// In front of every OpenSSL allocation, keeps the size for the count and
+// the alignment of malloc.
+#define PREFIX 16
+
+static atomic_llong glob_heap_used;
+
+static void *counted_malloc(size_t size, const char *file, int line) {
+    uint8_t *block = malloc(size + PREFIX);
+    if (block == NULL) {
+        return NULL;
+    }
+    memcpy(block, &size, sizeof(size));
+    atomic_fetch_add(&glob_heap_used, (long long)size);
+    return block + PREFIX;
+}
+
+static void counted_free(void *ptr, const char *file, int line) {
+    if (ptr == NULL) {
+        return;
+    }
+    uint8_t *block = (uint8_t *)ptr - PREFIX;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    atomic_fetch_sub(&glob_heap_used, (long long)size);
+    free(block);
+}
+
+static void *
+counted_realloc(void *ptr, size_t size, const char *file, int line) {
+    if (ptr == NULL) {
+        return counted_malloc(size, file, line);
+    }
+    uint8_t *block = (uint8_t *)ptr - PREFIX;
+    size_t old;
+    memcpy(&old, block, sizeof(old));
+    uint8_t *moved = realloc(block, size + PREFIX);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, &size, sizeof(size));
+    atomic_fetch_add(&glob_heap_used, (long long)size - (long long)old);
+    return moved + PREFIX;
+}
+
+size_t sim_tls_heap_used() { return (size_t)atomic_load(&glob_heap_used); }
+
+// Before OpenSSL allocates anything, it refuses the functions after.
+static void count_heap() {
+    static atomic_bool done;
+    if (!atomic_exchange(&done, true)) {
+        CRYPTO_set_mem_functions(
+            counted_malloc,
+            counted_realloc,
+            counted_free);
+    }
+}
+
+void mbedtls_entropy_init(mbedtls_entropy_context *ctx) {}
+
+void mbedtls_entropy_free(mbedtls_entropy_context *ctx) {}
+
+int mbedtls_entropy_func(void *data, unsigned char *output, size_t len) {
+    return RAND_bytes(output, (int)len) == 1 ? 0 : -1;
+}
+
+void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx) {}
+
+void mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx) {}
+
+int mbedtls_ctr_drbg_seed(
+    mbedtls_ctr_drbg_context *ctx,
+    int (*f_entropy)(void *, unsigned char *, size_t),
+    void *p_entropy,
+    const unsigned char *custom,
+    size_t len) {
+    return 0;
+}
+
+int mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t len) {
+    return RAND_bytes(output, (int)len) == 1 ? 0 : -1;
+}
+
+void mbedtls_net_init(mbedtls_net_context *ctx) { ctx->fd = -1; }
+
+int mbedtls_net_connect(
+    mbedtls_net_context *ctx, const char *host, const char *port, int proto) {
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *found = NULL;
+    if (getaddrinfo(host, port, &hints, &found) != 0) {
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+    }
+    int ret = MBEDTLS_ERR_NET_CONNECT_FAILED;
+    for (struct addrinfo *a = found; a != NULL; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            ret = MBEDTLS_ERR_NET_SOCKET_FAILED;
+            continue;
+        }
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            ctx->fd = fd;
+            ret = 0;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(found);
+    return ret;
+}
+
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len) {
+    ssize_t n = send(((mbedtls_net_context *)ctx)->fd, buf, len, 0);
+    return n < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : (int)n;
+}
+
+int mbedtls_net_recv_timeout(
+    void *ctx, unsigned char *buf, size_t len, uint32_t timeout) {
+    struct pollfd pfd = {.fd = ((mbedtls_net_context *)ctx)->fd};
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout == 0 ? -1 : (int)timeout) == 0) {
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    ssize_t n = recv(pfd.fd, buf, len, 0);
+    return n < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : (int)n;
+}
+
+void mbedtls_net_free(mbedtls_net_context *ctx) {
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+    }
+    ctx->fd = -1;
+}
+
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf) {
+    memset(conf, 0, sizeof(*conf));
+}
+
+int mbedtls_ssl_config_defaults(
+    mbedtls_ssl_config *conf, int endpoint, int transport, int preset) {
+    count_heap();
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    // Sessions are only resumed from what tls.c saved.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    conf->ctx = ctx;
+    return 0;
+}
+
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode) {
+    SSL_CTX_set_verify(
+        conf->ctx,
+        authmode == MBEDTLS_SSL_VERIFY_REQUIRED ? SSL_VERIFY_PEER
+                                                : SSL_VERIFY_NONE,
+        NULL);
+}
+
+void mbedtls_ssl_conf_rng(
+    mbedtls_ssl_config *conf,
+    int (*f_rng)(void *, unsigned char *, size_t),
+    void *p_rng) {}
+
+void mbedtls_ssl_conf_read_timeout(mbedtls_ssl_config *conf, uint32_t timeout) {
+    conf->read_timeout = timeout;
+}
+
+void mbedtls_ssl_conf_session_tickets(
+    mbedtls_ssl_config *conf, int use_tickets) {
+    if (use_tickets == MBEDTLS_SSL_SESSION_TICKETS_ENABLED) {
+        SSL_CTX_clear_options(conf->ctx, SSL_OP_NO_TICKET);
+    } else {
+        SSL_CTX_set_options(conf->ctx, SSL_OP_NO_TICKET);
+    }
+}
+
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf) {
+    SSL_CTX_free(conf->ctx);
+    conf->ctx = NULL;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    SSL_CTX *ctx = ((mbedtls_ssl_config *)conf)->ctx;
+    int ok = glob_sim.ca_file != NULL
+                 ? SSL_CTX_load_verify_locations(ctx, glob_sim.ca_file, NULL)
+                 : SSL_CTX_set_default_verify_paths(ctx);
+    return ok == 1 ? ESP_OK : ESP_FAIL;
+}
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl) {
+    memset(ssl, 0, sizeof(*ssl));
+    ssl->fd = -1;
+}
+
+int mbedtls_ssl_setup(
+    mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf) {
+    ssl->conf = conf;
+    ssl->ssl = SSL_new(conf->ctx);
+    if (ssl->ssl == NULL) {
+        return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    }
+    SSL_set_connect_state(ssl->ssl);
+    return 0;
+}
+
+// Checked against the certificate like mbedtls does, names go in the SNI
+// too.
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname) {
+    X509_VERIFY_PARAM *param = SSL_get0_param(ssl->ssl);
+    ASN1_OCTET_STRING *ip = a2i_IPADDRESS(hostname);
+    if (ip != NULL) {
+        ASN1_OCTET_STRING_free(ip);
+        return X509_VERIFY_PARAM_set1_ip_asc(param, hostname) == 1
+                   ? 0
+                   : MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    if (SSL_set_tlsext_host_name(ssl->ssl, hostname) != 1 ||
+        X509_VERIFY_PARAM_set1_host(param, hostname, 0) != 1) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    return 0;
+}
+
+int mbedtls_ssl_set_session(
+    mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session) {
+    return SSL_set_session(ssl->ssl, session->session) == 1
+               ? 0
+               : MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+}
+
+// OpenSSL does its own I/O on the socket, the callbacks go unused.
+void mbedtls_ssl_set_bio(
+    mbedtls_ssl_context *ssl,
+    void *p_bio,
+    mbedtls_ssl_send_t *f_send,
+    mbedtls_ssl_recv_t *f_recv,
+    mbedtls_ssl_recv_timeout_t *f_recv_timeout) {
+    ssl->fd = ((mbedtls_net_context *)p_bio)->fd;
+    SSL_set_fd(ssl->ssl, ssl->fd);
+}
+
+static void set_nonblocking(int fd, bool nonblocking) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+// The closest mbedtls state: SERVER_HELLO while the server hasn't answered,
+// SERVER_CERTIFICATE once it answered with a full handshake. A resumed
+// handshake never goes through the certificate.
+static int progress(SSL *s) {
+    OSSL_HANDSHAKE_STATE at = SSL_get_state(s);
+    if (at == TLS_ST_BEFORE || at == TLS_ST_CW_CLNT_HELLO ||
+        SSL_session_reused(s)) {
+        return MBEDTLS_SSL_SERVER_HELLO;
+    }
+    return MBEDTLS_SSL_SERVER_CERTIFICATE;
+}
+
+// Runs the handshake until it has to wait for the server's next flight.
+int mbedtls_ssl_handshake_step(mbedtls_ssl_context *ssl) {
+    SSL *s = ssl->ssl;
+    if (ssl->state == MBEDTLS_SSL_HELLO_REQUEST) {
+        set_nonblocking(ssl->fd, true);
+        ssl->state = MBEDTLS_SSL_CLIENT_HELLO;
+    }
+    while (true) {
+        int ret = SSL_do_handshake(s);
+        if (ret == 1 && ssl->state != MBEDTLS_SSL_SERVER_CERTIFICATE &&
+            !SSL_session_reused(s)) {
+            // The rest of a full handshake came in without a wait, the next
+            // step ends it.
+            ssl->state = MBEDTLS_SSL_SERVER_CERTIFICATE;
+            return 0;
+        }
+        if (ret == 1) {
+            set_nonblocking(ssl->fd, false);
+            ssl->state = MBEDTLS_SSL_HANDSHAKE_OVER;
+            return 0;
+        }
+        int err = SSL_get_error(s, ret);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            long verify = SSL_get_verify_result(s);
+            ERR_clear_error();
+            set_nonblocking(ssl->fd, false);
+            return verify != X509_V_OK ? MBEDTLS_ERR_X509_CERT_VERIFY_FAILED
+                                       : MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+        }
+        int state = progress(s);
+        if (state != ssl->state) {
+            ssl->state = state;
+            return 0;
+        }
+        struct pollfd pfd = {
+            .fd = ssl->fd,
+            .events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT,
+        };
+        if (poll(&pfd, 1, (int)ssl->conf->read_timeout) == 0) {
+            set_nonblocking(ssl->fd, false);
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+    }
+}
+
+int mbedtls_ssl_is_handshake_over(mbedtls_ssl_context *ssl) {
+    return ssl->state == MBEDTLS_SSL_HANDSHAKE_OVER;
+}
+
+int mbedtls_ssl_get_session(
+    const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session) {
+    session->session = SSL_get1_session(ssl->ssl);
+    return session->session != NULL ? 0 : MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+}
+
+static int io_error(mbedtls_ssl_context *ssl, int ret) {
+    int err = SSL_get_error(ssl->ssl, ret);
+    ERR_clear_error();
+    if (err == SSL_ERROR_ZERO_RETURN) {
+        return MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+    }
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    return MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+int mbedtls_ssl_write(
+    mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len) {
+    int ret = SSL_write(ssl->ssl, buf, (int)len);
+    return ret > 0 ? ret : io_error(ssl, ret);
+}
+
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len) {
+    struct pollfd pfd = {.fd = ssl->fd, .events = POLLIN};
+    if (SSL_pending(ssl->ssl) == 0 &&
+        poll(&pfd, 1, (int)ssl->conf->read_timeout) == 0) {
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    int ret = SSL_read(ssl->ssl, buf, (int)len);
+    return ret > 0 ? ret : io_error(ssl, ret);
+}
+
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl) {
+    if (ssl->ssl == NULL || ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        return 0;
+    }
+    SSL_shutdown(ssl->ssl);
+    ERR_clear_error();
+    return 0;
+}
+
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl) {
+    SSL_free(ssl->ssl);
+    mbedtls_ssl_init(ssl);
+}
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session) {
+    session->session = NULL;
+}
+
+int mbedtls_ssl_session_save(
+    const mbedtls_ssl_session *session,
+    unsigned char *buf,
+    size_t buf_len,
+    size_t *olen) {
+    int len = i2d_SSL_SESSION(session->session, NULL);
+    *olen = len > 0 ? (size_t)len : 0;
+    if (len <= 0) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    if ((size_t)len > buf_len) {
+        return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+    }
+    i2d_SSL_SESSION(session->session, &buf);
+    return 0;
+}
+
+int mbedtls_ssl_session_load(
+    mbedtls_ssl_session *session, const unsigned char *buf, size_t len) {
+    session->session = d2i_SSL_SESSION(NULL, &buf, (long)len);
+    return session->session != NULL ? 0 : MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+}
+
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session) {
+    SSL_SESSION_free(session->session);
+    session->session = NULL;
+}
@@ -0,0 +1,469 @@
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "sim.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_APS_MAX 16
+#define SIM_LINE_MAX 256
+
+static const char *TAG = "sim_wifi";
+
+// Scan results and how connecting to each network plays out. The format is
+// described in host/scenario.txt.
+typedef struct sim_ap_t {
+    wifi_ap_record_t record;
+    char password[MAX_PASSPHRASE_LEN];
+    // Connecting fails with this reason, 0 for none.
+    uint8_t fail_reason;
+    // Only the first this many attempts fail, 0 for all of them.
+    int fail_attempts;
+    // The link drops with this reason some time after associating, 0 for
+    // never.
+    uint8_t drop_reason;
+    int64_t drop_after_ms;
+    int attempts;
+} sim_ap_t;
+
+typedef struct sim_wifi_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    sim_ap_t aps[SIM_APS_MAX];
+    int ap_count;
+    uint8_t badpsk_reason;
+    int64_t scan_ms;
+    int64_t connect_ms;
+    // Negative never hands out an address.
+    int64_t dhcp_ms;
+    bool initialized;
+    bool started;
+    wifi_config_t sta_config;
+    // Bumped by every connect and disconnect, an attempt that sees it move
+    // has been called off and stays quiet.
+    uint32_t generation;
+} sim_wifi_t;
+
+static sim_wifi_t glob_wifi = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *DEFAULT_SCENARIO[] = {
+    "ap HomeNetwork -48 wpa2 correct-horse",
+    "ap HomeNetwork -71 wpa2 correct-horse",
+    "ap Neighbour -63 wpa2 hunter22",
+    "ap CoffeeShop -77 open",
+    "ap - -52 wpa2",
+    "scan_ms 1500",
+    "connect_ms 800",
+    "dhcp_ms 1200",
+    NULL,
+};
+
+static wifi_auth_mode_t parse_authmode(const char *name) {
+    if (strcmp(name, "open") == 0) {
+        return WIFI_AUTH_OPEN;
+    } else if (strcmp(name, "wpa2") == 0) {
+        return WIFI_AUTH_WPA2_PSK;
+    } else if (strcmp(name, "wpa3") == 0) {
+        return WIFI_AUTH_WPA3_PSK;
+    }
+    ESP_LOGE(TAG, "Unknown auth mode %s!", name);
+    abort();
+}
+
+// SSIDs can't hold whitespace in the scenario, underscores stand in for it.
+static void parse_ssid(const char *token, uint8_t *ssid, size_t size) {
+    memset(ssid, 0, size);
+    if (strcmp(token, "-") == 0) {
+        return;
+    }
+    for (size_t i = 0; token[i] != '\0' && i < size - 1; i++) {
+        ssid[i] = token[i] == '_' ? ' ' : token[i];
+    }
+}
+
+static sim_ap_t *find_ap(sim_wifi_t *wifi, const uint8_t *ssid) {
+    for (int i = 0; i < wifi->ap_count; i++) {
+        sim_ap_t *ap = &wifi->aps[i];
+        if (ap->record.ssid[0] != '\0' &&
+            strncmp((char *)ap->record.ssid, (char *)ssid, MAX_SSID_LEN) ==
+                0) {
+            return ap;
+        }
+    }
+    return NULL;
+}
+
+static void parse_scenario_line(sim_wifi_t *wifi, char *line) {
+    char *cursor = line;
+    char *key = strtok_r(cursor, " \t\r\n", &cursor);
+    if (key == NULL || key[0] == '#') {
+        return;
+    }
+    char *args[4] = {NULL};
+    int argc = 0;
+    while (argc < 4 && (args[argc] = strtok_r(NULL, " \t\r\n", &cursor))) {
+        argc++;
+    }
+
+    if (strcmp(key, "ap") == 0 && argc >= 3) {
+        if (wifi->ap_count >= SIM_APS_MAX) {
+            ESP_LOGE(TAG, "Too many access points in scenario!");
+            abort();
+        }
+        sim_ap_t *ap = &wifi->aps[wifi->ap_count++];
+        memset(ap, 0, sizeof(sim_ap_t));
+        parse_ssid(args[0], ap->record.ssid, sizeof(ap->record.ssid));
+        ap->record.rssi = (int8_t)atoi(args[1]);
+        ap->record.authmode = parse_authmode(args[2]);
+        ap->record.primary = 1 + wifi->ap_count % 11;
+        if (argc >= 4) {
+            strncpy(ap->password, args[3], sizeof(ap->password) - 1);
+        }
+    } else if (
+        (strcmp(key, "fail") == 0 || strcmp(key, "drop") == 0) &&
+        argc >= 2) {
+        uint8_t ssid[MAX_SSID_LEN + 1];
+        parse_ssid(args[0], ssid, sizeof(ssid));
+        // Applies to every access point with the SSID, the strongest one is
+        // the one that gets used anyway.
+        bool found = false;
+        for (int i = 0; i < wifi->ap_count; i++) {
+            sim_ap_t *ap = &wifi->aps[i];
+            if (strcmp((char *)ap->record.ssid, (char *)ssid) != 0) {
+                continue;
+            }
+            found = true;
+            if (key[0] == 'f') {
+                ap->fail_reason = (uint8_t)atoi(args[1]);
+                ap->fail_attempts = argc >= 3 ? atoi(args[2]) : 0;
+            } else {
+                ap->drop_reason = (uint8_t)atoi(args[1]);
+                ap->drop_after_ms = argc >= 3 ? atoll(args[2]) : 0;
+            }
+        }
+        if (!found) {
+            ESP_LOGE(TAG, "%s for unknown network %s!", key, args[0]);
+            abort();
+        }
+    } else if (strcmp(key, "badpsk_reason") == 0 && argc >= 1) {
+        wifi->badpsk_reason = (uint8_t)atoi(args[0]);
+    } else if (strcmp(key, "scan_ms") == 0 && argc >= 1) {
+        wifi->scan_ms = atoll(args[0]);
+    } else if (strcmp(key, "connect_ms") == 0 && argc >= 1) {
+        wifi->connect_ms = atoll(args[0]);
+    } else if (strcmp(key, "dhcp_ms") == 0 && argc >= 1) {
+        wifi->dhcp_ms = atoll(args[0]);
+    } else {
+        ESP_LOGE(TAG, "Can't parse scenario line starting with %s!", key);
+        abort();
+    }
+}
+
+static int compare_rssi(const void *a, const void *b) {
+    return ((const sim_ap_t *)b)->record.rssi -
+           ((const sim_ap_t *)a)->record.rssi;
+}
+
+void sim_wifi_load_scenario(const char *path) {
+    sim_wifi_t *wifi = &glob_wifi;
+    POSIX_EC(pthread_mutex_lock(&wifi->mutex));
+    wifi->ap_count = 0;
+    wifi->badpsk_reason = WIFI_REASON_AUTH_FAIL;
+    wifi->scan_ms = 0;
+    wifi->connect_ms = 0;
+    wifi->dhcp_ms = 0;
+
+    char line[SIM_LINE_MAX];
+    if (path == NULL) {
+        for (int i = 0; DEFAULT_SCENARIO[i] != NULL; i++) {
+            strncpy(line, DEFAULT_SCENARIO[i], sizeof(line) - 1);
+            line[sizeof(line) - 1] = '\0';
+            parse_scenario_line(wifi, line);
+        }
+    } else {
+        FILE *file = fopen(path, "r");
+        NPC(file);
+        while (fgets(line, sizeof(line), file) != NULL) {
+            parse_scenario_line(wifi, line);
+        }
+        fclose(file);
+    }
+
+    // The driver reports the strongest networks first.
+    qsort(wifi->aps, wifi->ap_count, sizeof(sim_ap_t), compare_rssi);
+    ESP_LOGI(
+        TAG,
+        "Scenario has %d networks, scan %lld ms, connect %lld ms, DHCP %lld "
+        "ms",
+        wifi->ap_count,
+        (long long)wifi->scan_ms,
+        (long long)wifi->connect_ms,
+        (long long)wifi->dhcp_ms);
+    POSIX_EC(pthread_mutex_unlock(&wifi->mutex));
+}
+
+static bool attempt_current(uintptr_t generation) {
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    bool current = glob_wifi.generation == generation;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    return current;
+}
+
+static void post_disconnected(const uint8_t *ssid, uint8_t reason) {
+    wifi_event_sta_disconnected_t event = {
+        .reason = reason,
+    };
+    memcpy(event.ssid, ssid, sizeof(event.ssid));
+    event.ssid_len = strnlen((char *)event.ssid, sizeof(event.ssid));
+    ESP_EC(esp_event_post(
+        WIFI_EVENT,
+        WIFI_EVENT_STA_DISCONNECTED,
+        &event,
+        sizeof(event),
+        portMAX_DELAY));
+}
+
+// One connection attempt, from association to DHCP.
+static void *connect_task(void *arg) {
+    uintptr_t generation = (uintptr_t)arg;
+    sim_wifi_t *wifi = &glob_wifi;
+    POSIX_EC(pthread_mutex_lock(&wifi->mutex));
+    wifi_sta_config_t config = wifi->sta_config.sta;
+    int64_t connect_ms = wifi->connect_ms;
+    int64_t dhcp_ms = wifi->dhcp_ms;
+    sim_ap_t *ap = find_ap(wifi, config.ssid);
+    wifi_ap_record_t record = {0};
+    uint8_t reason = 0;
+    uint8_t drop_reason = 0;
+    int64_t drop_after_ms = 0;
+    if (ap == NULL) {
+        reason = WIFI_REASON_NO_AP_FOUND;
+    } else {
+        ap->attempts++;
+        if (ap->fail_reason != 0 &&
+            (ap->fail_attempts == 0 || ap->attempts <= ap->fail_attempts)) {
+            reason = ap->fail_reason;
+        } else if (
+            ap->record.authmode != WIFI_AUTH_OPEN &&
+            strncmp(
+                ap->password,
+                (char *)config.password,
+                MAX_PASSPHRASE_LEN) != 0) {
+            reason = wifi->badpsk_reason;
+        }
+        record = ap->record;
+        drop_reason = ap->drop_reason;
+        drop_after_ms = ap->drop_after_ms;
+    }
+    POSIX_EC(pthread_mutex_unlock(&wifi->mutex));
+
+    sim_sleep_ms(connect_ms);
+    if (!attempt_current(generation)) {
+        return NULL;
+    }
+    if (reason != 0) {
+        ESP_LOGI(
+            TAG,
+            "Connecting to %s failed, reason %d",
+            config.ssid,
+            reason);
+        post_disconnected(config.ssid, reason);
+        return NULL;
+    }
+
+    wifi_event_sta_connected_t connected = {
+        .channel = record.primary,
+        .authmode = record.authmode,
+    };
+    memcpy(connected.ssid, config.ssid, sizeof(connected.ssid));
+    connected.ssid_len = strnlen((char *)config.ssid, sizeof(config.ssid));
+    ESP_EC(esp_event_post(
+        WIFI_EVENT,
+        WIFI_EVENT_STA_CONNECTED,
+        &connected,
+        sizeof(connected),
+        portMAX_DELAY));
+
+    // Whichever comes first, the link dropping or the DHCP lease.
+    bool drops_first =
+        drop_reason != 0 && (dhcp_ms < 0 || drop_after_ms < dhcp_ms);
+    if (drops_first) {
+        sim_sleep_ms(drop_after_ms);
+        if (!attempt_current(generation)) {
+            return NULL;
+        }
+        ESP_LOGI(
+            TAG,
+            "Link to %s dropped, reason %d",
+            config.ssid,
+            drop_reason);
+        post_disconnected(config.ssid, drop_reason);
+        return NULL;
+    }
+    if (dhcp_ms < 0) {
+        ESP_LOGI(TAG, "DHCP server on %s never answers", config.ssid);
+        return NULL;
+    }
+    sim_sleep_ms(dhcp_ms);
+    if (!attempt_current(generation)) {
+        return NULL;
+    }
+    ip_event_got_ip_t got_ip = {
+        .esp_netif = NULL,
+        .ip_changed = true,
+    };
+    esp_netif_set_ip4_addr(&got_ip.ip_info.ip, 192, 168, 0, 100);
+    esp_netif_set_ip4_addr(&got_ip.ip_info.gw, 192, 168, 0, 1);
+    esp_netif_set_ip4_addr(&got_ip.ip_info.netmask, 255, 255, 255, 0);
+    ESP_EC(esp_event_post(
+        IP_EVENT,
+        IP_EVENT_STA_GOT_IP,
+        &got_ip,
+        sizeof(got_ip),
+        portMAX_DELAY));
+
+    if (drop_reason != 0) {
+        sim_sleep_ms(drop_after_ms - dhcp_ms);
+        if (!attempt_current(generation)) {
+            return NULL;
+        }
+        ESP_LOGI(
+            TAG,
+            "Link to %s dropped, reason %d",
+            config.ssid,
+            drop_reason);
+        post_disconnected(config.ssid, drop_reason);
+    }
+    return NULL;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    if (config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    glob_wifi.initialized = true;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    return mode == WIFI_MODE_NULL ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    esp_err_t err = glob_wifi.initialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+    glob_wifi.started = glob_wifi.initialized;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    return err;
+}
+
+esp_err_t esp_wifi_stop(void) {
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    glob_wifi.started = false;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    bool started = glob_wifi.started;
+    uintptr_t generation = ++glob_wifi.generation;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    if (!started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_t task;
+    POSIX_EC(pthread_create(&task, NULL, connect_task, (void *)generation));
+    POSIX_EC(pthread_detach(task));
+    return ESP_OK;
+}
+
+// Calls off the running attempt, the driver reports leaving like it does for
+// a real disconnect.
+esp_err_t esp_wifi_disconnect(void) {
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    bool started = glob_wifi.started;
+    glob_wifi.generation++;
+    wifi_sta_config_t config = glob_wifi.sta_config.sta;
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    if (!started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    post_disconnected(config.ssid, WIFI_REASON_ASSOC_LEAVE);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
+    if (conf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (interface == WIFI_IF_STA) {
+        POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+        glob_wifi.sta_config = *conf;
+        POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_country(const wifi_country_t *country) {
+    return country == NULL ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block) {
+    (void)config;
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    bool started = glob_wifi.started;
+    int64_t scan_ms = glob_wifi.scan_ms;
+    wifi_event_sta_scan_done_t done = {
+        .status = 0,
+        .number = glob_wifi.ap_count,
+    };
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    if (!started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!block) {
+        // Nothing in the application scans in the background.
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sim_sleep_ms(scan_ms);
+    ESP_EC(esp_event_post(
+        WIFI_EVENT,
+        WIFI_EVENT_SCAN_DONE,
+        &done,
+        sizeof(done),
+        portMAX_DELAY));
+    // A blocking scan returns once the done event went out, which is what
+    // ll_do_scan relies on.
+    sim_event_flush();
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(
+    uint16_t *number, wifi_ap_record_t *ap_records) {
+    if (number == NULL || ap_records == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_wifi.mutex));
+    if (*number > glob_wifi.ap_count) {
+        *number = glob_wifi.ap_count;
+    }
+    for (int i = 0; i < *number; i++) {
+        ap_records[i] = glob_wifi.aps[i].record;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_wifi.mutex));
+    return ESP_OK;
+}
@@ -0,0 +1,366 @@
+#include "const.h"
+#include "esp_log.h"
+#include "modes/modes.h"
+#include "ota.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Host build of the firmware. The sources from main/ run unchanged on top of
+// the shims in host/shim, the modes in host/modes drive them, one per
+// subsystem. Without a mode the simulator runs the provisioning flow with a
+// simulated radio. What a mode measured goes to stdout, logs go to stderr.
+
+sim_config_t glob_sim = {
+    .http_port = 8080,
+    .time_scale = 1.0,
+};
+
+static void usage(const char *name) {
+    fprintf(
+        stderr,
+        "Usage: %s [-p port] [-s scenario] [-d page dir] [-n rounds] "
+        "[-t time scale] [-q | -v]\n"
+        "       %s -u image url -x image sha256 [-t time scale] [-q | -v]\n"
+        "       %s -l seconds [-p port] [-q | -v]\n"
+        "       %s -c target -w seconds [-i poll ms] [-e devname] [-q | -v]\n"
+        "       %s -k target -g hours -w seconds [-r live ms] [-e devname] "
+        "[-a ca file] [-q | -v]\n"
+        "       %s -b trace [-z deadband] [-y heartbeat ms]\n"
+        "       %s -m target -w seconds [-P rate] [-e devname] [-q | -v]\n"
+        "       %s -o hours:sample ms:upload ms [-f from h:to h]\n"
+        "       %s -A trace [-j fixed ms]\n"
+        "       %s -L levelcal [-T tank] < raw readings\n"
+        "       %s -C trace\n"
+        "       %s -R trace\n"
+        "       %s -D trace [-p port]\n"
+        "       %s -E trace [-F rules]\n"
+        "       %s -S channels\n"
+        "  -p  port for the setup server, default 8080\n"
+        "  -s  scenario file, see scenario.txt, default built in\n"
+        "  -d  page templates, default %s\n"
+        "  -n  provisioning rounds before exiting, 0 runs forever\n"
+        "  -t  run simulated delays this many times faster\n"
+        "  -u  update the firmware from this URL instead, see ota.h\n"
+        "  -x  SHA-256 the update has to match, in hex\n"
+        "  -l  serve /live readings of a simulated probe this long\n"
+        "  -c  poll remote config from this upload target instead\n"
+        "  -w  seconds to keep polling, or to wait for the backlog\n"
+        "  -i  milliseconds between polls, default 1000\n"
+        "  -e  device name sent with the polls, default sim\n"
+        "  -k  upload a backlog to this target instead, see modes/upload.c\n"
+        "  -g  hours of backlog logged before the upload starts\n"
+        "  -r  milliseconds between live samples, default %d\n"
+        "  -a  CA certificates for https:// targets, default the system's\n"
+        "  -b  replay a trace through the deadband instead, - for stdin\n"
+        "  -z  deadband in value units, default 0\n"
+        "  -y  heartbeat in ms, default 600000, 0 logs every reading\n"
+        "  -m  run the data path into this target instead, see "
+        "modes/pipeline.c\n"
+        "  -P  readings per second into the data path, default as fast as it "
+        "goes\n"
+        "  -o  run the duty cycle's decisions instead, see modes/dutycycle.c\n"
+        "  -f  hours into the run the uploads fail, default never\n"
+        "  -A  sample a trace with the adaptive controller instead, - for "
+        "stdin\n"
+        "  -j  sample every this many ms instead, the controller only "
+        "detects\n"
+        "  -L  convert raw readings with these points instead, \"\" for "
+        "none\n"
+        "  -T  and this tank, see calib.h\n"
+        "  -C  encode and decode a trace instead, - for stdin\n"
+        "  -R  roll a trace up into the rollup store instead, - for stdin\n"
+        "  -D  serve /data on a log of this trace instead, see "
+        "modes/dataserver.c\n"
+        "  -E  evaluate alarm rules against a trace instead, - for stdin\n"
+        "  -F  the rules, see ll_alarm_parse, default none\n"
+        "  -S  time scans of 1 to this many channels instead, see "
+        "modes/sampler.c\n"
+        "  -q  warnings and errors only\n"
+        "  -v  debug logs\n",
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        name,
+        LL_SIM_PAGE_DIR,
+        SAMPLE_PERIOD_MS);
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = NULL;
+    const char *page_dir = LL_SIM_PAGE_DIR;
+    int rounds = 1;
+    const char *update_url = NULL;
+    const char *update_sha256 = NULL;
+    int live_seconds = 0;
+    const char *remote_target = NULL;
+    const char *devname = "sim";
+    int remote_seconds = 0;
+    int poll_ms = 1000;
+    const char *catchup_target = NULL;
+    int backlog_hours = 0;
+    int live_ms = SAMPLE_PERIOD_MS;
+    const char *trace = NULL;
+    const char *pipeline_target = NULL;
+    int pipeline_rate = 0;
+    int32_t deadband = 0;
+    int heartbeat_ms = 10 * 60 * 1000;
+    const char *dutycycle = NULL;
+    const char *outage = NULL;
+    const char *adaptive = NULL;
+    int fixed_ms = 0;
+    const char *levelcal = NULL;
+    const char *tank = "";
+    const char *codec = NULL;
+    const char *rollup = NULL;
+    const char *dataserver = NULL;
+    const char *alarms = NULL;
+    const char *rules = "";
+    int max_channels = 0;
+    int opt;
+    const char *opts =
+        "p:s:d:n:t:u:x:l:c:w:i:e:k:g:r:a:b:z:y:m:P:o:f:A:j:L:T:C:R:D:E:F:S:qv";
+    while ((opt = getopt(argc, argv, opts)) != -1) {
+        switch (opt) {
+        case 'p':
+            glob_sim.http_port = (uint16_t)atoi(optarg);
+            break;
+        case 's':
+            scenario = optarg;
+            break;
+        case 'd':
+            page_dir = optarg;
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 't':
+            glob_sim.time_scale = atof(optarg);
+            break;
+        case 'u':
+            update_url = optarg;
+            break;
+        case 'x':
+            update_sha256 = optarg;
+            break;
+        case 'l':
+            live_seconds = atoi(optarg);
+            break;
+        case 'c':
+            remote_target = optarg;
+            break;
+        case 'w':
+            remote_seconds = atoi(optarg);
+            break;
+        case 'i':
+            poll_ms = atoi(optarg);
+            break;
+        case 'e':
+            devname = optarg;
+            break;
+        case 'k':
+            catchup_target = optarg;
+            break;
+        case 'g':
+            backlog_hours = atoi(optarg);
+            break;
+        case 'r':
+            live_ms = atoi(optarg);
+            break;
+        case 'a':
+            glob_sim.ca_file = optarg;
+            break;
+        case 'b':
+            trace = optarg;
+            break;
+        case 'z':
+            deadband = atoi(optarg);
+            break;
+        case 'y':
+            heartbeat_ms = atoi(optarg);
+            break;
+        case 'm':
+            pipeline_target = optarg;
+            break;
+        case 'P':
+            pipeline_rate = atoi(optarg);
+            break;
+        case 'o':
+            dutycycle = optarg;
+            break;
+        case 'f':
+            outage = optarg;
+            break;
+        case 'A':
+            adaptive = optarg;
+            break;
+        case 'j':
+            fixed_ms = atoi(optarg);
+            break;
+        case 'L':
+            levelcal = optarg;
+            break;
+        case 'T':
+            tank = optarg;
+            break;
+        case 'C':
+            codec = optarg;
+            break;
+        case 'R':
+            rollup = optarg;
+            break;
+        case 'D':
+            dataserver = optarg;
+            break;
+        case 'E':
+            alarms = optarg;
+            break;
+        case 'F':
+            rules = optarg;
+            break;
+        case 'S':
+            max_channels = atoi(optarg);
+            break;
+        case 'q':
+            sim_log_level = ESP_LOG_WARN;
+            break;
+        case 'v':
+            sim_log_level = ESP_LOG_DEBUG;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (glob_sim.time_scale <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (update_url != NULL) {
+        // Through the parser of the device's update requests.
+        char request[64 + 1 + OTA_URL_MAX];
+        snprintf(
+            request,
+            sizeof(request),
+            "%s %s",
+            update_sha256 != NULL ? update_sha256 : "",
+            update_url);
+        uint8_t sha256[32];
+        const char *url = ll_ota_parse_request(request, sha256);
+        if (url == NULL) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_update(url, sha256);
+    }
+    if (live_seconds > 0) {
+        return sim_run_live(live_seconds);
+    }
+    if (trace != NULL) {
+        if (deadband < 0 || heartbeat_ms < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_deadband(trace, deadband, heartbeat_ms);
+    }
+    if (levelcal != NULL) {
+        return sim_run_calibrate(levelcal, tank);
+    }
+    if (codec != NULL) {
+        return sim_run_codec(codec);
+    }
+    if (rollup != NULL) {
+        return sim_run_rollup(rollup);
+    }
+    if (dataserver != NULL) {
+        return sim_run_dataserver(dataserver);
+    }
+    if (alarms != NULL) {
+        return sim_run_alarms(alarms, rules);
+    }
+    if (max_channels != 0) {
+        if (max_channels < 0 || max_channels > SENSOR_CHANNELS_MAX) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_channels(max_channels);
+    }
+    if (adaptive != NULL) {
+        if (fixed_ms < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_adaptive(adaptive, fixed_ms);
+    }
+    if (dutycycle != NULL) {
+        double hours = 0;
+        long long sample_ms = 0;
+        long long upload_ms = 0;
+        double outage_from_h = 0;
+        double outage_to_h = 0;
+        int fields =
+            sscanf(dutycycle, "%lf:%lld:%lld", &hours, &sample_ms, &upload_ms);
+        if (fields != 3 || hours <= 0 || sample_ms <= 0 || upload_ms <= 0 ||
+            (outage != NULL &&
+             sscanf(outage, "%lf:%lf", &outage_from_h, &outage_to_h) != 2)) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_dutycycle(
+            hours,
+            sample_ms,
+            upload_ms,
+            outage_from_h,
+            outage_to_h);
+    }
+    if (remote_target != NULL) {
+        if (remote_seconds <= 0 || poll_ms <= 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_remote(
+            remote_target,
+            devname,
+            remote_seconds,
+            poll_ms);
+    }
+    if (pipeline_target != NULL) {
+        if (remote_seconds <= 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_pipeline(
+            pipeline_target,
+            devname,
+            remote_seconds,
+            pipeline_rate);
+    }
+    if (catchup_target != NULL) {
+        if (backlog_hours <= 0 || remote_seconds <= 0 || live_ms <= 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return sim_run_catchup(
+            catchup_target,
+            devname,
+            backlog_hours,
+            remote_seconds,
+            live_ms);
+    }
+
+    return sim_run_setup(scenario, page_dir, rounds);
+}
@@ -0,0 +1,163 @@
+"""What the benches of the host simulator share.
+
+- arguments(): the options every bench takes, --sim and where it fits
+  --port, --seed and --trace.
+- Traces of "timestamp value" lines: recorded() reads one, trace_text()
+  writes the readings for the simulator's stdin.
+- run() runs the simulator to the end, matches() and result() pick its
+  report lines out of stdout.
+- Target, a local HTTP server on its own thread, with Handler for the
+  replies the benches send.
+- finish() lists what a bench found wrong and exits with 1, so a run of
+  the benches fails on the first that doesn't hold.
+
+Not a bench itself, the benches import it from this directory.
+"""
+
+import argparse
+import http.server
+import os
+import subprocess
+import threading
+
+HOST = "127.0.0.1"
+LOG_TAIL = 2000
+PROBLEMS_MAX = 50
+
+
+def arguments(port=None, seed=False, trace=False, traces=False):
+    """Returns a parser with --sim, and --port with the default given,
+    --seed, one --trace or any number of them."""
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sim", required=True, help="simulator binary")
+    if port is not None:
+        parser.add_argument("--port", type=int, default=port)
+    if seed:
+        parser.add_argument("--seed", type=int, default=1)
+    if trace:
+        parser.add_argument("--trace",
+                            help="recorded trace instead of a generated one")
+    if traces:
+        parser.add_argument("--trace", action="append", default=[],
+                            help="recorded trace, may be given more than "
+                                 "once")
+    return parser
+
+
+def recorded(path):
+    """Returns the (timestamp, value) readings of a recorded trace."""
+    readings = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) >= 2:
+                readings.append((int(fields[0]), int(fields[1])))
+    return readings
+
+
+def recorded_named(path):
+    """Returns a recorded trace with its file name, as the reports show it."""
+    return os.path.basename(path), recorded(path)
+
+
+def trace_text(readings):
+    return "".join("{} {}\n".format(t, v) for t, v in readings)
+
+
+def trunc_div(a, b):
+    """Division rounding towards zero, as in C."""
+    q = abs(a) // abs(b)
+    return q if (a < 0) == (b < 0) else -q
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def run(sim, options, stdin=None):
+    """Runs the simulator with options to the end, stdin a string."""
+    return subprocess.run([sim] + [str(o) for o in options], input=stdin,
+                          capture_output=True, text=True)
+
+
+def failed(sim, what="simulator failed"):
+    raise SystemExit("{}:\n{}".format(what, sim.stderr[-LOG_TAIL:]))
+
+
+def matches(text, pattern):
+    """Yields the match of pattern for every line of text it matches at the
+    start of."""
+    for line in text.splitlines():
+        m = pattern.match(line)
+        if m:
+            yield m
+
+
+def result(sim, pattern):
+    """Returns the groups of the simulator's last report line that matches
+    pattern, exits with its log if there is none."""
+    found = None
+    for m in matches(sim.stdout, pattern):
+        found = m
+    if found is None:
+        failed(sim)
+    return found.groups()
+
+
+def fields(line):
+    """Returns the key=value fields of a report line as floats."""
+    return {k: float(v) for k, v in (f.split("=") for f in line.split())}
+
+
+class Target(http.server.ThreadingHTTPServer):
+    """A local server for the simulator to talk to, serving from a thread of
+    its own between start() and stop()."""
+
+    daemon_threads = True
+
+    def __init__(self, port, handler):
+        super().__init__((HOST, port), handler)
+        self.lock = threading.Lock()
+
+    def start(self):
+        threading.Thread(target=self.serve_forever, daemon=True).start()
+        return self
+
+    def stop(self):
+        self.shutdown()
+        self.server_close()
+
+    def url(self, path="/ingest", scheme="http"):
+        return "{}://{}:{}{}".format(scheme, HOST, self.server_port, path)
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *_):
+        pass
+
+    def body(self):
+        return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+    def reply(self, status, body=b"", content_type=None, close=False):
+        self.send_response(status)
+        if content_type:
+            self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        if close:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+        if body:
+            self.wfile.write(body)
+
+
+def finish(problems):
+    """Lists the problems and exits with 1, if there are any."""
+    if problems:
+        print("\n".join(problems[:PROBLEMS_MAX]))
+        if len(problems) > PROBLEMS_MAX:
+            print("and {} more".format(len(problems) - PROBLEMS_MAX))
+        raise SystemExit(1)
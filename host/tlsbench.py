@@ -0,0 +1,215 @@
+"""HTTPS upload benchmark, run against the host simulator.
+
+Lets a simulator upload a backlog (ll_sim -k, see catchupbench.py) to a
+local HTTPS target and counts the TLS handshakes it takes, see main/tls.c.
+The target serves TLS 1.2 with a throwaway EC certificate the simulator is
+given as its CA (ll_sim -a). Modes:
+
+- keepalive: the target keeps the connection open, one full handshake and
+  every later batch reuses the connection.
+- idle: the target closes connections idle for --idle-s, like a load
+  balancer, the device resumes the session of the last handshake.
+- close: the target answers every request with Connection: close, every
+  batch after the first resumes.
+- no-resume: like close, but the target forgets its sessions and tickets
+  between connections, so every handshake is a full one. The baseline the
+  resumed handshakes of close are against.
+
+Handshake times and heap peaks are the device's, from its log. On the host
+the heap is OpenSSL's rather than mbedtls's, compare the modes against each
+other rather than with the device.
+
+The target also serves a config document the device polls once per upload
+cycle, over a connection of its own with a full handshake, and applies on
+the uploader task. The most stack the uploader task used for all of it is
+reported, on the host's 64-bit frames and OpenSSL, see UPLOADER_STACK_SIZE.
+
+Exits with 1 if a mode didn't drain the backlog or apply the config, if
+close resumed no session or if no-resume did.
+
+Usage: python tlsbench.py --sim build-host/ll_sim [--hours 6]
+                          [--live-ms 50] [--port 8098]
+"""
+
+import os
+import re
+import ssl
+import subprocess
+import tempfile
+
+import simbench
+
+HANDSHAKE = re.compile(
+    r"(Full|Resumed) TLS handshake with \S+ in (\d+) us, heap peak (\d+) "
+    r"bytes")
+CATCHUP = re.compile(
+    r"catchup drained=(\d) ms=(\d+) batches=(\d+) failures=(\d+) "
+    r"bytes=(\d+) samples=(\d+) allocs=(\d+)")
+TLS = re.compile(
+    r"tls full=(\d+) resumed=(\d+) reused=(\d+) handshake_us=\d+ "
+    r"heap_peak=\d+ stack_used=(\d+)")
+APPLIED = re.compile(r"Applied config version (\d+)")
+CONFIG = "version 2\nsample_ms 5000\nalarms high:above:900:10\n"
+MODES = ["keepalive", "idle", "close", "no-resume"]
+
+parser = simbench.arguments(port=8098)
+parser.add_argument("--hours", type=int, default=6,
+                    help="backlog to upload, a sample per second")
+parser.add_argument("--live-ms", type=int, default=50,
+                    help="time between live samples while uploading")
+parser.add_argument("--idle-s", type=float, default=0.05,
+                    help="idle timeout of the target in the idle mode")
+parser.add_argument("--timeout-s", type=int, default=120)
+parser.add_argument("--modes", default=",".join(MODES))
+args = parser.parse_args()
+
+
+def make_context(cert, key):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(cert, key)
+    return context
+
+
+class Server(simbench.Target):
+    def __init__(self, port, mode, cert, key):
+        super().__init__(port, Handler)
+        self.mode = mode
+        self.cert = cert
+        self.key = key
+        self.context = make_context(cert, key)
+        self.connections = 0
+        self.resumed = 0
+        self.requests = 0
+        self.polls = 0
+
+    def get_request(self):
+        sock, address = self.socket.accept()
+        # A new context has no sessions and a new ticket key.
+        context = make_context(self.cert, self.key) \
+            if self.mode == "no-resume" else self.context
+        return context.wrap_socket(
+            sock, server_side=True, do_handshake_on_connect=False), address
+
+
+class Handler(simbench.Handler):
+    def setup(self):
+        srv = self.server
+        if srv.mode == "idle":
+            self.timeout = args.idle_s
+        super().setup()
+        self.request.do_handshake()
+        with srv.lock:
+            srv.connections += 1
+            srv.resumed += self.request.session_reused
+
+    def do_GET(self):
+        if not self.path.endswith("/config"):
+            self.send_error(404)
+            return
+        srv = self.server
+        with srv.lock:
+            srv.polls += 1
+        self.reply(200, CONFIG.encode(), "text/plain",
+                   close=srv.mode in ("close", "no-resume"))
+
+    def do_POST(self):
+        self.body()
+        srv = self.server
+        with srv.lock:
+            srv.requests += 1
+        self.reply(200, close=srv.mode in ("close", "no-resume"))
+
+    def handle(self):
+        try:
+            super().handle()
+        except (TimeoutError, ssl.SSLError, ConnectionError):
+            pass
+
+
+def make_cert(directory):
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(
+        ["openssl", "req", "-x509", "-newkey", "ec",
+         "-pkeyopt", "ec_paramgen_curve:prime256v1", "-nodes", "-days", "1",
+         "-subj", "/CN=127.0.0.1", "-addext", "subjectAltName=IP:127.0.0.1",
+         "-keyout", key, "-out", cert],
+        check=True, capture_output=True)
+    return cert, key
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2] if values else 0
+
+
+def run(mode, cert, key, problems):
+    server = Server(args.port, mode, cert, key).start()
+    sim = simbench.run(
+        args.sim, ["-k", server.url(scheme="https"), "-g", args.hours,
+                   "-w", args.timeout_s, "-r", args.live_ms, "-a", cert])
+    server.stop()
+    catchup = [int(g) for g in simbench.result(sim, CATCHUP)]
+    tls = [int(g) for g in simbench.result(sim, TLS)]
+    applied = False
+    handshakes = {"Full": [], "Resumed": []}
+    for line in sim.stderr.splitlines():
+        m = HANDSHAKE.search(line)
+        if m:
+            handshakes[m.group(1)].append((int(m.group(2)), int(m.group(3))))
+        applied = applied or APPLIED.search(line) is not None
+
+    print("{}: drained={} in {} ms, {} batches, {} failures, "
+          "{} allocations".format(
+              mode, catchup[0], catchup[1], catchup[2], catchup[3],
+              catchup[6]))
+    print("  device: {} full, {} resumed, {} reused connections, config {}, "
+          "uploader stack {} bytes".format(
+              *tls[:3], "applied" if applied else "NOT APPLIED", tls[3]))
+    for kind, seen in handshakes.items():
+        if seen:
+            print("  {:7s} handshake: median {:6d} us, max {:6d} us, heap "
+                  "peak median {:6d} bytes, max {:6d} bytes".format(
+                      kind.lower(), median([s[0] for s in seen]),
+                      max(s[0] for s in seen), median([s[1] for s in seen]),
+                      max(s[1] for s in seen)))
+    print("  target: {} connections, {} resumed, {} requests, {} config "
+          "polls".format(server.connections, server.resumed, server.requests,
+                         server.polls))
+    if not catchup[0]:
+        problems.append("{}: the backlog didn't drain".format(mode))
+    if not applied:
+        problems.append("{}: the config wasn't applied".format(mode))
+    if mode == "close" and not handshakes["Resumed"]:
+        problems.append("close: no handshake resumed")
+    if mode == "no-resume" and handshakes["Resumed"]:
+        problems.append("no-resume: {} handshakes resumed".format(
+            len(handshakes["Resumed"])))
+    return handshakes
+
+
+def main():
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = make_cert(directory)
+        print("{} h backlog, live samples every {} ms, TLS 1.2, P-256 "
+              "certificate".format(args.hours, args.live_ms))
+        results = {}
+        problems = []
+        for mode in args.modes.split(","):
+            results[mode] = run(mode, cert, key, problems)
+    if "close" in results and "no-resume" in results:
+        resumed = results["close"]["Resumed"]
+        full = results["no-resume"]["Full"]
+        if resumed and full:
+            print("resumed against full: {:.0f}% of the time, {:.0f}% of "
+                  "the heap peak".format(
+                      100 * median([s[0] for s in resumed]) /
+                      max(1, median([s[0] for s in full])),
+                      100 * median([s[1] for s in resumed]) /
+                      max(1, median([s[1] for s in full]))))
+    simbench.finish(problems)
+
+
+main()
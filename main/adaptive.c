@@ -0,0 +1,64 @@
+#include "adaptive.h"
+
+void ll_adaptive_reset(
+    const adaptive_config_t *config, adaptive_state_t *state) {
+    // Start fast, nothing is known about the tank yet.
+    state->interval_ms = config->min_interval_ms;
+    state->reference = 0;
+    state->rise = 0;
+    state->fall = 0;
+    state->stable = 0;
+    state->primed = false;
+    state->detections = 0;
+}
+
+// Feeds one sample, taken interval_ms after the previous one. Returns true
+// when it detected a change, interval_ms is the time to the next sample.
+bool ll_adaptive_update(
+    const adaptive_config_t *config, adaptive_state_t *state, int32_t value) {
+    if (!state->primed) {
+        state->primed = true;
+        state->reference = value;
+        return false;
+    }
+
+    // The sums only grow while the level stays more than drift away from the
+    // reference, so noise and slow evaporation don't add up.
+    int64_t departure = (int64_t)value - state->reference;
+    state->rise += departure - config->drift;
+    state->fall += -departure - config->drift;
+    if (state->rise < 0) {
+        state->rise = 0;
+    }
+    if (state->fall < 0) {
+        state->fall = 0;
+    }
+
+    if (state->rise >= config->threshold || state->fall >= config->threshold) {
+        // Measure the rest of the change from here.
+        state->reference = value;
+        state->rise = 0;
+        state->fall = 0;
+        state->stable = 0;
+        state->interval_ms = config->min_interval_ms;
+        state->detections++;
+        return true;
+    }
+
+    if (++state->stable >= config->stable_samples) {
+        state->stable = 0;
+        state->interval_ms *= 2;
+        if (state->interval_ms > config->max_interval_ms) {
+            state->interval_ms = config->max_interval_ms;
+        }
+    }
+    return false;
+}
+
+// Uploads are due this often at the current sampling interval.
+int64_t ll_adaptive_report_ms(
+    const adaptive_config_t *config, const adaptive_state_t *state) {
+    int64_t report =
+        config->max_report_ms * state->interval_ms / config->max_interval_ms;
+    return report < config->min_report_ms ? config->min_report_ms : report;
+}
@@ -0,0 +1,64 @@
+#include "adcframe.h"
+
+#include <string.h>
+
+// DMA results are 32 bit words in the C3's type2 layout
+// (adc_digi_output_data_t): 12 bits of data, a reserved bit, 3 bits of
+// channel and 1 bit of unit. Unpacked by hand so this file builds on the host.
+#define RESULT_BYTES 4
+#define RESULT_DATA(word) ((word)&0xFFF)
+#define RESULT_CHANNEL(word) (((word) >> 13) & 0x7)
+#define RESULT_UNIT(word) (((word) >> 16) & 0x1)
+
+void ll_adcframe_init(
+    adc_frame_t *frame, const uint8_t *adc_channels, int channels) {
+    memset(frame, 0, sizeof(adc_frame_t));
+    memset(frame->slot_of, -1, sizeof(frame->slot_of));
+    for (int i = 0; i < channels; i++) {
+        frame->slot_of[adc_channels[i] % ADCFRAME_CHANNEL_IDS] = i;
+    }
+    frame->channels = channels;
+}
+
+void ll_adcframe_reset(adc_frame_t *frame) {
+    memset(frame->fill, 0, sizeof(frame->fill));
+    frame->full = 0;
+}
+
+// Sorts a buffer of DMA results into the per channel arrays. Returns true once
+// every channel has SENSOR_OVERSAMPLE conversions, extra ones are dropped.
+bool ll_adcframe_demux(adc_frame_t *frame, const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i + RESULT_BYTES <= len; i += RESULT_BYTES) {
+        uint32_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        int slot = frame->slot_of[RESULT_CHANNEL(word)];
+        if (RESULT_UNIT(word) != 0 || slot < 0 ||
+            frame->fill[slot] >= SENSOR_OVERSAMPLE) {
+            continue;
+        }
+        frame->raw[slot][frame->fill[slot]++] = RESULT_DATA(word);
+        if (frame->fill[slot] == SENSOR_OVERSAMPLE) {
+            frame->full++;
+        }
+    }
+    return frame->full == frame->channels;
+}
+
+// Average the conversions to knock down the ADC noise floor.
+int32_t ll_adcframe_mean(const adc_frame_t *frame, int slot) {
+    const uint16_t *raw = frame->raw[slot];
+    int count = frame->fill[slot];
+    if (count == 0) {
+        return 0;
+    }
+    int32_t sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += raw[i];
+    }
+    return sum / count;
+}
+
+int32_t ll_adcframe_calibrate(const adc_calib_t *calib, int32_t raw) {
+    return (int32_t)((int64_t)raw * calib->gain_num / calib->gain_den) +
+           calib->offset;
+}
@@ -0,0 +1,186 @@
+#include "alarm.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const KIND_NAMES[] = {
+    [ak_Above] = "above",
+    [ak_Below] = "below",
+    [ak_Rise] = "rise",
+    [ak_Fall] = "fall",
+};
+
+static bool parse_int32(const char *text, size_t len, int32_t *value) {
+    char buf[12];
+    if (len == 0 || len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    char *end = NULL;
+    long parsed = strtol(buf, &end, 10);
+    if (*end != '\0' || parsed < INT32_MIN || parsed > INT32_MAX) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Parses one "name:kind:threshold[:param]" rule of len characters.
+static bool parse_rule(const char *text, size_t len, alarm_rule_t *rule) {
+    const char *parts[4] = {NULL};
+    size_t part_lens[4] = {0};
+    int count = 0;
+    const char *cursor = text;
+    const char *end = text + len;
+    while (true) {
+        if (count == 4) {
+            return false;
+        }
+        const char *sep = memchr(cursor, ':', end - cursor);
+        const char *part_end = sep != NULL ? sep : end;
+        parts[count] = cursor;
+        part_lens[count] = part_end - cursor;
+        count++;
+        if (sep == NULL) {
+            break;
+        }
+        cursor = sep + 1;
+    }
+    if (count < 3) {
+        return false;
+    }
+
+    if (part_lens[0] == 0 || part_lens[0] >= sizeof(rule->name)) {
+        return false;
+    }
+    for (size_t i = 0; i < part_lens[0]; i++) {
+        char c = parts[0][i];
+        if (!isalnum((int)c) && c != '_' && c != '-') {
+            return false;
+        }
+    }
+    memcpy(rule->name, parts[0], part_lens[0]);
+    rule->name[part_lens[0]] = '\0';
+
+    bool known = false;
+    for (int kind = ak_Above; kind <= ak_Fall; kind++) {
+        if (strlen(KIND_NAMES[kind]) == part_lens[1] &&
+            strncmp(KIND_NAMES[kind], parts[1], part_lens[1]) == 0) {
+            rule->kind = kind;
+            known = true;
+        }
+    }
+    if (!known || !parse_int32(parts[2], part_lens[2], &rule->threshold)) {
+        return false;
+    }
+
+    int32_t param = 0;
+    if (count == 4 && !parse_int32(parts[3], part_lens[3], &param)) {
+        return false;
+    }
+    rule->hysteresis = 0;
+    rule->window_ms = ALARM_RATE_WINDOW_DEFAULT_S * 1000;
+    if (rule->kind == ak_Above || rule->kind == ak_Below) {
+        if (param < 0) {
+            return false;
+        }
+        rule->hysteresis = param;
+    } else if (count == 4) {
+        if (param <= 0 || param > ALARM_RATE_WINDOW_MAX_S) {
+            return false;
+        }
+        rule->window_ms = param * 1000;
+    }
+    return true;
+}
+
+// Parses comma separated rules, e.g. "overflow:above:3900:50,dry:below:200".
+// An empty spec is valid and has no rules.
+bool ll_alarm_parse(const char *spec, alarm_engine_t *engine) {
+    memset(engine, 0, sizeof(alarm_engine_t));
+    const char *cursor = spec;
+    while (*cursor != '\0') {
+        const char *sep = strchr(cursor, ',');
+        size_t len = sep != NULL ? (size_t)(sep - cursor) : strlen(cursor);
+        if (engine->count >= ALARM_RULES_MAX ||
+            !parse_rule(cursor, len, &engine->rules[engine->count])) {
+            engine->count = 0;
+            return false;
+        }
+        engine->count++;
+        cursor += len;
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return true;
+}
+
+static bool evaluate_rule(
+    const alarm_rule_t *rule, alarm_state_t *state, const sample_t *sample) {
+    int32_t value = sample->value;
+    switch (rule->kind) {
+    case ak_Above:
+        if (state->active) {
+            return value > (int64_t)rule->threshold - rule->hysteresis;
+        }
+        return value > rule->threshold;
+    case ak_Below:
+        if (state->active) {
+            return value < (int64_t)rule->threshold + rule->hysteresis;
+        }
+        return value < rule->threshold;
+    case ak_Rise:
+    case ak_Fall:
+        break;
+    }
+
+    // Rates are measured over whole windows from an anchor sample, so noise
+    // between neighbouring samples doesn't trip the rule.
+    int64_t elapsed = sample->timestamp - state->anchor_timestamp;
+    if (!state->primed || elapsed < 0) {
+        // First sample, or the clock was stepped back.
+        state->primed = true;
+        state->anchor_timestamp = sample->timestamp;
+        state->anchor_value = value;
+        return state->active;
+    }
+    if (elapsed < rule->window_ms) {
+        return state->active;
+    }
+    int64_t rate =
+        ((int64_t)value - state->anchor_value) * 60 * 1000 / elapsed;
+    state->anchor_timestamp = sample->timestamp;
+    state->anchor_value = value;
+    return rule->kind == ak_Rise ? rate > rule->threshold
+                                 : rate < -(int64_t)rule->threshold;
+}
+
+// Evaluates every rule against the sample in O(1) each. Fills events with the
+// rules that changed state and returns how many did.
+int ll_alarm_evaluate(
+    alarm_engine_t *engine, const sample_t *sample, alarm_event_t *events) {
+    int fired = 0;
+    for (int i = 0; i < engine->count; i++) {
+        const alarm_rule_t *rule = &engine->rules[i];
+        alarm_state_t *state = &engine->states[i];
+        bool active = evaluate_rule(rule, state, sample);
+        if (active == state->active) {
+            continue;
+        }
+        state->active = active;
+        alarm_event_t *event = &events[fired++];
+        memcpy(event->rule, rule->name, sizeof(event->rule));
+        event->kind = rule->kind;
+        event->active = active;
+        event->timestamp = sample->timestamp;
+        event->value = sample->value;
+    }
+    return fired;
+}
+
+const char *ll_alarm_kind_name(alarm_kind_t kind) {
+    return KIND_NAMES[kind];
+}
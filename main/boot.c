@@ -0,0 +1,306 @@
+#include "boot.h"
+
+#include "const.h"
+#include "esp_app_desc.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ll_boot";
+static const char *PHASE_NAMES[bp_Count] = {
+    [bp_NvsReady] = "nvs_ready",
+    [bp_WifiStarted] = "wifi_started",
+    [bp_StorageReady] = "storage_ready",
+    [bp_ConfigLoaded] = "config_loaded",
+    [bp_Scanned] = "scanned",
+    [bp_PagesLoaded] = "pages_loaded",
+    [bp_PortalReady] = "portal_ready",
+    [bp_Connected] = "connected",
+    [bp_SensorReady] = "sensor_ready",
+    [bp_FirstReading] = "first_reading",
+};
+
+typedef struct boot_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    boot_report_t report;
+    boot_report_t baseline;
+    bool has_baseline;
+} boot_t;
+
+static boot_t glob_boot = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_portal_ready = {
+    .name = "ll_boot_ms",
+    .help = "Milliseconds from boot to a boot phase",
+    .kind = mk_Gauge,
+    .label_key = "phase",
+    .label_value = "portal_ready",
+};
+
+static metric_t glob_first_reading = {
+    .name = "ll_boot_ms",
+    .help = "Milliseconds from boot to a boot phase",
+    .kind = mk_Gauge,
+    .label_key = "phase",
+    .label_value = "first_reading",
+};
+
+const char *ll_boot_phase_name(boot_phase_t phase) {
+    return phase < bp_Count ? PHASE_NAMES[phase] : "unknown";
+}
+
+// Marks the phase unless a task got there first.
+void ll_boot_mark(boot_phase_t phase) {
+    boot_t *boot = &glob_boot;
+    int64_t now = esp_timer_get_time();
+    POSIX_EC(pthread_mutex_lock(&boot->mutex));
+    bool first = boot->report.at_us[phase] == 0;
+    if (first) {
+        // Nothing happens at exactly 0, that means unmarked.
+        boot->report.at_us[phase] = now > 0 ? now : 1;
+    }
+    POSIX_EC(pthread_mutex_unlock(&boot->mutex));
+    if (!first) {
+        return;
+    }
+    if (phase == bp_PortalReady) {
+        ll_metrics_set(&glob_portal_ready, now / 1000);
+    } else if (phase == bp_FirstReading) {
+        ll_metrics_set(&glob_first_reading, now / 1000);
+    }
+    ESP_LOGI(TAG, "%s at %lld ms", PHASE_NAMES[phase], (long long)(now / 1000));
+}
+
+// Returns false if the phase wasn't reached in time.
+bool ll_boot_wait(boot_phase_t phase, uint32_t timeout_ms) {
+    boot_t *boot = &glob_boot;
+    uint32_t waited_ms = 0;
+    while (true) {
+        POSIX_EC(pthread_mutex_lock(&boot->mutex));
+        bool reached = boot->report.at_us[phase] != 0;
+        POSIX_EC(pthread_mutex_unlock(&boot->mutex));
+        if (reached) {
+            return true;
+        }
+        if (waited_ms >= timeout_ms) {
+            return false;
+        }
+        vTaskDelay(BOOT_POLL_MS / portTICK_PERIOD_MS);
+        waited_ms += BOOT_POLL_MS;
+    }
+}
+
+// The version string and the first bytes of the ELF hash, two builds of the
+// same version still tell apart.
+static void describe_build(char *build, size_t size) {
+    const esp_app_desc_t *app = esp_app_get_description();
+    const uint8_t *sha = app->app_elf_sha256;
+    snprintf(
+        build,
+        size,
+        "%.32s %02x%02x%02x%02x",
+        app->version,
+        sha[0],
+        sha[1],
+        sha[2],
+        sha[3]);
+}
+
+void ll_boot_report(boot_report_t *report) {
+    NPC(report);
+    boot_t *boot = &glob_boot;
+    POSIX_EC(pthread_mutex_lock(&boot->mutex));
+    *report = boot->report;
+    POSIX_EC(pthread_mutex_unlock(&boot->mutex));
+    report->layout = BOOT_REPORT_LAYOUT;
+    describe_build(report->build, sizeof(report->build));
+}
+
+void ll_boot_set_baseline(const boot_report_t *baseline) {
+    NPC(baseline);
+    boot_t *boot = &glob_boot;
+    POSIX_EC(pthread_mutex_lock(&boot->mutex));
+    boot->baseline = *baseline;
+    boot->has_baseline = true;
+    POSIX_EC(pthread_mutex_unlock(&boot->mutex));
+}
+
+// Milliseconds with one decimal, "-" for a phase that wasn't reached.
+static void format_ms(char *out, size_t size, int64_t us) {
+    if (us == 0) {
+        snprintf(out, size, "-");
+        return;
+    }
+    snprintf(
+        out,
+        size,
+        "%lld.%lld",
+        (long long)(us / 1000),
+        (long long)(us / 100 % 10));
+}
+
+static void format_change(char *out, size_t size, int64_t us, int64_t was) {
+    if (us == 0 || was == 0) {
+        snprintf(out, size, "-");
+        return;
+    }
+    int64_t change = us - was;
+    int64_t abs_change = change < 0 ? -change : change;
+    snprintf(
+        out,
+        size,
+        "%c%lld.%lld",
+        change < 0 ? '-' : '+',
+        (long long)(abs_change / 1000),
+        (long long)(abs_change / 100 % 10));
+}
+
+// One line per phase, with the baseline and the change against it if there
+// is one.
+static void format_line(
+    char *out,
+    size_t size,
+    boot_phase_t phase,
+    const boot_report_t *report,
+    const boot_report_t *baseline) {
+    char now_ms[24];
+    char was_ms[24];
+    char change_ms[24];
+    int64_t was = baseline != NULL ? baseline->at_us[phase] : 0;
+    format_ms(now_ms, sizeof(now_ms), report->at_us[phase]);
+    format_ms(was_ms, sizeof(was_ms), was);
+    format_change(change_ms, sizeof(change_ms), report->at_us[phase], was);
+    snprintf(
+        out,
+        size,
+        "%-14s %10s %10s %10s\n",
+        PHASE_NAMES[phase],
+        now_ms,
+        was_ms,
+        change_ms);
+}
+
+// Copies the report and the baseline if there is one, NULL otherwise.
+static const boot_report_t *
+snapshot(boot_report_t *report, boot_report_t *baseline) {
+    boot_t *boot = &glob_boot;
+    ll_boot_report(report);
+    POSIX_EC(pthread_mutex_lock(&boot->mutex));
+    bool has_baseline = boot->has_baseline;
+    *baseline = boot->baseline;
+    POSIX_EC(pthread_mutex_unlock(&boot->mutex));
+    return has_baseline ? baseline : NULL;
+}
+
+void ll_boot_log() {
+    boot_report_t report;
+    boot_report_t baseline_buf;
+    const boot_report_t *baseline = snapshot(&report, &baseline_buf);
+    ESP_LOGI(
+        TAG,
+        "Boot timeline of %s (ms since boot, baseline %s):",
+        report.build,
+        baseline != NULL ? baseline->build : "none");
+    for (int i = 0; i < bp_Count; i++) {
+        char line[BOOT_LINE_SIZE];
+        format_line(line, sizeof(line), i, &report, baseline);
+        line[strcspn(line, "\n")] = '\0';
+        ESP_LOGI(TAG, "%s", line);
+    }
+}
+
+static void job_main(void *arg) {
+    boot_job_t *job = (boot_job_t *)arg;
+    job->run(job->arg);
+    uint8_t done = 1;
+    xQueueSend(job->done, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+// Runs run(arg) on its own task until ll_boot_job_join. The job has to stay
+// put until then.
+void ll_boot_job_start(
+    boot_job_t *job, const char *name, void (*run)(void *arg), void *arg) {
+    NPC(job);
+    NPC(run);
+    job->name = name;
+    job->run = run;
+    job->arg = arg;
+    job->done = xQueueCreateStatic(
+        1,
+        sizeof(uint8_t),
+        job->done_storage,
+        &job->done_queue);
+    NPC(job->done);
+    if (xTaskCreate(job_main, name, BOOT_JOB_STACK_SIZE, job, 5, NULL) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create boot job %s!", name);
+        abort();
+    }
+}
+
+void ll_boot_job_join(boot_job_t *job) {
+    NPC(job);
+    NPC(job->done);
+    int64_t started = esp_timer_get_time();
+    uint8_t done = 0;
+    xQueueReceive(job->done, &done, portMAX_DELAY);
+    job->done = NULL;
+    ESP_LOGD(
+        TAG,
+        "Waited %lld us for boot job %s",
+        (long long)(esp_timer_get_time() - started),
+        job->name);
+}
+
+static esp_err_t boot_get_handler(httpd_req_t *request) {
+    NPC(request);
+    // Only the server task renders the report.
+    static char text[BOOT_TEXT_SIZE];
+    boot_report_t report;
+    boot_report_t baseline_buf;
+    const boot_report_t *baseline = snapshot(&report, &baseline_buf);
+    int len = snprintf(
+        text,
+        sizeof(text),
+        "this boot: %s\nbaseline:  %s\n\n%-14s %10s %10s %10s\n",
+        report.build,
+        baseline != NULL ? baseline->build : "none",
+        "phase",
+        "ms",
+        "baseline",
+        "change");
+    for (int i = 0; i < bp_Count; i++) {
+        format_line(text + len, sizeof(text) - len, i, &report, baseline);
+        len += strlen(text + len);
+    }
+    ESP_EC(httpd_resp_set_type(request, "text/plain"));
+    ESP_EC(httpd_resp_send(request, text, len));
+    return ESP_OK;
+}
+
+void ll_boot_serve(httpd_handle_t server) {
+    NPC(server);
+    const httpd_uri_t boot_get = {
+        .uri = "/boot",
+        .method = HTTP_GET,
+        .handler = boot_get_handler,
+    };
+    ll_metrics_register(&glob_portal_ready);
+    ll_metrics_register(&glob_first_reading);
+    ESP_EC(httpd_register_uri_handler(server, &boot_get));
+    ESP_LOGI(TAG, "Serving /boot");
+}
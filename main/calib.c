@@ -0,0 +1,285 @@
+#include "calib.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOPE_FRAC_BITS 16
+#define LEVEL_ONE (1 << CALIB_LEVEL_FRAC_BITS)
+#define VOLUME_ONE (1 << CALIB_VOLUME_FRAC_BITS)
+
+static const char *const SHAPE_NAMES[] = {
+    [ts_HorizontalCylinder] = "hcyl",
+    [ts_VerticalCylinder] = "vcyl",
+    [ts_Box] = "box",
+};
+// Dimensions each shape takes, in mm.
+static const int SHAPE_DIMS[] = {
+    [ts_HorizontalCylinder] = 2, // diameter, length
+    [ts_VerticalCylinder] = 2,   // diameter, height
+    [ts_Box] = 3,                // width, length, height
+};
+// The dimension that is the height of the full tank.
+static const int SHAPE_HEIGHT[] = {
+    [ts_HorizontalCylinder] = 0,
+    [ts_VerticalCylinder] = 1,
+    [ts_Box] = 2,
+};
+
+static bool parse_int32(const char *text, size_t len, int32_t *value) {
+    char buf[12];
+    if (len == 0 || len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    char *end = NULL;
+    long parsed = strtol(buf, &end, 10);
+    if (*end != '\0' || parsed < INT32_MIN || parsed > INT32_MAX) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Splits text of len characters at ':' into at most max parts, returns how
+// many there are or -1 if there are more.
+static int split(
+    const char *text, size_t len, const char **parts, size_t *lens, int max) {
+    int count = 0;
+    const char *cursor = text;
+    const char *end = text + len;
+    while (true) {
+        if (count == max) {
+            return -1;
+        }
+        const char *sep = memchr(cursor, ':', end - cursor);
+        const char *part_end = sep != NULL ? sep : end;
+        parts[count] = cursor;
+        lens[count] = part_end - cursor;
+        count++;
+        if (sep == NULL) {
+            return count;
+        }
+        cursor = sep + 1;
+    }
+}
+
+static int32_t clamp(int64_t value, int64_t low, int64_t high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+// Parses comma separated "raw:mm" points, e.g. "310:0,2200:800,3900:1500".
+static bool parse_points(const char *spec, calib_t *calib) {
+    const char *cursor = spec;
+    while (*cursor != '\0') {
+        const char *sep = strchr(cursor, ',');
+        size_t len = sep != NULL ? (size_t)(sep - cursor) : strlen(cursor);
+        const char *parts[2];
+        size_t lens[2];
+        int32_t raw = 0;
+        int32_t mm = 0;
+        int at = calib->points;
+        if (at >= CALIB_POINTS_MAX ||
+            split(cursor, len, parts, lens, 2) != 2 ||
+            !parse_int32(parts[0], lens[0], &raw) ||
+            !parse_int32(parts[1], lens[1], &mm) || raw < -CALIB_RAW_LIMIT ||
+            raw > CALIB_RAW_LIMIT || mm < -CALIB_MM_LIMIT ||
+            mm > CALIB_MM_LIMIT || (at > 0 && raw <= calib->raw[at - 1])) {
+            return false;
+        }
+        calib->raw[at] = raw;
+        calib->level[at] = mm * LEVEL_ONE;
+        calib->points++;
+        cursor += len;
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return calib->points != 1;
+}
+
+static void build_level_table(calib_t *calib) {
+    int last = calib->points - 1;
+    for (int i = 0; i < last; i++) {
+        calib->slope[i] = ((int64_t)(calib->level[i + 1] - calib->level[i])
+                           << SLOPE_FRAC_BITS) /
+                          (calib->raw[i + 1] - calib->raw[i]);
+    }
+    calib->slope[last] = calib->slope[last - 1];
+
+    int32_t span = calib->raw[last] - calib->raw[0];
+    calib->bucket_shift = 0;
+    while ((span >> calib->bucket_shift) >= CALIB_BUCKETS) {
+        calib->bucket_shift++;
+    }
+    int segment = 0;
+    for (int b = 0; b < CALIB_BUCKETS; b++) {
+        int32_t start = calib->raw[0] + (b << calib->bucket_shift);
+        while (segment < last - 1 && start >= calib->raw[segment + 1]) {
+            segment++;
+        }
+        calib->bucket[b] = segment;
+    }
+}
+
+// Parses "shape:dim:dim[:dim]" in mm, e.g. "hcyl:1200:3000".
+static bool parse_tank(const char *spec, int32_t *dims, calib_t *calib) {
+    const char *parts[4];
+    size_t lens[4];
+    int count = split(spec, strlen(spec), parts, lens, 4);
+    calib->shape = ts_None;
+    for (int shape = ts_HorizontalCylinder; shape <= ts_Box; shape++) {
+        if (strlen(SHAPE_NAMES[shape]) == lens[0] &&
+            strncmp(SHAPE_NAMES[shape], parts[0], lens[0]) == 0) {
+            calib->shape = shape;
+        }
+    }
+    if (calib->shape == ts_None || count != SHAPE_DIMS[calib->shape] + 1) {
+        return false;
+    }
+    for (int i = 0; i < SHAPE_DIMS[calib->shape]; i++) {
+        if (!parse_int32(parts[i + 1], lens[i + 1], &dims[i]) ||
+            dims[i] <= 0 || dims[i] > CALIB_MM_LIMIT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Samples the tank's volume at every table level. The entry past the top is
+// extrapolated so the last segment still ends on the full volume at
+// level_max, rather than at the next multiple of the step.
+static bool build_volume_table(calib_t *calib, const int32_t *dims) {
+    calib->level_max = dims[SHAPE_HEIGHT[calib->shape]] * LEVEL_ONE;
+    double full = ll_calib_tank_litres(
+        calib->shape,
+        dims,
+        (double)calib->level_max / LEVEL_ONE);
+    if (full * VOLUME_ONE >= INT32_MAX) {
+        return false;
+    }
+    calib->volume_shift = 0;
+    while ((calib->level_max >> calib->volume_shift) >=
+           CALIB_VOLUME_SEGMENTS) {
+        calib->volume_shift++;
+    }
+    int32_t step = 1 << calib->volume_shift;
+    int top = calib->level_max >> calib->volume_shift;
+    for (int i = 0; i <= top; i++) {
+        double mm = (double)i * step / LEVEL_ONE;
+        calib->volume[i] = lround(
+            ll_calib_tank_litres(calib->shape, dims, mm) * VOLUME_ONE);
+    }
+    int32_t rest = calib->level_max - top * step;
+    double past = calib->volume[top];
+    if (rest > 0) {
+        past += (full * VOLUME_ONE - calib->volume[top]) * step / rest;
+    }
+    for (int i = top + 1; i <= CALIB_VOLUME_SEGMENTS; i++) {
+        calib->volume[i] = past >= INT32_MAX ? INT32_MAX : lround(past);
+    }
+    return true;
+}
+
+// Builds the tables from the provisioned calibration points and tank, either
+// may be empty. Floats are fine here, this runs once per boot.
+bool ll_calib_parse(const char *points, const char *tank, calib_t *calib) {
+    memset(calib, 0, sizeof(calib_t));
+    if (!parse_points(points, calib)) {
+        memset(calib, 0, sizeof(calib_t));
+        return false;
+    }
+    if (calib->points > 0) {
+        build_level_table(calib);
+        calib->output = co_Level;
+    }
+    if (*tank != '\0') {
+        int32_t dims[3];
+        if (!parse_tank(tank, dims, calib) ||
+            !build_volume_table(calib, dims)) {
+            memset(calib, 0, sizeof(calib_t));
+            return false;
+        }
+        calib->output = co_Volume;
+    }
+    return true;
+}
+
+// Level in mm with CALIB_LEVEL_FRAC_BITS of fraction. Without calibration
+// points the raw reading is taken to be in mm already.
+int32_t ll_calib_level(const calib_t *calib, int32_t raw) {
+    const int64_t limit = (int64_t)CALIB_MM_LIMIT * LEVEL_ONE;
+    if (calib->points == 0) {
+        return clamp((int64_t)raw * LEVEL_ONE, -limit, limit);
+    }
+    raw = clamp(raw, -CALIB_RAW_LIMIT, CALIB_RAW_LIMIT);
+    int i = 0;
+    if (raw >= calib->raw[0]) {
+        uint32_t b = (uint32_t)(raw - calib->raw[0]) >> calib->bucket_shift;
+        i = b < CALIB_BUCKETS ? calib->bucket[b] : calib->points - 2;
+        // A bucket holds at most a few points, usually none.
+        while (i < calib->points - 2 && raw >= calib->raw[i + 1]) {
+            i++;
+        }
+    }
+    int64_t level = calib->level[i] +
+                    (((int64_t)(raw - calib->raw[i]) * calib->slope[i]) >>
+                     SLOPE_FRAC_BITS);
+    return clamp(level, -limit, limit);
+}
+
+// Volume in litres with CALIB_VOLUME_FRAC_BITS of fraction, for a level from
+// ll_calib_level.
+int32_t ll_calib_volume(const calib_t *calib, int32_t level) {
+    level = clamp(level, 0, calib->level_max);
+    int b = level >> calib->volume_shift;
+    int32_t frac = level & ((1 << calib->volume_shift) - 1);
+    int32_t low = calib->volume[b];
+    return low + (((int64_t)(calib->volume[b + 1] - low) * frac) >>
+                  calib->volume_shift);
+}
+
+// The stored value of a channel for a raw reading, see calib_output_t.
+int32_t ll_calib_apply(const calib_t *calib, int32_t raw) {
+    switch (calib->output) {
+    case co_Raw:
+        break;
+    case co_Level:
+        return (ll_calib_level(calib, raw) + LEVEL_ONE / 2) >>
+               CALIB_LEVEL_FRAC_BITS;
+    case co_Volume:
+        return (ll_calib_volume(calib, ll_calib_level(calib, raw)) +
+                VOLUME_ONE / 2) >>
+               CALIB_VOLUME_FRAC_BITS;
+    }
+    return raw;
+}
+
+// Exact volume of the tank filled to level_mm. Used to build the table, and
+// as the reference to check it against.
+double ll_calib_tank_litres(
+    tank_shape_t shape, const int32_t *dims, double level_mm) {
+    double mm3 = 0;
+    switch (shape) {
+    case ts_None:
+        break;
+    case ts_HorizontalCylinder: {
+        double r = dims[0] / 2.0;
+        double h = fmin(fmax(level_mm, 0), dims[0]);
+        double area = r * r * acos((r - h) / r) -
+                      (r - h) * sqrt(fmax(2 * r * h - h * h, 0));
+        mm3 = area * dims[1];
+        break;
+    }
+    case ts_VerticalCylinder: {
+        double r = dims[0] / 2.0;
+        mm3 = M_PI * r * r * fmin(fmax(level_mm, 0), dims[1]);
+        break;
+    }
+    case ts_Box:
+        mm3 = (double)dims[0] * dims[1] * fmin(fmax(level_mm, 0), dims[2]);
+        break;
+    }
+    return mm3 / 1e6;
+}
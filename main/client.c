@@ -1,10 +1,12 @@
 #include "client.h"
 
+#include "const.h"
 #include "esp_flash.h"
 #include "esp_netif_types.h"
 #include "esp_wifi.h"
 #include "esp_wifi_default.h"
 #include "esp_wifi_types.h"
+#include "reactor.h"
 #include "setup.h"
 #include "station.h"
 #include "util.h"
@@ -52,58 +54,95 @@ const char *esp_wifi_reflect_reason(uint8_t reason) {
     }
 }
 
-connect_result_t try_connect_to_network(char *ssid, char *pass) {
-    NPC(ssid);
-    NPC(pass);
-    esp_log_level_set(TAG, ESP_LOG_DEBUG);
-    conn_attempt_t *conn_attempt = ll_station_create_conn_attempt();
-    ll_station_set_network_params(ssid, pass);
-    ll_station_start_conn_fsm(conn_attempt);
-    ESP_LOGD(TAG, "Started connection FSM");
-    while (true) {
-        ll_station_wait_for_change(conn_attempt);
-        switch (ll_station_get_state(conn_attempt)) {
-        case cas_Initial:
-            ESP_LOGE(
-                TAG,
-                "Connection attempt FSM transitioned into initial state!");
-            abort();
-        case cas_StartedConnection:
-            ESP_LOGI(TAG, "Started connecting to network...");
-            break;
-        case cas_Failed:;
-            uint8_t reason = ll_station_get_fail_reason(conn_attempt);
-            ESP_LOGW(
+void ll_client_connect_start(
+    client_attempt_t *attempt, const char *ssid, const char *pass) {
+    NPC(attempt);
+    attempt->id = ll_station_connect(ssid, pass);
+    ll_reactor_arm(rd_ConnectTimeout, CLIENT_CONNECT_TIMEOUT_MS);
+    ESP_LOGI(TAG, "Started connecting to network...");
+}
+
+static connect_result_t result_for_reason(uint8_t reason) {
+    switch (reason) {
+    case WIFI_REASON_NO_AP_FOUND:
+        return cr_InvalidSsid;
+    case WIFI_REASON_AUTH_FAIL:
+        return cr_InvalidPass;
+    default:
+        return cr_TechnicalError;
+    }
+}
+
+bool ll_client_connect_step(
+    client_attempt_t *attempt,
+    const reactor_event_t *event,
+    connect_result_t *result) {
+    NPC(attempt);
+    NPC(event);
+    NPC(result);
+    switch (event->kind) {
+    case re_StaConnected:
+    case re_StaDisconnected:
+    case re_StaGotIp:
+        if (event->attempt != attempt->id) {
+            ESP_LOGD(
                 TAG,
-                "Connection to access point failed!\nCode: %s",
-                esp_wifi_reflect_reason(reason));
-            goto stop_fsm;
-        case cas_ConnectSuccess:
-            ESP_LOGI(TAG, "Connected to the access point!");
-            break;
-        case cas_DhcpSuccess:
-            ESP_LOGI(TAG, "Got IP from network!");
-            goto stop_fsm;
+                "Dropping event of earlier attempt %lu",
+                event->attempt);
+            return false;
+        }
+        break;
+    case re_Deadline:
+        if (event->deadline != rd_ConnectTimeout) {
+            return false;
         }
+        break;
+    default:
+        return false;
     }
 
-stop_fsm:
-    ll_station_stop_conn_fsm(conn_attempt);
-    ESP_LOGD(TAG, "Stopped connection FSM.");
+    switch (event->kind) {
+    case re_StaConnected:
+        ESP_LOGI(TAG, "Connected to the access point!");
+        return false;
+    case re_StaDisconnected:
+        ESP_LOGW(
+            TAG,
+            "Connection to access point failed!\nCode: %s",
+            esp_wifi_reflect_reason(event->reason));
+        *result = result_for_reason(event->reason);
+        break;
+    case re_StaGotIp:
+        ESP_LOGI(TAG, "Got IP from network!");
+        *result = cr_None;
+        break;
+    default:
+        ESP_LOGW(
+            TAG,
+            "No IP from network after %d ms, giving up",
+            CLIENT_CONNECT_TIMEOUT_MS);
+        // Whatever the driver still reports about this attempt is dropped.
+        esp_wifi_disconnect();
+        *result = cr_TechnicalError;
+        break;
+    }
+    ll_reactor_disarm(rd_ConnectTimeout);
+    ll_station_stop_connect();
+    return true;
+}
 
-    if (ll_station_get_state(conn_attempt) == cas_DhcpSuccess) {
-        ll_station_destroy_conn_attempt(conn_attempt);
-        return cr_None;
-    } else {
-        uint8_t reason = ll_station_get_fail_reason(conn_attempt);
-        ll_station_destroy_conn_attempt(conn_attempt);
-        switch (reason) {
-        case WIFI_REASON_NO_AP_FOUND:
-            return cr_InvalidSsid;
-        case WIFI_REASON_AUTH_FAIL:
-            return cr_InvalidPass;
-        default:
-            return cr_TechnicalError;
+connect_result_t try_connect_to_network(const char *ssid, const char *pass) {
+    NPC(ssid);
+    NPC(pass);
+    ll_reactor_init();
+    client_attempt_t attempt;
+    ll_client_connect_start(&attempt, ssid, pass);
+    while (true) {
+        reactor_event_t event;
+        ll_reactor_next(&event);
+        connect_result_t result;
+        if (ll_client_connect_step(&attempt, &event, &result)) {
+            return result;
         }
     }
 }
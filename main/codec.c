@@ -0,0 +1,218 @@
+#include "codec.h"
+
+#include "sample.h"
+
+#include <string.h>
+
+// Worst case encoded size of a single sample: a 64 bit delta-of-delta and a 33
+// bit value delta, both as zigzag varints, the value delta with two more bits
+// in tagged blocks.
+#define CODEC_MAX_SAMPLE_SIZE (10 + 6)
+
+static inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline size_t varint_write(uint8_t *out, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+// Returns the number of bytes consumed, or 0 if the varint is truncated or
+// malformed.
+static inline size_t
+varint_read(const uint8_t *in, size_t avail, uint64_t *value) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < avail && i < 10; i++) {
+        result |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void ll_codec_encoder_reset(codec_encoder_t *enc, uint8_t channel) {
+    memset(&enc->header, 0, sizeof(codec_block_header_t));
+    enc->header.magic = CODEC_BLOCK_MAGIC;
+    enc->header.channel = channel;
+    enc->cursor = sizeof(codec_block_header_t);
+    enc->prev_delta = 0;
+    enc->prev_value = 0;
+}
+
+// Only on an empty block, right after the reset.
+void ll_codec_encoder_tag(
+    codec_encoder_t *enc, int32_t deadband, int64_t heartbeat_ms) {
+    enc->header.flags |= CODEC_FLAG_TAGGED;
+    enc->cursor += varint_write(enc->block + enc->cursor, (uint64_t)deadband);
+    enc->cursor +=
+        varint_write(enc->block + enc->cursor, (uint64_t)heartbeat_ms);
+}
+
+// The value delta, with the report in the low bits in tagged blocks.
+static inline uint64_t
+value_code(const codec_encoder_t *enc, int64_t delta, uint8_t report) {
+    uint64_t code = zigzag_encode(delta);
+    if (enc->header.flags & CODEC_FLAG_TAGGED) {
+        code = code << 2 | (report & 0x3);
+    }
+    return code;
+}
+
+bool ll_codec_encoder_append(codec_encoder_t *enc, const sample_t *sample) {
+    codec_block_header_t *header = &enc->header;
+    if (header->count == UINT16_MAX) {
+        return false;
+    }
+
+    // Encode into a small staging area first so a sample that doesn't fit
+    // leaves the block untouched.
+    uint8_t staging[CODEC_MAX_SAMPLE_SIZE];
+    size_t len = 0;
+    int64_t delta = 0;
+    if (header->count == 0) {
+        // Timestamp is stored in the header, value is a delta from zero.
+        len += varint_write(
+            staging,
+            value_code(enc, sample->value, sample->report));
+    } else {
+        delta = sample->timestamp - header->last_timestamp;
+        len += varint_write(staging, zigzag_encode(delta - enc->prev_delta));
+        len += varint_write(
+            staging + len,
+            value_code(
+                enc,
+                (int64_t)sample->value - enc->prev_value,
+                sample->report));
+    }
+    if (enc->cursor + len > CODEC_BLOCK_SIZE) {
+        return false;
+    }
+    memcpy(enc->block + enc->cursor, staging, len);
+    enc->cursor += len;
+
+    if (header->count == 0) {
+        header->first_timestamp = sample->timestamp;
+        header->min_value = sample->value;
+        header->max_value = sample->value;
+    } else {
+        if (sample->value < header->min_value) {
+            header->min_value = sample->value;
+        }
+        if (sample->value > header->max_value) {
+            header->max_value = sample->value;
+        }
+    }
+    header->last_timestamp = sample->timestamp;
+    header->count++;
+    enc->prev_delta = delta;
+    enc->prev_value = sample->value;
+    return true;
+}
+
+const uint8_t *ll_codec_encoder_finish(codec_encoder_t *enc, size_t *len) {
+    enc->header.payload_len = enc->cursor - sizeof(codec_block_header_t);
+    memcpy(enc->block, &enc->header, sizeof(codec_block_header_t));
+    *len = enc->cursor;
+    return enc->block;
+}
+
+bool ll_codec_read_header(
+    const uint8_t *block, size_t len, codec_block_header_t *header) {
+    if (len < sizeof(codec_block_header_t)) {
+        return false;
+    }
+    memcpy(header, block, sizeof(codec_block_header_t));
+    return header->magic == CODEC_BLOCK_MAGIC &&
+           header->payload_len <= CODEC_PAYLOAD_SIZE &&
+           sizeof(codec_block_header_t) + header->payload_len <= len;
+}
+
+bool ll_codec_decoder_init(
+    codec_decoder_t *dec, const uint8_t *block, size_t len) {
+    if (!ll_codec_read_header(block, len, &dec->header)) {
+        return false;
+    }
+    dec->payload = block + sizeof(codec_block_header_t);
+    dec->cursor = 0;
+    dec->decoded = 0;
+    dec->deadband = 0;
+    dec->heartbeat_ms = 0;
+    if (dec->header.flags & CODEC_FLAG_TAGGED) {
+        uint64_t deadband = 0;
+        uint64_t heartbeat_ms = 0;
+        size_t used = varint_read(
+            dec->payload,
+            dec->header.payload_len,
+            &deadband);
+        if (used == 0) {
+            return false;
+        }
+        dec->cursor = used;
+        used = varint_read(
+            dec->payload + dec->cursor,
+            dec->header.payload_len - dec->cursor,
+            &heartbeat_ms);
+        if (used == 0) {
+            return false;
+        }
+        dec->cursor += used;
+        dec->deadband = (int32_t)deadband;
+        dec->heartbeat_ms = (int64_t)heartbeat_ms;
+    }
+    dec->prev_timestamp = dec->header.first_timestamp;
+    dec->prev_delta = 0;
+    dec->prev_value = 0;
+    return true;
+}
+
+bool ll_codec_decoder_next(codec_decoder_t *dec, sample_t *sample) {
+    if (dec->decoded >= dec->header.count) {
+        return false;
+    }
+    const uint8_t *cursor = dec->payload + dec->cursor;
+    size_t avail = dec->header.payload_len - dec->cursor;
+    size_t used = 0;
+    uint64_t raw = 0;
+
+    int64_t timestamp = dec->header.first_timestamp;
+    if (dec->decoded > 0) {
+        used = varint_read(cursor, avail, &raw);
+        if (used == 0) {
+            return false;
+        }
+        dec->prev_delta += zigzag_decode(raw);
+        timestamp = dec->prev_timestamp + dec->prev_delta;
+        cursor += used;
+        avail -= used;
+        dec->cursor += used;
+    }
+    used = varint_read(cursor, avail, &raw);
+    if (used == 0) {
+        return false;
+    }
+    dec->cursor += used;
+    sample->report = sr_Every;
+    if (dec->header.flags & CODEC_FLAG_TAGGED) {
+        sample->report = raw & 0x3;
+        raw >>= 2;
+    }
+
+    dec->prev_timestamp = timestamp;
+    dec->prev_value = (int32_t)(dec->prev_value + zigzag_decode(raw));
+    sample->timestamp = timestamp;
+    sample->value = dec->prev_value;
+    dec->decoded++;
+    return true;
+}
@@ -0,0 +1,192 @@
+#include "config.h"
+
+#include "boot.h"
+#include "const.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "remote.h"
+#include "render.h"
+#include "setup.h"
+#include "util.h"
+
+#include <string.h>
+
+static const char *TAG = "ll_config";
+
+void ll_config_save_netinfo(const network_info_t *netinfo) {
+    NPC(netinfo);
+    nvs_handle_t nvs;
+    ESP_EC(nvs_open(NETINFO_NVS_NAMESPACE, NVS_READWRITE, &nvs));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_SSID, netinfo->ssid));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_PASSWORD, netinfo->password));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_TARGET, netinfo->target));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_DEVNAME, netinfo->devname));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_ALARMS, netinfo->alarms));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_LEVELCAL, netinfo->levelcal));
+    ESP_EC(nvs_set_str(nvs, FORM_NAME_TANK, netinfo->tank));
+    ESP_EC(nvs_commit(nvs));
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "Saved network info for %s", netinfo->devname);
+}
+
+// Read a string from NVS into the remaining space of the netinfo buffer.
+static char *load_field(
+    nvs_handle_t nvs, const char *key, char **cursor, char *end) {
+    size_t len = end - *cursor;
+    if (nvs_get_str(nvs, key, *cursor, &len) != ESP_OK) {
+        return NULL;
+    }
+    char *field = *cursor;
+    *cursor += len; // Length includes the null terminator
+    return field;
+}
+
+bool ll_config_load_netinfo(network_info_t *netinfo) {
+    NPC(netinfo);
+    nvs_handle_t nvs;
+    if (nvs_open(NETINFO_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        // Namespace doesn't exist yet, nothing was ever saved.
+        return false;
+    }
+
+    // Pack the fields back into the buffer the same way the POST parser
+    // leaves them, as consecutive c-strings.
+    char *cursor = netinfo->buffer;
+    char *end = netinfo->buffer + sizeof(netinfo->buffer);
+    netinfo->ssid = load_field(nvs, FORM_NAME_SSID, &cursor, end);
+    netinfo->password = load_field(nvs, FORM_NAME_PASSWORD, &cursor, end);
+    netinfo->target = load_field(nvs, FORM_NAME_TARGET, &cursor, end);
+    netinfo->devname = load_field(nvs, FORM_NAME_DEVNAME, &cursor, end);
+    netinfo->alarms = load_field(nvs, FORM_NAME_ALARMS, &cursor, end);
+    netinfo->levelcal = load_field(nvs, FORM_NAME_LEVELCAL, &cursor, end);
+    netinfo->tank = load_field(nvs, FORM_NAME_TANK, &cursor, end);
+    nvs_close(nvs);
+
+    bool complete = netinfo->ssid && netinfo->password && netinfo->target &&
+                    netinfo->devname && netinfo->alarms;
+    if (!complete) {
+        ESP_LOGW(TAG, "Stored network info is incomplete, ignoring it");
+        return false;
+    }
+    // Saved before calibration existed, alias the end of the device name the
+    // same way the POST parser does.
+    char *empty = netinfo->devname + strlen(netinfo->devname);
+    if (netinfo->levelcal == NULL) {
+        netinfo->levelcal = empty;
+    }
+    if (netinfo->tank == NULL) {
+        netinfo->tank = empty;
+    }
+    return true;
+}
+
+// Only the keys that changed and the version, in one commit.
+void ll_config_save_remote(const remote_config_t *config, uint32_t changed) {
+    NPC(config);
+    const network_info_t *netinfo = &config->netinfo;
+    nvs_handle_t nvs;
+    ESP_EC(nvs_open(NETINFO_NVS_NAMESPACE, NVS_READWRITE, &nvs));
+    if (changed & rk_Target) {
+        ESP_EC(nvs_set_str(nvs, FORM_NAME_TARGET, netinfo->target));
+    }
+    if (changed & rk_Devname) {
+        ESP_EC(nvs_set_str(nvs, FORM_NAME_DEVNAME, netinfo->devname));
+    }
+    if (changed & rk_Alarms) {
+        ESP_EC(nvs_set_str(nvs, FORM_NAME_ALARMS, netinfo->alarms));
+    }
+    if (changed & rk_Levelcal) {
+        ESP_EC(nvs_set_str(nvs, FORM_NAME_LEVELCAL, netinfo->levelcal));
+    }
+    if (changed & rk_Tank) {
+        ESP_EC(nvs_set_str(nvs, FORM_NAME_TANK, netinfo->tank));
+    }
+    if (changed & rk_SampleMs) {
+        ESP_EC(nvs_set_u32(nvs, "sample_ms", config->sample_ms));
+    }
+    if (changed & rk_Deadband) {
+        ESP_EC(nvs_set_u32(nvs, "deadband", config->deadband));
+        ESP_EC(nvs_set_u32(nvs, "heartbeat_ms", config->heartbeat_ms));
+    }
+    if (changed & rk_Firmware) {
+        ESP_EC(nvs_set_str(nvs, "firmware", config->firmware));
+    }
+    ESP_EC(nvs_set_u32(nvs, "remote_ver", config->version));
+    ESP_EC(nvs_commit(nvs));
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "Saved remote config version %lu", config->version);
+}
+
+// What remote config keeps apart from the network info, defaults for a
+// device that never got any.
+// Leaves the network info alone.
+void ll_config_load_remote(remote_config_t *config) {
+    NPC(config);
+    config->version = 0;
+    config->sample_ms = SAMPLE_PERIOD_MS;
+    config->deadband = DEADBAND_DEFAULT;
+    config->heartbeat_ms = DEADBAND_HEARTBEAT_DEFAULT_MS;
+    config->firmware[0] = '\0';
+    nvs_handle_t nvs;
+    if (nvs_open(NETINFO_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_get_u32(nvs, "remote_ver", &config->version);
+    nvs_get_u32(nvs, "sample_ms", &config->sample_ms);
+    nvs_get_u32(nvs, "deadband", &config->deadband);
+    nvs_get_u32(nvs, "heartbeat_ms", &config->heartbeat_ms);
+    size_t len = sizeof(config->firmware);
+    if (nvs_get_str(nvs, "firmware", config->firmware, &len) != ESP_OK) {
+        config->firmware[0] = '\0';
+    }
+    nvs_close(nvs);
+}
+
+// Reads a boot report saved under key, false if there is none or it has an
+// older layout.
+static bool
+load_boot_report(nvs_handle_t nvs, const char *key, boot_report_t *report) {
+    size_t len = sizeof(boot_report_t);
+    if (nvs_get_blob(nvs, key, report, &len) != ESP_OK ||
+        len != sizeof(boot_report_t) || report->layout != BOOT_REPORT_LAYOUT) {
+        return false;
+    }
+    report->build[sizeof(report->build) - 1] = '\0';
+    return true;
+}
+
+// The last boot keeps its report under "last". When a different build boots,
+// the report of the one before moves to "previous", so there is always one
+// to compare against.
+void ll_config_save_boot_report(const boot_report_t *report) {
+    NPC(report);
+    nvs_handle_t nvs;
+    ESP_EC(nvs_open(BOOT_NVS_NAMESPACE, NVS_READWRITE, &nvs));
+    boot_report_t last;
+    if (load_boot_report(nvs, "last", &last) &&
+        strcmp(last.build, report->build) != 0) {
+        ESP_EC(nvs_set_blob(nvs, "previous", &last, sizeof(last)));
+    }
+    ESP_EC(nvs_set_blob(nvs, "last", report, sizeof(boot_report_t)));
+    ESP_EC(nvs_commit(nvs));
+    nvs_close(nvs);
+}
+
+// Finds the last boot of another build than the one in current.
+bool ll_config_load_boot_baseline(
+    const boot_report_t *current, boot_report_t *baseline) {
+    NPC(current);
+    NPC(baseline);
+    nvs_handle_t nvs;
+    if (nvs_open(BOOT_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    bool found = load_boot_report(nvs, "last", baseline) &&
+                 strcmp(baseline->build, current->build) != 0;
+    if (!found) {
+        found = load_boot_report(nvs, "previous", baseline) &&
+                strcmp(baseline->build, current->build) != 0;
+    }
+    nvs_close(nvs);
+    return found;
+}
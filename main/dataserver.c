@@ -0,0 +1,452 @@
+#include "dataserver.h"
+
+#include "codec.h"
+#include "const.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "metrics.h"
+#include "rollupstore.h"
+#include "samplelog.h"
+#include "util.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ll_dataserver";
+
+// Output of a query is generated front to back in constant memory. The same
+// generator runs without sending anything to measure the total size when a
+// range is requested, so bytes outside [skip, end) are only counted.
+typedef struct data_stream_t {
+    httpd_req_t *request;
+    char chunk[DATASERVER_CHUNK_SIZE];
+    size_t chunk_len;
+    uint64_t offset;
+    uint64_t skip;
+    uint64_t end;
+    bool sending;
+    bool failed;
+} data_stream_t;
+
+static httpd_handle_t glob_handle = NULL;
+
+// httpd runs every handler on its one task, so the buffers can be shared.
+static data_stream_t glob_stream;
+static uint8_t glob_block[CODEC_BLOCK_SIZE];
+
+static void stream_flush(data_stream_t *stream) {
+    if (stream->chunk_len == 0 || stream->failed) {
+        return;
+    }
+    if (httpd_resp_send_chunk(
+            stream->request,
+            stream->chunk,
+            stream->chunk_len) != ESP_OK) {
+        // Client went away, stop generating.
+        stream->failed = true;
+    }
+    stream->chunk_len = 0;
+}
+
+// Returns false once nothing more of the output is wanted.
+static bool stream_write(data_stream_t *stream, const void *data, size_t len) {
+    uint64_t start = stream->offset;
+    stream->offset += len;
+    if (stream->sending && stream->offset > stream->skip &&
+        start < stream->end) {
+        uint64_t from = start < stream->skip ? stream->skip - start : 0;
+        uint64_t to = stream->offset > stream->end ? stream->end - start : len;
+        const char *cursor = (const char *)data + from;
+        size_t remaining = to - from;
+        while (remaining > 0 && !stream->failed) {
+            size_t room = sizeof(stream->chunk) - stream->chunk_len;
+            size_t copy = remaining < room ? remaining : room;
+            memcpy(stream->chunk + stream->chunk_len, cursor, copy);
+            stream->chunk_len += copy;
+            cursor += copy;
+            remaining -= copy;
+            if (stream->chunk_len == sizeof(stream->chunk)) {
+                stream_flush(stream);
+            }
+        }
+    }
+    return !stream->failed && stream->offset < stream->end;
+}
+
+static bool stream_printf(data_stream_t *stream, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static bool stream_printf(data_stream_t *stream, const char *format, ...) {
+    char line[DATASERVER_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    return stream_write(stream, line, len);
+}
+
+// Blocks and rollups of different channels are stored in time order only give
+// or take a channel period, so lookups and cutoffs allow for that much slack.
+static inline int64_t add_slack(int64_t timestamp, int64_t slack) {
+    if (slack > 0 && timestamp > INT64_MAX - slack) {
+        return INT64_MAX;
+    }
+    if (slack < 0 && timestamp < INT64_MIN - slack) {
+        return INT64_MIN;
+    }
+    return timestamp + slack;
+}
+
+static void stream_raw(data_stream_t *stream, const data_query_t *query) {
+    if (query->format == df_Csv &&
+        !stream_printf(stream, "timestamp,value\n")) {
+        return;
+    }
+
+    samplelog_pos_t pos = ll_samplelog_find(
+        add_slack(query->from, -SENSOR_CHANNEL_PERIOD_MAX_MS));
+    int64_t cutoff = add_slack(query->to, SENSOR_CHANNEL_PERIOD_MAX_MS);
+    size_t len = 0;
+    while ((len = ll_samplelog_read(&pos, glob_block, sizeof(glob_block))) >
+           0) {
+        codec_decoder_t dec;
+        if (!ll_codec_decoder_init(&dec, glob_block, len)) {
+            continue;
+        }
+        if (dec.header.channel != query->channel ||
+            dec.header.last_timestamp < query->from) {
+            continue;
+        }
+        if (dec.header.first_timestamp > cutoff) {
+            break;
+        }
+
+        if (query->format == df_Bin) {
+            // Same framing as uploads, so the collector can decode it.
+            uint64_t block_pos = pos - len;
+            if (!stream_write(stream, &block_pos, sizeof(block_pos)) ||
+                !stream_write(stream, glob_block, len)) {
+                return;
+            }
+            continue;
+        }
+
+        sample_t sample;
+        while (ll_codec_decoder_next(&dec, &sample)) {
+            if (sample.timestamp < query->from ||
+                sample.timestamp > query->to) {
+                continue;
+            }
+            bool more =
+                query->format == df_Csv
+                    ? stream_printf(
+                          stream,
+                          "%" PRId64 ",%" PRId32 "\n",
+                          sample.timestamp,
+                          sample.value)
+                    : stream_printf(
+                          stream,
+                          "{\"t\":%" PRId64 ",\"v\":%" PRId32 "}\n",
+                          sample.timestamp,
+                          sample.value);
+            if (!more) {
+                return;
+            }
+        }
+    }
+}
+
+static void stream_rollups(
+    data_stream_t *stream, const data_query_t *query, rollup_tier_t tier) {
+    if (query->format == df_Csv &&
+        !stream_printf(stream, "start,count,min,max,mean\n")) {
+        return;
+    }
+
+    rollup_index_t head = ll_rollupstore_head(tier);
+    int64_t period = ll_rollupstore_period(tier);
+    int64_t from =
+        add_slack(query->from, -SENSOR_CHANNEL_PERIOD_MAX_MS - period);
+    int64_t cutoff = add_slack(query->to, SENSOR_CHANNEL_PERIOD_MAX_MS);
+    for (rollup_index_t index = ll_rollupstore_find(tier, from);
+         index < head;
+         index++) {
+        rollup_t rollup;
+        if (!ll_rollupstore_read(tier, index, &rollup)) {
+            // Overwritten while streaming, nothing older is left.
+            continue;
+        }
+        if (rollup.start > cutoff) {
+            break;
+        }
+        if (rollup.channel != query->channel ||
+            rollup.start + period <= query->from ||
+            rollup.start > query->to) {
+            continue;
+        }
+
+        bool more = true;
+        switch (query->format) {
+        case df_Bin:
+            more = stream_write(stream, &rollup, sizeof(rollup));
+            break;
+        case df_Csv:
+            more = stream_printf(
+                stream,
+                "%" PRId64 ",%" PRIu32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "\n",
+                rollup.start,
+                rollup.count,
+                rollup.min_value,
+                rollup.max_value,
+                ll_rollup_mean(&rollup));
+            break;
+        case df_Ndjson:
+            more = stream_printf(
+                stream,
+                "{\"start\":%" PRId64 ",\"count\":%" PRIu32
+                ",\"min\":%" PRId32 ",\"max\":%" PRId32 ",\"mean\":%" PRId32
+                "}\n",
+                rollup.start,
+                rollup.count,
+                rollup.min_value,
+                rollup.max_value,
+                ll_rollup_mean(&rollup));
+            break;
+        }
+        if (!more) {
+            return;
+        }
+    }
+}
+
+static void stream_query(data_stream_t *stream, const data_query_t *query) {
+    switch (query->res) {
+    case dr_Raw:
+        stream_raw(stream, query);
+        break;
+    case dr_Minute:
+        stream_rollups(stream, query, rt_Minute);
+        break;
+    case dr_Hour:
+        stream_rollups(stream, query, rt_Hour);
+        break;
+    }
+}
+
+static bool parse_int64(const char *text, int64_t *value) {
+    char *end = NULL;
+    long long parsed = strtoll(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Returns false if the query string has an invalid value.
+static bool parse_query(httpd_req_t *request, data_query_t *query) {
+    query->from = INT64_MIN;
+    query->to = INT64_MAX;
+    query->res = dr_Raw;
+    query->format = df_Csv;
+    query->channel = 0;
+
+    char qs[128];
+    if (httpd_req_get_url_query_str(request, qs, sizeof(qs)) != ESP_OK) {
+        return true;
+    }
+    char value[24];
+    if (httpd_query_key_value(qs, "from", value, sizeof(value)) == ESP_OK &&
+        !parse_int64(value, &query->from)) {
+        return false;
+    }
+    if (httpd_query_key_value(qs, "to", value, sizeof(value)) == ESP_OK &&
+        !parse_int64(value, &query->to)) {
+        return false;
+    }
+    int64_t channel = 0;
+    if (httpd_query_key_value(qs, "channel", value, sizeof(value)) == ESP_OK) {
+        if (!parse_int64(value, &channel) || channel < 0 ||
+            channel >= SENSOR_CHANNEL_COUNT) {
+            return false;
+        }
+        query->channel = channel;
+    }
+    if (httpd_query_key_value(qs, "res", value, sizeof(value)) == ESP_OK) {
+        if (strcmp(value, "raw") == 0) {
+            query->res = dr_Raw;
+        } else if (strcmp(value, "minute") == 0) {
+            query->res = dr_Minute;
+        } else if (strcmp(value, "hour") == 0) {
+            query->res = dr_Hour;
+        } else {
+            return false;
+        }
+    }
+    if (httpd_query_key_value(qs, "format", value, sizeof(value)) == ESP_OK) {
+        if (strcmp(value, "csv") == 0) {
+            query->format = df_Csv;
+        } else if (strcmp(value, "ndjson") == 0) {
+            query->format = df_Ndjson;
+        } else if (strcmp(value, "bin") == 0) {
+            query->format = df_Bin;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parses "bytes=first-" and "bytes=first-last". Returns false without a usable
+// Range header, in which case the whole output is sent.
+static bool parse_range(httpd_req_t *request, uint64_t *first, uint64_t *last) {
+    char range[48];
+    if (httpd_req_get_hdr_value_str(request, "Range", range, sizeof(range)) !=
+        ESP_OK) {
+        return false;
+    }
+    unsigned long long range_first = 0;
+    unsigned long long range_last = UINT64_MAX;
+    int matched =
+        sscanf(range, "bytes=%llu-%llu", &range_first, &range_last);
+    if (matched < 1 || range_last < range_first) {
+        return false;
+    }
+    *first = range_first;
+    *last = range_last;
+    return true;
+}
+
+static const char *format_content_type(data_format_t format) {
+    switch (format) {
+    case df_Csv:
+        return "text/csv";
+    case df_Ndjson:
+        return "application/x-ndjson";
+    case df_Bin:
+        return "application/octet-stream";
+    }
+    return "application/octet-stream";
+}
+
+static esp_err_t data_get_handler(httpd_req_t *request) {
+    NPC(request);
+    data_query_t query;
+    if (!parse_query(request, &query)) {
+        ESP_EC(httpd_resp_send_err(
+            request,
+            HTTPD_400_BAD_REQUEST,
+            "Expected from=<ms>&to=<ms>&channel=<n>&res=raw|minute|hour&"
+            "format=csv|ndjson|bin"));
+        return ESP_OK;
+    }
+
+    data_stream_t *stream = &glob_stream;
+    memset(stream, 0, sizeof(data_stream_t));
+    stream->request = request;
+    stream->end = UINT64_MAX;
+    stream->sending = true;
+
+    // The output is only stable across requests if "to" is in the past, a
+    // client resuming a pull is expected to pin it.
+    // "bytes <first>-<last>/<total>" with every number at its widest
+    char content_range[72];
+    uint64_t first = 0;
+    uint64_t last = 0;
+    if (parse_range(request, &first, &last)) {
+        // Measure the output first, the response has to state the total.
+        stream->sending = false;
+        stream_query(stream, &query);
+        uint64_t total = stream->offset;
+        if (first >= total) {
+            snprintf(
+                content_range,
+                sizeof(content_range),
+                "bytes */%" PRIu64,
+                total);
+            ESP_EC(httpd_resp_set_status(request, "416 Range Not Satisfiable"));
+            ESP_EC(httpd_resp_set_hdr(request, "Content-Range", content_range));
+            ESP_EC(httpd_resp_send(request, "", 0));
+            return ESP_OK;
+        }
+        if (last >= total) {
+            last = total - 1;
+        }
+        snprintf(
+            content_range,
+            sizeof(content_range),
+            "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64,
+            first,
+            last,
+            total);
+        ESP_EC(httpd_resp_set_status(request, "206 Partial Content"));
+        ESP_EC(httpd_resp_set_hdr(request, "Content-Range", content_range));
+
+        memset(stream, 0, sizeof(data_stream_t));
+        stream->request = request;
+        stream->skip = first;
+        stream->end = last + 1;
+        stream->sending = true;
+    }
+
+    ESP_EC(httpd_resp_set_type(request, format_content_type(query.format)));
+    ESP_EC(httpd_resp_set_hdr(request, "Accept-Ranges", "bytes"));
+    stream_query(stream, &query);
+    stream_flush(stream);
+    if (stream->failed) {
+        ESP_LOGW(
+            TAG,
+            "Client dropped a data pull after %llu bytes",
+            stream->offset);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(request, NULL, 0);
+    ESP_LOGI(
+        TAG,
+        "Served data pull (res: %d, format: %d, bytes: %llu)",
+        query.res,
+        query.format,
+        stream->offset - stream->skip);
+    return ESP_OK;
+}
+
+static metric_t glob_data_latency = {
+    .name = "ll_http_request_duration_us",
+    .help = "Time spent in an HTTP handler",
+    .kind = mk_Histogram,
+    .label_key = "handler",
+    .label_value = "data",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
+void ll_dataserver_start() {
+    NOT_NPC(glob_handle);
+    static metrics_handler_t timed_get = {
+        .handler = data_get_handler,
+        .latency = &glob_data_latency,
+    };
+    const httpd_uri_t data_get = {
+        .uri = "/data",
+        .method = HTTP_GET,
+        .handler = ll_metrics_timed_handler,
+        .user_ctx = &timed_get,
+    };
+    ll_metrics_register(&glob_data_latency);
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = DATASERVER_URI_HANDLERS;
+    ESP_EC(httpd_start(&glob_handle, &config));
+    ESP_EC(httpd_register_uri_handler(glob_handle, &data_get));
+    ESP_LOGI(TAG, "Data server started");
+}
+
+httpd_handle_t ll_dataserver_handle() {
+    return glob_handle;
+}
@@ -0,0 +1,35 @@
+#include "deadband.h"
+
+void ll_deadband_reset(deadband_state_t *state) {
+    state->primed = false;
+    state->reported = 0;
+    state->reported_at = 0;
+}
+
+// Returns true if the sample goes into the log, and sets its report.
+bool ll_deadband_update(
+    const deadband_config_t *config,
+    deadband_state_t *state,
+    sample_t *sample) {
+    if (config->heartbeat_ms == 0) {
+        sample->report = sr_Every;
+        return true;
+    }
+    int64_t moved = (int64_t)sample->value - state->reported;
+    int64_t silent_ms = sample->timestamp - state->reported_at;
+    if (!state->primed) {
+        sample->report = sr_First;
+    } else if (moved > config->deadband || -moved > config->deadband) {
+        sample->report = sr_Change;
+    } else if (silent_ms >= config->heartbeat_ms || silent_ms < 0) {
+        // A clock that went back, when it got synchronized, would hold
+        // everything back until it caught up.
+        sample->report = sr_Heartbeat;
+    } else {
+        return false;
+    }
+    state->primed = true;
+    state->reported = sample->value;
+    state->reported_at = sample->timestamp;
+    return true;
+}
@@ -0,0 +1,205 @@
+#include "dlog.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <string.h>
+
+static const char *TAG = "ll_dlog";
+
+// Record layout, little endian:
+//   u16 length of the whole record
+//   u8  level, DLOG_TRUNCATED set if arguments didn't fit
+//   u8  argument count
+//   i32 format string, relative to ll_dlog_anchor
+//   i32 tag, relative to ll_dlog_anchor
+//   u32 milliseconds since boot
+// followed by the arguments, each a type byte and its value:
+//   'i' u32, 'q' u64, 'd' f64, 'p' u32 address,
+//   's' u8 length and the bytes, 'r' u8 length of a redacted string.
+#define DLOG_HEADER_SIZE 16
+#define DLOG_TRUNCATED 0x80
+
+// Format strings and tags are literals in the same read only data as this,
+// their distance to it is the same on the device and in the ELF.
+const char ll_dlog_anchor[] = "ll_dlog";
+
+typedef struct dlog_ring_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    uint8_t data[DLOG_RING_SIZE];
+    // Free running byte counts, the oldest record starts at tail.
+    uint32_t head;
+    uint32_t tail;
+    // Records overwritten before anyone read them
+    uint32_t dropped;
+} dlog_ring_t;
+
+static dlog_ring_t glob_ring = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Dumps are only served by one httpd task at a time, setup or data server.
+static uint8_t glob_dump[8 + DLOG_RING_SIZE];
+
+static int32_t anchor_offset(const char *literal) {
+    return (int32_t)((intptr_t)literal - (intptr_t)ll_dlog_anchor);
+}
+
+void ll_dlog_begin(
+    dlog_record_t *record,
+    esp_log_level_t level,
+    const char *tag,
+    const char *format) {
+    int32_t format_offset = anchor_offset(format);
+    int32_t tag_offset = anchor_offset(tag);
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    record->data[2] = (uint8_t)level;
+    record->data[3] = 0;
+    memcpy(record->data + 4, &format_offset, 4);
+    memcpy(record->data + 8, &tag_offset, 4);
+    memcpy(record->data + 12, &now_ms, 4);
+    record->len = DLOG_HEADER_SIZE;
+}
+
+// Returns where the value goes, NULL if it doesn't fit.
+static uint8_t *put(dlog_record_t *record, char type, size_t len) {
+    if (record->len + 1 + len > sizeof(record->data)) {
+        record->data[2] |= DLOG_TRUNCATED;
+        return NULL;
+    }
+    uint8_t *value = record->data + record->len;
+    *value = type;
+    record->len += 1 + len;
+    record->data[3]++;
+    return value + 1;
+}
+
+void ll_dlog_put_u32(dlog_record_t *record, uint32_t value) {
+    uint8_t *at = put(record, 'i', 4);
+    if (at != NULL) {
+        memcpy(at, &value, 4);
+    }
+}
+
+void ll_dlog_put_u64(dlog_record_t *record, uint64_t value) {
+    uint8_t *at = put(record, 'q', 8);
+    if (at != NULL) {
+        memcpy(at, &value, 8);
+    }
+}
+
+// long is 32 bits on the device and 64 on the host simulator.
+void ll_dlog_put_long(dlog_record_t *record, long value) {
+    if (sizeof(long) > 4) {
+        ll_dlog_put_u64(record, (uint64_t)value);
+    } else {
+        ll_dlog_put_u32(record, (uint32_t)value);
+    }
+}
+
+void ll_dlog_put_ulong(dlog_record_t *record, unsigned long value) {
+    ll_dlog_put_long(record, (long)value);
+}
+
+void ll_dlog_put_double(dlog_record_t *record, double value) {
+    uint8_t *at = put(record, 'd', 8);
+    if (at != NULL) {
+        memcpy(at, &value, 8);
+    }
+}
+
+void ll_dlog_put_ptr(dlog_record_t *record, const void *value) {
+    uint32_t address = (uint32_t)(uintptr_t)value;
+    uint8_t *at = put(record, 'p', 4);
+    if (at != NULL) {
+        memcpy(at, &address, 4);
+    }
+}
+
+void ll_dlog_put_str(dlog_record_t *record, const char *value) {
+    if (value == NULL) {
+        value = "(null)";
+    }
+    size_t len = strnlen(value, DLOG_STR_MAX);
+    uint8_t *at = put(record, 's', 1 + len);
+    if (at != NULL) {
+        *at = (uint8_t)len;
+        memcpy(at + 1, value, len);
+    }
+}
+
+void ll_dlog_put_ustr(dlog_record_t *record, const unsigned char *value) {
+    ll_dlog_put_str(record, (const char *)value);
+}
+
+void ll_dlog_put_secret(dlog_record_t *record, dlog_secret_t value) {
+    size_t len = value.value == NULL ? 0 : strnlen(value.value, UINT8_MAX);
+    uint8_t *at = put(record, 'r', 1);
+    if (at != NULL) {
+        *at = (uint8_t)len;
+    }
+}
+
+static void ring_copy_out(
+    const dlog_ring_t *ring, uint32_t from, uint8_t *out, size_t len) {
+    size_t start = from % DLOG_RING_SIZE;
+    size_t first = len < DLOG_RING_SIZE - start ? len : DLOG_RING_SIZE - start;
+    memcpy(out, ring->data + start, first);
+    memcpy(out + first, ring->data, len - first);
+}
+
+static void
+ring_copy_in(dlog_ring_t *ring, uint32_t to, const void *in, size_t len) {
+    size_t start = to % DLOG_RING_SIZE;
+    size_t first = len < DLOG_RING_SIZE - start ? len : DLOG_RING_SIZE - start;
+    memcpy(ring->data + start, in, first);
+    memcpy(ring->data, (const uint8_t *)in + first, len - first);
+}
+
+void ll_dlog_commit(const dlog_record_t *record) {
+    uint16_t len = (uint16_t)record->len;
+    dlog_ring_t *ring = &glob_ring;
+    POSIX_EC(pthread_mutex_lock(&ring->mutex));
+    // Make room by dropping the oldest records.
+    while (ring->head + len - ring->tail > DLOG_RING_SIZE) {
+        uint16_t oldest = 0;
+        ring_copy_out(ring, ring->tail, (uint8_t *)&oldest, 2);
+        ring->tail += oldest;
+        ring->dropped++;
+    }
+    ring_copy_in(ring, ring->head, &len, 2);
+    ring_copy_in(ring, ring->head + 2, record->data + 2, len - 2);
+    ring->head += len;
+    POSIX_EC(pthread_mutex_unlock(&ring->mutex));
+}
+
+// "DLOG", u32 dropped records, then the records oldest first.
+static esp_err_t log_get_handler(httpd_req_t *request) {
+    NPC(request);
+    dlog_ring_t *ring = &glob_ring;
+    POSIX_EC(pthread_mutex_lock(&ring->mutex));
+    size_t len = ring->head - ring->tail;
+    memcpy(glob_dump, "DLOG", 4);
+    memcpy(glob_dump + 4, &ring->dropped, 4);
+    ring_copy_out(ring, ring->tail, glob_dump + 8, len);
+    POSIX_EC(pthread_mutex_unlock(&ring->mutex));
+
+    ESP_EC(httpd_resp_set_type(request, "application/octet-stream"));
+    return httpd_resp_send(request, (const char *)glob_dump, 8 + len);
+}
+
+void ll_dlog_serve(httpd_handle_t server) {
+    NPC(server);
+    const httpd_uri_t log_get = {
+        .uri = "/log",
+        .method = HTTP_GET,
+        .handler = log_get_handler,
+        .user_ctx = NULL,
+    };
+    ESP_EC(httpd_register_uri_handler(server, &log_get));
+    ESP_LOGI(TAG, "Serving /log");
+}
@@ -0,0 +1,132 @@
+#include "dutycycle.h"
+
+#define MS_PER_DAY (24.0f * 60 * 60 * 1000)
+#define MS_PER_HOUR (60.0f * 60 * 1000)
+
+void ll_dutycycle_reset(dutycycle_state_t *state, int64_t now_ms) {
+    state->last_wake_ms = now_ms;
+    state->last_upload_ms = now_ms;
+    state->unsent = 0;
+    state->retry_at_ms = now_ms;
+    state->failed_uploads = 0;
+    state->wakes = 0;
+    state->uploads = 0;
+    state->awake_ms = 0;
+    state->radio_ms = 0;
+}
+
+void ll_dutycycle_woke(dutycycle_state_t *state, int64_t now_ms) {
+    state->last_wake_ms = now_ms;
+    state->wakes++;
+}
+
+void ll_dutycycle_sampled(dutycycle_state_t *state, uint32_t samples) {
+    state->unsent += samples;
+}
+
+dutycycle_decision_t ll_dutycycle_decide(
+    const dutycycle_config_t *config,
+    const dutycycle_state_t *state,
+    int64_t now_ms) {
+    dutycycle_decision_t decision = {
+        .upload = false,
+        .sleep_ms = config->min_sleep_ms,
+    };
+
+    if (state->unsent > 0 && now_ms >= state->retry_at_ms) {
+        // Upload if the buffer is full enough, if the time budget ran out, or
+        // if the time budget would run out before the next wake.
+        int64_t next_wake = state->last_wake_ms + config->sample_interval_ms;
+        int64_t upload_due = state->last_upload_ms + config->upload_interval_ms;
+        decision.upload = state->unsent >= config->upload_threshold ||
+                          now_ms >= upload_due || next_wake > upload_due;
+    }
+
+    // Keep the wake grid anchored to the wake time, not to when the work
+    // finished. Guard against the clock jumping backwards.
+    int64_t elapsed = now_ms - state->last_wake_ms;
+    int64_t remaining = config->sample_interval_ms - elapsed;
+    if (elapsed >= 0 && remaining > config->min_sleep_ms) {
+        decision.sleep_ms = remaining;
+    }
+    return decision;
+}
+
+void ll_dutycycle_radio_used(dutycycle_state_t *state, int64_t radio_ms) {
+    state->radio_ms += radio_ms;
+}
+
+void ll_dutycycle_uploaded(dutycycle_state_t *state, int64_t now_ms) {
+    state->last_upload_ms = now_ms;
+    state->retry_at_ms = now_ms;
+    state->unsent = 0;
+    state->failed_uploads = 0;
+    state->uploads++;
+}
+
+void ll_dutycycle_upload_failed(
+    const dutycycle_config_t *config,
+    dutycycle_state_t *state,
+    int64_t now_ms) {
+    // Exponential backoff in whole sample intervals, capped at the upload
+    // interval.
+    int64_t backoff = config->sample_interval_ms;
+    for (uint32_t i = 0; i < state->failed_uploads; i++) {
+        backoff *= 2;
+        if (backoff >= config->upload_interval_ms) {
+            backoff = config->upload_interval_ms;
+            break;
+        }
+    }
+    state->failed_uploads++;
+    state->retry_at_ms = now_ms + backoff;
+}
+
+void ll_dutycycle_slept(dutycycle_state_t *state, int64_t awake_ms) {
+    state->awake_ms += awake_ms;
+}
+
+float ll_dutycycle_estimate_mah_per_day(
+    const dutycycle_config_t *config,
+    const dutycycle_power_t *power,
+    int64_t awake_ms_per_wake,
+    int64_t radio_ms_per_upload) {
+    float wakes = MS_PER_DAY / config->sample_interval_ms;
+    float uploads_by_time = MS_PER_DAY / config->upload_interval_ms;
+    float uploads_by_size =
+        wakes * config->burst_samples / config->upload_threshold;
+    float uploads =
+        uploads_by_size > uploads_by_time ? uploads_by_size : uploads_by_time;
+    if (uploads > wakes) {
+        uploads = wakes;
+    }
+
+    // Radio time is on top of the CPU being awake.
+    float awake_ms = wakes * awake_ms_per_wake;
+    float radio_ms = uploads * radio_ms_per_upload;
+    float sleep_ms = MS_PER_DAY - awake_ms - radio_ms;
+    if (sleep_ms < 0) {
+        sleep_ms = 0;
+    }
+    return awake_ms / MS_PER_HOUR * power->active_ma +
+           radio_ms / MS_PER_HOUR * power->radio_ma +
+           sleep_ms / MS_PER_HOUR * power->sleep_ua / 1000.0f;
+}
+
+float ll_dutycycle_measured_mah_per_day(
+    const dutycycle_config_t *config,
+    const dutycycle_power_t *power,
+    const dutycycle_state_t *state) {
+    if (state->wakes == 0) {
+        return 0.0f;
+    }
+    int64_t radio_per_upload =
+        state->uploads > 0 ? state->radio_ms / state->uploads : 0;
+    int64_t awake_per_wake =
+        (state->awake_ms - state->radio_ms) / state->wakes;
+    return ll_dutycycle_estimate_mah_per_day(
+        config,
+        power,
+        awake_per_wake,
+        radio_per_upload);
+}
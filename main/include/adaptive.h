@@ -0,0 +1,43 @@
+#ifndef LL_ADAPTIVE_H
+#define LL_ADAPTIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pure sampling rate controller, like dutycycle.h. A two sided CUSUM on the
+// level's departure from where it last settled detects fills and drains.
+// Detection drops the sampling interval to the minimum, every stable_samples
+// quiet samples after that double it up to the maximum. The upload interval
+// scales along with it.
+
+typedef struct adaptive_config_t {
+    int64_t min_interval_ms;
+    int64_t max_interval_ms;
+    int64_t min_report_ms;
+    int64_t max_report_ms;
+    // In value units, see calib_output_t. Departures within drift are taken
+    // as noise, the detector fires once the excess adds up to threshold.
+    int32_t drift;
+    int32_t threshold;
+    uint32_t stable_samples;
+} adaptive_config_t;
+
+typedef struct adaptive_state_t {
+    int64_t interval_ms;
+    int32_t reference;
+    int64_t rise;
+    int64_t fall;
+    uint32_t stable;
+    bool primed;
+    // Detections so far, for the logs.
+    uint32_t detections;
+} adaptive_state_t;
+
+void ll_adaptive_reset(
+    const adaptive_config_t *config, adaptive_state_t *state);
+bool ll_adaptive_update(
+    const adaptive_config_t *config, adaptive_state_t *state, int32_t value);
+int64_t ll_adaptive_report_ms(
+    const adaptive_config_t *config, const adaptive_state_t *state);
+
+#endif // LL_ADAPTIVE_H
@@ -0,0 +1,39 @@
+#ifndef LL_ADCFRAME_H
+#define LL_ADCFRAME_H
+
+#include "const.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ADC channel ids the DMA results can carry (3 bits).
+#define ADCFRAME_CHANNEL_IDS 8
+
+// One scan worth of conversions for every channel in the pattern, stored as a
+// struct of arrays so each channel's conversions are contiguous and the filter
+// runs over one linear array per channel.
+typedef struct adc_frame_t {
+    uint16_t raw[SENSOR_CHANNELS_MAX][SENSOR_OVERSAMPLE];
+    uint8_t fill[SENSOR_CHANNELS_MAX];
+    // Slot of each ADC channel id in the arrays above, -1 if not scanned.
+    int8_t slot_of[ADCFRAME_CHANNEL_IDS];
+    uint8_t channels;
+    uint8_t full;
+} adc_frame_t;
+
+// Linear calibration from averaged raw counts to the stored value.
+typedef struct adc_calib_t {
+    int32_t gain_num;
+    int32_t gain_den;
+    int32_t offset;
+} adc_calib_t;
+
+void ll_adcframe_init(
+    adc_frame_t *frame, const uint8_t *adc_channels, int channels);
+void ll_adcframe_reset(adc_frame_t *frame);
+bool ll_adcframe_demux(adc_frame_t *frame, const uint8_t *buf, size_t len);
+int32_t ll_adcframe_mean(const adc_frame_t *frame, int slot);
+int32_t ll_adcframe_calibrate(const adc_calib_t *calib, int32_t raw);
+
+#endif // LL_ADCFRAME_H
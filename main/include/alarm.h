@@ -0,0 +1,54 @@
+#ifndef LL_ALARM_H
+#define LL_ALARM_H
+
+#include "const.h"
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum alarm_kind_t {
+    ak_Above,
+    ak_Below,
+    ak_Rise,
+    ak_Fall,
+} alarm_kind_t;
+
+// Level rules compare the value against the threshold, and clear once the
+// value is back past the threshold by the hysteresis. Rate rules compare the
+// change over each window, in value units per minute, against the threshold.
+typedef struct alarm_rule_t {
+    char name[ALARM_NAME_MAX];
+    alarm_kind_t kind;
+    int32_t threshold;
+    int32_t hysteresis;
+    int32_t window_ms;
+} alarm_rule_t;
+
+typedef struct alarm_state_t {
+    bool active;
+    bool primed;
+    int64_t anchor_timestamp;
+    int32_t anchor_value;
+} alarm_state_t;
+
+typedef struct alarm_engine_t {
+    alarm_rule_t rules[ALARM_RULES_MAX];
+    alarm_state_t states[ALARM_RULES_MAX];
+    int count;
+} alarm_engine_t;
+
+typedef struct alarm_event_t {
+    char rule[ALARM_NAME_MAX];
+    alarm_kind_t kind;
+    bool active;
+    int64_t timestamp;
+    int32_t value;
+} alarm_event_t;
+
+bool ll_alarm_parse(const char *spec, alarm_engine_t *engine);
+int ll_alarm_evaluate(
+    alarm_engine_t *engine, const sample_t *sample, alarm_event_t *events);
+const char *ll_alarm_kind_name(alarm_kind_t kind);
+
+#endif // LL_ALARM_H
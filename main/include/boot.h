@@ -0,0 +1,65 @@
+#ifndef LL_BOOT_H
+#define LL_BOOT_H
+
+#include "const.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Boot timeline. Every phase is marked with the time since boot the first
+// time any task reaches it. The report of a boot is kept in NVS, /boot shows
+// the running boot next to the last boot of a different build, so a change
+// to the boot sequence can be compared before and after an update.
+//
+// Boot jobs run independent steps of the boot on their own task, so they
+// overlap with steps that mostly wait on the radio.
+
+typedef enum boot_phase_t {
+    bp_NvsReady,
+    bp_WifiStarted,
+    bp_StorageReady,
+    bp_ConfigLoaded,
+    bp_Scanned,
+    bp_PagesLoaded,
+    bp_PortalReady,
+    bp_Connected,
+    bp_SensorReady,
+    bp_FirstReading,
+    bp_Count,
+} boot_phase_t;
+
+typedef struct boot_report_t {
+    // Layout of the report, older layouts are dropped instead of compared.
+    uint32_t layout;
+    // App version and the start of the ELF hash.
+    char build[BOOT_BUILD_SIZE];
+    // Microseconds since boot, 0 for phases this boot didn't get to.
+    int64_t at_us[bp_Count];
+} boot_report_t;
+
+typedef struct boot_job_t {
+    const char *name;
+    void (*run)(void *arg);
+    void *arg;
+    StaticQueue_t done_queue;
+    uint8_t done_storage[1];
+    QueueHandle_t done;
+} boot_job_t;
+
+void ll_boot_mark(boot_phase_t phase);
+bool ll_boot_wait(boot_phase_t phase, uint32_t timeout_ms);
+void ll_boot_report(boot_report_t *report);
+void ll_boot_set_baseline(const boot_report_t *baseline);
+void ll_boot_log();
+const char *ll_boot_phase_name(boot_phase_t phase);
+
+void ll_boot_job_start(
+    boot_job_t *job, const char *name, void (*run)(void *arg), void *arg);
+void ll_boot_job_join(boot_job_t *job);
+
+void ll_boot_serve(httpd_handle_t server);
+
+#endif // LL_BOOT_H
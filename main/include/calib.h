@@ -0,0 +1,65 @@
+#ifndef LL_CALIB_H
+#define LL_CALIB_H
+
+#include "const.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fractional bits of the level between the two steps, so the volume table
+// interpolates on sub-millimeter levels.
+#define CALIB_LEVEL_FRAC_BITS 8
+// Fractional bits of the volume table entries.
+#define CALIB_VOLUME_FRAC_BITS 8
+
+typedef enum tank_shape_t {
+    ts_None,
+    ts_HorizontalCylinder,
+    ts_VerticalCylinder,
+    ts_Box,
+} tank_shape_t;
+
+// What the channel value becomes: raw counts when nothing is provisioned,
+// level in mm with only calibration points, volume in litres with a tank.
+typedef enum calib_output_t {
+    co_Raw,
+    co_Level,
+    co_Volume,
+} calib_output_t;
+
+// Raw reading to level through the calibration points, then level to volume
+// through a table generated from the tank geometry. Both steps are fixed
+// point and find their segment in O(1), floats are only used to build the
+// tables.
+typedef struct calib_t {
+    calib_output_t output;
+
+    // Raw to level. Points are sorted by raw reading, the end segments are
+    // extrapolated so a faulty probe still shows up as out of range.
+    uint8_t points;
+    int32_t raw[CALIB_POINTS_MAX];
+    // Level at each point and slope of the segment starting there, in
+    // CALIB_LEVEL_FRAC_BITS fixed point mm and 16 more bits per raw count.
+    int32_t level[CALIB_POINTS_MAX];
+    int64_t slope[CALIB_POINTS_MAX];
+    // First segment of each 1 << bucket_shift wide bucket of raw readings
+    // above raw[0].
+    uint8_t bucket_shift;
+    uint8_t bucket[CALIB_BUCKETS];
+
+    // Level to volume, entry i is the volume at level i << volume_shift.
+    // Levels are clamped to [0, level_max] before the lookup.
+    tank_shape_t shape;
+    uint8_t volume_shift;
+    int32_t level_max;
+    int32_t volume[CALIB_VOLUME_SEGMENTS + 1];
+} calib_t;
+
+bool ll_calib_parse(const char *points, const char *tank, calib_t *calib);
+int32_t ll_calib_level(const calib_t *calib, int32_t raw);
+int32_t ll_calib_volume(const calib_t *calib, int32_t level);
+int32_t ll_calib_apply(const calib_t *calib, int32_t raw);
+double ll_calib_tank_litres(
+    tank_shape_t shape, const int32_t *dims, double level_mm);
+
+#endif // LL_CALIB_H
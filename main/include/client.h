@@ -1,6 +1,11 @@
 #ifndef LL_CLIENT_H
 #define LL_CLIENT_H
 
+#include "reactor.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum connect_error_t {
     cr_None,
     cr_InvalidSsid,
@@ -8,6 +13,20 @@ typedef enum connect_error_t {
     cr_TechnicalError,
 } connect_result_t;
 
-connect_result_t try_connect_to_network(char *ssid, char *pass);
+// One connection attempt as a state machine on the reactor task. Feed it
+// every reactor event until it returns true with the result.
+typedef struct client_attempt_t {
+    uint32_t id;
+} client_attempt_t;
+
+void ll_client_connect_start(
+    client_attempt_t *attempt, const char *ssid, const char *pass);
+bool ll_client_connect_step(
+    client_attempt_t *attempt,
+    const reactor_event_t *event,
+    connect_result_t *result);
+
+// Runs one attempt to completion on the calling task.
+connect_result_t try_connect_to_network(const char *ssid, const char *pass);
 
 #endif // LL_CLIENT_H
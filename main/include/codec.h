@@ -0,0 +1,69 @@
+#ifndef LL_CODEC_H
+#define LL_CODEC_H
+
+#include "const.h"
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CODEC_BLOCK_MAGIC 0x424C // "LB" in little endian
+// The block holds the output of the deadband filter, see deadband.h. Its
+// payload starts with the deadband and the heartbeat in ms as varints, and
+// every value delta is shifted up to carry the sample's report in the low
+// two bits.
+#define CODEC_FLAG_TAGGED 0x01
+
+// Every encoded block starts with this header, followed by payload_len bytes
+// of varint encoded samples. The first sample's timestamp lives in the header,
+// every following timestamp is stored as a delta-of-delta, and every value is
+// stored as a delta from the previous value. All deltas are zigzag varints.
+typedef struct __attribute__((packed)) codec_block_header_t {
+    uint16_t magic;
+    uint16_t payload_len;
+    uint16_t count;
+    uint8_t channel;
+    uint8_t flags;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+    int32_t min_value;
+    int32_t max_value;
+} codec_block_header_t;
+
+#define CODEC_PAYLOAD_SIZE (CODEC_BLOCK_SIZE - sizeof(codec_block_header_t))
+
+typedef struct codec_encoder_t {
+    // Header is written in front of the payload when the block is finished.
+    uint8_t block[CODEC_BLOCK_SIZE];
+    codec_block_header_t header;
+    size_t cursor;
+    int64_t prev_delta;
+    int32_t prev_value;
+} codec_encoder_t;
+
+typedef struct codec_decoder_t {
+    codec_block_header_t header;
+    const uint8_t *payload;
+    size_t cursor;
+    uint16_t decoded;
+    // Of tagged blocks, 0 otherwise.
+    int32_t deadband;
+    int64_t heartbeat_ms;
+    int64_t prev_timestamp;
+    int64_t prev_delta;
+    int32_t prev_value;
+} codec_decoder_t;
+
+void ll_codec_encoder_reset(codec_encoder_t *enc, uint8_t channel);
+void ll_codec_encoder_tag(
+    codec_encoder_t *enc, int32_t deadband, int64_t heartbeat_ms);
+bool ll_codec_encoder_append(codec_encoder_t *enc, const sample_t *sample);
+const uint8_t *ll_codec_encoder_finish(codec_encoder_t *enc, size_t *len);
+bool ll_codec_read_header(
+    const uint8_t *block, size_t len, codec_block_header_t *header);
+bool ll_codec_decoder_init(
+    codec_decoder_t *dec, const uint8_t *block, size_t len);
+bool ll_codec_decoder_next(codec_decoder_t *dec, sample_t *sample);
+
+#endif // LL_CODEC_H
@@ -0,0 +1,18 @@
+#ifndef LL_CONFIG_H
+#define LL_CONFIG_H
+
+#include "boot.h"
+#include "remote.h"
+#include "setup.h"
+
+#include <stdbool.h>
+
+void ll_config_save_netinfo(const network_info_t *netinfo);
+bool ll_config_load_netinfo(network_info_t *netinfo);
+void ll_config_save_remote(const remote_config_t *config, uint32_t changed);
+void ll_config_load_remote(remote_config_t *config);
+void ll_config_save_boot_report(const boot_report_t *report);
+bool ll_config_load_boot_baseline(
+    const boot_report_t *current, boot_report_t *baseline);
+
+#endif // LL_CONFIG_H
@@ -9,6 +9,17 @@
 #define LOWEST_CHAN 1
 #define HIGHEST_CHAN 11
 #define AP_SCAN_MAX_APS 8
+#define SETUP_SUCCESS_DISPLAY_MS 5000
+// The target probe of setup has to come to a verdict within this, see
+// probe.h. It runs while the success countdown does, so it is shorter.
+#define SETUP_PROBE_TIMEOUT_MS 3000
+#define PROBE_HOST_MAX 128
+#define PROBE_STACK_SIZE 3072
+#define CLIENT_CONNECT_TIMEOUT_MS (30 * 1000)
+#define REACTOR_QUEUE_LEN 8
+// Blocks in the pools of the setup session objects, see pool.h
+#define SETUP_SERVER_POOL_SIZE 1
+#define SCAN_POOL_SIZE 1
 
 #define PAGE_SMALL_SCRATCHPAD_SIZE 512
 #define PAGE_LARGE_SCRATCHPAD_SIZE 1024
@@ -17,5 +28,192 @@
 #define PAGE_PART_TYPE 0x40
 #define PAGE_PART_SUBTYPE 0x00
 #define TEMPLATE_BUFFER_SIZE 1024
+#define PAGE_TABLE_MAX_ENTRIES 8
+#define PAGE_TABLE_TEXT_MAX 256
+
+#define SENSOR_ADC_CHANNEL 2
+#define SENSOR_OVERSAMPLE 16
+// Channels are configured in sampler.c, at most SOC_ADC_PATT_LEN_MAX
+#define SENSOR_CHANNEL_COUNT 1
+#define SENSOR_CHANNELS_MAX 8
+#define SENSOR_CHANNEL_PERIOD_MAX_MS (60 * 1000)
+#define SENSOR_SAMPLE_FREQ_HZ 20000
+#define SENSOR_CONV_FRAME_SIZE 256
+#define SENSOR_READ_TIMEOUT_MS 100
+#define SAMPLE_PERIOD_MS 1000
+// Remote config can change the period within these, see remote.h
+#define SAMPLE_PERIOD_MIN_MS 100
+#define SAMPLE_QUEUE_LEN 32
+
+// Calibration to level and volume, see calib.h
+#define CALIB_POINTS_MAX 16
+#define CALIB_BUCKETS 32
+#define CALIB_VOLUME_SEGMENTS 256
+#define CALIB_RAW_LIMIT (1 << 16)
+#define CALIB_MM_LIMIT 100000
+
+#define CODEC_BLOCK_SIZE 512
+#define SAMPLE_LOG_PART_NAME "sample_log"
+#define SAMPLE_LOG_PART_TYPE 0x40
+#define SAMPLE_LOG_PART_SUBTYPE 0x01
+#define SAMPLE_LOG_SECTOR_SIZE 4096
+#define LOGGER_FLUSH_INTERVAL_MS (10 * 60 * 1000)
+// Report by exception in front of the log, see deadband.h. The deadband is
+// in value units, a heartbeat of 0 logs every reading. Remote config can
+// change both.
+#define DEADBAND_DEFAULT 0
+#define DEADBAND_HEARTBEAT_DEFAULT_MS 0
+#define DEADBAND_HEARTBEAT_MAX_MS (24 * 60 * 60 * 1000)
+
+// Rollup tiers, retention is set by the partition sizes: 127 records per
+// sector, so 256K of minutes is ~8.5 days and 64K of hours is ~84 days
+#define ROLLUP_MINUTE_PART_NAME "rollup_minute"
+#define ROLLUP_HOUR_PART_NAME "rollup_hour"
+#define ROLLUP_PART_TYPE 0x40
+#define ROLLUP_PART_SUBTYPE 0x02
+#define ROLLUP_RTC_MAGIC 0x524F4C4C
+
+#define DATASERVER_CHUNK_SIZE 2048
+#define DATASERVER_LINE_SIZE 128
+// What app_main registers on the data server: /data, /metrics, /log, /ota,
+// /live, /boot, and with the profiler /profile GET and POST.
+#define DATASERVER_URI_HANDLERS (6 + (PROFILER_ENABLED ? 2 : 0))
+
+// Live readings over a WebSocket, see live.h. The queue length is a power of
+// two and at most 255.
+#define LIVE_PERIOD_MS 20
+#define LIVE_DEFAULT_HZ 10
+#define LIVE_CLIENTS_MAX 3
+#define LIVE_QUEUE_LEN 32
+#define LIVE_RECV_MAX 64
+
+// Deferred log, see dlog.h
+#define DLOG_LEVEL ESP_LOG_DEBUG
+#define DLOG_RING_SIZE 4096
+#define DLOG_RECORD_MAX 160
+#define DLOG_STR_MAX 48
+
+// Sampling profiler, see profiler.h. Takes about 7K of RAM when enabled.
+#define PROFILER_ENABLED false
+// Profile from boot at this rate, 0 waits for POST /profile
+#define PROFILER_BOOT_HZ 0
+// Prime, so sampling doesn't beat with the 100 Hz tick
+#define PROFILER_HZ 997
+#define PROFILER_HZ_MAX 5000
+#define PROFILER_INTR_PRIORITY 3
+#define PROFILER_SLOTS 512
+#define PROFILER_PROBES 8
+#define PROFILER_TASKS_MAX 16
+#define PROFILER_NAME_SIZE 16
+#define PROFILER_CHUNK_SIZE 1024
+
+#define METRICS_MAX 32
+#define METRICS_TASKS_MAX 8
+#define METRICS_BUCKETS_MAX 10
+#define METRICS_CHUNK_SIZE 1024
+#define METRICS_LINE_SIZE 160
+// Compact snapshot the uploader sends along with a batch this often
+#define METRICS_SNAPSHOT_SIZE 384
+#define METRICS_SNAPSHOT_INTERVAL_MS (15 * 60 * 1000)
+
+#define UPLOAD_BATCH_MAX_BYTES 4096
+#define UPLOAD_MAX_DELAY_MS (5 * 60 * 1000)
+#define UPLOAD_POLL_MS 1000
+#define UPLOAD_TIMEOUT_MS 10000
+#define UPLOAD_RETRY_MIN_MS 1000
+#define UPLOAD_RETRY_MAX_MS (5 * 60 * 1000)
+#define UPLOAD_NVS_NAMESPACE "ll_upload"
+#define UPLOAD_WINDOW_MAX 8
+#define UPLOAD_DRAIN_INTERVAL_MS 200
+#define UPLOAD_DRAIN_POLL_MS 100
+// The uploader task runs the full TLS handshakes of tls.c and of the remote
+// config poll and the config subscribers. Full handshakes log how much of it
+// was never used, so does ll_task_stack_free_bytes.
+#define UPLOADER_STACK_SIZE 8192
+// Catch-up after an outage, see uploader.c. The summary is built in the batch
+// buffer.
+#define UPLOAD_CATCHUP_MIN_BYTES (16 * UPLOAD_BATCH_MAX_BYTES)
+#define UPLOAD_CATCHUP_FRESH_MS (15 * 60 * 1000)
+#define UPLOAD_SUMMARY_BUCKETS 48
+// HTTPS uploads, see tls.h. A saved session is about 150 bytes plus the
+// server's ticket, the head buffer takes a request with a metrics snapshot.
+#define TLS_RTC_MAGIC 0x544C5353
+#define TLS_SESSION_SAVE_MAX 1024
+#define TLS_PEER_MAX 136
+#define UPLOAD_HTTPS_HEAD_SIZE 1024
+#define UPLOAD_HTTPS_PATH_MAX 256
+#define MQTT_WINDOW 4
+// The device name goes into request headers and topics, with the NUL.
+#define DEVNAME_SIZE 64
+#define MQTT_TOPIC_FORMAT "level-logger/%s/samples"
+#define MQTT_KEEPALIVE_S 60
+
+#define NETINFO_NVS_NAMESPACE "ll_netinfo"
+
+// Remote configuration, see remote.h
+#define REMOTE_CONFIG_PATH "/config"
+#define REMOTE_DOC_MAX 1024
+#define REMOTE_URL_MAX 192
+#define REMOTE_TIMEOUT_MS 5000
+#define REMOTE_SUBSCRIBERS_MAX 6
+// At most one poll per upload cycle, backlogs send a batch every
+// UPLOAD_DRAIN_INTERVAL_MS.
+#define REMOTE_POLL_INTERVAL_MS UPLOAD_MAX_DELAY_MS
+
+// Boot timeline, see boot.h. Bump the layout when the phases change.
+#define BOOT_NVS_NAMESPACE "ll_boot"
+#define BOOT_REPORT_LAYOUT 1
+#define BOOT_BUILD_SIZE 48
+// A phase name and three columns as wide as an int64 of ms can get.
+#define BOOT_LINE_SIZE 96
+#define BOOT_TEXT_SIZE 1024
+#define BOOT_JOB_STACK_SIZE 4096
+#define BOOT_POLL_MS 10
+// How long the end of app_main waits for the first reading to save the report
+#define BOOT_REPORT_WAIT_MS 5000
+
+// Firmware updates, see ota.h. A buffer is one flash sector.
+#define OTA_BUFFER_SIZE 4096
+#define OTA_BUFFER_COUNT 2
+#define OTA_URL_MAX 256
+#define OTA_TIMEOUT_MS 10000
+#define OTA_RESUME_MAX 5
+#define OTA_RESUME_DELAY_MS 1000
+#define OTA_REBOOT_DELAY_MS 1000
+#define OTA_STATUS_SIZE 160
+// "<sha256 hex> <image url>" with the NUL, see ll_ota_parse_request.
+#define OTA_REQUEST_SIZE (64 + 1 + OTA_URL_MAX)
+
+#define ALARM_RULES_MAX 8
+#define ALARM_NAME_MAX 16
+#define ALARM_RATE_WINDOW_DEFAULT_S 60
+#define ALARM_RATE_WINDOW_MAX_S (24 * 60 * 60)
+#define ALARM_QUEUE_LEN 8
+#define ALARM_JSON_SIZE 128
+#define MQTT_ALARM_TOPIC_FORMAT "level-logger/%s/alarms"
+#define MQTT_METRICS_TOPIC_FORMAT "level-logger/%s/metrics"
+#define MQTT_SUMMARY_TOPIC_FORMAT "level-logger/%s/summary"
+
+// Deep sleep duty cycling for battery powered installs
+#define DUTYCYCLE_ENABLED false
+#define DUTYCYCLE_UPLOAD_INTERVAL_MS (6 * 60 * 60 * 1000)
+#define DUTYCYCLE_MIN_SLEEP_MS 1000
+#define DUTYCYCLE_UPLOAD_THRESHOLD 256
+#define DUTYCYCLE_BURST_SAMPLES 4
+#define DUTYCYCLE_BURST_SPACING_MS 50
+#define DUTYCYCLE_UPLOAD_TIMEOUT_MS 30000
+#define DUTYCYCLE_RTC_MAGIC 0x44555459
+// Current draw used for the mAh/day estimate
+#define DUTYCYCLE_SLEEP_UA 8.0f
+#define DUTYCYCLE_ACTIVE_MA 22.0f
+#define DUTYCYCLE_RADIO_MA 95.0f
+// Wake intervals of the duty cycle, see adaptive.h. Drift and threshold are
+// in value units, these suit levels in mm.
+#define ADAPTIVE_MIN_INTERVAL_MS (30 * 1000)
+#define ADAPTIVE_MAX_INTERVAL_MS (10 * 60 * 1000)
+#define ADAPTIVE_MIN_REPORT_MS (5 * 60 * 1000)
+#define ADAPTIVE_DRIFT 3
+#define ADAPTIVE_THRESHOLD 15
+#define ADAPTIVE_STABLE_SAMPLES 4
 
 #endif // CONST_H
@@ -0,0 +1,29 @@
+#ifndef LL_DATASERVER_H
+#define LL_DATASERVER_H
+
+#include "esp_http_server.h"
+
+typedef enum data_res_t {
+    dr_Raw,
+    dr_Minute,
+    dr_Hour,
+} data_res_t;
+
+typedef enum data_format_t {
+    df_Csv,
+    df_Ndjson,
+    df_Bin,
+} data_format_t;
+
+typedef struct data_query_t {
+    int64_t from;
+    int64_t to;
+    data_res_t res;
+    data_format_t format;
+    uint8_t channel;
+} data_query_t;
+
+void ll_dataserver_start();
+httpd_handle_t ll_dataserver_handle();
+
+#endif // LL_DATASERVER_H
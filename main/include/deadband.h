@@ -0,0 +1,35 @@
+#ifndef LL_DEADBAND_H
+#define LL_DEADBAND_H
+
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pure report-by-exception filter, like adaptive.h. A reading goes into the
+// log when it moved more than the deadband from the last one that did, or
+// when nothing went in for the heartbeat. Everything in between is within
+// the deadband of the reading before it, so holding the last reported value
+// rebuilds the series with an error of at most the deadband, and a gap
+// longer than the heartbeat means lost data rather than a still tank. The
+// codec keeps both in every block and the reason in every sample, see
+// codec.h.
+
+typedef struct deadband_config_t {
+    // In value units, see calib_output_t.
+    int32_t deadband;
+    // 0 turns the filter off, every reading goes in as sr_Every.
+    int64_t heartbeat_ms;
+} deadband_config_t;
+
+typedef struct deadband_state_t {
+    bool primed;
+    int32_t reported;
+    int64_t reported_at;
+} deadband_state_t;
+
+void ll_deadband_reset(deadband_state_t *state);
+bool ll_deadband_update(
+    const deadband_config_t *config, deadband_state_t *state, sample_t *sample);
+
+#endif // LL_DEADBAND_H
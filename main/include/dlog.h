@@ -0,0 +1,106 @@
+#ifndef LL_DLOG_H
+#define LL_DLOG_H
+
+#include "const.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Deferred logging. A record holds where its format string and tag are and
+// the raw arguments, nothing is formatted on the device. Records go into a
+// RAM ring served at /log, host/dlog_decode.py formats them on a host with
+// the firmware ELF.
+//
+// Arguments are encoded by their C type, strings are copied (truncated to
+// DLOG_STR_MAX). Wrap secrets in LL_DLOG_SECRET, only their length is kept.
+
+typedef struct dlog_record_t {
+    uint8_t data[DLOG_RECORD_MAX];
+    size_t len;
+} dlog_record_t;
+
+typedef struct dlog_secret_t {
+    const char *value;
+} dlog_secret_t;
+
+#define LL_DLOG_SECRET(VALUE) ((dlog_secret_t){.value = (VALUE)})
+
+void ll_dlog_begin(
+    dlog_record_t *record,
+    esp_log_level_t level,
+    const char *tag,
+    const char *format);
+void ll_dlog_put_u32(dlog_record_t *record, uint32_t value);
+void ll_dlog_put_long(dlog_record_t *record, long value);
+void ll_dlog_put_ulong(dlog_record_t *record, unsigned long value);
+void ll_dlog_put_u64(dlog_record_t *record, uint64_t value);
+void ll_dlog_put_double(dlog_record_t *record, double value);
+void ll_dlog_put_ptr(dlog_record_t *record, const void *value);
+void ll_dlog_put_str(dlog_record_t *record, const char *value);
+void ll_dlog_put_ustr(dlog_record_t *record, const unsigned char *value);
+void ll_dlog_put_secret(dlog_record_t *record, dlog_secret_t value);
+void ll_dlog_commit(const dlog_record_t *record);
+
+void ll_dlog_serve(httpd_handle_t server);
+
+#define DLOG_PUT(RECORD, X)                                                    \
+    _Generic((X),                                                              \
+        dlog_secret_t: ll_dlog_put_secret,                                     \
+        char *: ll_dlog_put_str,                                               \
+        const char *: ll_dlog_put_str,                                         \
+        unsigned char *: ll_dlog_put_ustr,                                     \
+        const unsigned char *: ll_dlog_put_ustr,                               \
+        void *: ll_dlog_put_ptr,                                               \
+        const void *: ll_dlog_put_ptr,                                         \
+        long: ll_dlog_put_long,                                                \
+        unsigned long: ll_dlog_put_ulong,                                      \
+        long long: ll_dlog_put_u64,                                            \
+        unsigned long long: ll_dlog_put_u64,                                   \
+        float: ll_dlog_put_double,                                             \
+        double: ll_dlog_put_double,                                            \
+        default: ll_dlog_put_u32)(RECORD, X);
+
+#define DLOG_EACH_0(R)
+#define DLOG_EACH_1(R, A) DLOG_PUT(R, A)
+#define DLOG_EACH_2(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_1(R, __VA_ARGS__)
+#define DLOG_EACH_3(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_2(R, __VA_ARGS__)
+#define DLOG_EACH_4(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_3(R, __VA_ARGS__)
+#define DLOG_EACH_5(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_4(R, __VA_ARGS__)
+#define DLOG_EACH_6(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_5(R, __VA_ARGS__)
+#define DLOG_EACH_7(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_6(R, __VA_ARGS__)
+#define DLOG_EACH_8(R, A, ...) DLOG_PUT(R, A) DLOG_EACH_7(R, __VA_ARGS__)
+#define DLOG_PICK(_0, _1, _2, _3, _4, _5, _6, _7, _8, NAME, ...) NAME
+#define DLOG_EACH(R, ...)                                                      \
+    DLOG_PICK(                                                                 \
+        _0,                                                                    \
+        ##__VA_ARGS__,                                                         \
+        DLOG_EACH_8,                                                           \
+        DLOG_EACH_7,                                                           \
+        DLOG_EACH_6,                                                           \
+        DLOG_EACH_5,                                                           \
+        DLOG_EACH_4,                                                           \
+        DLOG_EACH_3,                                                           \
+        DLOG_EACH_2,                                                           \
+        DLOG_EACH_1,                                                           \
+        DLOG_EACH_0)                                                           \
+    (R, ##__VA_ARGS__)
+
+// FORMAT has to be a string literal, the decoder reads it out of the ELF.
+#define LL_DLOG(LEVEL, TAG, FORMAT, ...)                                       \
+    do {                                                                       \
+        if ((LEVEL) <= DLOG_LEVEL) {                                           \
+            dlog_record_t dlog_record;                                         \
+            ll_dlog_begin(&dlog_record, LEVEL, TAG, "" FORMAT);                \
+            DLOG_EACH(&dlog_record, ##__VA_ARGS__)                             \
+            ll_dlog_commit(&dlog_record);                                      \
+        }                                                                      \
+    } while (0)
+
+#define LL_DLOGE(TAG, ...) LL_DLOG(ESP_LOG_ERROR, TAG, __VA_ARGS__)
+#define LL_DLOGW(TAG, ...) LL_DLOG(ESP_LOG_WARN, TAG, __VA_ARGS__)
+#define LL_DLOGI(TAG, ...) LL_DLOG(ESP_LOG_INFO, TAG, __VA_ARGS__)
+#define LL_DLOGD(TAG, ...) LL_DLOG(ESP_LOG_DEBUG, TAG, __VA_ARGS__)
+
+#endif // LL_DLOG_H
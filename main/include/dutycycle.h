@@ -0,0 +1,71 @@
+#ifndef LL_DUTYCYCLE_H
+#define LL_DUTYCYCLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pure wake/upload/sleep decision logic for duty cycled operation. Knows
+// nothing about the hardware so it can be reasoned about (and exercised) on
+// its own.
+
+typedef struct dutycycle_config_t {
+    int64_t sample_interval_ms;
+    int64_t upload_interval_ms;
+    int64_t min_sleep_ms;
+    // Unsent samples that trigger an upload before the interval runs out.
+    uint32_t upload_threshold;
+    uint32_t burst_samples;
+} dutycycle_config_t;
+
+typedef struct dutycycle_power_t {
+    float sleep_ua;
+    float active_ma;
+    float radio_ma;
+} dutycycle_power_t;
+
+typedef struct dutycycle_state_t {
+    int64_t last_wake_ms;
+    int64_t last_upload_ms;
+    uint32_t unsent;
+    // Upload attempts back off after failures so a dead network doesn't
+    // bring the radio up on every wake.
+    int64_t retry_at_ms;
+    uint32_t failed_uploads;
+
+    // Accounting for the energy estimate.
+    uint32_t wakes;
+    uint32_t uploads;
+    int64_t awake_ms;
+    int64_t radio_ms;
+} dutycycle_state_t;
+
+typedef struct dutycycle_decision_t {
+    bool upload;
+    int64_t sleep_ms;
+} dutycycle_decision_t;
+
+void ll_dutycycle_reset(dutycycle_state_t *state, int64_t now_ms);
+void ll_dutycycle_woke(dutycycle_state_t *state, int64_t now_ms);
+void ll_dutycycle_sampled(dutycycle_state_t *state, uint32_t samples);
+dutycycle_decision_t ll_dutycycle_decide(
+    const dutycycle_config_t *config,
+    const dutycycle_state_t *state,
+    int64_t now_ms);
+void ll_dutycycle_radio_used(dutycycle_state_t *state, int64_t radio_ms);
+void ll_dutycycle_uploaded(dutycycle_state_t *state, int64_t now_ms);
+void ll_dutycycle_upload_failed(
+    const dutycycle_config_t *config,
+    dutycycle_state_t *state,
+    int64_t now_ms);
+void ll_dutycycle_slept(dutycycle_state_t *state, int64_t awake_ms);
+float ll_dutycycle_estimate_mah_per_day(
+    const dutycycle_config_t *config,
+    const dutycycle_power_t *power,
+    int64_t awake_ms_per_wake,
+    int64_t radio_ms_per_upload);
+float ll_dutycycle_measured_mah_per_day(
+    const dutycycle_config_t *config,
+    const dutycycle_power_t *power,
+    const dutycycle_state_t *state);
+
+#endif // LL_DUTYCYCLE_H
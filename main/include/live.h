@@ -0,0 +1,27 @@
+#ifndef LL_LIVE_H
+#define LL_LIVE_H
+
+#include "esp_http_server.h"
+#include "sample.h"
+
+#include <stdbool.h>
+
+// Live readings for installers, over a WebSocket at /live?hz=<n>&channel=<n>.
+// While anyone is watching the sampler scans every LIVE_PERIOD_MS and
+// publishes each scan here. Every client keeps every n-th reading for the
+// rate it asked for in its own bounded queue, which drops its oldest
+// readings when the client falls behind. Publishing never waits on a client,
+// so a slow one only loses its own readings.
+//
+// Frames are binary, little endian:
+//   u32 sequence number of the first reading, counting every reading kept
+//       for this client, so a gap is the number of readings dropped
+//   i64 timestamp of the first reading, see sample_t
+//   u8 channel, u8 reading count
+// then per reading u16 ms after the first one and i32 value.
+
+void ll_live_publish(const sample_t *samples, int count);
+bool ll_live_active();
+void ll_live_serve(httpd_handle_t server);
+
+#endif // LL_LIVE_H
@@ -0,0 +1,18 @@
+#ifndef LL_LOGGER_H
+#define LL_LOGGER_H
+
+#include "alarm.h"
+#include "deadband.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Every reading goes to the alarms, the rollups and the sample log, through
+// the deadband filter for the log only.
+void ll_logger_start(
+    QueueHandle_t sample_queue,
+    const alarm_engine_t *alarms,
+    const deadband_config_t *deadband);
+void ll_logger_set_alarms(const alarm_engine_t *alarms);
+void ll_logger_set_deadband(const deadband_config_t *deadband);
+
+#endif // LL_LOGGER_H
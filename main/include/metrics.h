@@ -0,0 +1,86 @@
+#ifndef LL_METRICS_H
+#define LL_METRICS_H
+
+#include "const.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum metric_kind_t {
+    mk_Counter,
+    mk_Gauge,
+    mk_Histogram,
+} metric_kind_t;
+
+// Metrics are static objects, registered once and never freed. Every metric
+// has a single writer, the task that owns what it measures, so an update is
+// a plain load and store instead of a locked read-modify-write. Counters and
+// histogram sums wrap at 32 bits, which scrapers treat like a restart.
+typedef struct metric_t {
+    const char *name;
+    const char *help;
+    metric_kind_t kind;
+    // Rendered as {label_key="label_value"}, NULL for no label.
+    const char *label_key;
+    const char *label_value;
+
+    // Counters and gauges
+    atomic_uint_least32_t value;
+
+    // Histograms, bucket i counts values up to bounds[i], the last bucket
+    // everything above.
+    uint32_t bounds[METRICS_BUCKETS_MAX];
+    uint8_t bound_count;
+    atomic_uint_least32_t buckets[METRICS_BUCKETS_MAX + 1];
+    atomic_uint_least32_t sum;
+} metric_t;
+
+// Bucket bounds for handler latencies in microseconds.
+#define METRICS_LATENCY_US_BOUNDS                                              \
+    { 1000, 3000, 10000, 30000, 100000, 300000, 1000000, 3000000 }
+#define METRICS_LATENCY_US_BOUND_COUNT 8
+
+// Wraps an httpd handler to observe how long it takes. Register
+// ll_metrics_timed_handler as the handler, with one of these as user_ctx.
+typedef struct metrics_handler_t {
+    esp_err_t (*handler)(httpd_req_t *request);
+    metric_t *latency;
+} metrics_handler_t;
+
+static inline void
+metrics_bump(atomic_uint_least32_t *value, uint_least32_t amount) {
+    atomic_store_explicit(
+        value,
+        atomic_load_explicit(value, memory_order_relaxed) + amount,
+        memory_order_relaxed);
+}
+
+static inline void ll_metrics_add(metric_t *metric, uint32_t amount) {
+    metrics_bump(&metric->value, amount);
+}
+
+static inline void ll_metrics_set(metric_t *metric, uint32_t value) {
+    atomic_store_explicit(&metric->value, value, memory_order_relaxed);
+}
+
+static inline void ll_metrics_observe(metric_t *metric, uint32_t value) {
+    int i = 0;
+    while (i < metric->bound_count && value > metric->bounds[i]) {
+        i++;
+    }
+    metrics_bump(&metric->buckets[i], 1);
+    metrics_bump(&metric->sum, value);
+}
+
+void ll_metrics_register(metric_t *metric);
+void ll_metrics_register_task(TaskHandle_t task);
+esp_err_t ll_metrics_timed_handler(httpd_req_t *request);
+void ll_metrics_serve(httpd_handle_t server);
+size_t ll_metrics_snapshot(char *buffer, size_t size);
+
+#endif // LL_METRICS_H
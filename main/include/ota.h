@@ -0,0 +1,59 @@
+#ifndef LL_OTA_H
+#define LL_OTA_H
+
+#include "esp_http_server.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Firmware updates over HTTP into the ota slot that isn't running. The
+// download runs on the calling task and hands full buffers to a flash writer
+// task, so the next buffer is received while the last one is erased and
+// written. A dropped connection is resumed with a Range request for the rest
+// of the image. The SHA-256 of the image is computed while it streams and
+// has to match before the slot becomes the boot slot.
+//
+// A new image boots pending verification. ll_ota_confirm_boot keeps it, if
+// the device resets before that the bootloader goes back to the old image.
+
+typedef enum ota_error_t {
+    oe_None,
+    oe_Busy,
+    oe_Connect,
+    oe_Status,
+    oe_TooBig,
+    oe_Truncated,
+    oe_Hash,
+    oe_Image,
+} ota_error_t;
+
+typedef struct ota_result_t {
+    ota_error_t error;
+    uint32_t bytes;
+    uint32_t ms;
+    // Connections after the first one
+    uint32_t resumes;
+} ota_result_t;
+
+// Blocks until the image is written and verified. Doesn't reboot.
+void ll_ota_update(
+    const char *url, const uint8_t sha256[32], ota_result_t *result);
+const char *ll_ota_error_explain(ota_error_t error);
+
+// Starts an update on a task of its own and reboots into the image once it's
+// verified. false if an update is already running.
+bool ll_ota_start(const char *url, const uint8_t sha256[32]);
+// Reads "<sha256 hex> <image url>", the form updates are requested in.
+// Returns the URL within request, NULL if it's malformed or not http(s)://.
+// The hash comes with the URL, so whoever may send a request decides what
+// runs on the device.
+const char *ll_ota_parse_request(const char *request, uint8_t sha256[32]);
+
+// GET /ota reports how the last update went, or how the running one is going.
+void ll_ota_serve(httpd_handle_t server);
+
+// Call once the running image has shown it works, i.e. reached the network or
+// logged a reading.
+void ll_ota_confirm_boot();
+
+#endif // LL_OTA_H
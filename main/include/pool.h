@@ -0,0 +1,52 @@
+#ifndef LL_POOL_H
+#define LL_POOL_H
+
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed capacity pool of same sized blocks, sized at build time. Objects
+// that come and go with a setup session or a connection attempt live here
+// instead of the general heap, so months of reprovisioning can't fragment
+// it. Running out is a sizing bug and aborts, like a failed malloc does.
+// LABEL names the pool in its high water metric.
+typedef struct pool_t {
+    pthread_mutex_t mutex;
+    uint8_t *blocks;
+    size_t block_size;
+    int capacity;
+
+    // SYNCHRONIZED FIELDS
+    uint32_t in_use;
+    int used;
+    // Most blocks ever in use at once, also reported as a metric
+    int high_water;
+    metric_t high_water_metric;
+    bool registered;
+} pool_t;
+
+#define LL_POOL_DEFINE(NAME, LABEL, TYPE, CAPACITY)                            \
+    _Static_assert((CAPACITY) <= 32, "pool " LABEL " is too big");             \
+    static TYPE NAME##_blocks[CAPACITY];                                       \
+    static pool_t NAME = {                                                     \
+        .mutex = PTHREAD_MUTEX_INITIALIZER,                                    \
+        .blocks = (uint8_t *)NAME##_blocks,                                    \
+        .block_size = sizeof(TYPE),                                            \
+        .capacity = (CAPACITY),                                                \
+        .high_water_metric =                                                   \
+            {                                                                  \
+                .name = "ll_pool_high_water",                                  \
+                .help = "Most blocks of a pool in use at once",                \
+                .kind = mk_Gauge,                                              \
+                .label_key = "pool",                                           \
+                .label_value = LABEL,                                          \
+            },                                                                 \
+    }
+
+void *ll_pool_alloc(pool_t *pool);
+void ll_pool_free(pool_t *pool, void *block);
+
+#endif // LL_POOL_H
@@ -0,0 +1,34 @@
+#ifndef LL_PROBE_H
+#define LL_PROBE_H
+
+#include "reactor.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Checks during setup that the upload target answers: resolves its host and
+// opens a TCP connection to its port, nothing is sent. The resolver blocks,
+// so the probe runs on a task of its own and reports back through the
+// reactor, where a deadline bounds the time to a verdict.
+typedef enum probe_result_t {
+    pr_Reachable,
+    pr_Unresolved,
+    pr_Unreachable,
+    pr_Timeout,
+} probe_result_t;
+
+// One probe as a state machine on the reactor task, like client_attempt_t.
+typedef struct probe_attempt_t {
+    uint32_t id;
+    int64_t started_us;
+} probe_attempt_t;
+
+// Returns false if the target has no host to probe.
+bool ll_probe_start(probe_attempt_t *attempt, const char *target);
+bool ll_probe_step(
+    probe_attempt_t *attempt,
+    const reactor_event_t *event,
+    probe_result_t *result);
+const char *ll_probe_result_name(probe_result_t result);
+
+#endif // LL_PROBE_H
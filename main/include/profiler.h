@@ -0,0 +1,33 @@
+#ifndef LL_PROFILER_H
+#define LL_PROFILER_H
+
+#include "esp_http_server.h"
+
+#include <stdint.h>
+
+// Sampling CPU profiler, opt in with PROFILER_ENABLED. A general purpose
+// timer interrupts at a fixed rate and counts the interrupted PC and task in
+// a fixed hash table, so the cost per sample is bounded and nothing is
+// allocated. host/profile_decode.py symbolizes a dump against the firmware
+// ELF.
+//
+// Samples that interrupt another ISR only count as in_isr, their PC isn't
+// known. Unless CONFIG_GPTIMER_ISR_IRAM_SAFE is set the timer is masked while
+// the flash is written, so time in flash writes is missing from the profile.
+
+// Dump layout, little endian:
+//   "PROF"
+//   u32 hz, u32 elapsed ms, u32 samples, u32 dropped (table full),
+//   u32 in_isr, u32 cpu cycles spent sampling, u32 cpu MHz,
+//   u32 task count, u32 entry count
+// then per task 16 bytes of name, then per entry u32 pc, u32 task index,
+// u32 count. Task index PROFILER_TASK_OTHER is every task past
+// PROFILER_TASKS_MAX.
+#define PROFILER_TASK_OTHER 0xFF
+
+void ll_profiler_start(uint32_t hz);
+void ll_profiler_stop();
+void ll_profiler_print();
+void ll_profiler_serve(httpd_handle_t server);
+
+#endif // LL_PROFILER_H
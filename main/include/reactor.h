@@ -0,0 +1,48 @@
+#ifndef LL_REACTOR_H
+#define LL_REACTOR_H
+
+#include "freertos/FreeRTOS.h"
+
+#include <stdint.h>
+
+// The setup and connect flows run as state machines on one task, the
+// reactor, fed by a single queue. Station events, form submissions and
+// expired deadlines all arrive through ll_reactor_next, so there is nothing
+// to signal before somebody waits and no wakeup can get lost.
+typedef enum reactor_event_kind_t {
+    re_StaConnected,
+    re_StaDisconnected,
+    re_StaGotIp,
+    re_FormSubmitted,
+    re_ProbeDone,
+    re_Deadline,
+} reactor_event_kind_t;
+
+typedef enum reactor_deadline_t {
+    rd_ConnectTimeout,
+    rd_SuccessShown,
+    rd_ProbeTimeout,
+    rd_Count,
+} reactor_deadline_t;
+
+typedef struct reactor_event_t {
+    reactor_event_kind_t kind;
+    // Station and probe events, the attempt they belong to. Events of an
+    // attempt that was given up on can still be in the queue.
+    uint32_t attempt;
+    // re_StaDisconnected, a WIFI_REASON_*. re_ProbeDone, a probe_result_t.
+    uint8_t reason;
+    // re_Deadline
+    reactor_deadline_t deadline;
+} reactor_event_t;
+
+void ll_reactor_init();
+// Any task, blocks while the queue is full.
+void ll_reactor_post(const reactor_event_t *event);
+
+// Reactor task only
+void ll_reactor_arm(reactor_deadline_t deadline, uint32_t ms);
+void ll_reactor_disarm(reactor_deadline_t deadline);
+void ll_reactor_next(reactor_event_t *event);
+
+#endif // LL_REACTOR_H
@@ -0,0 +1,87 @@
+#ifndef LL_REMOTE_H
+#define LL_REMOTE_H
+
+#include "const.h"
+#include "setup.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Remote configuration. Every upload cycle the uploader polls
+// <target>/config with If-None-Match: "<version>", the target answers 304
+// while the device is current and otherwise with the whole document, one
+// "key value" per line:
+//
+//   version 12
+//   devname tank-3
+//   sample_ms 5000
+//   alarms high:above:900:10
+//   deadband 5
+//   heartbeat_ms 600000
+//   firmware <sha256 hex> https://example.com/level-sensor-1.4.bin
+//
+// version is required and has to be newer than the running one. Keys that
+// are left out keep their value, an empty value clears the key. The whole
+// document is checked before anything is applied, one bad key rejects it,
+// and its version goes along in If-None-Match from then on so the target
+// doesn't send it again. The changed keys are then swapped in together and
+// handed to the subscribers, nothing restarts.
+//
+// Only http:// and https:// targets are polled, and the target has to stay
+// one. The portal keeps the version, so setup doesn't hold back the next
+// remote change.
+//
+// firmware updates the device to the image at the URL, see ota.h. Whoever
+// sends it decides what the device runs, so it's only taken from https://
+// targets, which are checked against the certificate bundle. A document from
+// an http:// target that changes it is rejected.
+
+typedef enum remote_key_t {
+    rk_Target = 1 << 0,
+    rk_Devname = 1 << 1,
+    rk_Alarms = 1 << 2,
+    rk_Levelcal = 1 << 3,
+    rk_Tank = 1 << 4,
+    rk_SampleMs = 1 << 5,
+    // deadband and heartbeat_ms, see deadband.h.
+    rk_Deadband = 1 << 6,
+    rk_Firmware = 1 << 7,
+} remote_key_t;
+
+#define REMOTE_KEYS_ALL 0xFF
+
+typedef struct remote_config_t {
+    uint32_t version;
+    // Base sampling period, see ll_sampler_set_period.
+    uint32_t sample_ms;
+    // Report by exception in front of the log, see deadband.h.
+    uint32_t deadband;
+    uint32_t heartbeat_ms;
+    // The last update requested, "<sha256 hex> <image url>" or empty.
+    char firmware[OTA_REQUEST_SIZE];
+    network_info_t netinfo;
+} remote_config_t;
+
+typedef enum remote_result_t {
+    rr_Current,
+    rr_Applied,
+    rr_Stale,
+    rr_Invalid,
+    rr_Unreachable,
+} remote_result_t;
+
+// Called on the polling task with the new config and the keys that changed
+// among the ones subscribed to. Subscribers run in the order they
+// subscribed, app_main subscribes the NVS write first so nothing acts on a
+// change a reset would lose.
+typedef void (*remote_callback_t)(
+    const remote_config_t *config, uint32_t changed, void *ctx);
+
+void ll_remote_init(const remote_config_t *config);
+void ll_remote_subscribe(uint32_t keys, remote_callback_t callback, void *ctx);
+void ll_remote_get(remote_config_t *config);
+remote_result_t ll_remote_apply(char *doc, uint32_t *changed);
+remote_result_t ll_remote_poll();
+const char *ll_remote_result_explain(remote_result_t result);
+
+#endif // LL_REMOTE_H
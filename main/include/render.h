@@ -5,8 +5,12 @@
 #define FORM_NAME_PASSWORD "psk"
 #define FORM_NAME_TARGET "target"
 #define FORM_NAME_DEVNAME "devname"
+#define FORM_NAME_ALARMS "alarms"
+#define FORM_NAME_LEVELCAL "levelcal"
+#define FORM_NAME_TANK "tank"
 #define KEY_LEN 32
 
+#include "const.h"
 #include "scan.h"
 
 typedef struct page_entry_t {
@@ -16,10 +20,11 @@ typedef struct page_entry_t {
 } page_entry_t;
 
 typedef struct page_table_t {
-    page_entry_t *entries;
+    page_entry_t entries[PAGE_TABLE_MAX_ENTRIES];
     uint32_t num_entries;
 } page_table_t;
 
+void preload_page_table();
 void init_page_table();
 const char *label_authmode(wifi_auth_mode_t authmode);
 void render_netlist_rows(bg_scan_t *scanned_networks);
@@ -0,0 +1,34 @@
+#ifndef LL_ROLLUP_H
+#define LL_ROLLUP_H
+
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ROLLUP_RECORD_MAGIC 0x5552 // "RU" in little endian
+
+// Aggregate of every sample whose timestamp falls in
+// [start, start + period). Stored as is in flash, so the mean is kept as a sum
+// and only divided out when read.
+typedef struct __attribute__((packed)) rollup_t {
+    uint16_t magic;
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t count;
+    int64_t start;
+    int64_t sum;
+    int32_t min_value;
+    int32_t max_value;
+} rollup_t;
+
+typedef struct rollup_acc_t {
+    int64_t period_ms;
+    rollup_t current;
+} rollup_acc_t;
+
+void ll_rollup_reset(rollup_acc_t *acc, int64_t period_ms, uint8_t channel);
+bool ll_rollup_add(rollup_acc_t *acc, const sample_t *sample, rollup_t *closed);
+int32_t ll_rollup_mean(const rollup_t *rollup);
+
+#endif // LL_ROLLUP_H
@@ -0,0 +1,51 @@
+#ifndef LL_ROLLUPSTORE_H
+#define LL_ROLLUPSTORE_H
+
+#include "esp_partition.h"
+#include "rollup.h"
+#include "sample.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum rollup_tier_t {
+    rt_Minute = 0,
+    rt_Hour,
+    rt_Count,
+} rollup_tier_t;
+
+// Records are addressed by index, the sector sequence number times the
+// records per sector plus the slot in the sector. Indices only ever grow and
+// records are stored in time order (give or take a channel period between
+// channels), so an index range is a time range.
+typedef uint32_t rollup_index_t;
+
+typedef struct rollupstore_tier_t {
+    // SYNCHRONIZED FIELDS
+    const esp_partition_t *part;
+    uint32_t num_sectors;
+    uint32_t head_seq;
+    uint32_t head_slot;
+    uint32_t tail_seq;
+} rollupstore_tier_t;
+
+typedef struct rollupstore_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    rollupstore_tier_t tiers[rt_Count];
+} rollupstore_t;
+
+void ll_rollupstore_init();
+void ll_rollupstore_add(const sample_t *sample);
+rollup_index_t ll_rollupstore_head(rollup_tier_t tier);
+rollup_index_t ll_rollupstore_tail(rollup_tier_t tier);
+rollup_index_t ll_rollupstore_find(rollup_tier_t tier, int64_t timestamp);
+bool ll_rollupstore_read(
+    rollup_tier_t tier, rollup_index_t index, rollup_t *rollup);
+bool ll_rollupstore_current(
+    rollup_tier_t tier, uint8_t channel, rollup_t *rollup);
+int64_t ll_rollupstore_period(rollup_tier_t tier);
+
+#endif // LL_ROLLUPSTORE_H
@@ -0,0 +1,30 @@
+#ifndef LL_SAMPLE_H
+#define LL_SAMPLE_H
+
+#include <stdint.h>
+
+// Why a reading went into the log, see deadband.h.
+typedef enum sample_report_t {
+    // No deadband, every reading goes in.
+    sr_Every,
+    // First reading after a start or a change of the deadband.
+    sr_First,
+    // Moved more than the deadband from the last one that went in.
+    sr_Change,
+    // Didn't move, but the heartbeat ran out.
+    sr_Heartbeat,
+} sample_report_t;
+
+typedef struct sample_t {
+    // Milliseconds since the UNIX epoch (or since boot if the clock has not
+    // been synchronized yet).
+    int64_t timestamp;
+    // Filtered and calibrated sensor reading.
+    int32_t value;
+    // Index into the configured sensor channels.
+    uint8_t channel;
+    // A sample_report_t, set on the way into the log.
+    uint8_t report;
+} sample_t;
+
+#endif // LL_SAMPLE_H
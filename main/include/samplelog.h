@@ -0,0 +1,41 @@
+#ifndef LL_SAMPLELOG_H
+#define LL_SAMPLELOG_H
+
+#include "const.h"
+#include "esp_partition.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+// A position in the log is the sector sequence number times the sector size
+// plus the offset into the sector. Positions only ever grow, so they double as
+// stable sequence numbers for the blocks stored at them.
+typedef uint64_t samplelog_pos_t;
+
+typedef struct samplelog_sector_header_t {
+    uint32_t magic;
+    uint32_t seq;
+} samplelog_sector_header_t;
+
+typedef struct samplelog_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    const esp_partition_t *part;
+    uint32_t num_sectors;
+    uint32_t head_seq;
+    uint32_t head_offset;
+    uint32_t tail_seq;
+    // Sparse time index, the first timestamp in each sector slot. INT64_MAX
+    // for a sector without blocks.
+    int64_t *sector_first_ts;
+} samplelog_t;
+
+void ll_samplelog_init();
+samplelog_pos_t ll_samplelog_append(const uint8_t *block, size_t len);
+samplelog_pos_t ll_samplelog_head();
+samplelog_pos_t ll_samplelog_tail();
+samplelog_pos_t ll_samplelog_find(int64_t timestamp);
+size_t ll_samplelog_read(samplelog_pos_t *pos, uint8_t *block, size_t maxlen);
+
+#endif // LL_SAMPLELOG_H
@@ -0,0 +1,33 @@
+#ifndef LL_SAMPLER_H
+#define LL_SAMPLER_H
+
+#include "adcframe.h"
+#include "calib.h"
+#include "esp_adc/adc_continuous.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct sensor_channel_t {
+    adc_channel_t adc_channel;
+    adc_atten_t atten;
+    adc_calib_t calib;
+    // Converted to level or volume by the provisioned calibration.
+    bool tank;
+    // A multiple of SAMPLE_PERIOD_MS, scales along with
+    // ll_sampler_set_period.
+    uint32_t period_ms;
+} sensor_channel_t;
+
+int64_t ll_sampler_now();
+void ll_sampler_init(const calib_t *calib);
+int ll_sampler_read(sample_t *samples);
+void ll_sampler_start(const calib_t *calib);
+void ll_sampler_set_period(uint32_t period_ms);
+void ll_sampler_set_calib(const calib_t *calib);
+QueueHandle_t ll_sampler_queue();
+
+#endif // LL_SAMPLER_H
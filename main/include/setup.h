@@ -4,18 +4,23 @@
 #include "esp_http_server.h"
 #include "scan.h"
 
-#include <pthread.h>
+#include <stdatomic.h>
 
 typedef struct network_info_t {
     // This field STORES the data for the other fields in a contiguous array of
     // c-strings.
-    char buffer[256];
+    char buffer[512];
 
     // These fields are ALIASES of the buffer field.
     char *ssid;
     char *password;
     char *target;
     char *devname;
+    // Alarm rules, see ll_alarm_parse. Empty when there are none.
+    char *alarms;
+    // Calibration points and tank, see ll_calib_parse. Empty when not given.
+    char *levelcal;
+    char *tank;
 } network_info_t;
 
 typedef enum setup_error_t {
@@ -30,7 +35,15 @@ typedef enum setup_error_t {
     se_PskMissing,
     se_PskIncorrect,
     se_TargetMissing,
+    se_TargetInvalid,
     se_DevnameMissing,
+    se_DevnameInvalid,
+    se_AlarmsInvalid,
+    se_LevelCalInvalid,
+    se_TankInvalid,
+    se_TargetUnresolved,
+    se_TargetUnreachable,
+    se_TargetTimeout,
 } setup_error_t;
 
 typedef enum _setup_state_t {
@@ -40,18 +53,19 @@ typedef enum _setup_state_t {
     ss_Success,
 } _setup_state_t;
 
+// Every state has one owner and only the owner moves out of it: the httpd
+// task out of ss_WaitingForNetInfo and ss_Failure, the reactor out of
+// ss_WaitingForConnection. ss_Success is final. The owner writes info and
+// _error before it stores the next state, readers load the state first.
 typedef struct setup_ap_server_t {
-    pthread_mutex_t _mutex;
-    pthread_cond_t _release_to_connect;
-
     // UNSYNCHRONRIZED FIELDS
     network_info_t info;
     httpd_handle_t _server_handle;
     bg_scan_t *scan;
+    setup_error_t _error;
 
     // SYNCHRONIZED FIELDS
-    setup_error_t _error;
-    _setup_state_t _state;
+    atomic_int _state;
 } setup_ap_server_t;
 
 setup_ap_server_t *setup_ap_start_server(bg_scan_t *initial_scan);
@@ -59,12 +73,13 @@ void setup_ap_stop_server(setup_ap_server_t *server);
 
 setup_ap_server_t *create_setup_server(bg_scan_t *initial_scan);
 void destroy_setup_server(setup_ap_server_t *server);
-void wait_for_netinfo_filled(setup_ap_server_t *server);
 void tried_connecting(setup_ap_server_t *server, setup_error_t error);
 _setup_state_t get_setup_server_state(setup_ap_server_t *server);
 void reset_setup_server_state(setup_ap_server_t *server);
 void setup_server_error_format(
     setup_ap_server_t *server, int buflen, char *buffer, const char *format);
 void fill_netinfo(setup_ap_server_t *server);
+void copy_netinfo(network_info_t *dst, const network_info_t *src);
+void do_setup(network_info_t *netinfo);
 
 #endif // SETUP_AP_H
@@ -0,0 +1,31 @@
+#ifndef LL_TLS_H
+#define LL_TLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The TLS connection of HTTPS uploads. It stays open across batches, and
+// the session of the last handshake is kept serialized in RTC memory, so the
+// next connection resumes it with an abbreviated handshake, after deep sleep
+// too. No certificate chain to verify and no key exchange, a fraction of the
+// CPU time and heap of a full handshake. Only the uploader task uses it.
+
+typedef struct tls_stats_t {
+    uint32_t full;
+    uint32_t resumed;
+    // Connects that found the connection still open.
+    uint32_t reused;
+    // Of the last handshake. The heap peak is the most the free heap went
+    // down from before the connect, sampled after every handshake step.
+    int64_t handshake_us;
+    uint32_t heap_peak;
+} tls_stats_t;
+
+bool ll_tls_connect(const char *host, const char *port, bool *reused);
+bool ll_tls_write(const void *data, size_t len);
+int ll_tls_read(void *buf, size_t len);
+void ll_tls_close();
+void ll_tls_get_stats(tls_stats_t *stats);
+
+#endif // LL_TLS_H
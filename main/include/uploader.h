@@ -0,0 +1,70 @@
+#ifndef LL_UPLOADER_H
+#define LL_UPLOADER_H
+
+#include "alarm.h"
+#include "const.h"
+#include "samplelog.h"
+#include "setup.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum upload_transport_t {
+    ut_Http,
+    ut_Mqtt,
+} upload_transport_t;
+
+typedef struct upload_batch_t {
+    // Blocks from the log, each framed with its 64 bit log position so the
+    // target can drop blocks it has already seen when a batch is resent.
+    uint8_t data[UPLOAD_BATCH_MAX_BYTES];
+    size_t len;
+    samplelog_pos_t start;
+    samplelog_pos_t end;
+    uint32_t samples;
+    // Compact metrics snapshot sent along with the batch, empty for none.
+    char metrics[METRICS_SNAPSHOT_SIZE];
+} upload_batch_t;
+
+typedef struct upload_inflight_t {
+    samplelog_pos_t end;
+    size_t len;
+    uint32_t samples;
+    int64_t sent_at;
+    int id;
+    bool done;
+} upload_inflight_t;
+
+typedef struct uploader_stats_t {
+    uint32_t batches;
+    uint32_t failures;
+    uint64_t bytes;
+    uint64_t samples;
+    int64_t last_latency_ms;
+} uploader_stats_t;
+
+bool ll_uploader_target_supported(const char *target);
+// Not empty, shorter than DEVNAME_SIZE and without control characters.
+bool ll_uploader_devname_valid(const char *devname);
+void ll_uploader_start(const network_info_t *netinfo);
+void ll_uploader_get_stats(uploader_stats_t *stats);
+bool ll_uploader_drain(uint32_t timeout_ms);
+void ll_uploader_alarm(const alarm_event_t *event);
+
+// Called by the transports
+void ll_uploader_batch_done(int id);
+void ll_uploader_rewind();
+
+// Transports
+void ll_upload_http_init(const network_info_t *netinfo);
+void ll_upload_http_retarget(const network_info_t *netinfo);
+int ll_upload_http_send(const upload_batch_t *batch);
+int ll_upload_http_send_alarm(const char *json, size_t len);
+bool ll_upload_http_send_summary(const char *json, size_t len);
+void ll_upload_mqtt_init(const network_info_t *netinfo);
+bool ll_upload_mqtt_connected();
+int ll_upload_mqtt_send(const upload_batch_t *batch);
+int ll_upload_mqtt_send_alarm(const char *json, size_t len);
+bool ll_upload_mqtt_send_summary(const char *json, size_t len);
+
+#endif // LL_UPLOADER_H
@@ -1,111 +1,465 @@
 #include "access_point.h"
+#include "adaptive.h"
+#include "alarm.h"
+#include "boot.h"
+#include "calib.h"
 #include "client.h"
+#include "codec.h"
+#include "config.h"
+#include "dataserver.h"
+#include "dlog.h"
+#include "dutycycle.h"
+#include "esp_attr.h"
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
 #include "freertos/portmacro.h"
+#include "live.h"
+#include "logger.h"
+#include "metrics.h"
 #include "nvs_flash.h"
+#include "ota.h"
+#include "profiler.h"
+#include "remote.h"
+#include "render.h"
+#include "rollupstore.h"
+#include "samplelog.h"
+#include "sampler.h"
 #include "scan.h"
 #include "setup.h"
 #include "station.h"
+#include "uploader.h"
 #include "util.h"
 
 #include <stdio.h>
+#include <string.h>
 
 static const char *TAG = "level_logger_main";
+// The intervals are replaced on every wake by the adaptive controller's.
+static const dutycycle_config_t DUTYCYCLE_CONFIG = {
+    .sample_interval_ms = ADAPTIVE_MAX_INTERVAL_MS,
+    .upload_interval_ms = DUTYCYCLE_UPLOAD_INTERVAL_MS,
+    .min_sleep_ms = DUTYCYCLE_MIN_SLEEP_MS,
+    .upload_threshold = DUTYCYCLE_UPLOAD_THRESHOLD,
+    .burst_samples = DUTYCYCLE_BURST_SAMPLES,
+};
+static const adaptive_config_t ADAPTIVE_CONFIG = {
+    .min_interval_ms = ADAPTIVE_MIN_INTERVAL_MS,
+    .max_interval_ms = ADAPTIVE_MAX_INTERVAL_MS,
+    .min_report_ms = ADAPTIVE_MIN_REPORT_MS,
+    .max_report_ms = DUTYCYCLE_UPLOAD_INTERVAL_MS,
+    .drift = ADAPTIVE_DRIFT,
+    .threshold = ADAPTIVE_THRESHOLD,
+    .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+};
+static const dutycycle_power_t DUTYCYCLE_POWER = {
+    .sleep_ua = DUTYCYCLE_SLEEP_UA,
+    .active_ma = DUTYCYCLE_ACTIVE_MA,
+    .radio_ma = DUTYCYCLE_RADIO_MA,
+};
 
-void do_setup(void) {
-    // Do initial scan
-    bg_scan_t *initial_scan = ll_do_scan();
-
-    // Log the network list
-    ESP_LOGI(TAG, "SCANNED NETWORKS (SSID, RSSI)");
-    for (int i = 0; i < initial_scan->scanned_ap_count; i++) {
-        wifi_ap_record_t *netrec = &initial_scan->scanned_aps[i];
-        ESP_LOGI(TAG, "%s %d", netrec->ssid, netrec->rssi);
-    }
-
-    // Start the server
-    setup_ap_server_t *setup_server = setup_ap_start_server(initial_scan);
-
-    // Loop until setup succeeds
-    while (true) {
-        // Block until the user has submitted network and target information
-        // through the setup website.
-        wait_for_netinfo_filled(setup_server);
-        ESP_LOGD(TAG, "netinfo filling unblocked, continuing on main thread");
-
-        // Attempt to connect to the network with given ssid and password
-        connect_result_t connect_res = try_connect_to_network(
-            setup_server->info.ssid,
-            setup_server->info.password);
-        setup_error_t setup_err = se_None;
-        switch (connect_res) {
-        case cr_InvalidSsid:
-            setup_err = se_SsidIncorrect;
-            break;
-        case cr_InvalidPass:
-            setup_err = se_PskIncorrect;
-            break;
-        case cr_TechnicalError:
-            setup_err = se_GenNetConnect;
-            break;
-        default:
-            // Connection succeeded
-            break;
+// Kept in RTC memory so they survive deep sleep.
+static RTC_DATA_ATTR uint32_t rtc_valid;
+static RTC_DATA_ATTR dutycycle_state_t rtc_dutycycle;
+static RTC_DATA_ATTR adaptive_state_t rtc_adaptive;
+static RTC_DATA_ATTR codec_encoder_t rtc_encoders[SENSOR_CHANNEL_COUNT];
+static RTC_DATA_ATTR alarm_engine_t rtc_alarms;
+static RTC_DATA_ATTR alarm_event_t rtc_pending_alarms[ALARM_QUEUE_LEN];
+static RTC_DATA_ATTR int rtc_pending_alarm_count;
+
+// Owned by the sampler once it starts, see ll_sampler_init.
+static calib_t glob_calib;
+// An update remote config asked for during this duty cycle wake.
+static char glob_firmware[OTA_REQUEST_SIZE];
+
+static void start_wifi(wifi_mode_t mode) {
+    // Init network interface and event loop
+    ESP_EC(esp_netif_init());
+    ESP_EC(esp_event_loop_create_default());
+
+    // Initialize WIFI driver.
+    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&wifi_config));
+
+    // APSTA for both setup and client modes, STA only when the setup access
+    // point will never be needed.
+    ESP_EC(esp_wifi_set_mode(mode));
+
+    // Configure network interface for the access point
+    if (mode == WIFI_MODE_APSTA) {
+        ll_access_point_init();
+    }
+
+    // Configure network interface for the station
+    ll_station_init();
+
+    // Start wifi
+    ESP_EC(esp_wifi_start());
+    ll_boot_mark(bp_WifiStarted);
+}
+
+static void start_setup_wifi(void *arg) {
+    start_wifi(WIFI_MODE_APSTA);
+}
+
+// Brings up the ADC while the station connects, the calibration is parsed
+// into glob_calib before the sampler starts reading.
+static void warm_up_sensor(void *arg) {
+    ll_sampler_init(&glob_calib);
+}
+
+// Same as the logger, channels are flushed together.
+static void flush_rtc_encoders() {
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        codec_encoder_t *enc = &rtc_encoders[i];
+        if (enc->header.count == 0) {
+            continue;
         }
-        if (setup_err != se_None) {
-            tried_connecting(setup_server, setup_err);
+        size_t len = 0;
+        const uint8_t *block = ll_codec_encoder_finish(enc, &len);
+        ll_samplelog_append(block, len);
+        ll_codec_encoder_reset(enc, i);
+    }
+}
+
+// Evaluate the alarm rules, keeping raised alarms in RTC memory until an upload
+// gets them out.
+static void queue_alarms(const sample_t *sample) {
+    alarm_event_t events[ALARM_RULES_MAX];
+    int fired = ll_alarm_evaluate(&rtc_alarms, sample, events);
+    for (int i = 0; i < fired; i++) {
+        if (rtc_pending_alarm_count >= ALARM_QUEUE_LEN) {
+            ESP_LOGE(
+                TAG,
+                "Too many pending alarms, dropping %s!",
+                events[i].rule);
             continue;
         }
+        rtc_pending_alarms[rtc_pending_alarm_count++] = events[i];
+    }
+}
+
+static void save_remote(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    ll_config_save_remote(config, changed);
+}
 
-        // We succeeded in connecting, break out of the loop.
-        tried_connecting(setup_server, se_None);
-        break;
+// Picks up what remote config left in NVS and subscribes the NVS write,
+// before anything else subscribes. Returns the config it started with.
+static const remote_config_t *start_remote(const network_info_t *netinfo) {
+    NPC(netinfo);
+    // Too big for the main task's stack.
+    static remote_config_t config;
+    ll_config_load_remote(&config);
+    copy_netinfo(&config.netinfo, netinfo);
+    ll_remote_init(&config);
+    ll_remote_subscribe(REMOTE_KEYS_ALL, save_remote, NULL);
+    return &config;
+}
+
+// Runs on the uploader task and reboots into the new image once it's in.
+static void update_firmware(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    uint8_t sha256[32];
+    const char *url = ll_ota_parse_request(config->firmware, sha256);
+    if (url != NULL && !ll_ota_start(url, sha256)) {
+        ESP_LOGW(TAG, "%s", ll_ota_error_explain(oe_Busy));
     }
+}
 
-    // Give the user 5s to see the successful connection
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
+// Alarms are parsed into RTC memory once per cold boot, new rules replace
+// them right away. Updates wait for the upload to finish. The rest is read
+// from NVS on the next wake.
+static void duty_cycle_remote_changed(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    if (changed & rk_Alarms) {
+        ll_alarm_parse(config->netinfo.alarms, &rtc_alarms);
+    }
+    if (changed & rk_Firmware) {
+        strcpy(glob_firmware, config->firmware);
+    }
+}
 
-    // Stop the setup access point and server
-    setup_ap_stop_server(setup_server);
-    setup_server = NULL;
+// The update asked for during this wake, if any, while the radio is still up.
+// Reboots into the new image.
+static void duty_cycle_update_firmware() {
+    uint8_t sha256[32];
+    const char *url = ll_ota_parse_request(glob_firmware, sha256);
+    if (url == NULL) {
+        return;
+    }
+    ota_result_t result;
+    ll_ota_update(url, sha256, &result);
+    if (result.error == oe_None) {
+        esp_restart();
+    }
+}
 
-    // Deallocate scan results
-    ll_destroy_scan(initial_scan);
-    initial_scan = NULL;
+// One wake of the duty cycle. Ends in deep sleep and never returns.
+static void do_duty_cycle(const network_info_t *netinfo) {
+    NPC(netinfo);
+    int64_t now = ll_sampler_now();
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER ||
+        rtc_valid != DUTYCYCLE_RTC_MAGIC) {
+        // Cold boot, RTC memory holds nothing useful.
+        ll_dutycycle_reset(&rtc_dutycycle, now);
+        ll_adaptive_reset(&ADAPTIVE_CONFIG, &rtc_adaptive);
+        for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+            ll_codec_encoder_reset(&rtc_encoders[i], i);
+        }
+        ll_alarm_parse(netinfo->alarms, &rtc_alarms);
+        rtc_pending_alarm_count = 0;
+        rtc_valid = DUTYCYCLE_RTC_MAGIC;
+    }
+    ll_dutycycle_woke(&rtc_dutycycle, now);
+
+    // Take a burst of samples into RTC memory, only touching flash when a
+    // block fills up. Every channel is sampled on every wake, the channel
+    // periods only apply when running continuously.
+    static calib_t calib;
+    if (!ll_calib_parse(netinfo->levelcal, netinfo->tank, &calib)) {
+        ESP_LOGW(TAG, "Stored calibration is invalid, logging raw readings");
+    }
+    ll_sampler_init(&calib);
+    int64_t level_sum = 0;
+    for (int i = 0; i < DUTYCYCLE_BURST_SAMPLES; i++) {
+        if (i > 0) {
+            vTaskDelay(DUTYCYCLE_BURST_SPACING_MS / portTICK_PERIOD_MS);
+        }
+        sample_t samples[SENSOR_CHANNEL_COUNT];
+        int count = ll_sampler_read(samples);
+        for (int j = 0; j < count; j++) {
+            sample_t *sample = &samples[j];
+            if (sample->channel == 0) {
+                queue_alarms(sample);
+                level_sum += sample->value;
+            }
+            ll_rollupstore_add(sample);
+            codec_encoder_t *enc = &rtc_encoders[sample->channel];
+            if (!ll_codec_encoder_append(enc, sample)) {
+                flush_rtc_encoders();
+                ll_codec_encoder_append(enc, sample);
+            }
+        }
+    }
+    ll_dutycycle_sampled(
+        &rtc_dutycycle,
+        DUTYCYCLE_BURST_SAMPLES * SENSOR_CHANNEL_COUNT);
+    // Most wakes don't upload, an updated image that reads the sensor has
+    // proven itself before the bootloader would roll it back on the next one.
+    ll_ota_confirm_boot();
+
+    // Wake and upload more often while the level moves
+    if (ll_adaptive_update(
+            &ADAPTIVE_CONFIG,
+            &rtc_adaptive,
+            level_sum / DUTYCYCLE_BURST_SAMPLES)) {
+        ESP_LOGI(TAG, "Level is changing, sampling faster");
+    }
+    dutycycle_config_t config = DUTYCYCLE_CONFIG;
+    config.sample_interval_ms = rtc_adaptive.interval_ms;
+    config.upload_interval_ms =
+        ll_adaptive_report_ms(&ADAPTIVE_CONFIG, &rtc_adaptive);
+
+    dutycycle_decision_t decision =
+        ll_dutycycle_decide(&config, &rtc_dutycycle, ll_sampler_now());
+    // Alarms skip both the batching and the upload backoff.
+    decision.upload = decision.upload || rtc_pending_alarm_count > 0;
+    if (decision.upload) {
+        int64_t radio_started = esp_timer_get_time();
+        flush_rtc_encoders();
+        start_wifi(WIFI_MODE_STA);
+        bool uploaded = false;
+        if (try_connect_to_network(netinfo->ssid, netinfo->password) ==
+            cr_None) {
+            start_remote(netinfo);
+            ll_remote_subscribe(
+                rk_Alarms | rk_Firmware,
+                duty_cycle_remote_changed,
+                NULL);
+            ll_uploader_start(netinfo);
+            for (int i = 0; i < rtc_pending_alarm_count; i++) {
+                ll_uploader_alarm(&rtc_pending_alarms[i]);
+            }
+            uploaded = ll_uploader_drain(DUTYCYCLE_UPLOAD_TIMEOUT_MS);
+            // The reboot starts the duty cycle over, alarms that didn't go
+            // out would be lost.
+            if (uploaded) {
+                duty_cycle_update_firmware();
+            }
+        }
+        ESP_EC(esp_wifi_stop());
+
+        now = ll_sampler_now();
+        if (uploaded) {
+            rtc_pending_alarm_count = 0;
+            ll_dutycycle_uploaded(&rtc_dutycycle, now);
+        } else {
+            ESP_LOGW(TAG, "Upload failed, backing off");
+            ll_dutycycle_upload_failed(&config, &rtc_dutycycle, now);
+        }
+        ll_dutycycle_radio_used(
+            &rtc_dutycycle,
+            (esp_timer_get_time() - radio_started) / 1000);
+
+        // Time has passed, only the sleep time matters now.
+        decision = ll_dutycycle_decide(&config, &rtc_dutycycle, now);
+    }
+
+    // Deep sleep wakes go through a full boot, so time since boot is the time
+    // spent awake.
+    int64_t awake_ms = esp_timer_get_time() / 1000;
+    ll_dutycycle_slept(&rtc_dutycycle, awake_ms);
+    ESP_LOGI(
+        TAG,
+        "Awake for %lld ms, sleeping for %lld ms (%.2f mAh/day at this rate)",
+        awake_ms,
+        decision.sleep_ms,
+        ll_dutycycle_measured_mah_per_day(
+            &config,
+            &DUTYCYCLE_POWER,
+            &rtc_dutycycle));
+    esp_deep_sleep(decision.sleep_ms * 1000);
+}
+
+// The last boot of another build, for /boot to compare against.
+static void load_boot_baseline() {
+    boot_report_t report;
+    boot_report_t baseline;
+    ll_boot_report(&report);
+    if (ll_config_load_boot_baseline(&report, &baseline)) {
+        ll_boot_set_baseline(&baseline);
+    }
+}
+
+// Only boots that stay up are saved, duty cycle wakes would wear the flash.
+static void save_boot_report() {
+    boot_report_t report;
+    ll_boot_report(&report);
+    ll_config_save_boot_report(&report);
 }
 
 void app_main(void) {
     // Init logging
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
 
+    if (PROFILER_ENABLED && PROFILER_BOOT_HZ > 0) {
+        ll_profiler_start(PROFILER_BOOT_HZ);
+    }
+
     // Init NVS
     ESP_ERROR_CHECK(nvs_flash_init());
+    ll_boot_mark(bp_NvsReady);
 
-    // Init network interface and event loop
-    ESP_EC(esp_netif_init());
-    ESP_EC(esp_event_loop_create_default());
+    // Without the duty cycle the radio always comes up for setup and client
+    // modes, it calibrates while the storage and config load.
+    boot_job_t wifi_job;
+    if (!DUTYCYCLE_ENABLED) {
+        ll_boot_job_start(&wifi_job, "ll_boot_wifi", start_setup_wifi, NULL);
+    }
 
-    // Initialize WIFI driver.
-    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&wifi_config));
+    // Open the sample log and its rollups
+    ll_samplelog_init();
+    ll_rollupstore_init();
+    ll_boot_mark(bp_StorageReady);
 
-    // Set WIFI mode to APSTA for both setup and client modes
-    ESP_EC(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    // Battery powered units that are already provisioned never bring up the
+    // setup access point
+    network_info_t netinfo;
+    bool provisioned = ll_config_load_netinfo(&netinfo);
+    ll_boot_mark(bp_ConfigLoaded);
+    load_boot_baseline();
+    if (DUTYCYCLE_ENABLED && provisioned) {
+        do_duty_cycle(&netinfo);
+    }
 
-    // Configure network interface for the access point
-    ll_access_point_init();
+    // Setup serves the pages right after its scan
+    if (!provisioned) {
+        preload_page_table();
+    }
+    if (DUTYCYCLE_ENABLED) {
+        start_wifi(WIFI_MODE_APSTA);
+    } else {
+        ll_boot_job_join(&wifi_job);
+    }
 
-    // Configure network interface for the station
-    ll_station_init();
+    // Reuse stored network info unless the network rejects it, otherwise do
+    // main thread setup logic
+    bool need_setup = !provisioned;
+    connect_result_t connect_res = cr_TechnicalError;
+    if (provisioned) {
+        boot_job_t sensor_job;
+        ll_boot_job_start(&sensor_job, "ll_boot_sensor", warm_up_sensor, NULL);
+        connect_res = try_connect_to_network(netinfo.ssid, netinfo.password);
+        ll_boot_job_join(&sensor_job);
+        need_setup = connect_res == cr_InvalidPass;
+    }
+    if (need_setup) {
+        do_setup(&netinfo);
+        ll_config_save_netinfo(&netinfo);
+        connect_res = cr_None;
+    }
+    // An updated image that got onto the network has proven itself
+    if (connect_res == cr_None) {
+        ll_boot_mark(bp_Connected);
+        ll_ota_confirm_boot();
+    }
 
-    // Start wifi
-    ESP_EC(esp_wifi_start());
+    if (DUTYCYCLE_ENABLED) {
+        // Start the duty cycle from a clean boot
+        esp_deep_sleep(DUTYCYCLE_MIN_SLEEP_MS * 1000);
+    }
+
+    // Stay connected to the network from now on
+    ll_station_enable_reconnect();
 
-    // Do main thread setup logic
-    do_setup();
+    // Remote config changes from here on are saved first, then applied
+    const remote_config_t *remote = start_remote(&netinfo);
+    ll_remote_subscribe(rk_Firmware, update_firmware, NULL);
+    ll_sampler_set_period(remote->sample_ms);
+
+    // Start uploading the flash log to the target, before the logger so
+    // alarms have somewhere to go
+    ll_uploader_start(&netinfo);
+
+    // Start sampling the sensor into the flash log, setup may have changed
+    // the calibration
+    alarm_engine_t alarms;
+    if (!ll_alarm_parse(netinfo.alarms, &alarms)) {
+        ESP_LOGW(TAG, "Stored alarm rules are invalid, ignoring them");
+    }
+    if (!ll_calib_parse(netinfo.levelcal, netinfo.tank, &glob_calib)) {
+        ESP_LOGW(TAG, "Stored calibration is invalid, logging raw readings");
+    }
+    const deadband_config_t deadband = {
+        .deadband = (int32_t)remote->deadband,
+        .heartbeat_ms = remote->heartbeat_ms,
+    };
+    ll_sampler_start(&glob_calib);
+    ll_logger_start(ll_sampler_queue(), &alarms, &deadband);
+
+    // Serve the history to field techs on the access point
+    ll_dataserver_start();
+    ll_metrics_serve(ll_dataserver_handle());
+    ll_dlog_serve(ll_dataserver_handle());
+    ll_ota_serve(ll_dataserver_handle());
+    ll_live_serve(ll_dataserver_handle());
+    ll_boot_serve(ll_dataserver_handle());
+    if (PROFILER_ENABLED) {
+        ll_profiler_serve(ll_dataserver_handle());
+    }
+    ll_boot_mark(bp_PortalReady);
+
+    // Keep the timeline for comparing the next build against
+    if (!ll_boot_wait(bp_FirstReading, BOOT_REPORT_WAIT_MS)) {
+        ESP_LOGW(TAG, "No reading yet, saving the boot report without it");
+    }
+    save_boot_report();
+    ll_boot_log();
 }
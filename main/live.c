@@ -0,0 +1,310 @@
+#include "live.h"
+
+#include "const.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "metrics.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+#define LIVE_HZ (1000 / LIVE_PERIOD_MS)
+#define FRAME_HEADER_SIZE 14
+#define FRAME_READING_SIZE 6
+
+static const char *TAG = "ll_live";
+
+typedef struct live_reading_t {
+    int64_t timestamp;
+    int32_t value;
+} live_reading_t;
+
+typedef struct live_client_t {
+    bool used;
+    int fd;
+    uint8_t channel;
+    // Keeps one of every decimation readings of its channel.
+    uint32_t decimation;
+    uint32_t skipped;
+    // Sequence numbers, the queue holds [head, tail).
+    uint32_t head;
+    uint32_t tail;
+    live_reading_t queue[LIVE_QUEUE_LEN];
+    // A send is queued on the server task.
+    bool sending;
+} live_client_t;
+
+typedef struct live_t {
+    pthread_mutex_t mutex;
+    // Set once before the first client.
+    httpd_handle_t server;
+
+    // SYNCHRONIZED FIELDS
+    live_client_t clients[LIVE_CLIENTS_MAX];
+    int client_count;
+
+    // UNSYNCHRONIZED FIELDS (server task only)
+    uint8_t frame[FRAME_HEADER_SIZE + LIVE_QUEUE_LEN * FRAME_READING_SIZE];
+} live_t;
+
+static live_t glob_live = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_live_dropped = {
+    .name = "ll_live_dropped_total",
+    .help = "Live readings dropped because the client fell behind",
+    .kind = mk_Counter,
+};
+
+static void drop_client(live_t *live, live_client_t *client, int fd) {
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    if (client->used && client->fd == fd) {
+        client->used = false;
+        live->client_count--;
+    }
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    ESP_LOGI(TAG, "Live client on socket %d is gone", fd);
+}
+
+// Whether a frame can go out without waiting for the client.
+static bool writable(int fd) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    struct timeval now = {0};
+    return select(fd + 1, NULL, &fds, NULL, &now) > 0;
+}
+
+// Runs on the server task, sends everything the client has queued in one
+// frame.
+static void send_work(void *arg) {
+    live_t *live = &glob_live;
+    live_client_t *client = (live_client_t *)arg;
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    bool used = client->used;
+    int fd = client->fd;
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    if (!used) {
+        return;
+    }
+    if (httpd_ws_get_fd_info(live->server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        drop_client(live, client, fd);
+        return;
+    }
+    if (!writable(fd)) {
+        // The last frames are still on their way, the queue keeps filling
+        // and the next publish tries again.
+        POSIX_EC(pthread_mutex_lock(&live->mutex));
+        client->sending = false;
+        POSIX_EC(pthread_mutex_unlock(&live->mutex));
+        return;
+    }
+
+    uint8_t *frame = live->frame;
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    uint32_t first = client->head;
+    uint8_t count = (uint8_t)(client->tail - client->head);
+    int64_t start = client->queue[first % LIVE_QUEUE_LEN].timestamp;
+    memcpy(frame, &first, 4);
+    memcpy(frame + 4, &start, 8);
+    frame[12] = client->channel;
+    frame[13] = count;
+    uint8_t *out = frame + FRAME_HEADER_SIZE;
+    for (uint32_t seq = first; seq != client->tail; seq++) {
+        const live_reading_t *reading = &client->queue[seq % LIVE_QUEUE_LEN];
+        int64_t offset = reading->timestamp - start;
+        uint16_t offset_ms =
+            offset < 0 ? 0 : offset > UINT16_MAX ? UINT16_MAX : offset;
+        memcpy(out, &offset_ms, 2);
+        memcpy(out + 2, &reading->value, 4);
+        out += FRAME_READING_SIZE;
+    }
+    client->head = client->tail;
+    client->sending = false;
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    if (count == 0) {
+        return;
+    }
+
+    httpd_ws_frame_t ws_frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = frame,
+        .len = out - frame,
+    };
+    if (httpd_ws_send_frame_async(live->server, fd, &ws_frame) != ESP_OK) {
+        httpd_sess_trigger_close(live->server, fd);
+        drop_client(live, client, fd);
+    }
+}
+
+// Called by the sampler with every scan while ll_live_active.
+void ll_live_publish(const sample_t *samples, int count) {
+    NPC(samples);
+    live_t *live = &glob_live;
+    live_client_t *wake[LIVE_CLIENTS_MAX];
+    int wake_count = 0;
+    uint32_t dropped = 0;
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    for (int i = 0; i < LIVE_CLIENTS_MAX; i++) {
+        live_client_t *client = &live->clients[i];
+        if (!client->used) {
+            continue;
+        }
+        for (int s = 0; s < count; s++) {
+            if (samples[s].channel != client->channel ||
+                ++client->skipped < client->decimation) {
+                continue;
+            }
+            client->skipped = 0;
+            if (client->tail - client->head == LIVE_QUEUE_LEN) {
+                // Fell behind, the newest readings matter most.
+                client->head++;
+                dropped++;
+            }
+            live_reading_t *reading =
+                &client->queue[client->tail++ % LIVE_QUEUE_LEN];
+            reading->timestamp = samples[s].timestamp;
+            reading->value = samples[s].value;
+        }
+        if (client->tail != client->head && !client->sending) {
+            client->sending = true;
+            wake[wake_count++] = client;
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    if (dropped > 0) {
+        ll_metrics_add(&glob_live_dropped, dropped);
+    }
+
+    for (int i = 0; i < wake_count; i++) {
+        if (httpd_queue_work(live->server, send_work, wake[i]) != ESP_OK) {
+            POSIX_EC(pthread_mutex_lock(&live->mutex));
+            wake[i]->sending = false;
+            POSIX_EC(pthread_mutex_unlock(&live->mutex));
+        }
+    }
+}
+
+// Whether the sampler should scan at the live rate.
+bool ll_live_active() {
+    live_t *live = &glob_live;
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    bool active = live->client_count > 0;
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    return active;
+}
+
+// Returns false if the query string has an invalid value.
+static bool
+parse_query(httpd_req_t *request, uint32_t *hz, uint8_t *channel) {
+    *hz = LIVE_DEFAULT_HZ;
+    *channel = 0;
+    char qs[64];
+    if (httpd_req_get_url_query_str(request, qs, sizeof(qs)) != ESP_OK) {
+        return true;
+    }
+    char value[12];
+    char *end = NULL;
+    if (httpd_query_key_value(qs, "hz", value, sizeof(value)) == ESP_OK) {
+        long parsed = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || parsed < 1 || parsed > LIVE_HZ) {
+            return false;
+        }
+        *hz = parsed;
+    }
+    if (httpd_query_key_value(qs, "channel", value, sizeof(value)) == ESP_OK) {
+        long parsed = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || parsed < 0 ||
+            parsed >= SENSOR_CHANNEL_COUNT) {
+            return false;
+        }
+        *channel = parsed;
+    }
+    return true;
+}
+
+static esp_err_t start_client(httpd_req_t *request) {
+    live_t *live = &glob_live;
+    int fd = httpd_req_to_sockfd(request);
+    uint32_t hz = 0;
+    uint8_t channel = 0;
+    if (!parse_query(request, &hz, &channel)) {
+        ESP_LOGW(TAG, "Invalid live query on socket %d", fd);
+        return ESP_FAIL;
+    }
+
+    live_client_t *client = NULL;
+    POSIX_EC(pthread_mutex_lock(&live->mutex));
+    for (int i = 0; i < LIVE_CLIENTS_MAX; i++) {
+        live_client_t *slot = &live->clients[i];
+        if (slot->used && slot->fd == fd) {
+            // The socket of a client that left without a failed send.
+            slot->used = false;
+            live->client_count--;
+        }
+        if (!slot->used && client == NULL) {
+            client = slot;
+        }
+    }
+    if (client != NULL) {
+        memset(client, 0, sizeof(live_client_t));
+        client->used = true;
+        client->fd = fd;
+        client->channel = channel;
+        client->decimation = LIVE_HZ / hz;
+        live->client_count++;
+    }
+    POSIX_EC(pthread_mutex_unlock(&live->mutex));
+    if (client == NULL) {
+        ESP_LOGW(TAG, "Too many live clients, refusing socket %d", fd);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(
+        TAG,
+        "Live client on socket %d, channel %u at %lu Hz",
+        fd,
+        channel,
+        (unsigned long)(LIVE_HZ / client->decimation));
+    return ESP_OK;
+}
+
+static esp_err_t live_handler(httpd_req_t *request) {
+    NPC(request);
+    // Called with GET once the handshake is done, after that for every
+    // frame the client sends.
+    if (request->method == HTTP_GET) {
+        return start_client(request);
+    }
+    // Clients have nothing to say, whatever they send is read and ignored.
+    uint8_t payload[LIVE_RECV_MAX];
+    httpd_ws_frame_t frame = {0};
+    if (httpd_ws_recv_frame(request, &frame, 0) != ESP_OK ||
+        frame.len > sizeof(payload)) {
+        return ESP_FAIL;
+    }
+    if (frame.len == 0) {
+        return ESP_OK;
+    }
+    frame.payload = payload;
+    return httpd_ws_recv_frame(request, &frame, sizeof(payload));
+}
+
+void ll_live_serve(httpd_handle_t server) {
+    NPC(server);
+    NOT_NPC(glob_live.server);
+    glob_live.server = server;
+    const httpd_uri_t live_ws = {
+        .uri = "/live",
+        .method = HTTP_GET,
+        .handler = live_handler,
+        .is_websocket = true,
+    };
+    ll_metrics_register(&glob_live_dropped);
+    ESP_EC(httpd_register_uri_handler(server, &live_ws));
+    ESP_LOGI(TAG, "Serving /live");
+}
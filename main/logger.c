@@ -0,0 +1,234 @@
+#include "logger.h"
+
+#include "alarm.h"
+#include "codec.h"
+#include "const.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "remote.h"
+#include "rollupstore.h"
+#include "sample.h"
+#include "samplelog.h"
+#include "uploader.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+static const char *TAG = "ll_logger";
+
+// One encoder per sensor channel, so each block holds a single channel.
+static codec_encoder_t glob_encoders[SENSOR_CHANNEL_COUNT];
+static alarm_engine_t glob_alarms;
+static deadband_config_t glob_deadband;
+static deadband_state_t glob_deadband_states[SENSOR_CHANNEL_COUNT];
+
+typedef struct pending_alarms_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    alarm_engine_t alarms;
+    bool pending;
+    deadband_config_t deadband;
+    bool deadband_pending;
+} pending_alarms_t;
+
+// New rules and deadbands wait here until the logger task is between
+// samples.
+static pending_alarms_t glob_pending = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_held = {
+    .name = "ll_logger_held_total",
+    .help = "Readings the deadband kept out of the sample log",
+    .kind = mk_Counter,
+};
+
+// Blocks of the deadband's output say so, and with which deadband.
+static void reset_encoder(int channel) {
+    codec_encoder_t *enc = &glob_encoders[channel];
+    ll_codec_encoder_reset(enc, channel);
+    if (glob_deadband.heartbeat_ms > 0) {
+        ll_codec_encoder_tag(
+            enc,
+            glob_deadband.deadband,
+            glob_deadband.heartbeat_ms);
+    }
+}
+
+// Swaps in pending rules. Their states start over, an alarm that is still
+// active fires again under the new rules.
+static void take_pending_alarms() {
+    pending_alarms_t *pending = &glob_pending;
+    POSIX_EC(pthread_mutex_lock(&pending->mutex));
+    if (pending->pending) {
+        glob_alarms = pending->alarms;
+        pending->pending = false;
+        ESP_LOGI(TAG, "Now evaluating %d alarm rules", glob_alarms.count);
+    }
+    POSIX_EC(pthread_mutex_unlock(&pending->mutex));
+}
+
+// Channels are always flushed together, so blocks in the log start in time
+// order give or take one channel period.
+static void flush_blocks() {
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        codec_encoder_t *enc = &glob_encoders[i];
+        if (enc->header.count == 0) {
+            continue;
+        }
+        size_t len = 0;
+        const uint8_t *block = ll_codec_encoder_finish(enc, &len);
+        samplelog_pos_t pos = ll_samplelog_append(block, len);
+        ESP_LOGD(
+            TAG,
+            "Flushed %d samples of channel %d in %d bytes to log position "
+            "%llu",
+            enc->header.count,
+            i,
+            len,
+            pos);
+        reset_encoder(i);
+    }
+}
+
+// A new deadband starts new blocks, and every channel reports its next
+// reading.
+static void take_pending_deadband() {
+    pending_alarms_t *pending = &glob_pending;
+    POSIX_EC(pthread_mutex_lock(&pending->mutex));
+    bool changed = pending->deadband_pending;
+    deadband_config_t deadband = pending->deadband;
+    pending->deadband_pending = false;
+    POSIX_EC(pthread_mutex_unlock(&pending->mutex));
+    if (!changed) {
+        return;
+    }
+    flush_blocks();
+    glob_deadband = deadband;
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        ll_deadband_reset(&glob_deadband_states[i]);
+        reset_encoder(i);
+    }
+    ESP_LOGI(
+        TAG,
+        "Logging readings that move more than %ld, or every %lld ms",
+        (long)deadband.deadband,
+        (long long)deadband.heartbeat_ms);
+}
+
+static void logger_task(void *arg) {
+    QueueHandle_t sample_queue = (QueueHandle_t)arg;
+    TickType_t block_started = xTaskGetTickCount();
+    const TickType_t flush_interval =
+        LOGGER_FLUSH_INTERVAL_MS / portTICK_PERIOD_MS;
+
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        ll_deadband_reset(&glob_deadband_states[i]);
+        reset_encoder(i);
+    }
+    while (true) {
+        // Wake up at the latest when the current blocks are due to be
+        // flushed, so a slow sample rate doesn't keep data in RAM
+        // indefinitely.
+        TickType_t elapsed = xTaskGetTickCount() - block_started;
+        TickType_t wait = elapsed < flush_interval ? flush_interval - elapsed
+                                                   : 0;
+        sample_t sample;
+        bool received = xQueueReceive(sample_queue, &sample, wait) == pdTRUE;
+        if (received) {
+            take_pending_alarms();
+            take_pending_deadband();
+            // Alarms first, they skip the batching the samples go through.
+            // Rules apply to the level probe, channel 0.
+            if (sample.channel == 0) {
+                alarm_event_t events[ALARM_RULES_MAX];
+                int fired = ll_alarm_evaluate(&glob_alarms, &sample, events);
+                for (int i = 0; i < fired; i++) {
+                    ll_uploader_alarm(&events[i]);
+                }
+            }
+            ll_rollupstore_add(&sample);
+
+            codec_encoder_t *enc = &glob_encoders[sample.channel];
+            if (!ll_deadband_update(
+                    &glob_deadband,
+                    &glob_deadband_states[sample.channel],
+                    &sample)) {
+                ll_metrics_add(&glob_held, 1);
+            } else if (!ll_codec_encoder_append(enc, &sample)) {
+                // Block is full, store it and start a new one with this
+                // sample.
+                flush_blocks();
+                block_started = xTaskGetTickCount();
+                ll_codec_encoder_append(enc, &sample);
+            }
+        }
+        if (xTaskGetTickCount() - block_started >= flush_interval) {
+            flush_blocks();
+            block_started = xTaskGetTickCount();
+        }
+    }
+}
+
+void ll_logger_set_deadband(const deadband_config_t *deadband) {
+    NPC(deadband);
+    pending_alarms_t *pending = &glob_pending;
+    POSIX_EC(pthread_mutex_lock(&pending->mutex));
+    pending->deadband = *deadband;
+    pending->deadband_pending = true;
+    POSIX_EC(pthread_mutex_unlock(&pending->mutex));
+}
+
+void ll_logger_set_alarms(const alarm_engine_t *alarms) {
+    NPC(alarms);
+    pending_alarms_t *pending = &glob_pending;
+    POSIX_EC(pthread_mutex_lock(&pending->mutex));
+    pending->alarms = *alarms;
+    pending->pending = true;
+    POSIX_EC(pthread_mutex_unlock(&pending->mutex));
+}
+
+// Runs on the polling task, the remote config checked the rules and the
+// deadband already.
+static void remote_changed(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    // Only the polling task parses, too big for its stack.
+    static alarm_engine_t alarms;
+    if ((changed & rk_Alarms) &&
+        ll_alarm_parse(config->netinfo.alarms, &alarms)) {
+        ll_logger_set_alarms(&alarms);
+    }
+    if (changed & rk_Deadband) {
+        const deadband_config_t deadband = {
+            .deadband = (int32_t)config->deadband,
+            .heartbeat_ms = config->heartbeat_ms,
+        };
+        ll_logger_set_deadband(&deadband);
+    }
+}
+
+void ll_logger_start(
+    QueueHandle_t sample_queue,
+    const alarm_engine_t *alarms,
+    const deadband_config_t *deadband) {
+    NPC(sample_queue);
+    NPC(alarms);
+    NPC(deadband);
+    glob_alarms = *alarms;
+    glob_deadband = *deadband;
+    ll_metrics_register(&glob_held);
+    ll_remote_subscribe(rk_Alarms | rk_Deadband, remote_changed, NULL);
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(logger_task, "ll_logger", 3072, sample_queue, 4, &task) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create logger task!");
+        abort();
+    }
+    ll_metrics_register_task(task);
+}
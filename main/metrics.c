@@ -0,0 +1,349 @@
+#include "metrics.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ll_metrics";
+
+typedef struct metrics_registry_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    metric_t *metrics[METRICS_MAX];
+    int count;
+    TaskHandle_t tasks[METRICS_TASKS_MAX];
+    metric_t task_stacks[METRICS_TASKS_MAX];
+    int task_count;
+} metrics_registry_t;
+
+static metrics_registry_t glob_registry = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_heap_free = {
+    .name = "ll_heap_free_bytes",
+    .help = "Free heap",
+    .kind = mk_Gauge,
+};
+static metric_t glob_heap_min_free = {
+    .name = "ll_heap_min_free_bytes",
+    .help = "Lowest free heap since boot",
+    .kind = mk_Gauge,
+};
+static metric_t glob_metrics_latency = {
+    .name = "ll_http_request_duration_us",
+    .help = "Time spent in an HTTP handler",
+    .kind = mk_Histogram,
+    .label_key = "handler",
+    .label_value = "metrics",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
+// The endpoint renders into one buffer, httpd runs handlers on one task.
+static char glob_chunk[METRICS_CHUNK_SIZE];
+static size_t glob_chunk_len;
+
+static void register_locked(metrics_registry_t *registry, metric_t *metric) {
+    for (int i = 0; i < registry->count; i++) {
+        if (registry->metrics[i] == metric) {
+            return;
+        }
+    }
+    if (registry->count >= METRICS_MAX) {
+        ESP_LOGE(TAG, "Too many metrics, can't register %s!", metric->name);
+        abort();
+    }
+    registry->metrics[registry->count++] = metric;
+}
+
+void ll_metrics_register(metric_t *metric) {
+    NPC(metric);
+    POSIX_EC(pthread_mutex_lock(&glob_registry.mutex));
+    register_locked(&glob_registry, metric);
+    POSIX_EC(pthread_mutex_unlock(&glob_registry.mutex));
+}
+
+void ll_metrics_register_task(TaskHandle_t task) {
+    NPC(task);
+    metrics_registry_t *registry = &glob_registry;
+    POSIX_EC(pthread_mutex_lock(&registry->mutex));
+    for (int i = 0; i < registry->task_count; i++) {
+        if (registry->tasks[i] == task) {
+            POSIX_EC(pthread_mutex_unlock(&registry->mutex));
+            return;
+        }
+    }
+    if (registry->task_count >= METRICS_TASKS_MAX) {
+        ESP_LOGE(TAG, "Too many tasks to watch!");
+        abort();
+    }
+    // The task name lives in the task's control block, tasks registered here
+    // are never deleted.
+    metric_t *metric = &registry->task_stacks[registry->task_count];
+    metric->name = "ll_task_stack_free_bytes";
+    metric->help = "Least free stack a task ever had";
+    metric->kind = mk_Gauge;
+    metric->label_key = "task";
+    metric->label_value = pcTaskGetName(task);
+    registry->tasks[registry->task_count++] = task;
+    register_locked(registry, metric);
+    POSIX_EC(pthread_mutex_unlock(&registry->mutex));
+}
+
+// Gauges of the system are sampled when they are read rather than kept up to
+// date. Readers racing here only race to store fresh values.
+static void sample_system() {
+    ll_metrics_set(&glob_heap_free, esp_get_free_heap_size());
+    ll_metrics_set(&glob_heap_min_free, esp_get_minimum_free_heap_size());
+    metrics_registry_t *registry = &glob_registry;
+    POSIX_EC(pthread_mutex_lock(&registry->mutex));
+    for (int i = 0; i < registry->task_count; i++) {
+        ll_metrics_set(
+            &registry->task_stacks[i],
+            uxTaskGetStackHighWaterMark(registry->tasks[i]));
+    }
+    POSIX_EC(pthread_mutex_unlock(&registry->mutex));
+}
+
+static uint32_t load(const atomic_uint_least32_t *value) {
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+esp_err_t ll_metrics_timed_handler(httpd_req_t *request) {
+    NPC(request);
+    metrics_handler_t *timed = (metrics_handler_t *)request->user_ctx;
+    NPC(timed);
+    int64_t started = esp_timer_get_time();
+    esp_err_t err = timed->handler(request);
+    ll_metrics_observe(
+        timed->latency,
+        (uint32_t)(esp_timer_get_time() - started));
+    return err;
+}
+
+static bool chunk_flush(httpd_req_t *request) {
+    bool sent = glob_chunk_len == 0 ||
+                httpd_resp_send_chunk(request, glob_chunk, glob_chunk_len) ==
+                    ESP_OK;
+    glob_chunk_len = 0;
+    return sent;
+}
+
+static bool chunk_line(httpd_req_t *request, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static bool chunk_line(httpd_req_t *request, const char *format, ...) {
+    char line[METRICS_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len >= sizeof(line)) {
+        ESP_LOGW(TAG, "Metrics line truncated: %s", line);
+        len = sizeof(line) - 1;
+    }
+    if (glob_chunk_len + len > sizeof(glob_chunk) && !chunk_flush(request)) {
+        return false;
+    }
+    memcpy(glob_chunk + glob_chunk_len, line, len);
+    glob_chunk_len += len;
+    return true;
+}
+
+// Prometheus text format. Labels go in front of le for histogram buckets.
+static bool render_metric(httpd_req_t *request, const metric_t *metric) {
+    char labels[64] = "";
+    char bucket_labels[64] = "";
+    if (metric->label_key != NULL) {
+        snprintf(
+            labels,
+            sizeof(labels),
+            "{%s=\"%s\"}",
+            metric->label_key,
+            metric->label_value);
+        snprintf(
+            bucket_labels,
+            sizeof(bucket_labels),
+            "%s=\"%s\",",
+            metric->label_key,
+            metric->label_value);
+    }
+    if (metric->kind != mk_Histogram) {
+        return chunk_line(
+            request,
+            "%s%s %lu\n",
+            metric->name,
+            labels,
+            (unsigned long)load(&metric->value));
+    }
+
+    unsigned long count = 0;
+    for (int i = 0; i <= metric->bound_count; i++) {
+        count += load(&metric->buckets[i]);
+        bool sent;
+        if (i < metric->bound_count) {
+            sent = chunk_line(
+                request,
+                "%s_bucket{%sle=\"%lu\"} %lu\n",
+                metric->name,
+                bucket_labels,
+                (unsigned long)metric->bounds[i],
+                count);
+        } else {
+            sent = chunk_line(
+                request,
+                "%s_bucket{%sle=\"+Inf\"} %lu\n",
+                metric->name,
+                bucket_labels,
+                count);
+        }
+        if (!sent) {
+            return false;
+        }
+    }
+    return chunk_line(
+               request,
+               "%s_sum%s %lu\n",
+               metric->name,
+               labels,
+               (unsigned long)load(&metric->sum)) &&
+           chunk_line(request, "%s_count%s %lu\n", metric->name, labels, count);
+}
+
+static const char *kind_name(metric_kind_t kind) {
+    switch (kind) {
+    case mk_Counter:
+        return "counter";
+    case mk_Gauge:
+        return "gauge";
+    case mk_Histogram:
+        return "histogram";
+    }
+    return "untyped";
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *request) {
+    NPC(request);
+    // The server task only exists once a request runs on it.
+    ll_metrics_register_task(xTaskGetCurrentTaskHandle());
+    sample_system();
+
+    ESP_EC(httpd_resp_set_type(request, "text/plain; version=0.0.4"));
+    metrics_registry_t *registry = &glob_registry;
+    bool sent = true;
+    glob_chunk_len = 0;
+    POSIX_EC(pthread_mutex_lock(&registry->mutex));
+    // Metrics sharing a name are one family, rendered together under one
+    // HELP and TYPE, wherever they were registered.
+    for (int i = 0; i < registry->count && sent; i++) {
+        const metric_t *metric = registry->metrics[i];
+        bool seen = false;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = strcmp(registry->metrics[j]->name, metric->name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        sent = chunk_line(
+                   request,
+                   "# HELP %s %s\n# TYPE %s %s\n",
+                   metric->name,
+                   metric->help,
+                   metric->name,
+                   kind_name(metric->kind));
+        for (int j = i; j < registry->count && sent; j++) {
+            if (strcmp(registry->metrics[j]->name, metric->name) == 0) {
+                sent = render_metric(request, registry->metrics[j]);
+            }
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&registry->mutex));
+    if (!sent || !chunk_flush(request)) {
+        ESP_LOGW(TAG, "Client dropped a metrics scrape");
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(request, NULL, 0);
+    return ESP_OK;
+}
+
+void ll_metrics_serve(httpd_handle_t server) {
+    NPC(server);
+    static metrics_handler_t timed = {
+        .handler = metrics_get_handler,
+        .latency = &glob_metrics_latency,
+    };
+    const httpd_uri_t metrics_get = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = ll_metrics_timed_handler,
+        .user_ctx = &timed,
+    };
+    ll_metrics_register(&glob_heap_free);
+    ll_metrics_register(&glob_heap_min_free);
+    ll_metrics_register(&glob_metrics_latency);
+    ESP_EC(httpd_register_uri_handler(server, &metrics_get));
+    ESP_LOGI(TAG, "Serving /metrics");
+}
+
+// name[.label]=value pairs separated by commas, histograms as count/sum.
+// The ll_ prefix is dropped, everything in it is ours.
+size_t ll_metrics_snapshot(char *buffer, size_t size) {
+    NPC(buffer);
+    sample_system();
+    metrics_registry_t *registry = &glob_registry;
+    size_t len = 0;
+    buffer[0] = '\0';
+    POSIX_EC(pthread_mutex_lock(&registry->mutex));
+    for (int i = 0; i < registry->count; i++) {
+        const metric_t *metric = registry->metrics[i];
+        const char *name = metric->name;
+        if (strncmp(name, "ll_", 3) == 0) {
+            name += 3;
+        }
+        char value[24];
+        if (metric->kind == mk_Histogram) {
+            unsigned long count = 0;
+            for (int j = 0; j <= metric->bound_count; j++) {
+                count += load(&metric->buckets[j]);
+            }
+            snprintf(
+                value,
+                sizeof(value),
+                "%lu/%lu",
+                count,
+                (unsigned long)load(&metric->sum));
+        } else {
+            snprintf(
+                value,
+                sizeof(value),
+                "%lu",
+                (unsigned long)load(&metric->value));
+        }
+        int pair_len = snprintf(
+            buffer + len,
+            size - len,
+            "%s%s%s%s=%s",
+            len > 0 ? "," : "",
+            name,
+            metric->label_value ? "." : "",
+            metric->label_value ? metric->label_value : "",
+            value);
+        if (pair_len >= size - len) {
+            // Keep the pairs that fit whole.
+            buffer[len] = '\0';
+            ESP_LOGW(TAG, "Metrics snapshot truncated at %s", metric->name);
+            break;
+        }
+        len += pair_len;
+    }
+    POSIX_EC(pthread_mutex_unlock(&registry->mutex));
+    return len;
+}
@@ -0,0 +1,498 @@
+#include "ota.h"
+
+#include "const.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "metrics.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ll_ota";
+
+// A buffer on its way between the download and the writer. The empty queue
+// starts out with every buffer in it and the writer hands each one back once
+// it is written, so all of them being back means the writes are done.
+typedef struct ota_chunk_t {
+    int buffer;
+    size_t len;
+} ota_chunk_t;
+
+typedef enum ota_state_t {
+    os_Idle,
+    os_Running,
+    os_Done,
+    os_Failed,
+} ota_state_t;
+
+typedef struct ota_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    ota_state_t state;
+    uint32_t bytes;
+    int64_t total;
+    ota_result_t result;
+    // The update ll_ota_start started
+    char url[OTA_URL_MAX];
+    uint8_t sha256[32];
+
+    // UNSYNCHRONIZED FIELDS (updating task, and the writer task for the
+    // chunks it holds)
+    QueueHandle_t empty;
+    StaticQueue_t empty_storage;
+    uint8_t empty_items[OTA_BUFFER_COUNT * sizeof(ota_chunk_t)];
+    QueueHandle_t full;
+    StaticQueue_t full_storage;
+    uint8_t full_items[OTA_BUFFER_COUNT * sizeof(ota_chunk_t)];
+    TaskHandle_t writer;
+    esp_ota_handle_t handle;
+    // Set by the writer before it hands a buffer back.
+    esp_err_t write_err;
+    uint8_t buffers[OTA_BUFFER_COUNT][OTA_BUFFER_SIZE];
+} ota_t;
+
+static ota_t glob_ota = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_ms_per_mb = {
+    .name = "ll_ota_ms_per_mb",
+    .help = "End to end time of the last firmware update per MiB",
+    .kind = mk_Gauge,
+};
+static metric_t glob_resumes = {
+    .name = "ll_ota_resumes_total",
+    .help = "Firmware downloads resumed after the connection dropped",
+    .kind = mk_Counter,
+};
+
+static void writer_task(void *arg) {
+    ota_t *ota = (ota_t *)arg;
+    while (true) {
+        ota_chunk_t chunk;
+        xQueueReceive(ota->full, &chunk, portMAX_DELAY);
+        // After a failed write the rest of the image is only handed back.
+        if (ota->write_err == ESP_OK) {
+            ota->write_err = esp_ota_write(
+                ota->handle,
+                ota->buffers[chunk.buffer],
+                chunk.len);
+        }
+        xQueueSend(ota->empty, &chunk, portMAX_DELAY);
+    }
+}
+
+static void start_writer(ota_t *ota) {
+    if (ota->writer != NULL) {
+        return;
+    }
+    ota->empty = xQueueCreateStatic(
+        OTA_BUFFER_COUNT,
+        sizeof(ota_chunk_t),
+        ota->empty_items,
+        &ota->empty_storage);
+    ota->full = xQueueCreateStatic(
+        OTA_BUFFER_COUNT,
+        sizeof(ota_chunk_t),
+        ota->full_items,
+        &ota->full_storage);
+    NPC(ota->empty);
+    NPC(ota->full);
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        const ota_chunk_t chunk = {.buffer = i};
+        xQueueSend(ota->empty, &chunk, 0);
+    }
+    if (xTaskCreate(writer_task, "ll_ota_writer", 3072, ota, 5, &ota->writer) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create OTA writer task!");
+        abort();
+    }
+    ll_metrics_register_task(ota->writer);
+}
+
+// Every buffer back from the writer, the one still held included.
+static void wait_for_writer(ota_t *ota, ota_chunk_t *held) {
+    ota_chunk_t chunks[OTA_BUFFER_COUNT];
+    int back = 0;
+    if (held->buffer >= 0) {
+        chunks[back++] = *held;
+        held->buffer = -1;
+    }
+    while (back < OTA_BUFFER_COUNT) {
+        xQueueReceive(ota->empty, &chunks[back++], portMAX_DELAY);
+    }
+    for (int i = 0; i < OTA_BUFFER_COUNT; i++) {
+        xQueueSend(ota->empty, &chunks[i], 0);
+    }
+}
+
+// Receives from one connection until the image is complete or the
+// connection drops, which returns oe_Connect with done unset. received is
+// where the connection starts and how far it got.
+static ota_error_t download_from(
+    ota_t *ota,
+    esp_http_client_handle_t client,
+    uint32_t limit,
+    ota_chunk_t *chunk,
+    uint32_t *received,
+    mbedtls_sha256_context *sha,
+    bool *done) {
+    if (*received > 0) {
+        char range[24];
+        snprintf(
+            range,
+            sizeof(range),
+            "bytes=%lu-",
+            (unsigned long)*received);
+        ESP_EC(esp_http_client_set_header(client, "Range", range));
+    }
+    if (esp_http_client_open(client, 0) != ESP_OK) {
+        return oe_Connect;
+    }
+    int64_t len = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    // A server that ignores the range sends the whole image again, the part
+    // we already have is skipped.
+    uint32_t skip = 0;
+    if (status == 200) {
+        skip = *received;
+    } else if (status != 206 || *received == 0) {
+        ESP_LOGW(TAG, "Image server answered %d", status);
+        return len < 0 ? oe_Connect : oe_Status;
+    }
+    int64_t total = status == 200 ? len : *received + len;
+    if (len > 0 && total > limit) {
+        ESP_LOGW(TAG, "Image of %lld bytes doesn't fit in the slot", total);
+        return oe_TooBig;
+    }
+    POSIX_EC(pthread_mutex_lock(&ota->mutex));
+    ota->total = len > 0 ? total : -1;
+    POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+
+    while (true) {
+        if (chunk->buffer < 0) {
+            xQueueReceive(ota->empty, chunk, portMAX_DELAY);
+            chunk->len = 0;
+            if (ota->write_err != ESP_OK) {
+                ESP_LOGW(
+                    TAG,
+                    "Writing the image failed: %s",
+                    esp_err_to_name(ota->write_err));
+                return oe_Image;
+            }
+        }
+        uint8_t *at = ota->buffers[chunk->buffer] + chunk->len;
+        int n = esp_http_client_read(
+            client,
+            (char *)at,
+            OTA_BUFFER_SIZE - chunk->len);
+        if (n < 0) {
+            return oe_Connect;
+        }
+        if (n == 0) {
+            *done = esp_http_client_is_complete_data_received(client);
+            return *done ? oe_None : oe_Connect;
+        }
+        if (skip > 0) {
+            uint32_t drop = (uint32_t)n < skip ? (uint32_t)n : skip;
+            memmove(at, at + drop, n - drop);
+            skip -= drop;
+            n -= drop;
+        }
+        mbedtls_sha256_update(sha, at, n);
+        chunk->len += n;
+        *received += n;
+        if (chunk->len == OTA_BUFFER_SIZE) {
+            xQueueSend(ota->full, chunk, portMAX_DELAY);
+            chunk->buffer = -1;
+        }
+        POSIX_EC(pthread_mutex_lock(&ota->mutex));
+        ota->bytes = *received;
+        POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+    }
+}
+
+static void run_update(
+    ota_t *ota, const char *url, const uint8_t *sha256, ota_result_t *result) {
+    int64_t started = esp_timer_get_time();
+    memset(result, 0, sizeof(ota_result_t));
+    start_writer(ota);
+
+    const esp_partition_t *slot = esp_ota_get_next_update_partition(NULL);
+    NPC(slot);
+    ESP_LOGI(TAG, "Updating slot %s from %s", slot->label, url);
+    // Sequential writes erase each sector as the image reaches it, instead of
+    // the whole slot up front before the first byte arrives.
+    ESP_EC(esp_ota_begin(slot, OTA_WITH_SEQUENTIAL_WRITES, &ota->handle));
+    ota->write_err = ESP_OK;
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    const esp_http_client_config_t client_config = {
+        .url = url,
+        .timeout_ms = OTA_TIMEOUT_MS,
+        .buffer_size = OTA_BUFFER_SIZE,
+        // https:// image servers are checked against the certificate bundle.
+        .crt_bundle_attach = esp_crt_bundle_attach,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&client_config);
+    NPC(client);
+
+    ota_chunk_t chunk = {.buffer = -1};
+    uint32_t received = 0;
+    // Connections in a row that got nothing
+    int fruitless = 0;
+    ota_error_t error = oe_None;
+    while (true) {
+        uint32_t before = received;
+        bool done = false;
+        error = download_from(
+            ota,
+            client,
+            slot->size,
+            &chunk,
+            &received,
+            &sha,
+            &done);
+        esp_http_client_close(client);
+        if (done || error != oe_Connect) {
+            break;
+        }
+        fruitless = received > before ? 1 : fruitless + 1;
+        if (fruitless > OTA_RESUME_MAX) {
+            break;
+        }
+        result->resumes++;
+        ll_metrics_add(&glob_resumes, 1);
+        ESP_LOGW(
+            TAG,
+            "Download interrupted at %lu bytes, resuming",
+            received);
+        // Straight away after progress, backing off while nothing gets
+        // through.
+        vTaskDelay(
+            OTA_RESUME_DELAY_MS * (fruitless - 1) / portTICK_PERIOD_MS);
+    }
+    esp_http_client_cleanup(client);
+
+    // The last, partial buffer
+    if (error == oe_None && chunk.buffer >= 0 && chunk.len > 0) {
+        xQueueSend(ota->full, &chunk, portMAX_DELAY);
+        chunk.buffer = -1;
+    }
+    wait_for_writer(ota, &chunk);
+    if (error == oe_None && ota->write_err != ESP_OK) {
+        error = oe_Image;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if (error == oe_None && memcmp(digest, sha256, sizeof(digest)) != 0) {
+        error = oe_Hash;
+    }
+    if (error == oe_None) {
+        // Checks the image header and the checksum the build appends.
+        if (esp_ota_end(ota->handle) != ESP_OK) {
+            error = oe_Image;
+        } else {
+            ESP_EC(esp_ota_set_boot_partition(slot));
+        }
+    } else {
+        esp_ota_abort(ota->handle);
+    }
+
+    result->error = error;
+    result->bytes = received;
+    result->ms = (esp_timer_get_time() - started) / 1000;
+    uint32_t ms_per_mb =
+        received ? (uint64_t)result->ms * 1024 * 1024 / received : 0;
+    if (error == oe_None) {
+        ll_metrics_set(&glob_ms_per_mb, ms_per_mb);
+        ESP_LOGI(
+            TAG,
+            "Updated with %lu bytes in %lu ms (%lu ms/MiB, %lu resumes)",
+            result->bytes,
+            result->ms,
+            ms_per_mb,
+            result->resumes);
+    } else {
+        ESP_LOGW(
+            TAG,
+            "Update failed after %lu bytes: %s",
+            result->bytes,
+            ll_ota_error_explain(error));
+    }
+}
+
+static bool claim(ota_t *ota) {
+    POSIX_EC(pthread_mutex_lock(&ota->mutex));
+    bool claimed = ota->state != os_Running;
+    if (claimed) {
+        ota->state = os_Running;
+        ota->bytes = 0;
+        ota->total = -1;
+    }
+    POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+    return claimed;
+}
+
+static void release(ota_t *ota, const ota_result_t *result) {
+    POSIX_EC(pthread_mutex_lock(&ota->mutex));
+    ota->state = result->error == oe_None ? os_Done : os_Failed;
+    ota->result = *result;
+    POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+}
+
+void ll_ota_update(
+    const char *url, const uint8_t sha256[32], ota_result_t *result) {
+    NPC(url);
+    NPC(sha256);
+    NPC(result);
+    ota_t *ota = &glob_ota;
+    if (!claim(ota)) {
+        memset(result, 0, sizeof(ota_result_t));
+        result->error = oe_Busy;
+        return;
+    }
+    run_update(ota, url, sha256, result);
+    release(ota, result);
+}
+
+const char *ll_ota_error_explain(ota_error_t error) {
+    switch (error) {
+    case oe_None:
+        return "No error";
+    case oe_Busy:
+        return "An update is already running";
+    case oe_Connect:
+        return "Couldn't download the image";
+    case oe_Status:
+        return "Image server refused the request";
+    case oe_TooBig:
+        return "Image is bigger than the slot";
+    case oe_Hash:
+        return "Image doesn't match its SHA-256";
+    case oe_Image:
+        return "Image isn't a valid application";
+    default:
+        return "Unexplainable error";
+    }
+}
+
+static void ota_task(void *arg) {
+    ota_t *ota = (ota_t *)arg;
+    ota_result_t result;
+    // Nothing else writes the request while the update is running.
+    run_update(ota, ota->url, ota->sha256, &result);
+    release(ota, &result);
+    if (result.error == oe_None) {
+        // Leave GET /ota some time to see it succeed
+        vTaskDelay(OTA_REBOOT_DELAY_MS / portTICK_PERIOD_MS);
+        esp_restart();
+    }
+    vTaskDelete(NULL);
+}
+
+bool ll_ota_start(const char *url, const uint8_t sha256[32]) {
+    NPC(url);
+    NPC(sha256);
+    ota_t *ota = &glob_ota;
+    if (strlen(url) >= OTA_URL_MAX) {
+        ESP_LOGW(TAG, "Image URL too long");
+        return false;
+    }
+    if (!claim(ota)) {
+        return false;
+    }
+    POSIX_EC(pthread_mutex_lock(&ota->mutex));
+    strcpy(ota->url, url);
+    memcpy(ota->sha256, sha256, sizeof(ota->sha256));
+    POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+    if (xTaskCreate(ota_task, "ll_ota", 4096, ota, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create OTA task!");
+        abort();
+    }
+    return true;
+}
+
+const char *ll_ota_parse_request(const char *request, uint8_t sha256[32]) {
+    NPC(request);
+    NPC(sha256);
+    for (int i = 0; i < 32; i++) {
+        if (!isxdigit((int)request[2 * i]) ||
+            !isxdigit((int)request[2 * i + 1])) {
+            return NULL;
+        }
+        char byte[3] = {request[2 * i], request[2 * i + 1], '\0'};
+        sha256[i] = (uint8_t)strtol(byte, NULL, 16);
+    }
+    if (request[64] != ' ') {
+        return NULL;
+    }
+    const char *url = request + 65;
+    bool http = strncmp(url, "http://", 7) == 0 ||
+                strncmp(url, "https://", 8) == 0;
+    return http && strlen(url) < OTA_URL_MAX ? url : NULL;
+}
+
+static esp_err_t ota_get_handler(httpd_req_t *request) {
+    NPC(request);
+    ota_t *ota = &glob_ota;
+    static const char *STATES[] = {"idle", "running", "done", "failed"};
+    char status[OTA_STATUS_SIZE];
+    POSIX_EC(pthread_mutex_lock(&ota->mutex));
+    const ota_result_t *result = &ota->result;
+    snprintf(
+        status,
+        sizeof(status),
+        "{\"state\":\"%s\",\"bytes\":%lu,\"total\":%lld,\"ms\":%lu,"
+        "\"resumes\":%lu,\"error\":\"%s\"}\n",
+        STATES[ota->state],
+        (unsigned long)ota->bytes,
+        (long long)ota->total,
+        (unsigned long)result->ms,
+        (unsigned long)result->resumes,
+        ll_ota_error_explain(result->error));
+    POSIX_EC(pthread_mutex_unlock(&ota->mutex));
+    ESP_EC(httpd_resp_set_type(request, "application/json"));
+    ESP_EC(httpd_resp_send(request, status, HTTPD_RESP_USE_STRLEN));
+    return ESP_OK;
+}
+
+void ll_ota_serve(httpd_handle_t server) {
+    NPC(server);
+    const httpd_uri_t ota_get = {
+        .uri = "/ota",
+        .method = HTTP_GET,
+        .handler = ota_get_handler,
+    };
+    ll_metrics_register(&glob_ms_per_mb);
+    ll_metrics_register(&glob_resumes);
+    ESP_EC(httpd_register_uri_handler(server, &ota_get));
+    ESP_LOGI(TAG, "Serving /ota");
+}
+
+void ll_ota_confirm_boot() {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK &&
+        state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGI(TAG, "New image in %s works, keeping it", running->label);
+        ESP_EC(esp_ota_mark_app_valid_cancel_rollback());
+    }
+}
@@ -0,0 +1,59 @@
+#include "pool.h"
+
+#include "esp_log.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ll_pool";
+
+void *ll_pool_alloc(pool_t *pool) {
+    NPC(pool);
+    POSIX_EC(pthread_mutex_lock(&pool->mutex));
+    if (!pool->registered) {
+        ll_metrics_register(&pool->high_water_metric);
+        pool->registered = true;
+    }
+    int index = 0;
+    while (index < pool->capacity && (pool->in_use & (1u << index))) {
+        index++;
+    }
+    if (index == pool->capacity) {
+        ESP_LOGE(
+            TAG,
+            "Pool %s ran out of its %d blocks!",
+            pool->high_water_metric.label_value,
+            pool->capacity);
+        abort();
+    }
+    pool->in_use |= 1u << index;
+    pool->used++;
+    if (pool->used > pool->high_water) {
+        pool->high_water = pool->used;
+        ll_metrics_set(&pool->high_water_metric, pool->high_water);
+    }
+    POSIX_EC(pthread_mutex_unlock(&pool->mutex));
+    return pool->blocks + index * pool->block_size;
+}
+
+void ll_pool_free(pool_t *pool, void *block) {
+    NPC(pool);
+    NPC(block);
+    size_t offset = (uint8_t *)block - pool->blocks;
+    int index = offset / pool->block_size;
+    POSIX_EC(pthread_mutex_lock(&pool->mutex));
+    if ((uint8_t *)block < pool->blocks || index >= pool->capacity ||
+        offset % pool->block_size != 0 ||
+        !(pool->in_use & (1u << index))) {
+        ESP_LOGE(
+            TAG,
+            "Freed %p, which isn't an allocated block of pool %s!",
+            block,
+            pool->high_water_metric.label_value);
+        abort();
+    }
+    pool->in_use &= ~(1u << index);
+    pool->used--;
+    POSIX_EC(pthread_mutex_unlock(&pool->mutex));
+}
@@ -0,0 +1,271 @@
+#include "probe.h"
+
+#include "const.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *TAG = "ll_probe";
+
+typedef struct probe_request_t {
+    uint32_t attempt;
+    int64_t deadline_us;
+    char host[PROBE_HOST_MAX];
+    char port[8];
+} probe_request_t;
+
+typedef struct probe_t {
+    // One request at a time, a newer one replaces a request the task hasn't
+    // picked up yet.
+    QueueHandle_t requests;
+    StaticQueue_t requests_storage;
+    uint8_t items[sizeof(probe_request_t)];
+
+    // REACTOR TASK ONLY
+    uint32_t attempts;
+} probe_t;
+
+static probe_t glob_probe;
+
+static metric_t glob_verdict_us = {
+    .name = "ll_setup_probe_us",
+    .help = "Time from getting an IP in setup to the verdict on the target",
+    .kind = mk_Histogram,
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
+// Splits "scheme://[user[:pass]@]host[:port][/path]", the port defaults to
+// the one of the scheme.
+static bool split_target(const char *target, probe_request_t *request) {
+    static const char *schemes[][2] = {
+        {"http://", "80"},
+        {"https://", "443"},
+        {"mqtt://", "1883"},
+        {"mqtts://", "8883"},
+    };
+    const char *host = NULL;
+    const char *port = NULL;
+    for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); i++) {
+        size_t len = strlen(schemes[i][0]);
+        if (strncmp(target, schemes[i][0], len) == 0) {
+            host = target + len;
+            port = schemes[i][1];
+            break;
+        }
+    }
+    if (host == NULL) {
+        return false;
+    }
+    size_t authority_len = strcspn(host, "/");
+    for (size_t i = authority_len; i > 0; i--) {
+        if (host[i - 1] == '@') {
+            host += i;
+            break;
+        }
+    }
+    size_t host_len = strcspn(host, ":/");
+    size_t port_len = strlen(port);
+    if (host[host_len] == ':') {
+        port = host + host_len + 1;
+        port_len = strcspn(port, "/");
+    }
+    if (host_len == 0 || host_len >= sizeof(request->host) || port_len == 0 ||
+        port_len >= sizeof(request->port)) {
+        return false;
+    }
+    snprintf(request->host, sizeof(request->host), "%.*s", (int)host_len, host);
+    snprintf(request->port, sizeof(request->port), "%.*s", (int)port_len, port);
+    return true;
+}
+
+static probe_result_t wait_connected(int fd, int64_t deadline_us) {
+    int64_t left_us = deadline_us - esp_timer_get_time();
+    if (left_us <= 0) {
+        return pr_Timeout;
+    }
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    struct timeval timeout = {
+        .tv_sec = left_us / 1000000,
+        .tv_usec = left_us % 1000000,
+    };
+    int ready = select(fd + 1, NULL, &writable, NULL, &timeout);
+    if (ready == 0) {
+        return pr_Timeout;
+    }
+    int error = errno;
+    socklen_t len = sizeof(error);
+    if (ready > 0 &&
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+        error == 0) {
+        return pr_Reachable;
+    }
+    ESP_LOGW(TAG, "Couldn't connect: %s", strerror(error));
+    return pr_Unreachable;
+}
+
+// Only the first address is tried, the uploader doesn't try more either.
+static probe_result_t probe_target(const probe_request_t *request) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *found = NULL;
+    int err = getaddrinfo(request->host, request->port, &hints, &found);
+    if (err != 0 || found == NULL) {
+        ESP_LOGW(TAG, "Couldn't resolve %s (%d)", request->host, err);
+        return pr_Unresolved;
+    }
+    int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "Couldn't open a socket: %s", strerror(errno));
+        freeaddrinfo(found);
+        return pr_Unreachable;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    probe_result_t result = pr_Reachable;
+    if (connect(fd, found->ai_addr, found->ai_addrlen) != 0) {
+        if (errno == EINPROGRESS) {
+            result = wait_connected(fd, request->deadline_us);
+        } else {
+            ESP_LOGW(TAG, "Couldn't connect: %s", strerror(errno));
+            result = pr_Unreachable;
+        }
+    }
+    freeaddrinfo(found);
+    close(fd);
+    return result;
+}
+
+static void probe_task(void *arg) {
+    probe_t *probe = (probe_t *)arg;
+    while (true) {
+        probe_request_t request;
+        if (xQueueReceive(probe->requests, &request, portMAX_DELAY) !=
+            pdTRUE) {
+            continue;
+        }
+        const reactor_event_t event = {
+            .kind = re_ProbeDone,
+            .attempt = request.attempt,
+            .reason = (uint8_t)probe_target(&request),
+        };
+        ll_reactor_post(&event);
+    }
+}
+
+bool ll_probe_start(probe_attempt_t *attempt, const char *target) {
+    NPC(attempt);
+    NPC(target);
+    probe_t *probe = &glob_probe;
+    probe_request_t request;
+    if (!split_target(target, &request)) {
+        ESP_LOGW(TAG, "No host to probe in %s", target);
+        return false;
+    }
+    if (probe->requests == NULL) {
+        probe->requests = xQueueCreateStatic(
+            1,
+            sizeof(probe_request_t),
+            probe->items,
+            &probe->requests_storage);
+        NPC(probe->requests);
+        if (xTaskCreate(
+                probe_task,
+                "ll_probe",
+                PROBE_STACK_SIZE,
+                probe,
+                5,
+                NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Couldn't create the probe task!");
+            abort();
+        }
+        ll_metrics_register(&glob_verdict_us);
+    }
+
+    attempt->id = ++probe->attempts;
+    attempt->started_us = esp_timer_get_time();
+    request.attempt = attempt->id;
+    request.deadline_us = attempt->started_us + SETUP_PROBE_TIMEOUT_MS * 1000LL;
+    // Only the reactor sends, so the queue has room after the reset.
+    xQueueReset(probe->requests);
+    if (xQueueSend(probe->requests, &request, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Couldn't queue the probe!");
+        abort();
+    }
+    ll_reactor_arm(rd_ProbeTimeout, SETUP_PROBE_TIMEOUT_MS);
+    ESP_LOGI(TAG, "Probing target %s port %s", request.host, request.port);
+    return true;
+}
+
+bool ll_probe_step(
+    probe_attempt_t *attempt,
+    const reactor_event_t *event,
+    probe_result_t *result) {
+    NPC(attempt);
+    NPC(event);
+    NPC(result);
+    switch (event->kind) {
+    case re_ProbeDone:
+        if (event->attempt != attempt->id) {
+            ESP_LOGD(
+                TAG,
+                "Dropping verdict of earlier probe %lu",
+                (unsigned long)event->attempt);
+            return false;
+        }
+        *result = (probe_result_t)event->reason;
+        break;
+    case re_Deadline:
+        if (event->deadline != rd_ProbeTimeout) {
+            return false;
+        }
+        // The task may still be stuck in the resolver, its verdict is
+        // dropped when it comes.
+        *result = pr_Timeout;
+        break;
+    default:
+        return false;
+    }
+    ll_reactor_disarm(rd_ProbeTimeout);
+    int64_t took_us = esp_timer_get_time() - attempt->started_us;
+    ll_metrics_observe(&glob_verdict_us, (uint32_t)took_us);
+    ESP_LOGI(
+        TAG,
+        "Target probe: %s after %lld us",
+        ll_probe_result_name(*result),
+        (long long)took_us);
+    return true;
+}
+
+const char *ll_probe_result_name(probe_result_t result) {
+    switch (result) {
+    case pr_Reachable:
+        return "reachable";
+    case pr_Unresolved:
+        return "unresolved";
+    case pr_Unreachable:
+        return "unreachable";
+    case pr_Timeout:
+        return "timeout";
+    default:
+        return "unknown";
+    }
+}
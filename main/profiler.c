@@ -0,0 +1,358 @@
+#include "profiler.h"
+
+#include "const.h"
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "riscv/rvruntime-frames.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ll_profiler";
+
+typedef struct profile_entry_t {
+    uint32_t pc;
+    uint32_t task;
+    // Zero for a free slot.
+    uint32_t count;
+} profile_entry_t;
+
+typedef struct profile_header_t {
+    char magic[4];
+    uint32_t hz;
+    uint32_t elapsed_ms;
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t in_isr;
+    uint32_t cycles;
+    uint32_t cpu_mhz;
+    uint32_t task_count;
+    uint32_t entry_count;
+} profile_header_t;
+
+typedef struct profiler_t {
+    // Control, only one start, stop or dump at a time.
+    pthread_mutex_t mutex;
+    // The timer ISR's side, it can't take a mutex.
+    portMUX_TYPE lock;
+
+    // SYNCHRONIZED FIELDS, by lock
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t in_isr;
+    uint32_t cycles;
+    TaskHandle_t tasks[PROFILER_TASKS_MAX];
+    char names[PROFILER_TASKS_MAX][PROFILER_NAME_SIZE];
+    uint32_t task_count;
+    profile_entry_t entries[PROFILER_SLOTS];
+    uint32_t entry_count;
+
+    // SYNCHRONIZED FIELDS, by mutex
+    gptimer_handle_t timer;
+    uint32_t hz;
+    int64_t started_us;
+    // Zero while running.
+    int64_t stopped_us;
+    uint8_t chunk[PROFILER_CHUNK_SIZE];
+} profiler_t;
+
+static profiler_t glob_profiler = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static uint32_t IRAM_ATTR task_index(profiler_t *prof, TaskHandle_t task) {
+    for (uint32_t i = 0; i < prof->task_count; i++) {
+        if (prof->tasks[i] == task) {
+            return i;
+        }
+    }
+    if (prof->task_count == PROFILER_TASKS_MAX) {
+        return PROFILER_TASK_OTHER;
+    }
+    // Copied now, the task may be gone by the time the profile is read.
+    uint32_t i = prof->task_count++;
+    prof->tasks[i] = task;
+    strncpy(prof->names[i], pcTaskGetName(task), PROFILER_NAME_SIZE - 1);
+    return i;
+}
+
+static void IRAM_ATTR count(profiler_t *prof, uint32_t pc, uint32_t task) {
+    uint32_t hash = (pc ^ (task << 24)) * 2654435761u;
+    for (int probe = 0; probe < PROFILER_PROBES; probe++) {
+        profile_entry_t *entry =
+            &prof->entries[(hash + probe) % PROFILER_SLOTS];
+        if (entry->count == 0) {
+            entry->pc = pc;
+            entry->task = task;
+            entry->count = 1;
+            prof->entry_count++;
+            return;
+        }
+        if (entry->pc == pc && entry->task == task) {
+            entry->count++;
+            return;
+        }
+    }
+    prof->dropped++;
+}
+
+static bool IRAM_ATTR on_alarm(
+    gptimer_handle_t timer,
+    const gptimer_alarm_event_data_t *event,
+    void *ctx) {
+    uint32_t started = esp_cpu_get_cycle_count();
+    profiler_t *prof = &glob_profiler;
+    portENTER_CRITICAL_ISR(&prof->lock);
+    prof->samples++;
+    if (xPortInterruptedFromISRContext()) {
+        prof->in_isr++;
+    } else {
+        // Interrupt entry saved the task's registers on its stack and left
+        // the frame's address in the first word of its TCB.
+        TaskHandle_t task = xTaskGetCurrentTaskHandle();
+        const RvExcFrame *frame = *(RvExcFrame *const *)task;
+        count(prof, frame->mepc, task_index(prof, task));
+    }
+    prof->cycles += esp_cpu_get_cycle_count() - started;
+    portEXIT_CRITICAL_ISR(&prof->lock);
+    return false;
+}
+
+static void stop_timer(profiler_t *prof) {
+    if (prof->timer == NULL) {
+        return;
+    }
+    ESP_EC(gptimer_stop(prof->timer));
+    ESP_EC(gptimer_disable(prof->timer));
+    ESP_EC(gptimer_del_timer(prof->timer));
+    prof->timer = NULL;
+    prof->stopped_us = esp_timer_get_time();
+}
+
+// Starts over with an empty profile, sampling hz times a second.
+void ll_profiler_start(uint32_t hz) {
+    profiler_t *prof = &glob_profiler;
+    if (hz == 0 || hz > PROFILER_HZ_MAX) {
+        ESP_LOGE(TAG, "Can't sample at %lu Hz!", (unsigned long)hz);
+        abort();
+    }
+    POSIX_EC(pthread_mutex_lock(&prof->mutex));
+    stop_timer(prof);
+    portENTER_CRITICAL(&prof->lock);
+    prof->samples = 0;
+    prof->dropped = 0;
+    prof->in_isr = 0;
+    prof->cycles = 0;
+    prof->task_count = 0;
+    memset(prof->names, 0, sizeof(prof->names));
+    memset(prof->entries, 0, sizeof(prof->entries));
+    prof->entry_count = 0;
+    portEXIT_CRITICAL(&prof->lock);
+
+    const gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000 * 1000,
+        .intr_priority = PROFILER_INTR_PRIORITY,
+    };
+    const gptimer_event_callbacks_t callbacks = {
+        .on_alarm = on_alarm,
+    };
+    const gptimer_alarm_config_t alarm_config = {
+        .alarm_count = 1000 * 1000 / hz,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_EC(gptimer_new_timer(&timer_config, &prof->timer));
+    ESP_EC(gptimer_register_event_callbacks(prof->timer, &callbacks, NULL));
+    ESP_EC(gptimer_set_alarm_action(prof->timer, &alarm_config));
+    ESP_EC(gptimer_enable(prof->timer));
+    prof->hz = hz;
+    prof->started_us = esp_timer_get_time();
+    prof->stopped_us = 0;
+    ESP_EC(gptimer_start(prof->timer));
+    POSIX_EC(pthread_mutex_unlock(&prof->mutex));
+    ESP_LOGI(TAG, "Profiling at %lu Hz", (unsigned long)hz);
+}
+
+// Stops sampling, the profile stays readable until the next start.
+void ll_profiler_stop() {
+    profiler_t *prof = &glob_profiler;
+    POSIX_EC(pthread_mutex_lock(&prof->mutex));
+    stop_timer(prof);
+    POSIX_EC(pthread_mutex_unlock(&prof->mutex));
+}
+
+typedef bool (*dump_sink_t)(void *ctx, const uint8_t *data, size_t len);
+
+// Produces the dump a chunk at a time, only holding the ISR off while it
+// copies one chunk of entries. Samples taken during the dump are only in it
+// if their slot wasn't copied yet, so a dump of a running profile isn't a
+// snapshot. Slots are never freed, so there are always entry_count entries
+// to send.
+static bool dump(profiler_t *prof, dump_sink_t sink, void *ctx) {
+    int64_t until = prof->stopped_us ? prof->stopped_us : esp_timer_get_time();
+    profile_header_t header = {
+        .magic = {'P', 'R', 'O', 'F'},
+        .hz = prof->hz,
+        .elapsed_ms = (uint32_t)((until - prof->started_us) / 1000),
+        .cpu_mhz = esp_rom_get_cpu_ticks_per_us(),
+    };
+    char names[PROFILER_TASKS_MAX][PROFILER_NAME_SIZE];
+    portENTER_CRITICAL(&prof->lock);
+    header.samples = prof->samples;
+    header.dropped = prof->dropped;
+    header.in_isr = prof->in_isr;
+    header.cycles = prof->cycles;
+    header.task_count = prof->task_count;
+    header.entry_count = prof->entry_count;
+    memcpy(names, prof->names, sizeof(names));
+    portEXIT_CRITICAL(&prof->lock);
+    if (!sink(ctx, (const uint8_t *)&header, sizeof(header)) ||
+        !sink(ctx,
+              (const uint8_t *)names,
+              header.task_count * PROFILER_NAME_SIZE)) {
+        return false;
+    }
+
+    const size_t per_chunk = sizeof(prof->chunk) / sizeof(profile_entry_t);
+    uint32_t left = header.entry_count;
+    for (size_t slot = 0; slot < PROFILER_SLOTS && left > 0;
+         slot += per_chunk) {
+        profile_entry_t *out = (profile_entry_t *)prof->chunk;
+        size_t n = 0;
+        portENTER_CRITICAL(&prof->lock);
+        for (size_t i = slot; i < slot + per_chunk && i < PROFILER_SLOTS &&
+                              n < left;
+             i++) {
+            if (prof->entries[i].count != 0) {
+                out[n++] = prof->entries[i];
+            }
+        }
+        portEXIT_CRITICAL(&prof->lock);
+        left -= n;
+        if (!sink(ctx, prof->chunk, n * sizeof(profile_entry_t))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool http_sink(void *ctx, const uint8_t *data, size_t len) {
+    return len == 0 ||
+           httpd_resp_send_chunk((httpd_req_t *)ctx, (const char *)data, len) ==
+               ESP_OK;
+}
+
+// Console lines of "PROFILE " and up to 32 bytes in hex, for
+// host/profile_decode.py to pick out of a captured log.
+static bool uart_sink(void *ctx, const uint8_t *data, size_t len) {
+    for (size_t at = 0; at < len; at += 32) {
+        char line[8 + 2 * 32 + 1];
+        int n = snprintf(line, sizeof(line), "PROFILE ");
+        for (size_t i = at; i < len && i < at + 32; i++) {
+            n += snprintf(line + n, sizeof(line) - n, "%02x", data[i]);
+        }
+        puts(line);
+    }
+    return true;
+}
+
+void ll_profiler_print() {
+    profiler_t *prof = &glob_profiler;
+    POSIX_EC(pthread_mutex_lock(&prof->mutex));
+    dump(prof, uart_sink, NULL);
+    POSIX_EC(pthread_mutex_unlock(&prof->mutex));
+}
+
+static esp_err_t profile_get_handler(httpd_req_t *request) {
+    NPC(request);
+    profiler_t *prof = &glob_profiler;
+    ESP_EC(httpd_resp_set_type(request, "application/octet-stream"));
+    POSIX_EC(pthread_mutex_lock(&prof->mutex));
+    bool sent = dump(prof, http_sink, request);
+    POSIX_EC(pthread_mutex_unlock(&prof->mutex));
+    if (!sent) {
+        ESP_LOGW(TAG, "Client dropped a profile dump");
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(request, NULL, 0);
+    return ESP_OK;
+}
+
+// "start [hz]", "stop" or "print", the last one dumps to the console.
+static esp_err_t profile_post_handler(httpd_req_t *request) {
+    NPC(request);
+    char body[32];
+    if (request->content_len >= sizeof(body)) {
+        ESP_EC(httpd_resp_send_err(
+            request,
+            HTTPD_400_BAD_REQUEST,
+            "Body too long"));
+        return ESP_OK;
+    }
+    size_t len = 0;
+    while (len < request->content_len) {
+        int n = httpd_req_recv(request, body + len, request->content_len - len);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        len += n;
+    }
+    body[len] = '\0';
+    while (len > 0 && isspace((int)body[len - 1])) {
+        body[--len] = '\0';
+    }
+
+    unsigned long hz = 0;
+    if (strcmp(body, "start") == 0) {
+        hz = PROFILER_HZ;
+    } else if (strncmp(body, "start ", 6) == 0) {
+        char *end = NULL;
+        hz = strtoul(body + 6, &end, 10);
+        hz = *end == '\0' && hz <= PROFILER_HZ_MAX ? hz : 0;
+    }
+    if (hz > 0) {
+        ll_profiler_start(hz);
+    } else if (strcmp(body, "stop") == 0) {
+        ll_profiler_stop();
+    } else if (strcmp(body, "print") == 0) {
+        ll_profiler_print();
+    } else {
+        ESP_EC(httpd_resp_send_err(
+            request,
+            HTTPD_400_BAD_REQUEST,
+            "Expected \"start [hz]\", \"stop\" or \"print\""));
+        return ESP_OK;
+    }
+    return httpd_resp_send(request, "OK", HTTPD_RESP_USE_STRLEN);
+}
+
+void ll_profiler_serve(httpd_handle_t server) {
+    NPC(server);
+    const httpd_uri_t profile_get = {
+        .uri = "/profile",
+        .method = HTTP_GET,
+        .handler = profile_get_handler,
+    };
+    const httpd_uri_t profile_post = {
+        .uri = "/profile",
+        .method = HTTP_POST,
+        .handler = profile_post_handler,
+    };
+    ESP_EC(httpd_register_uri_handler(server, &profile_get));
+    ESP_EC(httpd_register_uri_handler(server, &profile_post));
+    ESP_LOGI(TAG, "Serving /profile");
+}
@@ -0,0 +1,90 @@
+#include "reactor.h"
+
+#include "const.h"
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+static const char *TAG = "ll_reactor";
+
+typedef struct reactor_t {
+    QueueHandle_t queue;
+    StaticQueue_t queue_storage;
+    uint8_t items[REACTOR_QUEUE_LEN * sizeof(reactor_event_t)];
+
+    // REACTOR TASK ONLY
+    TickType_t deadlines[rd_Count];
+    bool armed[rd_Count];
+} reactor_t;
+
+static reactor_t glob_reactor;
+
+void ll_reactor_init() {
+    reactor_t *reactor = &glob_reactor;
+    if (reactor->queue == NULL) {
+        reactor->queue = xQueueCreateStatic(
+            REACTOR_QUEUE_LEN,
+            sizeof(reactor_event_t),
+            reactor->items,
+            &reactor->queue_storage);
+        NPC(reactor->queue);
+    } else {
+        // Whatever the last flow left behind, its attempts are over.
+        xQueueReset(reactor->queue);
+    }
+    for (int i = 0; i < rd_Count; i++) {
+        reactor->armed[i] = false;
+    }
+}
+
+void ll_reactor_post(const reactor_event_t *event) {
+    NPC(event);
+    NPC(glob_reactor.queue);
+    if (xQueueSend(glob_reactor.queue, event, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Couldn't post reactor event %d!", event->kind);
+        abort();
+    }
+}
+
+void ll_reactor_arm(reactor_deadline_t deadline, uint32_t ms) {
+    glob_reactor.deadlines[deadline] =
+        xTaskGetTickCount() + ms / portTICK_PERIOD_MS;
+    glob_reactor.armed[deadline] = true;
+}
+
+void ll_reactor_disarm(reactor_deadline_t deadline) {
+    glob_reactor.armed[deadline] = false;
+}
+
+void ll_reactor_next(reactor_event_t *event) {
+    NPC(event);
+    reactor_t *reactor = &glob_reactor;
+    NPC(reactor->queue);
+    while (true) {
+        // Expired deadlines go first, a busy queue can't starve them.
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+        for (int i = 0; i < rd_Count; i++) {
+            if (!reactor->armed[i]) {
+                continue;
+            }
+            TickType_t left = reactor->deadlines[i] - now;
+            if ((int32_t)left <= 0) {
+                reactor->armed[i] = false;
+                event->kind = re_Deadline;
+                event->deadline = (reactor_deadline_t)i;
+                return;
+            }
+            if (left < wait) {
+                wait = left;
+            }
+        }
+        if (xQueueReceive(reactor->queue, event, wait) == pdTRUE) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,506 @@
+#include "remote.h"
+
+#include "alarm.h"
+#include "calib.h"
+#include "const.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "ota.h"
+#include "setup.h"
+#include "uploader.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NETINFO_FIELDS 7
+
+static const char *TAG = "ll_remote";
+
+typedef struct remote_subscriber_t {
+    uint32_t keys;
+    remote_callback_t callback;
+    void *ctx;
+} remote_subscriber_t;
+
+// Keys kept in the network info, in the order of its fields.
+typedef struct remote_field_t {
+    const char *key;
+    remote_key_t flag;
+    int field;
+} remote_field_t;
+
+static const remote_field_t REMOTE_FIELDS[] = {
+    {"target", rk_Target, 2},
+    {"devname", rk_Devname, 3},
+    {"alarms", rk_Alarms, 4},
+    {"levelcal", rk_Levelcal, 5},
+    {"tank", rk_Tank, 6},
+};
+#define REMOTE_FIELD_COUNT (sizeof(REMOTE_FIELDS) / sizeof(REMOTE_FIELDS[0]))
+
+typedef struct remote_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    remote_config_t config;
+    bool initialized;
+    remote_subscriber_t subscribers[REMOTE_SUBSCRIBERS_MAX];
+    int subscriber_count;
+
+    // UNSYNCHRONIZED FIELDS (polling task only)
+    esp_http_client_handle_t client;
+    char url[REMOTE_URL_MAX];
+    char doc[REMOTE_DOC_MAX];
+    remote_config_t current;
+    remote_config_t candidate;
+    // Last version that failed its checks, sent along so the target doesn't
+    // send it again.
+    uint32_t rejected;
+    // Only for checking a document, too big for the uploader's stack.
+    calib_t calib;
+    alarm_engine_t alarms;
+} remote_t;
+
+static remote_t glob_remote = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_version = {
+    .name = "ll_remote_config_version",
+    .help = "Version of the remote configuration in use",
+    .kind = mk_Gauge,
+};
+
+static metric_t glob_rejected = {
+    .name = "ll_remote_config_rejected_total",
+    .help = "Remote configuration documents that failed their checks",
+    .kind = mk_Counter,
+};
+
+static void copy_config(remote_config_t *dst, const remote_config_t *src) {
+    dst->version = src->version;
+    dst->sample_ms = src->sample_ms;
+    dst->deadband = src->deadband;
+    dst->heartbeat_ms = src->heartbeat_ms;
+    strcpy(dst->firmware, src->firmware);
+    copy_netinfo(&dst->netinfo, &src->netinfo);
+}
+
+static void netinfo_fields(const network_info_t *netinfo, const char **fields) {
+    fields[0] = netinfo->ssid;
+    fields[1] = netinfo->password;
+    fields[2] = netinfo->target;
+    fields[3] = netinfo->devname;
+    fields[4] = netinfo->alarms;
+    fields[5] = netinfo->levelcal;
+    fields[6] = netinfo->tank;
+}
+
+// Packs the fields back to back into the buffer, the way the POST parser
+// leaves them. Returns false if they don't fit.
+static bool pack_netinfo(network_info_t *dst, const char **fields) {
+    char **aliases[NETINFO_FIELDS] = {
+        &dst->ssid,
+        &dst->password,
+        &dst->target,
+        &dst->devname,
+        &dst->alarms,
+        &dst->levelcal,
+        &dst->tank,
+    };
+    char *cursor = dst->buffer;
+    char *end = dst->buffer + sizeof(dst->buffer);
+    for (int i = 0; i < NETINFO_FIELDS; i++) {
+        size_t len = strlen(fields[i]) + 1;
+        if (len > (size_t)(end - cursor)) {
+            return false;
+        }
+        memcpy(cursor, fields[i], len);
+        *aliases[i] = cursor;
+        cursor += len;
+    }
+    return true;
+}
+
+static bool parse_u32(const char *text, uint32_t *value) {
+    char *end = NULL;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+static bool sample_ms_valid(uint32_t sample_ms) {
+    return sample_ms >= SAMPLE_PERIOD_MIN_MS &&
+           sample_ms <= SENSOR_CHANNEL_PERIOD_MAX_MS &&
+           sample_ms % LIVE_PERIOD_MS == 0;
+}
+
+static bool deadband_valid(uint32_t deadband, uint32_t heartbeat_ms) {
+    return deadband <= INT32_MAX &&
+           (heartbeat_ms == 0 || (heartbeat_ms >= SAMPLE_PERIOD_MIN_MS &&
+                                  heartbeat_ms <= DEADBAND_HEARTBEAT_MAX_MS));
+}
+
+static bool target_polled(const char *target) {
+    return strncmp(target, "http://", 7) == 0 ||
+           strncmp(target, "https://", 8) == 0;
+}
+
+// A new update request has to come from a target the device verified.
+static bool firmware_valid(remote_t *remote, const remote_config_t *config) {
+    const remote_config_t *current = &remote->current;
+    if (config->firmware[0] == '\0' ||
+        strcmp(config->firmware, current->firmware) == 0) {
+        return true;
+    }
+    if (strncmp(current->netinfo.target, "https://", 8) != 0) {
+        ESP_LOGW(TAG, "Firmware updates are only taken from https:// targets");
+        return false;
+    }
+    uint8_t sha256[32];
+    return ll_ota_parse_request(config->firmware, sha256) != NULL;
+}
+
+// Everything a subscriber would otherwise have to reject on its own.
+static bool config_valid(remote_t *remote, const remote_config_t *config) {
+    const network_info_t *netinfo = &config->netinfo;
+    return target_polled(netinfo->target) &&
+           ll_uploader_target_supported(netinfo->target) &&
+           ll_uploader_devname_valid(netinfo->devname) &&
+           ll_alarm_parse(netinfo->alarms, &remote->alarms) &&
+           ll_calib_parse(netinfo->levelcal, netinfo->tank, &remote->calib) &&
+           sample_ms_valid(config->sample_ms) &&
+           deadband_valid(config->deadband, config->heartbeat_ms) &&
+           firmware_valid(remote, config);
+}
+
+static uint32_t
+changed_keys(const remote_config_t *old, const remote_config_t *new) {
+    const char *old_fields[NETINFO_FIELDS];
+    const char *new_fields[NETINFO_FIELDS];
+    netinfo_fields(&old->netinfo, old_fields);
+    netinfo_fields(&new->netinfo, new_fields);
+    uint32_t changed = 0;
+    for (int i = 0; i < REMOTE_FIELD_COUNT; i++) {
+        int field = REMOTE_FIELDS[i].field;
+        if (strcmp(old_fields[field], new_fields[field]) != 0) {
+            changed |= REMOTE_FIELDS[i].flag;
+        }
+    }
+    if (old->sample_ms != new->sample_ms) {
+        changed |= rk_SampleMs;
+    }
+    if (old->deadband != new->deadband ||
+        old->heartbeat_ms != new->heartbeat_ms) {
+        changed |= rk_Deadband;
+    }
+    if (strcmp(old->firmware, new->firmware) != 0) {
+        changed |= rk_Firmware;
+    }
+    return changed;
+}
+
+// Reads the document into the candidate on top of the current config.
+static remote_result_t parse_doc(remote_t *remote, char *doc) {
+    remote_config_t *current = &remote->current;
+    remote_config_t *candidate = &remote->candidate;
+    const char *fields[NETINFO_FIELDS];
+    netinfo_fields(&current->netinfo, fields);
+    candidate->version = 0;
+    candidate->sample_ms = current->sample_ms;
+    candidate->deadband = current->deadband;
+    candidate->heartbeat_ms = current->heartbeat_ms;
+    strcpy(candidate->firmware, current->firmware);
+
+    char *cursor = doc;
+    while (cursor != NULL && *cursor != '\0') {
+        char *line = strtok_r(cursor, "\n", &cursor);
+        if (line == NULL) {
+            break;
+        }
+        line[strcspn(line, "\r")] = '\0';
+        char *value = strchr(line, ' ');
+        if (value != NULL) {
+            *value++ = '\0';
+        } else {
+            value = line + strlen(line);
+        }
+        if (strcmp(line, "version") == 0) {
+            if (!parse_u32(value, &candidate->version)) {
+                return rr_Invalid;
+            }
+            continue;
+        }
+        if (strcmp(line, "sample_ms") == 0) {
+            if (!parse_u32(value, &candidate->sample_ms)) {
+                return rr_Invalid;
+            }
+            continue;
+        }
+        if (strcmp(line, "deadband") == 0) {
+            if (!parse_u32(value, &candidate->deadband)) {
+                return rr_Invalid;
+            }
+            continue;
+        }
+        if (strcmp(line, "heartbeat_ms") == 0) {
+            if (!parse_u32(value, &candidate->heartbeat_ms)) {
+                return rr_Invalid;
+            }
+            continue;
+        }
+        if (strcmp(line, "firmware") == 0) {
+            if (strlen(value) >= sizeof(candidate->firmware)) {
+                return rr_Invalid;
+            }
+            strcpy(candidate->firmware, value);
+            continue;
+        }
+        bool known = false;
+        for (int i = 0; i < REMOTE_FIELD_COUNT && !known; i++) {
+            if (strcmp(line, REMOTE_FIELDS[i].key) == 0) {
+                fields[REMOTE_FIELDS[i].field] = value;
+                known = true;
+            }
+        }
+        if (!known) {
+            ESP_LOGW(TAG, "Unknown key %s in remote config", line);
+            return rr_Invalid;
+        }
+    }
+    if (candidate->version == 0) {
+        return rr_Invalid;
+    }
+    if (candidate->version <= current->version) {
+        return rr_Stale;
+    }
+    if (!pack_netinfo(&candidate->netinfo, fields) ||
+        !config_valid(remote, candidate)) {
+        return rr_Invalid;
+    }
+    return rr_Applied;
+}
+
+// Checks the whole document, then swaps the changed keys in at once and
+// tells the subscribers. Modifies doc.
+remote_result_t ll_remote_apply(char *doc, uint32_t *changed) {
+    NPC(doc);
+    NPC(changed);
+    remote_t *remote = &glob_remote;
+    *changed = 0;
+    ll_remote_get(&remote->current);
+    remote_result_t result = parse_doc(remote, doc);
+    if (result == rr_Invalid) {
+        ll_metrics_add(&glob_rejected, 1);
+    }
+    if (result != rr_Applied) {
+        return result;
+    }
+    *changed = changed_keys(&remote->current, &remote->candidate);
+
+    remote_subscriber_t subscribers[REMOTE_SUBSCRIBERS_MAX];
+    POSIX_EC(pthread_mutex_lock(&remote->mutex));
+    copy_config(&remote->config, &remote->candidate);
+    int count = remote->subscriber_count;
+    memcpy(subscribers, remote->subscribers, sizeof(subscribers));
+    POSIX_EC(pthread_mutex_unlock(&remote->mutex));
+    ll_metrics_set(&glob_version, remote->candidate.version);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t keys = *changed & subscribers[i].keys;
+        if (keys != 0) {
+            subscribers[i].callback(
+                &remote->candidate,
+                keys,
+                subscribers[i].ctx);
+        }
+    }
+    return rr_Applied;
+}
+
+// <target>/config, without doubling a trailing slash.
+static void config_url(const char *target, char *url, size_t size) {
+    size_t len = strlen(target);
+    if (len > 0 && target[len - 1] == '/') {
+        len--;
+    }
+    snprintf(url, size, "%.*s%s", (int)len, target, REMOTE_CONFIG_PATH);
+}
+
+// Reads the body into remote->doc, false if it doesn't fit.
+static bool read_doc(remote_t *remote) {
+    size_t len = 0;
+    while (len < sizeof(remote->doc) - 1) {
+        int n = esp_http_client_read(
+            remote->client,
+            remote->doc + len,
+            sizeof(remote->doc) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    remote->doc[len] = '\0';
+    return esp_http_client_is_complete_data_received(remote->client);
+}
+
+// One conditional fetch of the config document, applied if it changed.
+remote_result_t ll_remote_poll() {
+    remote_t *remote = &glob_remote;
+    remote_config_t *current = &remote->current;
+    ll_remote_get(current);
+    if (!target_polled(current->netinfo.target)) {
+        // MQTT targets have no config to poll.
+        return rr_Current;
+    }
+
+    char url[REMOTE_URL_MAX];
+    config_url(current->netinfo.target, url, sizeof(url));
+    if (remote->client == NULL) {
+        const esp_http_client_config_t client_config = {
+            .url = url,
+            .method = HTTP_METHOD_GET,
+            .timeout_ms = REMOTE_TIMEOUT_MS,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+        };
+        remote->client = esp_http_client_init(&client_config);
+        NPC(remote->client);
+        snprintf(remote->url, sizeof(remote->url), "%s", url);
+    } else if (strcmp(url, remote->url) != 0) {
+        ESP_EC(esp_http_client_set_url(remote->client, url));
+        snprintf(remote->url, sizeof(remote->url), "%s", url);
+    }
+    char etag[32];
+    if (remote->rejected > current->version) {
+        snprintf(
+            etag,
+            sizeof(etag),
+            "\"%lu\", \"%lu\"",
+            (unsigned long)current->version,
+            (unsigned long)remote->rejected);
+    } else {
+        snprintf(
+            etag,
+            sizeof(etag),
+            "\"%lu\"",
+            (unsigned long)current->version);
+    }
+    ESP_EC(esp_http_client_set_header(remote->client, "If-None-Match", etag));
+    ESP_EC(esp_http_client_set_header(
+        remote->client,
+        "X-Device",
+        current->netinfo.devname));
+
+    int64_t started = esp_timer_get_time();
+    remote_result_t result = rr_Unreachable;
+    if (esp_http_client_open(remote->client, 0) == ESP_OK &&
+        esp_http_client_fetch_headers(remote->client) >= 0) {
+        int status = esp_http_client_get_status_code(remote->client);
+        if (status == 304) {
+            result = rr_Current;
+        } else if (status == 200) {
+            result = read_doc(remote) ? rr_Applied : rr_Invalid;
+        } else {
+            ESP_LOGW(TAG, "Config poll got status %d", status);
+        }
+    }
+    esp_http_client_close(remote->client);
+    if (result != rr_Applied) {
+        return result;
+    }
+
+    uint32_t changed = 0;
+    result = ll_remote_apply(remote->doc, &changed);
+    if (result == rr_Invalid && remote->candidate.version > current->version) {
+        remote->rejected = remote->candidate.version;
+    }
+    if (result == rr_Applied) {
+        ESP_LOGI(
+            TAG,
+            "Applied config version %lu in %lld us, changed keys 0x%lx",
+            (unsigned long)remote->candidate.version,
+            (long long)(esp_timer_get_time() - started),
+            (unsigned long)changed);
+    } else if (result == rr_Stale) {
+        // Targets that don't look at If-None-Match send the same document
+        // every time.
+        ESP_LOGD(TAG, "%s", ll_remote_result_explain(result));
+    } else {
+        ESP_LOGW(
+            TAG,
+            "Remote config not applied: %s",
+            ll_remote_result_explain(result));
+    }
+    return result;
+}
+
+const char *ll_remote_result_explain(remote_result_t result) {
+    switch (result) {
+    case rr_Current:
+        return "Config is current";
+    case rr_Applied:
+        return "Config applied";
+    case rr_Stale:
+        return "Config version isn't newer than the running one";
+    case rr_Invalid:
+        return "Config document is invalid";
+    case rr_Unreachable:
+        return "Couldn't fetch the config document";
+    default:
+        return "Unknown";
+    }
+}
+
+void ll_remote_init(const remote_config_t *config) {
+    NPC(config);
+    remote_t *remote = &glob_remote;
+    POSIX_EC(pthread_mutex_lock(&remote->mutex));
+    bool initialized = remote->initialized;
+    copy_config(&remote->config, config);
+    remote->initialized = true;
+    POSIX_EC(pthread_mutex_unlock(&remote->mutex));
+    if (initialized) {
+        ESP_LOGE(TAG, "Remote config initialized twice!");
+        abort();
+    }
+    ll_metrics_set(&glob_version, config->version);
+    ll_metrics_register(&glob_version);
+    ll_metrics_register(&glob_rejected);
+}
+
+void ll_remote_subscribe(uint32_t keys, remote_callback_t callback, void *ctx) {
+    NPC(callback);
+    remote_t *remote = &glob_remote;
+    POSIX_EC(pthread_mutex_lock(&remote->mutex));
+    if (remote->subscriber_count >= REMOTE_SUBSCRIBERS_MAX) {
+        ESP_LOGE(TAG, "Too many remote config subscribers!");
+        abort();
+    }
+    remote->subscribers[remote->subscriber_count++] = (remote_subscriber_t){
+        .keys = keys,
+        .callback = callback,
+        .ctx = ctx,
+    };
+    POSIX_EC(pthread_mutex_unlock(&remote->mutex));
+}
+
+void ll_remote_get(remote_config_t *config) {
+    NPC(config);
+    remote_t *remote = &glob_remote;
+    POSIX_EC(pthread_mutex_lock(&remote->mutex));
+    if (!remote->initialized) {
+        ESP_LOGE(TAG, "Remote config used before ll_remote_init!");
+        abort();
+    }
+    copy_config(config, &remote->config);
+    POSIX_EC(pthread_mutex_unlock(&remote->mutex));
+}
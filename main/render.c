@@ -1,9 +1,13 @@
 #include "render.h"
 
+#include "boot.h"
 #include "const.h"
+#include "dlog.h"
 #include "esp_log.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
 #include "esp_wifi_types.h"
+#include "metrics.h"
 #include "scan.h"
 #include "util.h"
 
@@ -12,9 +16,24 @@
 static const char *TAG = "ll_render";
 
 static page_table_t glob_page_table;
+// The partitions don't change while running, the table is loaded once per
+// boot. Setup runs on the main task, so these are main task only.
+static bool glob_table_loaded = false;
+static bool glob_table_preloading = false;
+static boot_job_t glob_table_job;
+// Only needed while the table is parsed, the entries copy what they need.
+static char glob_table_text[PAGE_TABLE_TEXT_MAX];
 static char glob_template[TEMPLATE_BUFFER_SIZE];
 static char glob_scratch_small[PAGE_SMALL_SCRATCHPAD_SIZE];
 static char glob_scratch_large[PAGE_LARGE_SCRATCHPAD_SIZE];
+// Only the setup server task loads templates.
+static metric_t glob_read_latency = {
+    .name = "ll_page_read_duration_us",
+    .help = "Time to read a page template from flash",
+    .kind = mk_Histogram,
+    .bounds = {20, 50, 100, 200, 500, 1000, 2000, 5000},
+    .bound_count = 8,
+};
 
 const char *label_authmode(wifi_auth_mode_t authmode) {
     switch (authmode) {
@@ -42,14 +61,15 @@ const char *label_rssi(int8_t rssi) {
     }
 }
 
-void init_page_table() {
+static void load_page_table(void *arg) {
+    ll_metrics_register(&glob_read_latency);
     const esp_partition_t *table_part = esp_partition_find_first(
         PAGE_PART_TYPE,
         PAGE_PART_SUBTYPE,
         PAGE_TABLE_PART_NAME);
 
     // First thing in partition is a 32 bit unsigned integer telling us how
-    // much memory to allocate to store the table string.
+    // long the table string is.
     uint32_t table_len = 0;
     ESP_EC(esp_partition_read(table_part, 0, &table_len, 4));
 
@@ -64,13 +84,21 @@ void init_page_table() {
         num_entries,
         table_len);
 
-    // Allocate memory to store the rest of the table
-    char *table_buffer = malloc(table_len + 1); // Store null terminator
-    NPC(table_buffer);
-
-    // Allocate memory to store the entries
-    page_entry_t *entries = malloc(sizeof(page_entry_t) * num_entries);
-    NPC(entries);
+    // The table and its entries go into fixed buffers.
+    if (table_len >= sizeof(glob_table_text) ||
+        num_entries > PAGE_TABLE_MAX_ENTRIES) {
+        ESP_LOGE(
+            TAG,
+            "Page table too big!\nLength: %ld, maximum: %d\nEntries: %ld, "
+            "maximum: %d",
+            table_len,
+            sizeof(glob_table_text) - 1,
+            num_entries,
+            PAGE_TABLE_MAX_ENTRIES);
+        abort();
+    }
+    char *table_buffer = glob_table_text;
+    page_entry_t *entries = glob_page_table.entries;
 
     // Read the table into the buffer
     // There is a newline after the first 8 bytes.
@@ -111,22 +139,40 @@ void init_page_table() {
     }
 
     // Make sure we parsed all rows
-    if (cursor != NULL) {
+    if (cursor != NULL && *cursor != '\0') {
         ESP_LOGW(TAG, "More table rows left in table!");
     }
 
-    // Move page entry array to global struct
-    glob_page_table.entries = entries;
-    entries = NULL;
     glob_page_table.num_entries = num_entries;
-    // Deallocate table buffer
-    free(table_buffer);
 
     ESP_LOGI(TAG, "Page table initialized (key, offset, length):");
     for (int i = 0; i < glob_page_table.num_entries; i++) {
         page_entry_t *entry = &glob_page_table.entries[i];
         ESP_LOGI(TAG, "%s %d %d", entry->key, entry->offset, entry->length);
     }
+    ll_boot_mark(bp_PagesLoaded);
+}
+
+// Starts loading the page table on a boot job, so it overlaps with the radio
+// starting and scanning. init_page_table waits for it.
+void preload_page_table() {
+    if (glob_table_loaded || glob_table_preloading) {
+        return;
+    }
+    glob_table_preloading = true;
+    ll_boot_job_start(&glob_table_job, "ll_pages", load_page_table, NULL);
+}
+
+void init_page_table() {
+    if (glob_table_preloading) {
+        ll_boot_job_join(&glob_table_job);
+        glob_table_preloading = false;
+        glob_table_loaded = true;
+    }
+    if (!glob_table_loaded) {
+        load_page_table(NULL);
+        glob_table_loaded = true;
+    }
 }
 
 void load_page_template(const char *page_key) {
@@ -137,11 +183,15 @@ void load_page_template(const char *page_key) {
                 PAGE_PART_TYPE,
                 PAGE_PART_SUBTYPE,
                 PAGE_CONTENT_PART_NAME);
+            int64_t started = esp_timer_get_time();
             ESP_EC(esp_partition_read(
                 content_part,
                 entry->offset,
                 glob_template,
                 entry->length));
+            ll_metrics_observe(
+                &glob_read_latency,
+                (uint32_t)(esp_timer_get_time() - started));
             glob_template[entry->length] = '\0';
             goto template_loaded;
         }
@@ -161,16 +211,14 @@ void render_netlist_rows(bg_scan_t *scanned_networks) {
     int cur_offset = 0;
     for (uint16_t i = 0; i < scanned_networks->scanned_ap_count; i++) {
         wifi_ap_record_t *ap_record = &scanned_networks->scanned_aps[i];
-        ESP_LOGD(
+        LL_DLOGD(
             TAG,
-            "render_netlist_rows: snprintf(\nbuf: %p\nsize: %d\ntemplate: "
-            "%p\nssid: %p\nrssi: %s\nauthmode: %p\n)",
-            glob_scratch_small + cur_offset,
-            sizeof(glob_scratch_small) - cur_offset,
-            glob_template,
+            "Netlist row %d at %d: ssid=%s rssi=%d auth=%d",
+            i,
+            cur_offset,
             ap_record->ssid,
-            label_rssi(ap_record->rssi),
-            label_authmode(ap_record->authmode));
+            ap_record->rssi,
+            ap_record->authmode);
         cur_offset += snprintf(
             glob_scratch_small + cur_offset,
             sizeof(glob_scratch_small) - cur_offset,
@@ -186,18 +234,21 @@ void render_netlist_rows(bg_scan_t *scanned_networks) {
         }
     }
 
-    ESP_LOGI(TAG, "Finished rendering netlist rows:\n%s\n", glob_scratch_small);
+    LL_DLOGD(
+        TAG,
+        "Rendered %d netlist rows in %d bytes",
+        scanned_networks->scanned_ap_count,
+        cur_offset);
 }
 
 char *render_form_page(bg_scan_t *scanned_networks) {
     NPC(scanned_networks);
-    esp_log_level_set(TAG, ESP_LOG_DEBUG);
 
     // First fill small scratchpad with network table
     render_netlist_rows(scanned_networks);
 
     // Then render full form page into large scratchpad
-    load_page_template("form_template");
+    load_page_template("form");
     int len_needed = snprintf(
         glob_scratch_large,
         sizeof(glob_scratch_large),
@@ -206,12 +257,15 @@ char *render_form_page(bg_scan_t *scanned_networks) {
         FORM_NAME_PASSWORD,
         FORM_NAME_TARGET,
         FORM_NAME_DEVNAME,
+        FORM_NAME_ALARMS,
+        FORM_NAME_LEVELCAL,
+        FORM_NAME_TANK,
         glob_scratch_small);
     if (len_needed >= sizeof(glob_scratch_large)) {
         ESP_LOGW(TAG, "Couldn't fully render form page into large scratchpad!");
     }
 
-    ESP_LOGI(TAG, "Finished rendering form page: \n%s\n", glob_scratch_large);
+    LL_DLOGD(TAG, "Rendered form page in %d bytes", len_needed);
 
     return glob_scratch_large;
 }
@@ -0,0 +1,59 @@
+#include "rollup.h"
+
+#include <string.h>
+
+static inline int64_t bucket_start(int64_t timestamp, int64_t period_ms) {
+    // Round towards negative infinity, timestamps before the clock is set can
+    // be anything.
+    int64_t rem = timestamp % period_ms;
+    return rem < 0 ? timestamp - rem - period_ms : timestamp - rem;
+}
+
+static void open_bucket(rollup_acc_t *acc, const sample_t *sample) {
+    rollup_t *current = &acc->current;
+    current->count = 1;
+    current->start = bucket_start(sample->timestamp, acc->period_ms);
+    current->sum = sample->value;
+    current->min_value = sample->value;
+    current->max_value = sample->value;
+}
+
+void ll_rollup_reset(rollup_acc_t *acc, int64_t period_ms, uint8_t channel) {
+    memset(acc, 0, sizeof(rollup_acc_t));
+    acc->period_ms = period_ms;
+    acc->current.magic = ROLLUP_RECORD_MAGIC;
+    acc->current.channel = channel;
+}
+
+bool ll_rollup_add(
+    rollup_acc_t *acc, const sample_t *sample, rollup_t *closed) {
+    rollup_t *current = &acc->current;
+    if (current->count == 0) {
+        open_bucket(acc, sample);
+        return false;
+    }
+
+    // Samples from before the open bucket (the clock got stepped back) are
+    // folded into it rather than reopening a bucket that was already stored.
+    if (sample->timestamp >= current->start + acc->period_ms) {
+        *closed = *current;
+        open_bucket(acc, sample);
+        return true;
+    }
+    current->count++;
+    current->sum += sample->value;
+    if (sample->value < current->min_value) {
+        current->min_value = sample->value;
+    }
+    if (sample->value > current->max_value) {
+        current->max_value = sample->value;
+    }
+    return false;
+}
+
+int32_t ll_rollup_mean(const rollup_t *rollup) {
+    if (rollup->count == 0) {
+        return 0;
+    }
+    return (int32_t)(rollup->sum / (int64_t)rollup->count);
+}
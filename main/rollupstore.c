@@ -0,0 +1,251 @@
+#include "rollupstore.h"
+
+#include "const.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "samplelog.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// Sectors start with the sample log's sector header, with a different magic.
+#define ROLLUP_SECTOR_MAGIC 0x50554C52 // "RLUP" in little endian
+#define SECTOR_DATA_START sizeof(samplelog_sector_header_t)
+#define RECORDS_PER_SECTOR                                                     \
+    ((SAMPLE_LOG_SECTOR_SIZE - SECTOR_DATA_START) / sizeof(rollup_t))
+
+static const char *TAG = "ll_rollupstore";
+
+static const char *const TIER_PART_NAMES[rt_Count] = {
+    [rt_Minute] = ROLLUP_MINUTE_PART_NAME,
+    [rt_Hour] = ROLLUP_HOUR_PART_NAME,
+};
+static const int64_t TIER_PERIODS_MS[rt_Count] = {
+    [rt_Minute] = 60 * 1000,
+    [rt_Hour] = 60 * 60 * 1000,
+};
+
+static rollupstore_t glob_store = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Open buckets live in RTC memory so they survive resets and deep sleep.
+static RTC_DATA_ATTR uint32_t rtc_accs_valid;
+static RTC_DATA_ATTR rollup_acc_t rtc_accs[rt_Count][SENSOR_CHANNEL_COUNT];
+
+static inline uint32_t
+slot_addr(const rollupstore_tier_t *tier, uint32_t seq, uint32_t slot) {
+    return (seq % tier->num_sectors) * SAMPLE_LOG_SECTOR_SIZE +
+           SECTOR_DATA_START + slot * sizeof(rollup_t);
+}
+
+static void start_sector(rollupstore_tier_t *tier, uint32_t seq) {
+    samplelog_sector_header_t header = {
+        .magic = ROLLUP_SECTOR_MAGIC,
+        .seq = seq,
+    };
+    uint32_t addr = (seq % tier->num_sectors) * SAMPLE_LOG_SECTOR_SIZE;
+    ESP_EC(esp_partition_erase_range(tier->part, addr, SAMPLE_LOG_SECTOR_SIZE));
+    ESP_EC(esp_partition_write(tier->part, addr, &header, sizeof(header)));
+}
+
+// Find the first free slot in the sector.
+static uint32_t find_sector_end(rollupstore_tier_t *tier, uint32_t seq) {
+    uint32_t slot = 0;
+    for (; slot < RECORDS_PER_SECTOR; slot++) {
+        rollup_t rollup;
+        ESP_EC(esp_partition_read(
+            tier->part,
+            slot_addr(tier, seq, slot),
+            &rollup,
+            sizeof(rollup)));
+        if (rollup.magic != ROLLUP_RECORD_MAGIC) {
+            break;
+        }
+    }
+    return slot;
+}
+
+static void init_tier(rollupstore_tier_t *tier, const char *part_name) {
+    tier->part = esp_partition_find_first(
+        ROLLUP_PART_TYPE,
+        ROLLUP_PART_SUBTYPE,
+        part_name);
+    NPC(tier->part);
+    tier->num_sectors = tier->part->size / SAMPLE_LOG_SECTOR_SIZE;
+
+    // Same recovery as the sample log, a sector is only valid in the slot its
+    // sequence number maps to.
+    bool found = false;
+    uint32_t head_seq = 0;
+    uint32_t tail_seq = 0;
+    for (uint32_t i = 0; i < tier->num_sectors; i++) {
+        samplelog_sector_header_t header;
+        ESP_EC(esp_partition_read(
+            tier->part,
+            i * SAMPLE_LOG_SECTOR_SIZE,
+            &header,
+            sizeof(header)));
+        if (header.magic != ROLLUP_SECTOR_MAGIC ||
+            header.seq % tier->num_sectors != i) {
+            continue;
+        }
+        if (!found || header.seq > head_seq) {
+            head_seq = header.seq;
+        }
+        if (!found || header.seq < tail_seq) {
+            tail_seq = header.seq;
+        }
+        found = true;
+    }
+
+    if (!found) {
+        ESP_LOGI(TAG, "No valid %s found, formatting", part_name);
+        start_sector(tier, 0);
+    }
+    tier->head_seq = head_seq;
+    tier->tail_seq = tail_seq;
+    tier->head_slot = find_sector_end(tier, head_seq);
+
+    ESP_LOGI(
+        TAG,
+        "Rollup tier %s initialized (sectors: %lu, tail: %lu, head: %lu+%lu)",
+        part_name,
+        tier->num_sectors,
+        tier->tail_seq,
+        tier->head_seq,
+        tier->head_slot);
+}
+
+static void append(rollupstore_tier_t *tier, const rollup_t *rollup) {
+    if (tier->head_slot >= RECORDS_PER_SECTOR) {
+        tier->head_seq++;
+        start_sector(tier, tier->head_seq);
+        tier->head_slot = 0;
+        if (tier->head_seq - tier->tail_seq >= tier->num_sectors) {
+            tier->tail_seq = tier->head_seq - tier->num_sectors + 1;
+        }
+    }
+    ESP_EC(esp_partition_write(
+        tier->part,
+        slot_addr(tier, tier->head_seq, tier->head_slot),
+        rollup,
+        sizeof(rollup_t)));
+    tier->head_slot++;
+}
+
+static inline rollup_index_t head_index(const rollupstore_tier_t *tier) {
+    return tier->head_seq * RECORDS_PER_SECTOR + tier->head_slot;
+}
+
+static inline rollup_index_t tail_index(const rollupstore_tier_t *tier) {
+    return tier->tail_seq * RECORDS_PER_SECTOR;
+}
+
+static void read_record(
+    const rollupstore_tier_t *tier, rollup_index_t index, rollup_t *rollup) {
+    ESP_EC(esp_partition_read(
+        tier->part,
+        slot_addr(tier, index / RECORDS_PER_SECTOR, index % RECORDS_PER_SECTOR),
+        rollup,
+        sizeof(rollup_t)));
+}
+
+void ll_rollupstore_init() {
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    for (int i = 0; i < rt_Count; i++) {
+        NOT_NPC(glob_store.tiers[i].part);
+        init_tier(&glob_store.tiers[i], TIER_PART_NAMES[i]);
+    }
+    if (rtc_accs_valid != ROLLUP_RTC_MAGIC) {
+        for (int i = 0; i < rt_Count; i++) {
+            for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) {
+                ll_rollup_reset(&rtc_accs[i][ch], TIER_PERIODS_MS[i], ch);
+            }
+        }
+        rtc_accs_valid = ROLLUP_RTC_MAGIC;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+}
+
+void ll_rollupstore_add(const sample_t *sample) {
+    NPC(sample);
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    for (int i = 0; i < rt_Count; i++) {
+        rollup_t closed;
+        if (ll_rollup_add(&rtc_accs[i][sample->channel], sample, &closed)) {
+            append(&glob_store.tiers[i], &closed);
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+}
+
+rollup_index_t ll_rollupstore_head(rollup_tier_t tier) {
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    rollup_index_t index = head_index(&glob_store.tiers[tier]);
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+    return index;
+}
+
+rollup_index_t ll_rollupstore_tail(rollup_tier_t tier) {
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    rollup_index_t index = tail_index(&glob_store.tiers[tier]);
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+    return index;
+}
+
+// Index of the first record whose bucket ends after the timestamp, or the
+// head if there is none. Records are in time order, so this is a binary
+// search touching O(log n) records.
+rollup_index_t ll_rollupstore_find(rollup_tier_t tier, int64_t timestamp) {
+    const rollupstore_tier_t *t = &glob_store.tiers[tier];
+    int64_t period = TIER_PERIODS_MS[tier];
+
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    rollup_index_t low = tail_index(t);
+    rollup_index_t high = head_index(t);
+    while (low < high) {
+        rollup_index_t mid = low + (high - low) / 2;
+        rollup_t rollup;
+        read_record(t, mid, &rollup);
+        if (rollup.start + period <= timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+    return low;
+}
+
+// Returns false if the record was overwritten or hasn't been written yet.
+bool ll_rollupstore_read(
+    rollup_tier_t tier, rollup_index_t index, rollup_t *rollup) {
+    NPC(rollup);
+    const rollupstore_tier_t *t = &glob_store.tiers[tier];
+    bool valid = false;
+
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    if (index >= tail_index(t) && index < head_index(t)) {
+        read_record(t, index, rollup);
+        valid = rollup->magic == ROLLUP_RECORD_MAGIC;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+    return valid;
+}
+
+// The bucket still being filled, not in flash yet.
+bool ll_rollupstore_current(
+    rollup_tier_t tier, uint8_t channel, rollup_t *rollup) {
+    NPC(rollup);
+    POSIX_EC(pthread_mutex_lock(&glob_store.mutex));
+    *rollup = rtc_accs[tier][channel].current;
+    POSIX_EC(pthread_mutex_unlock(&glob_store.mutex));
+    return rollup->count > 0;
+}
+
+int64_t ll_rollupstore_period(rollup_tier_t tier) {
+    return TIER_PERIODS_MS[tier];
+}
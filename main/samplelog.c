@@ -0,0 +1,272 @@
+#include "samplelog.h"
+
+#include "codec.h"
+#include "const.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLELOG_SECTOR_MAGIC 0x474F4C53 // "SLOG" in little endian
+#define SECTOR_DATA_START sizeof(samplelog_sector_header_t)
+
+static const char *TAG = "ll_samplelog";
+
+static samplelog_t glob_log = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .part = NULL,
+};
+
+static inline uint32_t sector_addr(uint32_t seq) {
+    return (seq % glob_log.num_sectors) * SAMPLE_LOG_SECTOR_SIZE;
+}
+
+static inline samplelog_pos_t make_pos(uint32_t seq, uint32_t offset) {
+    return (samplelog_pos_t)seq * SAMPLE_LOG_SECTOR_SIZE + offset;
+}
+
+static inline int64_t *sector_first_ts(uint32_t seq) {
+    return &glob_log.sector_first_ts[seq % glob_log.num_sectors];
+}
+
+static void start_sector(uint32_t seq) {
+    samplelog_sector_header_t header = {
+        .magic = SAMPLELOG_SECTOR_MAGIC,
+        .seq = seq,
+    };
+    ESP_EC(esp_partition_erase_range(
+        glob_log.part,
+        sector_addr(seq),
+        SAMPLE_LOG_SECTOR_SIZE));
+    ESP_EC(esp_partition_write(
+        glob_log.part,
+        sector_addr(seq),
+        &header,
+        sizeof(header)));
+    *sector_first_ts(seq) = INT64_MAX;
+}
+
+static void index_sector(uint32_t seq) {
+    codec_block_header_t header;
+    ESP_EC(esp_partition_read(
+        glob_log.part,
+        sector_addr(seq) + SECTOR_DATA_START,
+        &header,
+        sizeof(header)));
+    *sector_first_ts(seq) =
+        header.magic == CODEC_BLOCK_MAGIC ? header.first_timestamp : INT64_MAX;
+}
+
+// Find the offset right after the last complete block in the sector.
+static uint32_t find_sector_end(uint32_t seq) {
+    uint32_t offset = SECTOR_DATA_START;
+    while (offset + sizeof(codec_block_header_t) <= SAMPLE_LOG_SECTOR_SIZE) {
+        codec_block_header_t header;
+        ESP_EC(esp_partition_read(
+            glob_log.part,
+            sector_addr(seq) + offset,
+            &header,
+            sizeof(header)));
+        if (header.magic != CODEC_BLOCK_MAGIC) {
+            // Erased flash, this is where the next block goes.
+            break;
+        }
+        if (header.payload_len > CODEC_PAYLOAD_SIZE) {
+            // Torn write, don't append anything more to this sector.
+            ESP_LOGW(TAG, "Corrupt block in sector %lu, skipping rest", seq);
+            return SAMPLE_LOG_SECTOR_SIZE;
+        }
+        offset += sizeof(header) + header.payload_len;
+    }
+    return offset;
+}
+
+void ll_samplelog_init() {
+    NOT_NPC(glob_log.part);
+    glob_log.part = esp_partition_find_first(
+        SAMPLE_LOG_PART_TYPE,
+        SAMPLE_LOG_PART_SUBTYPE,
+        SAMPLE_LOG_PART_NAME);
+    NPC(glob_log.part);
+    glob_log.num_sectors = glob_log.part->size / SAMPLE_LOG_SECTOR_SIZE;
+    glob_log.sector_first_ts = malloc(glob_log.num_sectors * sizeof(int64_t));
+    NPC(glob_log.sector_first_ts);
+
+    // Find the newest and oldest valid sectors. A sector is only valid in the
+    // slot its sequence number maps to.
+    bool found = false;
+    uint32_t head_seq = 0;
+    uint32_t tail_seq = 0;
+    for (uint32_t i = 0; i < glob_log.num_sectors; i++) {
+        samplelog_sector_header_t header;
+        ESP_EC(esp_partition_read(
+            glob_log.part,
+            i * SAMPLE_LOG_SECTOR_SIZE,
+            &header,
+            sizeof(header)));
+        if (header.magic != SAMPLELOG_SECTOR_MAGIC ||
+            header.seq % glob_log.num_sectors != i) {
+            continue;
+        }
+        if (!found || header.seq > head_seq) {
+            head_seq = header.seq;
+        }
+        if (!found || header.seq < tail_seq) {
+            tail_seq = header.seq;
+        }
+        found = true;
+    }
+
+    if (!found) {
+        ESP_LOGI(TAG, "No valid sample log found, formatting");
+        start_sector(0);
+    }
+    glob_log.head_seq = head_seq;
+    glob_log.tail_seq = tail_seq;
+    glob_log.head_offset = find_sector_end(head_seq);
+    for (uint32_t seq = tail_seq; seq <= head_seq; seq++) {
+        index_sector(seq);
+    }
+
+    ESP_LOGI(
+        TAG,
+        "Sample log initialized (sectors: %lu, tail: %lu, head: %lu+%lu)",
+        glob_log.num_sectors,
+        glob_log.tail_seq,
+        glob_log.head_seq,
+        glob_log.head_offset);
+}
+
+samplelog_pos_t ll_samplelog_append(const uint8_t *block, size_t len) {
+    NPC(block);
+    NPC(glob_log.part);
+    if (len > SAMPLE_LOG_SECTOR_SIZE - SECTOR_DATA_START) {
+        ESP_LOGE(TAG, "Block of %d bytes can't fit in a sector!", len);
+        abort();
+    }
+
+    POSIX_EC(pthread_mutex_lock(&glob_log.mutex));
+    if (glob_log.head_offset + len > SAMPLE_LOG_SECTOR_SIZE) {
+        // Move on to the next sector, dropping the oldest one if the log has
+        // wrapped around.
+        glob_log.head_seq++;
+        start_sector(glob_log.head_seq);
+        glob_log.head_offset = SECTOR_DATA_START;
+        if (glob_log.head_seq - glob_log.tail_seq >= glob_log.num_sectors) {
+            glob_log.tail_seq = glob_log.head_seq - glob_log.num_sectors + 1;
+        }
+    }
+    if (glob_log.head_offset == SECTOR_DATA_START) {
+        codec_block_header_t header;
+        memcpy(&header, block, sizeof(header));
+        *sector_first_ts(glob_log.head_seq) = header.first_timestamp;
+    }
+    ESP_EC(esp_partition_write(
+        glob_log.part,
+        sector_addr(glob_log.head_seq) + glob_log.head_offset,
+        block,
+        len));
+    samplelog_pos_t pos = make_pos(glob_log.head_seq, glob_log.head_offset);
+    glob_log.head_offset += len;
+    POSIX_EC(pthread_mutex_unlock(&glob_log.mutex));
+    return pos;
+}
+
+samplelog_pos_t ll_samplelog_head() {
+    POSIX_EC(pthread_mutex_lock(&glob_log.mutex));
+    samplelog_pos_t pos = make_pos(glob_log.head_seq, glob_log.head_offset);
+    POSIX_EC(pthread_mutex_unlock(&glob_log.mutex));
+    return pos;
+}
+
+samplelog_pos_t ll_samplelog_tail() {
+    POSIX_EC(pthread_mutex_lock(&glob_log.mutex));
+    samplelog_pos_t pos = make_pos(glob_log.tail_seq, SECTOR_DATA_START);
+    POSIX_EC(pthread_mutex_unlock(&glob_log.mutex));
+    return pos;
+}
+
+// Position of the sector holding the first block that can contain samples at or
+// after the timestamp. Only looks at the in-memory index, no flash reads.
+samplelog_pos_t ll_samplelog_find(int64_t timestamp) {
+    POSIX_EC(pthread_mutex_lock(&glob_log.mutex));
+    // Find the last sector starting at or before the timestamp, samples before
+    // it can only be in earlier sectors.
+    uint32_t low = glob_log.tail_seq;
+    uint32_t high = glob_log.head_seq + 1;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (*sector_first_ts(mid) <= timestamp) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    samplelog_pos_t pos = make_pos(low, SECTOR_DATA_START);
+    POSIX_EC(pthread_mutex_unlock(&glob_log.mutex));
+    return pos;
+}
+
+size_t ll_samplelog_read(samplelog_pos_t *pos, uint8_t *block, size_t maxlen) {
+    NPC(pos);
+    NPC(block);
+    NPC(glob_log.part);
+    size_t len = 0;
+
+    POSIX_EC(pthread_mutex_lock(&glob_log.mutex));
+    samplelog_pos_t tail = make_pos(glob_log.tail_seq, SECTOR_DATA_START);
+    samplelog_pos_t head = make_pos(glob_log.head_seq, glob_log.head_offset);
+    if (*pos < tail) {
+        // The reader fell behind and the data it wanted was overwritten.
+        *pos = tail;
+    }
+    while (*pos < head) {
+        uint32_t seq = *pos / SAMPLE_LOG_SECTOR_SIZE;
+        uint32_t offset = *pos % SAMPLE_LOG_SECTOR_SIZE;
+        if (offset < SECTOR_DATA_START) {
+            *pos = make_pos(seq, SECTOR_DATA_START);
+            continue;
+        }
+
+        codec_block_header_t header;
+        bool valid = false;
+        if (offset + sizeof(header) <= SAMPLE_LOG_SECTOR_SIZE) {
+            ESP_EC(esp_partition_read(
+                glob_log.part,
+                sector_addr(seq) + offset,
+                &header,
+                sizeof(header)));
+            valid = header.magic == CODEC_BLOCK_MAGIC &&
+                    header.payload_len <= CODEC_PAYLOAD_SIZE;
+        }
+        if (!valid) {
+            // End of this sector, continue with the next one.
+            *pos = make_pos(seq + 1, SECTOR_DATA_START);
+            continue;
+        }
+
+        len = sizeof(header) + header.payload_len;
+        if (len > maxlen) {
+            ESP_LOGE(
+                TAG,
+                "Block at %llu doesn't fit in read buffer!\nSize: %d\nMaximum: "
+                "%d",
+                *pos,
+                len,
+                maxlen);
+            abort();
+        }
+        ESP_EC(esp_partition_read(
+            glob_log.part,
+            sector_addr(seq) + offset,
+            block,
+            len));
+        *pos += len;
+        break;
+    }
+    POSIX_EC(pthread_mutex_unlock(&glob_log.mutex));
+    return len;
+}
@@ -0,0 +1,254 @@
+#include "sampler.h"
+
+#include "adcframe.h"
+#include "boot.h"
+#include "const.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "live.h"
+#include "metrics.h"
+#include "remote.h"
+#include "sample.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "ll_sampler";
+static const sensor_channel_t SENSOR_CHANNELS[SENSOR_CHANNEL_COUNT] = {
+    // Level probe
+    {
+        .adc_channel = SENSOR_ADC_CHANNEL,
+        .atten = ADC_ATTEN_DB_11, // Full 0-2.5V range.
+        .calib = {.gain_num = 1, .gain_den = 1, .offset = 0},
+        .tank = true,
+        .period_ms = SAMPLE_PERIOD_MS,
+    },
+};
+static const adc_continuous_handle_cfg_t ADC_HANDLE_CONFIG = {
+    .max_store_buf_size = SENSOR_CONV_FRAME_SIZE * 2,
+    .conv_frame_size = SENSOR_CONV_FRAME_SIZE,
+};
+
+static adc_continuous_handle_t glob_adc = NULL;
+static adc_frame_t glob_frame;
+static uint8_t glob_conv_buf[SENSOR_CONV_FRAME_SIZE];
+static QueueHandle_t glob_sample_queue = NULL;
+// Owned by the caller of ll_sampler_init, lives as long as the sampler,
+// until ll_sampler_set_calib points it at the sampler's own copy.
+static pthread_mutex_t glob_calib_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const calib_t *glob_calib = NULL;
+static calib_t glob_calib_copy;
+static atomic_uint_least32_t glob_period_ms = SAMPLE_PERIOD_MS;
+// Only one task reads at a time, first the boot and then the sampler task.
+static bool glob_read_any = false;
+
+int64_t ll_sampler_now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Run the pattern until every channel has a full set of conversions.
+static void scan_channels() {
+    ll_adcframe_reset(&glob_frame);
+    ESP_EC(adc_continuous_start(glob_adc));
+    bool full = false;
+    while (!full) {
+        uint32_t len = 0;
+        esp_err_t err = adc_continuous_read(
+            glob_adc,
+            glob_conv_buf,
+            sizeof(glob_conv_buf),
+            &len,
+            SENSOR_READ_TIMEOUT_MS);
+        if (err == ESP_ERR_TIMEOUT) {
+            ESP_LOGW(TAG, "ADC conversions timed out, using what we have");
+            break;
+        }
+        ESP_EC(err);
+        full = ll_adcframe_demux(&glob_frame, glob_conv_buf, len);
+    }
+    ESP_EC(adc_continuous_stop(glob_adc));
+}
+
+// Hands the scan to the logger, tick counts the logged scans.
+static void log_samples(const sample_t *samples, uint32_t tick) {
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        // Every channel is scanned each period, slower channels only keep
+        // every n-th reading.
+        if (tick % (SENSOR_CHANNELS[i].period_ms / SAMPLE_PERIOD_MS) != 0) {
+            continue;
+        }
+        if (xQueueSend(glob_sample_queue, &samples[i], 0) != pdTRUE) {
+            ESP_LOGW(TAG, "Sample queue full, dropping sample!");
+        }
+    }
+}
+
+static void sampler_task(void *arg) {
+    TickType_t last_wake = xTaskGetTickCount();
+    uint32_t tick = 0;
+    // Live scans run in between the logged ones.
+    uint32_t since_logged_ms = 0;
+    while (true) {
+        uint32_t period_ms = atomic_load(&glob_period_ms);
+        if (since_logged_ms >= period_ms) {
+            // The period got shorter than the time since the last logged
+            // scan, log this one.
+            since_logged_ms = 0;
+        }
+        sample_t samples[SENSOR_CHANNEL_COUNT];
+        ll_sampler_read(samples);
+        bool live = ll_live_active();
+        if (live) {
+            ll_live_publish(samples, SENSOR_CHANNEL_COUNT);
+        }
+        if (since_logged_ms == 0) {
+            log_samples(samples, tick++);
+        }
+        // Without live clients, sleep up to the next logged scan, so the log
+        // keeps its period either way.
+        uint32_t step_ms = live ? LIVE_PERIOD_MS : period_ms - since_logged_ms;
+        since_logged_ms = (since_logged_ms + step_ms) % period_ms;
+        vTaskDelayUntil(&last_wake, step_ms / portTICK_PERIOD_MS);
+    }
+}
+
+void ll_sampler_init(const calib_t *calib) {
+    NOT_NPC(glob_adc);
+    NPC(calib);
+    glob_calib = calib;
+    adc_digi_pattern_config_t pattern[SENSOR_CHANNEL_COUNT];
+    uint8_t adc_channels[SENSOR_CHANNEL_COUNT];
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        const sensor_channel_t *channel = &SENSOR_CHANNELS[i];
+        if (channel->period_ms % SAMPLE_PERIOD_MS != 0 ||
+            channel->period_ms > SENSOR_CHANNEL_PERIOD_MAX_MS) {
+            ESP_LOGE(TAG, "Invalid period for sensor channel %d!", i);
+            abort();
+        }
+        pattern[i].atten = channel->atten;
+        pattern[i].channel = channel->adc_channel;
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        adc_channels[i] = channel->adc_channel;
+    }
+    const adc_continuous_config_t adc_config = {
+        .pattern_num = SENSOR_CHANNEL_COUNT,
+        .adc_pattern = pattern,
+        .sample_freq_hz = SENSOR_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    if (SAMPLE_PERIOD_MS % LIVE_PERIOD_MS != 0 ||
+        LIVE_PERIOD_MS % portTICK_PERIOD_MS != 0) {
+        ESP_LOGE(TAG, "Invalid live sampling period!");
+        abort();
+    }
+    ESP_EC(adc_continuous_new_handle(&ADC_HANDLE_CONFIG, &glob_adc));
+    ESP_EC(adc_continuous_config(glob_adc, &adc_config));
+    ll_adcframe_init(&glob_frame, adc_channels, SENSOR_CHANNEL_COUNT);
+    ll_boot_mark(bp_SensorReady);
+}
+
+// Fills one sample per configured channel, returns the number of samples.
+int ll_sampler_read(sample_t *samples) {
+    NPC(samples);
+    NPC(glob_adc);
+    int64_t now = ll_sampler_now();
+    scan_channels();
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        samples[i].timestamp = now;
+        samples[i].channel = i;
+        const sensor_channel_t *channel = &SENSOR_CHANNELS[i];
+        int32_t value = ll_adcframe_calibrate(
+            &channel->calib,
+            ll_adcframe_mean(&glob_frame, i));
+        if (channel->tank) {
+            POSIX_EC(pthread_mutex_lock(&glob_calib_mutex));
+            value = ll_calib_apply(glob_calib, value);
+            POSIX_EC(pthread_mutex_unlock(&glob_calib_mutex));
+        }
+        samples[i].value = value;
+    }
+    if (!glob_read_any) {
+        glob_read_any = true;
+        ll_boot_mark(bp_FirstReading);
+    }
+    return SENSOR_CHANNEL_COUNT;
+}
+
+// Base period of the logged scans. Channels keep their multiple of it, a
+// channel at twice the base period stays at twice the new one. Takes effect
+// with the next scan.
+void ll_sampler_set_period(uint32_t period_ms) {
+    if (period_ms == 0 || period_ms % LIVE_PERIOD_MS != 0) {
+        ESP_LOGE(
+            TAG,
+            "Invalid sampling period %lu ms!",
+            (unsigned long)period_ms);
+        abort();
+    }
+    atomic_store(&glob_period_ms, period_ms);
+}
+
+// Copies the calibration, readings after this call use the copy.
+void ll_sampler_set_calib(const calib_t *calib) {
+    NPC(calib);
+    POSIX_EC(pthread_mutex_lock(&glob_calib_mutex));
+    glob_calib_copy = *calib;
+    glob_calib = &glob_calib_copy;
+    POSIX_EC(pthread_mutex_unlock(&glob_calib_mutex));
+}
+
+// Runs on the polling task, the remote config checked the calibration
+// already.
+static void remote_changed(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    // Only the polling task parses, too big for its stack.
+    static calib_t calib;
+    if (changed & rk_SampleMs) {
+        ll_sampler_set_period(config->sample_ms);
+    }
+    const network_info_t *netinfo = &config->netinfo;
+    if ((changed & (rk_Levelcal | rk_Tank)) &&
+        ll_calib_parse(netinfo->levelcal, netinfo->tank, &calib)) {
+        ll_sampler_set_calib(&calib);
+    }
+}
+
+void ll_sampler_start(const calib_t *calib) {
+    NPC(calib);
+    // Boot may have brought the sensor up while connecting already.
+    if (glob_adc == NULL) {
+        ll_sampler_init(calib);
+    }
+    POSIX_EC(pthread_mutex_lock(&glob_calib_mutex));
+    glob_calib = calib;
+    POSIX_EC(pthread_mutex_unlock(&glob_calib_mutex));
+    ll_remote_subscribe(
+        rk_SampleMs | rk_Levelcal | rk_Tank,
+        remote_changed,
+        NULL);
+    glob_sample_queue = xQueueCreate(SAMPLE_QUEUE_LEN, sizeof(sample_t));
+    NPC(glob_sample_queue);
+
+    TaskHandle_t task = NULL;
+    if (xTaskCreate(sampler_task, "ll_sampler", 2048, NULL, 5, &task) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create sampler task!");
+        abort();
+    }
+    ll_metrics_register_task(task);
+}
+
+QueueHandle_t ll_sampler_queue() {
+    NPC(glob_sample_queue);
+    return glob_sample_queue;
+}
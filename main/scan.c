@@ -4,6 +4,7 @@
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
+#include "pool.h"
 #include "util.h"
 
 #include <string.h>
@@ -29,6 +30,8 @@ static const wifi_country_t SCAN_COUNTRY = {
 
 static const char *TAG = "ll_scan";
 
+LL_POOL_DEFINE(glob_scan_pool, "scan", bg_scan_t, SCAN_POOL_SIZE);
+
 static void handle_scan_complete(
     void *handler_data, esp_event_base_t base, int32_t id, void *event_data) {
     NPC(handler_data);
@@ -77,8 +80,7 @@ static void filter_scan_results(bg_scan_t *bg_scan) {
 
 bg_scan_t *ll_do_scan() {
     // Allocate and init background scan state struct
-    bg_scan_t *bg_scan = malloc(sizeof(bg_scan_t));
-    NPC(bg_scan);
+    bg_scan_t *bg_scan = ll_pool_alloc(&glob_scan_pool);
     bg_scan->scanned_ap_count = AP_SCAN_MAX_APS;
     memset(&bg_scan->scanned_aps, 0, sizeof(bg_scan->scanned_aps));
 
@@ -108,5 +110,5 @@ bg_scan_t *ll_do_scan() {
 
 void ll_destroy_scan(bg_scan_t *scan) {
     NPC(scan);
-    free(scan);
+    ll_pool_free(&glob_scan_pool, scan);
 }
@@ -1,6 +1,11 @@
 #include "setup.h"
 
+#include "alarm.h"
+#include "boot.h"
+#include "calib.h"
+#include "client.h"
 #include "const.h"
+#include "dlog.h"
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_http_server.h"
@@ -9,12 +14,20 @@
 #include "esp_netif_types.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+#include "pool.h"
+#include "probe.h"
+#include "reactor.h"
 #include "render.h"
 #include "scan.h"
+#include "uploader.h"
 #include "util.h"
 
+#include <ctype.h>
 #include <errno.h>
-#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
 
@@ -44,6 +57,28 @@ static const char *SETUP_ERROR_HTML_FORMAT =
     "red;\">Error!</h1><h2>%s</h2></body></html>";
 
 static setup_ap_server_t *glob_server = NULL;
+LL_POOL_DEFINE(
+    glob_server_pool,
+    "setup_server",
+    setup_ap_server_t,
+    SETUP_SERVER_POOL_SIZE);
+
+// Decode application/x-www-form-urlencoded escapes in place.
+static void url_decode(char *value) {
+    char *out = value;
+    for (char *in = value; *in != '\0'; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%' && isxdigit((int)in[1]) && isxdigit((int)in[2])) {
+            char hex[3] = {in[1], in[2], '\0'};
+            *out++ = (char)strtol(hex, NULL, 16);
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
 
 static setup_error_t parse_netinfo_from_post(network_info_t *netinfo) {
     NPC(netinfo);
@@ -51,18 +86,32 @@ static setup_error_t parse_netinfo_from_post(network_info_t *netinfo) {
     netinfo->password = NULL;
     netinfo->target = NULL;
     netinfo->devname = NULL;
+    netinfo->alarms = NULL;
+    netinfo->levelcal = NULL;
+    netinfo->tank = NULL;
     char *post_cursor = netinfo->buffer;
     while (post_cursor != NULL) {
-        char *field = strtok_r(post_cursor, "=", &post_cursor);
-        char *value = strtok_r(post_cursor, "&", &post_cursor);
-        if (strcmp(field, "ssid") == 0) {
+        // strsep rather than strtok, values can be empty.
+        char *value = strsep(&post_cursor, "&");
+        char *field = strsep(&value, "=");
+        if (value == NULL) {
+            return se_UnmatchedPair;
+        }
+        url_decode(value);
+        if (strcmp(field, FORM_NAME_SSID) == 0) {
             netinfo->ssid = value;
-        } else if (strcmp(field, "pass") == 0) {
+        } else if (strcmp(field, FORM_NAME_PASSWORD) == 0) {
             netinfo->password = value;
-        } else if (strcmp(field, "target") == 0) {
+        } else if (strcmp(field, FORM_NAME_TARGET) == 0) {
             netinfo->target = value;
-        } else if (strcmp(field, "dev_name") == 0) {
+        } else if (strcmp(field, FORM_NAME_DEVNAME) == 0) {
             netinfo->devname = value;
+        } else if (strcmp(field, FORM_NAME_ALARMS) == 0) {
+            netinfo->alarms = value;
+        } else if (strcmp(field, FORM_NAME_LEVELCAL) == 0) {
+            netinfo->levelcal = value;
+        } else if (strcmp(field, FORM_NAME_TANK) == 0) {
+            netinfo->tank = value;
         } else {
             return se_UnknownField;
         }
@@ -79,6 +128,18 @@ static setup_error_t parse_netinfo_from_post(network_info_t *netinfo) {
     if (netinfo->devname == NULL) {
         return se_DevnameMissing;
     }
+    // Alarms and calibration are optional, alias the end of the device name
+    // so the fields still live in the buffer.
+    char *empty = netinfo->devname + strlen(netinfo->devname);
+    if (netinfo->alarms == NULL) {
+        netinfo->alarms = empty;
+    }
+    if (netinfo->levelcal == NULL) {
+        netinfo->levelcal = empty;
+    }
+    if (netinfo->tank == NULL) {
+        netinfo->tank = empty;
+    }
     return se_None;
 }
 
@@ -90,6 +151,24 @@ static setup_error_t netinfo_validate(network_info_t *netinfo) {
     if (strlen(netinfo->password) >= MAX_PASSPHRASE_LEN) {
         return se_PskTooLong;
     }
+    if (!ll_uploader_target_supported(netinfo->target)) {
+        return se_TargetInvalid;
+    }
+    if (!ll_uploader_devname_valid(netinfo->devname)) {
+        return se_DevnameInvalid;
+    }
+    alarm_engine_t alarms;
+    if (!ll_alarm_parse(netinfo->alarms, &alarms)) {
+        return se_AlarmsInvalid;
+    }
+    // Too big for the httpd task's stack, and only ever used from there.
+    static calib_t calib;
+    if (!ll_calib_parse(netinfo->levelcal, "", &calib)) {
+        return se_LevelCalInvalid;
+    }
+    if (!ll_calib_parse("", netinfo->tank, &calib)) {
+        return se_TankInvalid;
+    }
     return se_None;
 }
 
@@ -118,8 +197,29 @@ static const char *netinfo_error_explain(setup_error_t error) {
         return "Authentication with given password (PSK) failed!";
     case se_TargetMissing:
         return "Target missing";
+    case se_TargetInvalid:
+        return "Target must be an http(s):// or mqtt(s):// URL";
     case se_DevnameMissing:
         return "Device name missing";
+    case se_DevnameInvalid:
+        return "Device name must be 1 to 63 characters, without control "
+               "characters";
+    case se_AlarmsInvalid:
+        return "Alarms must be comma separated name:kind:threshold[:param] "
+               "rules, kind being above, below, rise or fall";
+    case se_LevelCalInvalid:
+        return "Level calibration must be comma separated raw:mm points, at "
+               "least two, in increasing raw order";
+    case se_TankInvalid:
+        return "Tank must be hcyl:diameter:length, vcyl:diameter:height or "
+               "box:width:length:height in mm";
+    case se_TargetUnresolved:
+        return "Couldn't look up the target's host name on this network";
+    case se_TargetUnreachable:
+        return "The target's host refused the connection or can't be "
+               "reached from this network";
+    case se_TargetTimeout:
+        return "The target didn't answer in time";
     default:
         return "Unexplainable error";
     }
@@ -134,12 +234,12 @@ static void resp_with_refresh(httpd_req_t *request) {
 
 static esp_err_t main_get_handler(httpd_req_t *request) {
     NPC(request);
-    ESP_LOGI(TAG, "Received GET request from user!");
+    LL_DLOGI(TAG, "Received GET request from user!");
 
     // Decide which page to present to the user
     switch (get_setup_server_state(glob_server)) {
     case ss_WaitingForNetInfo:
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Waiting for network information. Responding with "
             "network information form page.");
@@ -149,7 +249,7 @@ static esp_err_t main_get_handler(httpd_req_t *request) {
             HTTPD_RESP_USE_STRLEN));
         break;
     case ss_WaitingForConnection:
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Currently trying to connect. Responding with redirect to status.");
         ESP_EC(httpd_resp_send(
@@ -160,7 +260,7 @@ static esp_err_t main_get_handler(httpd_req_t *request) {
     case ss_Failure:;
         char error_reason_buffer[256];
 
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Failed to connect and/or confirm target. Resonding with "
             "fail message!");
@@ -176,7 +276,7 @@ static esp_err_t main_get_handler(httpd_req_t *request) {
         reset_setup_server_state(glob_server);
         break;
     case ss_Success:
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Succeeded in connecting with network and confirming "
             "target. Responding with success mesage!");
@@ -193,11 +293,20 @@ static esp_err_t main_get_handler(httpd_req_t *request) {
 static esp_err_t main_post_handler(httpd_req_t *request) {
     NPC(request);
     NPC(glob_server);
-    ESP_LOGI(TAG, "Received POST request from form page!");
+    LL_DLOGI(TAG, "Received POST request from form page!");
+
+    // The reactor reads the info while it connects, a resubmitted form
+    // must not overwrite it.
+    if (get_setup_server_state(glob_server) != ss_WaitingForNetInfo) {
+        LL_DLOGI(TAG, "Not waiting for network information, ignoring POST.");
+        resp_with_refresh(request);
+        return ESP_OK;
+    }
 
     // Check if the POST content length is more than the buffer size.
     int copy_len = request->content_len;
-    int max_len = sizeof(glob_server->info.buffer);
+    // Leave room for the null terminator.
+    int max_len = sizeof(glob_server->info.buffer) - 1;
     if (copy_len > max_len) {
         ESP_LOGW(
             TAG,
@@ -212,8 +321,10 @@ static esp_err_t main_post_handler(httpd_req_t *request) {
     if (recv_status <= 0) {
         return ESP_FAIL;
     }
+    glob_server->info.buffer[recv_status] = '\0';
 
-    ESP_LOGD(TAG, "Post Content:\n%s", glob_server->info.buffer);
+    // The content holds the PSK, only its size is logged.
+    LL_DLOGD(TAG, "POST content of %d bytes", recv_status);
     fill_netinfo(glob_server);
 
     resp_with_refresh(request);
@@ -221,20 +332,49 @@ static esp_err_t main_post_handler(httpd_req_t *request) {
     return ESP_OK;
 }
 
+static metric_t glob_get_latency = {
+    .name = "ll_http_request_duration_us",
+    .help = "Time spent in an HTTP handler",
+    .kind = mk_Histogram,
+    .label_key = "handler",
+    .label_value = "setup_get",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+static metric_t glob_post_latency = {
+    .name = "ll_http_request_duration_us",
+    .help = "Time spent in an HTTP handler",
+    .kind = mk_Histogram,
+    .label_key = "handler",
+    .label_value = "setup_post",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
 setup_ap_server_t *setup_ap_start_server(bg_scan_t *initial_scan) {
-    // Create URI handlers.
+    // Create URI handlers, timed through the metrics wrapper.
+    static metrics_handler_t timed_get = {
+        .handler = main_get_handler,
+        .latency = &glob_get_latency,
+    };
+    static metrics_handler_t timed_post = {
+        .handler = main_post_handler,
+        .latency = &glob_post_latency,
+    };
     const httpd_uri_t main_get = {
         .uri = "/",
         .method = HTTP_GET,
-        .handler = main_get_handler,
-        .user_ctx = NULL,
+        .handler = ll_metrics_timed_handler,
+        .user_ctx = &timed_get,
     };
     const httpd_uri_t main_post = {
         .uri = "/",
         .method = HTTP_POST,
-        .handler = main_post_handler,
-        .user_ctx = NULL,
+        .handler = ll_metrics_timed_handler,
+        .user_ctx = &timed_post,
     };
+    ll_metrics_register(&glob_get_latency);
+    ll_metrics_register(&glob_post_latency);
 
     // Create the page table
     init_page_table();
@@ -250,6 +390,7 @@ setup_ap_server_t *setup_ap_start_server(bg_scan_t *initial_scan) {
     ESP_EC(httpd_start(&server->_server_handle, &SETUP_HTTP_CONFIG));
     httpd_register_uri_handler(server->_server_handle, &main_get);
     httpd_register_uri_handler(server->_server_handle, &main_post);
+    ll_dlog_serve(server->_server_handle);
 
     return server;
 }
@@ -270,39 +411,29 @@ void setup_ap_stop_server(setup_ap_server_t *server) {
 }
 
 setup_ap_server_t *create_setup_server(bg_scan_t *initial_scan) {
-    setup_ap_server_t *ret = malloc(sizeof(setup_ap_server_t));
-    NPC(ret);
+    setup_ap_server_t *ret = ll_pool_alloc(&glob_server_pool);
     memset(&ret->info, 0, sizeof(network_info_t));
     ret->_error = se_None;
-    ret->_state = ss_WaitingForNetInfo;
+    atomic_init(&ret->_state, ss_WaitingForNetInfo);
     ret->scan = initial_scan;
-    POSIX_EC(pthread_mutex_init(&ret->_mutex, NULL));
-    POSIX_EC(pthread_cond_init(&ret->_release_to_connect, NULL));
     memset(&ret->_server_handle, 0, sizeof(httpd_handle_t));
     return ret;
 }
 
 void destroy_setup_server(setup_ap_server_t *server) {
     NPC(server);
-    POSIX_EC(pthread_mutex_destroy(&server->_mutex));
-    POSIX_EC(pthread_cond_destroy(&server->_release_to_connect));
     ESP_EC(httpd_stop(server->_server_handle));
-    free(server);
+    ll_pool_free(&glob_server_pool, server);
 }
 
 _setup_state_t get_setup_server_state(setup_ap_server_t *server) {
     NPC(server);
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
-    _setup_state_t state = server->_state;
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
-    return state;
+    return (_setup_state_t)atomic_load(&server->_state);
 }
 
 void reset_setup_server_state(setup_ap_server_t *server) {
     NPC(server);
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
-    server->_state = ss_WaitingForNetInfo;
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
+    atomic_store(&server->_state, ss_WaitingForNetInfo);
 }
 
 void setup_server_error_format(
@@ -310,7 +441,6 @@ void setup_server_error_format(
     NPC(server);
     NPC(buffer);
     NPC(format);
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
     int len_needed =
         snprintf(buffer, buflen, format, netinfo_error_explain(server->_error));
     if (len_needed >= buflen) {
@@ -318,61 +448,184 @@ void setup_server_error_format(
             TAG,
             "Setup server error message can't fit in provided buffer!");
     }
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
 }
 
 void fill_netinfo(setup_ap_server_t *server) {
     NPC(server);
-    ESP_LOGD(TAG, "entering fill_netinfo");
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
+    LL_DLOGD(TAG, "entering fill_netinfo");
     server->_error = parse_netinfo_from_post(&server->info);
     if (server->_error == se_None) {
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
-            "Parsed network info:\nSSID: %s\nPSK: %s\nTarget: %s\nDevice "
-            "Name: %s",
+            "Parsed network info: ssid=%s psk=%s target=%s devname=%s "
+            "alarms=%s",
             server->info.ssid,
-            server->info.password,
+            LL_DLOG_SECRET(server->info.password),
             server->info.target,
-            server->info.devname);
+            server->info.devname,
+            server->info.alarms);
         server->_error = netinfo_validate(&server->info);
     } else {
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Error parsing network info: %s!",
             netinfo_error_explain(server->_error));
     }
     if (server->_error != se_None) {
-        ESP_LOGI(
+        LL_DLOGI(
             TAG,
             "Network info invalid: %s!",
             netinfo_error_explain(server->_error));
-        server->_state = ss_Failure;
-    } else {
-        ESP_LOGD(TAG, "validated network info");
-        server->_state = ss_WaitingForConnection;
+        atomic_store(&server->_state, ss_Failure);
+        return;
     }
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
 
-    // Signal main thread that it should try to connect with given netinfo.
-    ESP_LOGD(TAG, "signaling release_to_connect condition");
-    POSIX_EC(pthread_cond_signal(&server->_release_to_connect));
+    // Hand the info over to the reactor to connect with.
+    LL_DLOGD(TAG, "validated network info, posting it to the reactor");
+    atomic_store(&server->_state, ss_WaitingForConnection);
+    const reactor_event_t event = {.kind = re_FormSubmitted};
+    ll_reactor_post(&event);
 }
 
-void wait_for_netinfo_filled(setup_ap_server_t *server) {
+void tried_connecting(setup_ap_server_t *server, setup_error_t error) {
     NPC(server);
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
-    while (server->_state != ss_WaitingForConnection) {
-        POSIX_EC(
-            pthread_cond_wait(&server->_release_to_connect, &server->_mutex));
+    server->_error = error;
+    atomic_store(&server->_state, error == se_None ? ss_Success : ss_Failure);
+}
+
+void copy_netinfo(network_info_t *dst, const network_info_t *src) {
+    NPC(dst);
+    NPC(src);
+    memcpy(dst->buffer, src->buffer, sizeof(dst->buffer));
+    // Rebase the aliases onto the destination buffer.
+    dst->ssid = dst->buffer + (src->ssid - src->buffer);
+    dst->password = dst->buffer + (src->password - src->buffer);
+    dst->target = dst->buffer + (src->target - src->buffer);
+    dst->devname = dst->buffer + (src->devname - src->buffer);
+    dst->alarms = dst->buffer + (src->alarms - src->buffer);
+    dst->levelcal = dst->buffer + (src->levelcal - src->buffer);
+    dst->tank = dst->buffer + (src->tank - src->buffer);
+}
+
+static setup_error_t probe_error(probe_result_t result) {
+    switch (result) {
+    case pr_Reachable:
+        return se_None;
+    case pr_Unresolved:
+        return se_TargetUnresolved;
+    case pr_Unreachable:
+        return se_TargetUnreachable;
+    default:
+        return se_TargetTimeout;
     }
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
 }
 
-void tried_connecting(setup_ap_server_t *server, setup_error_t error) {
-    NPC(server);
-    POSIX_EC(pthread_mutex_lock(&server->_mutex));
-    server->_error = error;
-    server->_state = (error == se_None ? ss_Success : ss_Failure);
-    POSIX_EC(pthread_mutex_unlock(&server->_mutex));
+// The countdown mustn't run out before the verdict is in.
+_Static_assert(
+    SETUP_PROBE_TIMEOUT_MS < SETUP_SUCCESS_DISPLAY_MS,
+    "the target probe has to finish within the success countdown");
+
+void do_setup(network_info_t *netinfo) {
+    NPC(netinfo);
+
+    // Load the pages while the radio scans, unless boot already started to
+    // load them, then this does nothing
+    preload_page_table();
+
+    // Do initial scan
+    bg_scan_t *initial_scan = ll_do_scan();
+    ll_boot_mark(bp_Scanned);
+
+    // Log the network list
+    ESP_LOGI(TAG, "SCANNED NETWORKS (SSID, RSSI)");
+    for (int i = 0; i < initial_scan->scanned_ap_count; i++) {
+        wifi_ap_record_t *netrec = &initial_scan->scanned_aps[i];
+        ESP_LOGI(TAG, "%s %d", netrec->ssid, netrec->rssi);
+    }
+
+    // Start the server, form submissions arrive through the reactor
+    ll_reactor_init();
+    setup_ap_server_t *setup_server = setup_ap_start_server(initial_scan);
+    ll_boot_mark(bp_PortalReady);
+
+    // Run the setup until the user has seen it succeed
+    client_attempt_t attempt;
+    probe_attempt_t probe;
+    bool connecting = false;
+    bool probing = false;
+    while (true) {
+        reactor_event_t event;
+        ll_reactor_next(&event);
+        if (event.kind == re_Deadline && event.deadline == rd_SuccessShown) {
+            break;
+        }
+        probe_result_t probe_res;
+        if (probing && ll_probe_step(&probe, &event, &probe_res)) {
+            probing = false;
+            setup_error_t setup_err = probe_error(probe_res);
+            if (setup_err != se_None) {
+                // Back to the form, the next submission connects again.
+                ll_reactor_disarm(rd_SuccessShown);
+                esp_wifi_disconnect();
+            }
+            tried_connecting(setup_server, setup_err);
+            continue;
+        }
+        if (event.kind == re_FormSubmitted) {
+            // The user has submitted network and target information
+            // through the setup website.
+            ESP_LOGD(TAG, "netinfo filled, connecting on the reactor");
+            ll_client_connect_start(
+                &attempt,
+                setup_server->info.ssid,
+                setup_server->info.password);
+            connecting = true;
+            continue;
+        }
+        connect_result_t connect_res;
+        if (!connecting ||
+            !ll_client_connect_step(&attempt, &event, &connect_res)) {
+            continue;
+        }
+        connecting = false;
+        setup_error_t setup_err = se_None;
+        switch (connect_res) {
+        case cr_InvalidSsid:
+            setup_err = se_SsidIncorrect;
+            break;
+        case cr_InvalidPass:
+            setup_err = se_PskIncorrect;
+            break;
+        case cr_TechnicalError:
+            setup_err = se_GenNetConnect;
+            break;
+        default:
+            // Connection succeeded
+            break;
+        }
+        if (setup_err == se_None &&
+            !ll_probe_start(&probe, setup_server->info.target)) {
+            setup_err = se_TargetInvalid;
+            esp_wifi_disconnect();
+        }
+        if (setup_err != se_None) {
+            tried_connecting(setup_server, setup_err);
+            continue;
+        }
+        // Check the target while the countdown for the user to see the
+        // success runs, the page says verifying until the verdict.
+        probing = true;
+        ll_reactor_arm(rd_SuccessShown, SETUP_SUCCESS_DISPLAY_MS);
+    }
+
+    // Keep the network info around, the server owns the original
+    copy_netinfo(netinfo, &setup_server->info);
+
+    // Stop the setup access point and server
+    setup_ap_stop_server(setup_server);
+    setup_server = NULL;
+
+    // Deallocate scan results
+    ll_destroy_scan(initial_scan);
+    initial_scan = NULL;
 }
@@ -0,0 +1,354 @@
+#include "tls.h"
+
+#include "const.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "metrics.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+static const char *TAG = "ll_tls";
+
+// The session of the last handshake and the "host:port" it is good for.
+// RTC memory keeps it through deep sleep, a reset clears the magic.
+static RTC_DATA_ATTR uint32_t rtc_session_valid;
+static RTC_DATA_ATTR char rtc_session_peer[TLS_PEER_MAX];
+static RTC_DATA_ATTR uint32_t rtc_session_len;
+static RTC_DATA_ATTR uint8_t rtc_session[TLS_SESSION_SAVE_MAX];
+
+typedef struct tls_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    tls_stats_t stats;
+
+    // UNSYNCHRONIZED FIELDS (uploader task only)
+    bool configured;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;
+    bool open;
+    char peer[TLS_PEER_MAX];
+} tls_t;
+
+static tls_t glob_tls = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static metric_t glob_full_us = {
+    .name = "ll_tls_handshake_us",
+    .help = "Time spent in a TLS handshake",
+    .kind = mk_Histogram,
+    .label_key = "kind",
+    .label_value = "full",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
+static metric_t glob_resumed_us = {
+    .name = "ll_tls_handshake_us",
+    .help = "Time spent in a TLS handshake",
+    .kind = mk_Histogram,
+    .label_key = "kind",
+    .label_value = "resumed",
+    .bounds = METRICS_LATENCY_US_BOUNDS,
+    .bound_count = METRICS_LATENCY_US_BOUND_COUNT,
+};
+
+static metric_t glob_heap_peak = {
+    .name = "ll_tls_heap_peak_bytes",
+    .help = "Heap taken at the peak of the last TLS handshake",
+    .kind = mk_Gauge,
+};
+
+// Without a config there is nothing to upload with.
+static void check(int ret, const char *what) {
+    if (ret != 0) {
+        ESP_LOGE(TAG, "%s failed!\nError: -0x%04x", what, -ret);
+        abort();
+    }
+}
+
+static void configure(tls_t *tls) {
+    mbedtls_entropy_init(&tls->entropy);
+    mbedtls_ctr_drbg_init(&tls->drbg);
+    mbedtls_ssl_config_init(&tls->conf);
+    check(
+        mbedtls_ctr_drbg_seed(
+            &tls->drbg,
+            mbedtls_entropy_func,
+            &tls->entropy,
+            NULL,
+            0),
+        "Seeding the DRBG");
+    check(
+        mbedtls_ssl_config_defaults(
+            &tls->conf,
+            MBEDTLS_SSL_IS_CLIENT,
+            MBEDTLS_SSL_TRANSPORT_STREAM,
+            MBEDTLS_SSL_PRESET_DEFAULT),
+        "TLS config");
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->drbg);
+    mbedtls_ssl_conf_read_timeout(&tls->conf, UPLOAD_TIMEOUT_MS);
+    mbedtls_ssl_conf_session_tickets(
+        &tls->conf,
+        MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    ESP_EC(esp_crt_bundle_attach(&tls->conf));
+    ll_metrics_register(&glob_full_us);
+    ll_metrics_register(&glob_resumed_us);
+    ll_metrics_register(&glob_heap_peak);
+    tls->configured = true;
+}
+
+// The saved session if it is for this peer and still loads.
+static bool load_session(const char *peer, mbedtls_ssl_session *session) {
+    if (rtc_session_valid != TLS_RTC_MAGIC ||
+        strcmp(rtc_session_peer, peer) != 0) {
+        return false;
+    }
+    int ret = mbedtls_ssl_session_load(session, rtc_session, rtc_session_len);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Dropping saved TLS session!\nError: -0x%04x", -ret);
+        rtc_session_valid = 0;
+        return false;
+    }
+    return true;
+}
+
+static void save_session(tls_t *tls) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    rtc_session_valid = 0;
+    size_t len = 0;
+    int ret = mbedtls_ssl_get_session(&tls->ssl, &session);
+    if (ret == 0) {
+        ret = mbedtls_ssl_session_save(
+            &session,
+            rtc_session,
+            sizeof(rtc_session),
+            &len);
+    }
+    mbedtls_ssl_session_free(&session);
+    if (ret != 0) {
+        ESP_LOGW(
+            TAG,
+            "Couldn't save the TLS session, the next connection does a "
+            "full handshake!\nError: -0x%04x",
+            -ret);
+        return;
+    }
+    memcpy(rtc_session_peer, tls->peer, sizeof(rtc_session_peer));
+    rtc_session_len = len;
+    rtc_session_valid = TLS_RTC_MAGIC;
+}
+
+// Open unless the target closed it while it sat idle, or sent anything
+// unasked, which can only be a close_notify.
+static bool still_open(tls_t *tls) {
+    uint8_t byte;
+    ssize_t n = recv(tls->net.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// One step at a time, so the heap can be sampled in between. A full
+// handshake goes through the server's certificate, a resumed one skips it.
+static int handshake(tls_t *tls, bool *full, uint32_t *min_free) {
+    *full = false;
+    while (!mbedtls_ssl_is_handshake_over(&tls->ssl)) {
+        int ret = mbedtls_ssl_handshake_step(&tls->ssl);
+        if (ret != 0) {
+            return ret;
+        }
+        // The same field mbedtls_ssl_is_handshake_over reads.
+        *full = *full || tls->ssl.MBEDTLS_PRIVATE(state) ==
+                             MBEDTLS_SSL_SERVER_CERTIFICATE;
+        uint32_t free_now = esp_get_free_heap_size();
+        if (free_now < *min_free) {
+            *min_free = free_now;
+        }
+    }
+    return 0;
+}
+
+static void free_connection(tls_t *tls) {
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_net_free(&tls->net);
+    tls->open = false;
+}
+
+// Keeps the open connection if it is to the same peer and still up,
+// otherwise connects, resuming the saved session if there is one.
+bool ll_tls_connect(const char *host, const char *port, bool *reused) {
+    NPC(host);
+    NPC(port);
+    NPC(reused);
+    tls_t *tls = &glob_tls;
+    char peer[TLS_PEER_MAX];
+    snprintf(peer, sizeof(peer), "%s:%s", host, port);
+    *reused = tls->open && strcmp(peer, tls->peer) == 0 && still_open(tls);
+    if (*reused) {
+        POSIX_EC(pthread_mutex_lock(&tls->mutex));
+        tls->stats.reused++;
+        POSIX_EC(pthread_mutex_unlock(&tls->mutex));
+        return true;
+    }
+    ll_tls_close();
+    if (!tls->configured) {
+        configure(tls);
+    }
+    memcpy(tls->peer, peer, sizeof(tls->peer));
+
+    // The peak counts the connection's buffers, set up along with it.
+    uint32_t base_free = esp_get_free_heap_size();
+    uint32_t min_free = base_free;
+    int64_t started = esp_timer_get_time();
+    mbedtls_net_init(&tls->net);
+    mbedtls_ssl_init(&tls->ssl);
+    int ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&tls->ssl, host);
+    }
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    bool offered = ret == 0 && load_session(peer, &session) &&
+                   mbedtls_ssl_set_session(&tls->ssl, &session) == 0;
+    mbedtls_ssl_session_free(&session);
+    bool full = false;
+    if (ret == 0) {
+        ret = mbedtls_net_connect(
+            &tls->net,
+            host,
+            port,
+            MBEDTLS_NET_PROTO_TCP);
+    }
+    if (ret == 0) {
+        // Reads time out through the config.
+        struct timeval timeout = {
+            .tv_sec = UPLOAD_TIMEOUT_MS / 1000,
+            .tv_usec = UPLOAD_TIMEOUT_MS % 1000 * 1000,
+        };
+        setsockopt(
+            tls->net.fd,
+            SOL_SOCKET,
+            SO_SNDTIMEO,
+            &timeout,
+            sizeof(timeout));
+        mbedtls_ssl_set_bio(
+            &tls->ssl,
+            &tls->net,
+            mbedtls_net_send,
+            NULL,
+            mbedtls_net_recv_timeout);
+        ret = handshake(tls, &full, &min_free);
+    }
+    if (ret != 0) {
+        ESP_LOGW(
+            TAG,
+            "TLS connection to %s failed!\nError: -0x%04x",
+            peer,
+            -ret);
+        free_connection(tls);
+        return false;
+    }
+    tls->open = true;
+    save_session(tls);
+
+    int64_t took_us = esp_timer_get_time() - started;
+    uint32_t peak = base_free - min_free;
+    bool resumed = offered && !full;
+    POSIX_EC(pthread_mutex_lock(&tls->mutex));
+    if (resumed) {
+        tls->stats.resumed++;
+    } else {
+        tls->stats.full++;
+    }
+    tls->stats.handshake_us = took_us;
+    tls->stats.heap_peak = peak;
+    POSIX_EC(pthread_mutex_unlock(&tls->mutex));
+    ll_metrics_observe(resumed ? &glob_resumed_us : &glob_full_us, took_us);
+    ll_metrics_set(&glob_heap_peak, peak);
+    ESP_LOGI(
+        TAG,
+        "%s TLS handshake with %s in %lld us, heap peak %lu bytes, %lu "
+        "bytes of stack never used%s",
+        resumed ? "Resumed" : "Full",
+        peer,
+        (long long)took_us,
+        (unsigned long)peak,
+        (unsigned long)uxTaskGetStackHighWaterMark(NULL),
+        offered && !resumed ? " (saved session declined)" : "");
+    return true;
+}
+
+bool ll_tls_write(const void *data, size_t len) {
+    NPC(data);
+    tls_t *tls = &glob_tls;
+    if (!tls->open) {
+        return false;
+    }
+    const uint8_t *at = data;
+    while (len > 0) {
+        int n = mbedtls_ssl_write(&tls->ssl, at, len);
+        if (n <= 0) {
+            ESP_LOGD(TAG, "TLS write failed: -0x%04x", -n);
+            return false;
+        }
+        at += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Returns the bytes read, 0 once the target closed the connection and -1 on
+// errors.
+int ll_tls_read(void *buf, size_t len) {
+    NPC(buf);
+    tls_t *tls = &glob_tls;
+    if (!tls->open) {
+        return -1;
+    }
+    int n = mbedtls_ssl_read(&tls->ssl, buf, len);
+    if (n == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+    if (n < 0) {
+        ESP_LOGD(TAG, "TLS read failed: -0x%04x", -n);
+        return -1;
+    }
+    return n;
+}
+
+void ll_tls_close() {
+    tls_t *tls = &glob_tls;
+    if (!tls->open) {
+        return;
+    }
+    // Best effort, the target may be gone already.
+    mbedtls_ssl_close_notify(&tls->ssl);
+    free_connection(tls);
+}
+
+void ll_tls_get_stats(tls_stats_t *stats) {
+    NPC(stats);
+    POSIX_EC(pthread_mutex_lock(&glob_tls.mutex));
+    *stats = glob_tls.stats;
+    POSIX_EC(pthread_mutex_unlock(&glob_tls.mutex));
+}
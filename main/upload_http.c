@@ -0,0 +1,326 @@
+#include "const.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "setup.h"
+#include "tls.h"
+#include "uploader.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ll_upload_http";
+
+typedef struct upload_http_t {
+    // UNSYNCHRONIZED FIELDS (uploader task only)
+    // http:// targets go through one client for the lifetime of the device,
+    // so batches reuse the same keep-alive connection. https:// targets go
+    // through tls.c, which also resumes the session after the connection
+    // closes. The client is only created for the first http:// target.
+    esp_http_client_handle_t client;
+    bool https;
+    char host[TLS_PEER_MAX];
+    char port[8];
+    char path[UPLOAD_HTTPS_PATH_MAX];
+    char devname[DEVNAME_SIZE];
+    // Request head on the way out, response head on the way back.
+    char head[UPLOAD_HTTPS_HEAD_SIZE];
+} upload_http_t;
+
+static upload_http_t glob_http;
+
+// Splits "https://host[:port][/path]", the port defaults to 443.
+static bool parse_https(upload_http_t *http, const char *target) {
+    const char *host = target + strlen("https://");
+    size_t host_len = strcspn(host, ":/");
+    const char *rest = host + host_len;
+    size_t port_len = 0;
+    if (*rest == ':') {
+        rest++;
+        port_len = strcspn(rest, "/");
+    }
+    const char *path = rest + port_len;
+    if (host_len == 0 || host_len >= sizeof(http->host) ||
+        port_len >= sizeof(http->port) ||
+        strlen(path) >= sizeof(http->path)) {
+        return false;
+    }
+    snprintf(http->host, sizeof(http->host), "%.*s", (int)host_len, host);
+    if (port_len > 0) {
+        snprintf(http->port, sizeof(http->port), "%.*s", (int)port_len, rest);
+    } else {
+        snprintf(http->port, sizeof(http->port), "443");
+    }
+    snprintf(http->path, sizeof(http->path), "%s", *path ? path : "/");
+    return true;
+}
+
+static void set_target(upload_http_t *http, const network_info_t *netinfo) {
+    snprintf(http->devname, sizeof(http->devname), "%s", netinfo->devname);
+    http->https = strncmp(netinfo->target, "https://", 8) == 0;
+    if (http->https) {
+        if (!parse_https(http, netinfo->target)) {
+            ESP_LOGE(TAG, "Invalid HTTPS target %s!", netinfo->target);
+            abort();
+        }
+        return;
+    }
+    ll_tls_close();
+    if (http->client == NULL) {
+        const esp_http_client_config_t client_config = {
+            .url = netinfo->target,
+            .method = HTTP_METHOD_POST,
+            .timeout_ms = UPLOAD_TIMEOUT_MS,
+            .keep_alive_enable = true,
+        };
+        http->client = esp_http_client_init(&client_config);
+        NPC(http->client);
+    } else {
+        ESP_EC(esp_http_client_set_url(http->client, netinfo->target));
+    }
+    ESP_EC(
+        esp_http_client_set_header(http->client, "X-Device", http->devname));
+}
+
+void ll_upload_http_init(const network_info_t *netinfo) {
+    NPC(netinfo);
+    set_target(&glob_http, netinfo);
+}
+
+// Points the next batch at the new target and device name. Only called on
+// the uploader task, between batches.
+void ll_upload_http_retarget(const network_info_t *netinfo) {
+    NPC(netinfo);
+    upload_http_t *http = &glob_http;
+    // A different peer doesn't take the open connection, ll_tls_connect
+    // drops it.
+    set_target(http, netinfo);
+}
+
+// Reads the response head and drains the body, so the connection is ready
+// for the next request. Returns the status, -1 if there was no complete
+// response. *keep is false if the connection can't take another request.
+static int read_response(upload_http_t *http, bool *keep) {
+    char *head = http->head;
+    size_t len = 0;
+    char *end = NULL;
+    while (end == NULL) {
+        if (len == sizeof(http->head) - 1) {
+            return -1;
+        }
+        int n = ll_tls_read(head + len, sizeof(http->head) - 1 - len);
+        if (n <= 0) {
+            return -1;
+        }
+        len += n;
+        head[len] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+    int status = 0;
+    if (sscanf(head, "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    size_t body_read = len - (end + 4 - head);
+    *end = '\0';
+    // Header names are case insensitive.
+    for (char *c = head; *c != '\0'; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+    const char *length = strstr(head, "\r\ncontent-length:");
+    *keep = length != NULL && strstr(head, "\r\nconnection: close") == NULL;
+    if (length == NULL) {
+        // No way to tell where the body ends, the connection goes.
+        return status;
+    }
+    long remaining = strtol(length + strlen("\r\ncontent-length:"), NULL, 10);
+    remaining -= body_read;
+    while (remaining > 0) {
+        size_t want = remaining < (long)sizeof(http->head)
+                          ? (size_t)remaining
+                          : sizeof(http->head);
+        int n = ll_tls_read(head, want);
+        if (n <= 0) {
+            return -1;
+        }
+        remaining -= n;
+    }
+    return status;
+}
+
+static int https_post_once(
+    upload_http_t *http,
+    const char *type,
+    const char *seq,
+    const char *metrics,
+    const void *body,
+    size_t len,
+    bool *reused) {
+    if (!ll_tls_connect(http->host, http->port, reused)) {
+        return -1;
+    }
+    int head_len = snprintf(
+        http->head,
+        sizeof(http->head),
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s:%s\r\n"
+        "X-Device: %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s%s%s"
+        "%s%s%s"
+        "Content-Length: %lu\r\n"
+        "\r\n",
+        http->path,
+        http->host,
+        http->port,
+        http->devname,
+        type,
+        seq != NULL ? "X-Seq: " : "",
+        seq != NULL ? seq : "",
+        seq != NULL ? "\r\n" : "",
+        metrics != NULL ? "X-Metrics: " : "",
+        metrics != NULL ? metrics : "",
+        metrics != NULL ? "\r\n" : "",
+        (unsigned long)len);
+    if (head_len >= (int)sizeof(http->head)) {
+        ESP_LOGE(TAG, "Request head too long!");
+        return -1;
+    }
+    if (!ll_tls_write(http->head, head_len) || !ll_tls_write(body, len)) {
+        return -1;
+    }
+    bool keep = false;
+    int status = read_response(http, &keep);
+    if (!keep) {
+        ll_tls_close();
+    }
+    return status;
+}
+
+static int https_post(
+    upload_http_t *http,
+    const char *type,
+    const char *seq,
+    const char *metrics,
+    const void *body,
+    size_t len) {
+    bool reused = false;
+    int status = https_post_once(http, type, seq, metrics, body, len, &reused);
+    if (status < 0 && reused) {
+        // The target closed the idle connection as the request went out,
+        // once more on a new one. Batches are idempotent.
+        ll_tls_close();
+        status = https_post_once(http, type, seq, metrics, body, len, &reused);
+    }
+    return status;
+}
+
+// One POST to the target, the optional headers are left out when NULL.
+static esp_err_t post(
+    const char *type,
+    const char *seq,
+    const char *metrics,
+    const void *body,
+    size_t len,
+    int *status) {
+    upload_http_t *http = &glob_http;
+    if (http->https) {
+        *status = https_post(http, type, seq, metrics, body, len);
+        return *status < 0 ? ESP_FAIL : ESP_OK;
+    }
+    NPC(http->client);
+    ESP_EC(esp_http_client_set_header(http->client, "Content-Type", type));
+    if (seq != NULL) {
+        ESP_EC(esp_http_client_set_header(http->client, "X-Seq", seq));
+    } else {
+        esp_http_client_delete_header(http->client, "X-Seq");
+    }
+    if (metrics != NULL) {
+        ESP_EC(esp_http_client_set_header(http->client, "X-Metrics", metrics));
+    } else {
+        esp_http_client_delete_header(http->client, "X-Metrics");
+    }
+    ESP_EC(esp_http_client_set_post_field(
+        http->client,
+        (const char *)body,
+        len));
+    esp_err_t err = esp_http_client_perform(http->client);
+    *status = esp_http_client_get_status_code(http->client);
+    return err;
+}
+
+// Drops the connection so the next attempt starts from a clean slate.
+static void drop_connection() {
+    upload_http_t *http = &glob_http;
+    if (http->https) {
+        ll_tls_close();
+    } else {
+        esp_http_client_close(http->client);
+    }
+}
+
+int ll_upload_http_send(const upload_batch_t *batch) {
+    NPC(batch);
+    char seq_buf[24];
+    snprintf(
+        seq_buf,
+        sizeof(seq_buf),
+        "%llu",
+        (unsigned long long)batch->start);
+    int status = 0;
+    esp_err_t err = post(
+        "application/octet-stream",
+        seq_buf,
+        batch->metrics[0] != '\0' ? batch->metrics : NULL,
+        batch->data,
+        batch->len,
+        &status);
+
+    // 409 means the target already had every block in the batch.
+    if (err != ESP_OK || !((status >= 200 && status < 300) || status == 409)) {
+        ESP_LOGW(
+            TAG,
+            "Batch at %llu failed!\nError: %s\nStatus: %d",
+            batch->start,
+            esp_err_to_name(err),
+            status);
+        drop_connection();
+        return -1;
+    }
+    ll_uploader_batch_done(0);
+    return 0;
+}
+
+// Alarms and summaries go to the same URL over the same connection, told
+// apart from batches by their content type and from each other by their
+// fields.
+static bool send_json(const char *what, const char *json, size_t len) {
+    NPC(json);
+    int status = 0;
+    esp_err_t err = post("application/json", NULL, NULL, json, len, &status);
+    if (err != ESP_OK || status < 200 || status >= 300) {
+        ESP_LOGW(
+            TAG,
+            "%s failed!\nError: %s\nStatus: %d",
+            what,
+            esp_err_to_name(err),
+            status);
+        drop_connection();
+        return false;
+    }
+    return true;
+}
+
+int ll_upload_http_send_alarm(const char *json, size_t len) {
+    if (!send_json("Alarm", json, len)) {
+        return -1;
+    }
+    // The response confirms it, like a batch.
+    ll_uploader_batch_done(0);
+    return 0;
+}
+
+bool ll_upload_http_send_summary(const char *json, size_t len) {
+    return send_json("Summary", json, len);
+}
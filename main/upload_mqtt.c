@@ -0,0 +1,176 @@
+#include "const.h"
+#include "esp_crt_bundle.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "setup.h"
+#include "uploader.h"
+#include "util.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ll_upload_mqtt";
+
+static esp_mqtt_client_handle_t glob_client = NULL;
+static char glob_topic[96];
+static char glob_alarm_topic[96];
+static char glob_metrics_topic[96];
+static char glob_summary_topic[96];
+static atomic_bool glob_connected = false;
+
+static void handle_mqtt_event(
+    void *handler_data, esp_event_base_t base, int32_t id, void *event_data) {
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
+    switch ((esp_mqtt_event_id_t)id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG, "Connected to broker.");
+        // Unconfirmed messages are still in the outbox and get resent by
+        // the client, so there's nothing to rewind here.
+        atomic_store(&glob_connected, true);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGW(TAG, "Disconnected from broker.");
+        atomic_store(&glob_connected, false);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        ll_uploader_batch_done(event->msg_id);
+        break;
+    case MQTT_EVENT_DELETED:
+        // Expired from the outbox without being acknowledged.
+        ESP_LOGW(TAG, "Message %d dropped from outbox.", event->msg_id);
+        ll_uploader_rewind();
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGW(TAG, "MQTT error.");
+        break;
+    default:
+        break;
+    }
+}
+
+void ll_upload_mqtt_init(const network_info_t *netinfo) {
+    NPC(netinfo);
+    NOT_NPC(glob_client);
+
+    // Derive the topic from the device name, keeping MQTT wildcards and level
+    // separators out of it.
+    char devname[DEVNAME_SIZE];
+    snprintf(devname, sizeof(devname), "%s", netinfo->devname);
+    for (char *c = devname; *c != '\0'; c++) {
+        if (*c == '/' || *c == '+' || *c == '#') {
+            *c = '_';
+        }
+    }
+    snprintf(glob_topic, sizeof(glob_topic), MQTT_TOPIC_FORMAT, devname);
+    snprintf(
+        glob_alarm_topic,
+        sizeof(glob_alarm_topic),
+        MQTT_ALARM_TOPIC_FORMAT,
+        devname);
+    snprintf(
+        glob_metrics_topic,
+        sizeof(glob_metrics_topic),
+        MQTT_METRICS_TOPIC_FORMAT,
+        devname);
+    snprintf(
+        glob_summary_topic,
+        sizeof(glob_summary_topic),
+        MQTT_SUMMARY_TOPIC_FORMAT,
+        devname);
+
+    const esp_mqtt_client_config_t client_config = {
+        .broker.address.uri = netinfo->target,
+        // mqtts:// brokers are verified against the bundled CA certificates.
+        .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
+        .credentials.client_id = netinfo->devname,
+        .session.keepalive = MQTT_KEEPALIVE_S,
+        .network.timeout_ms = UPLOAD_TIMEOUT_MS,
+        .network.reconnect_timeout_ms = UPLOAD_RETRY_MIN_MS,
+    };
+    glob_client = esp_mqtt_client_init(&client_config);
+    NPC(glob_client);
+    ESP_EC(esp_mqtt_client_register_event(
+        glob_client,
+        (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID,
+        handle_mqtt_event,
+        NULL));
+    ESP_EC(esp_mqtt_client_start(glob_client));
+    ESP_LOGI(TAG, "Publishing to topic %s", glob_topic);
+}
+
+bool ll_upload_mqtt_connected() { return atomic_load(&glob_connected); }
+
+int ll_upload_mqtt_send(const upload_batch_t *batch) {
+    NPC(batch);
+    NPC(glob_client);
+    // MQTT 3.1.1 has no properties to attach the snapshot to, so it goes out
+    // on its own topic just ahead of the batch. QoS 0, a lost snapshot is
+    // replaced by the next one.
+    if (batch->metrics[0] != '\0' &&
+        esp_mqtt_client_enqueue(
+            glob_client,
+            glob_metrics_topic,
+            batch->metrics,
+            0,
+            0,
+            0,
+            true) < 0) {
+        ESP_LOGW(TAG, "Couldn't enqueue metrics snapshot!");
+    }
+    // Enqueue instead of publish so the call doesn't wait for the PUBACK,
+    // letting several batches be in flight at once.
+    int msg_id = esp_mqtt_client_enqueue(
+        glob_client,
+        glob_topic,
+        (const char *)batch->data,
+        batch->len,
+        1,
+        0,
+        true);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Couldn't enqueue batch at %llu!", batch->start);
+    }
+    return msg_id;
+}
+
+int ll_upload_mqtt_send_alarm(const char *json, size_t len) {
+    NPC(json);
+    NPC(glob_client);
+    // Publish rather than enqueue, so the alarm is written to the socket now
+    // instead of on the client task's next pass. The uploader holds on to the
+    // alarm until its PUBACK.
+    int msg_id = esp_mqtt_client_publish(
+        glob_client,
+        glob_alarm_topic,
+        json,
+        len,
+        1,
+        0);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Couldn't publish alarm!");
+        return -1;
+    }
+    return msg_id;
+}
+
+bool ll_upload_mqtt_send_summary(const char *json, size_t len) {
+    NPC(json);
+    NPC(glob_client);
+    // Enqueued, it only has to get there ahead of the backlog, which is
+    // enqueued behind it.
+    int msg_id = esp_mqtt_client_enqueue(
+        glob_client,
+        glob_summary_topic,
+        json,
+        len,
+        1,
+        0,
+        true);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Couldn't enqueue summary!");
+        return false;
+    }
+    return true;
+}
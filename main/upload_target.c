@@ -0,0 +1,35 @@
+#include "uploader.h"
+
+#include "const.h"
+#include "util.h"
+
+#include <string.h>
+
+static const char *TAG = "ll_upload_target";
+
+// Both end up in request heads, a CR or LF would start a header of its own.
+static bool printable(const char *value) {
+    for (const char *c = value; *c != '\0'; c++) {
+        if ((unsigned char)*c < 0x20 || *c == 0x7f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Kept apart from the uploader so setup can validate targets without pulling
+// in the transports.
+bool ll_uploader_target_supported(const char *target) {
+    NPC(target);
+    return (strncmp(target, "http://", 7) == 0 ||
+            strncmp(target, "https://", 8) == 0 ||
+            strncmp(target, "mqtt://", 7) == 0 ||
+            strncmp(target, "mqtts://", 8) == 0) &&
+           printable(target);
+}
+
+bool ll_uploader_devname_valid(const char *devname) {
+    NPC(devname);
+    size_t len = strlen(devname);
+    return len > 0 && len < DEVNAME_SIZE && printable(devname);
+}
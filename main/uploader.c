@@ -0,0 +1,784 @@
+#include "uploader.h"
+
+#include "codec.h"
+#include "const.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "nvs.h"
+#include "remote.h"
+#include "rollupstore.h"
+#include "sampler.h"
+#include "samplelog.h"
+#include "setup.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ll_uploader";
+
+// An alarm taken off the queue and sent, until the target confirms it.
+typedef struct upload_alarm_t {
+    alarm_event_t event;
+    int id;
+} upload_alarm_t;
+
+typedef struct uploader_t {
+    pthread_mutex_t mutex;
+
+    // SYNCHRONIZED FIELDS
+    uploader_stats_t stats;
+    // Everything before this log position has been accepted by the target.
+    samplelog_pos_t acked;
+    // Where the next batch starts. Ahead of acked while batches are in
+    // flight.
+    samplelog_pos_t next;
+    // Batches sent but not yet confirmed, oldest first.
+    upload_inflight_t inflight[UPLOAD_WINDOW_MAX];
+    int inflight_head;
+    int inflight_count;
+    // Send whatever is pending without waiting for the batch delay.
+    bool flush;
+    // A confirmation that matched no batch, kept in case it is for the batch
+    // whose send call hasn't returned its id yet. -1 if none.
+    int early_ack;
+    // Alarms sent but not yet confirmed, ll_uploader_drain waits for them
+    // like for the queued ones.
+    upload_alarm_t alarms_inflight[ALARM_QUEUE_LEN];
+    int alarms_inflight_count;
+    // The acked position last written to NVS. Both the uploader task and
+    // ll_uploader_drain persist, the write happens with the mutex held.
+    nvs_handle_t nvs;
+    samplelog_pos_t persisted;
+
+    // UNSYNCHRONIZED FIELDS (uploader task only)
+    network_info_t info;
+    upload_transport_t transport;
+    int window;
+    TaskHandle_t task;
+    QueueHandle_t alarms;
+    upload_batch_t batch;
+    // When a metrics snapshot last went out with a batch.
+    int64_t metrics_at;
+    // When the remote config was last polled.
+    int64_t polled_at;
+    // Catching up on a backlog, see start_catchup. The freshest stretch of
+    // the log, from fresh_from on, goes out ahead of the backlog.
+    bool catching_up;
+    samplelog_pos_t fresh_from;
+    samplelog_pos_t fresh_next;
+    int64_t catchup_started;
+} uploader_t;
+
+static uploader_t glob_uploader = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static upload_inflight_t *inflight_at(uploader_t *up, int i) {
+    return &up->inflight[(up->inflight_head + i) % UPLOAD_WINDOW_MAX];
+}
+
+// Confirmations can arrive out of order, only move acked over the contiguous
+// confirmed prefix. Called with the mutex held.
+static void advance_acked(uploader_t *up) {
+    int64_t now = esp_timer_get_time();
+    while (up->inflight_count > 0 && inflight_at(up, 0)->done) {
+        upload_inflight_t *entry = inflight_at(up, 0);
+        up->acked = entry->end;
+        up->stats.batches++;
+        up->stats.bytes += entry->len;
+        up->stats.samples += entry->samples;
+        up->stats.last_latency_ms = (now - entry->sent_at) / 1000;
+        ESP_LOGI(
+            TAG,
+            "Uploaded %lu samples in %d bytes (%.2f B/sample) in %lld ms",
+            entry->samples,
+            entry->len,
+            entry->samples ? (float)entry->len / entry->samples : 0.0f,
+            up->stats.last_latency_ms);
+        up->inflight_head = (up->inflight_head + 1) % UPLOAD_WINDOW_MAX;
+        up->inflight_count--;
+    }
+}
+
+static void build_batch(uploader_t *up, samplelog_pos_t pos) {
+    upload_batch_t *batch = &up->batch;
+    batch->len = 0;
+    batch->samples = 0;
+    batch->start = pos;
+    while (batch->len + sizeof(samplelog_pos_t) + CODEC_BLOCK_SIZE <=
+           sizeof(batch->data)) {
+        uint8_t *frame = batch->data + batch->len;
+        uint8_t *block = frame + sizeof(samplelog_pos_t);
+        size_t len = ll_samplelog_read(&pos, block, CODEC_BLOCK_SIZE);
+        if (len == 0) {
+            break;
+        }
+        samplelog_pos_t block_pos = pos - len;
+        if (batch->len == 0) {
+            batch->start = block_pos;
+        }
+        memcpy(frame, &block_pos, sizeof(block_pos));
+
+        codec_block_header_t header;
+        if (ll_codec_read_header(block, len, &header)) {
+            batch->samples += header.count;
+        }
+        batch->len += sizeof(samplelog_pos_t) + len;
+    }
+    batch->end = pos;
+}
+
+static bool transport_ready(uploader_t *up) {
+    switch (up->transport) {
+    case ut_Mqtt:
+        return ll_upload_mqtt_connected();
+    default:
+        return true;
+    }
+}
+
+static int transport_send(uploader_t *up) {
+    switch (up->transport) {
+    case ut_Mqtt:
+        return ll_upload_mqtt_send(&up->batch);
+    default:
+        return ll_upload_http_send(&up->batch);
+    }
+}
+
+// Returns the id the confirmation comes with, or -1.
+static int transport_send_alarm(uploader_t *up, const char *json, size_t len) {
+    switch (up->transport) {
+    case ut_Mqtt:
+        return ll_upload_mqtt_send_alarm(json, len);
+    default:
+        return ll_upload_http_send_alarm(json, len);
+    }
+}
+
+static bool
+transport_send_summary(uploader_t *up, const char *json, size_t len) {
+    switch (up->transport) {
+    case ut_Mqtt:
+        return ll_upload_mqtt_send_summary(json, len);
+    default:
+        return ll_upload_http_send_summary(json, len);
+    }
+}
+
+// Alarms go out one by one as soon as they are raised, ahead of any batch.
+// Returns false if one couldn't be sent, it stays queued for the next try.
+static bool send_alarms(uploader_t *up) {
+    alarm_event_t event;
+    while (xQueuePeek(up->alarms, &event, 0) == pdTRUE) {
+        // Like a batch, the alarm may be confirmed before the send call
+        // returns its id.
+        POSIX_EC(pthread_mutex_lock(&up->mutex));
+        bool full = up->alarms_inflight_count >= ALARM_QUEUE_LEN;
+        up->early_ack = -1;
+        POSIX_EC(pthread_mutex_unlock(&up->mutex));
+        if (full) {
+            return false;
+        }
+        char json[ALARM_JSON_SIZE];
+        int len = snprintf(
+            json,
+            sizeof(json),
+            "{\"rule\":\"%s\",\"kind\":\"%s\",\"active\":%s,\"t\":%lld,"
+            "\"v\":%ld}",
+            event.rule,
+            ll_alarm_kind_name(event.kind),
+            event.active ? "true" : "false",
+            (long long)event.timestamp,
+            (long)event.value);
+        int id = transport_send_alarm(up, json, len);
+        if (id < 0) {
+            return false;
+        }
+        // Off the queue and in flight in one step, so a drain never sees the
+        // alarm in neither.
+        POSIX_EC(pthread_mutex_lock(&up->mutex));
+        xQueueReceive(up->alarms, &event, 0);
+        if (up->early_ack == id) {
+            up->early_ack = -1;
+        } else {
+            upload_alarm_t *slot =
+                &up->alarms_inflight[up->alarms_inflight_count++];
+            slot->event = event;
+            slot->id = id;
+        }
+        POSIX_EC(pthread_mutex_unlock(&up->mutex));
+        ESP_LOGI(
+            TAG,
+            "Alarm %s %s sent %lld ms after the sample",
+            event.rule,
+            event.active ? "raised" : "cleared",
+            ll_sampler_now() - event.timestamp);
+    }
+    return true;
+}
+
+// Drops the in-flight alarm with the id. Called with the mutex held.
+static bool alarm_done(uploader_t *up, int id) {
+    for (int i = 0; i < up->alarms_inflight_count; i++) {
+        if (up->alarms_inflight[i].id == id) {
+            memmove(
+                &up->alarms_inflight[i],
+                &up->alarms_inflight[i + 1],
+                (up->alarms_inflight_count - i - 1) * sizeof(upload_alarm_t));
+            up->alarms_inflight_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false if the batch wasn't handed to the transport.
+static bool send_batch(uploader_t *up, samplelog_pos_t from) {
+    // Claim a window slot before sending, a fast transport may confirm the
+    // batch before the send call even returns.
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    if (up->next != from || up->inflight_count >= up->window) {
+        POSIX_EC(pthread_mutex_unlock(&up->mutex));
+        return false;
+    }
+    upload_inflight_t *slot = inflight_at(up, up->inflight_count);
+    slot->end = up->batch.end;
+    slot->len = up->batch.len;
+    slot->samples = up->batch.samples;
+    slot->sent_at = esp_timer_get_time();
+    slot->id = -1;
+    slot->done = false;
+    up->inflight_count++;
+    up->early_ack = -1;
+    up->next = up->batch.end;
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+
+    int id = transport_send(up);
+
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    bool sent = id >= 0;
+    if (sent) {
+        // The slot may have been rewound away in the meantime, or confirmed
+        // before the id was known.
+        for (int i = 0; i < up->inflight_count; i++) {
+            upload_inflight_t *entry = inflight_at(up, i);
+            if (entry->id == -1) {
+                entry->id = id;
+                if (up->early_ack == id) {
+                    entry->done = true;
+                    up->early_ack = -1;
+                    advance_acked(up);
+                }
+                break;
+            }
+        }
+    } else {
+        up->stats.failures++;
+        up->inflight_count = 0;
+        up->next = up->acked;
+    }
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+    return sent;
+}
+
+// Skip over a stretch of the log that holds no blocks.
+static void
+skip_empty(uploader_t *up, samplelog_pos_t from, samplelog_pos_t to) {
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    if (up->next == from) {
+        up->next = to;
+        if (up->acked == from) {
+            up->acked = to;
+        }
+    }
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+}
+
+// One bucket of the summary, merged from the rollups that fall into it.
+typedef struct summary_bucket_t {
+    int64_t start;
+    uint32_t count;
+    int64_t sum;
+    int32_t min_value;
+    int32_t max_value;
+} summary_bucket_t;
+
+static void merge_rollup(summary_bucket_t *bucket, const rollup_t *rollup) {
+    if (bucket->count == 0) {
+        bucket->min_value = rollup->min_value;
+        bucket->max_value = rollup->max_value;
+    }
+    bucket->min_value = rollup->min_value < bucket->min_value
+                            ? rollup->min_value
+                            : bucket->min_value;
+    bucket->max_value = rollup->max_value > bucket->max_value
+                            ? rollup->max_value
+                            : bucket->max_value;
+    bucket->count += rollup->count;
+    bucket->sum += rollup->sum;
+}
+
+// Appends "[channel,start,min,max,mean]," to the JSON, false if it doesn't
+// fit.
+static bool append_bucket(
+    char *json, size_t size, size_t *len, int channel, summary_bucket_t *b) {
+    if (b->count == 0) {
+        return true;
+    }
+    int n = snprintf(
+        json + *len,
+        size - *len,
+        "[%d,%lld,%ld,%ld,%ld],",
+        channel,
+        (long long)b->start,
+        (long)b->min_value,
+        (long)b->max_value,
+        (long)(b->sum / b->count));
+    if (n < 0 || (size_t)n >= size - *len) {
+        return false;
+    }
+    *len += n;
+    b->count = 0;
+    b->sum = 0;
+    return true;
+}
+
+// Min, max and mean of every channel over the gap in at most
+// UPLOAD_SUMMARY_BUCKETS buckets, read from the rollups instead of the log.
+// Min and max keep the spikes a plain downsample would smooth over. The
+// bucket still being filled goes last, it is the freshest reading there is.
+// Returns the length, 0 if there is nothing to summarize.
+static size_t
+build_summary(char *json, size_t size, int64_t from, int64_t to) {
+    rollup_tier_t tier = rt_Minute;
+    int64_t bucket_ms = (to - from) / UPLOAD_SUMMARY_BUCKETS;
+    if (bucket_ms >= ll_rollupstore_period(rt_Hour)) {
+        tier = rt_Hour;
+    }
+    int64_t period = ll_rollupstore_period(tier);
+    bucket_ms = (bucket_ms / period + 1) * period;
+
+    size_t len = snprintf(
+        json,
+        size,
+        "{\"summary\":{\"from\":%lld,\"to\":%lld,\"bucket_ms\":%lld,"
+        "\"b\":[",
+        (long long)from,
+        (long long)to,
+        (long long)bucket_ms);
+    size_t empty_len = len;
+    summary_bucket_t buckets[SENSOR_CHANNEL_COUNT] = {0};
+    rollup_index_t head = ll_rollupstore_head(tier);
+    bool fits = true;
+    for (rollup_index_t i = ll_rollupstore_find(tier, from); i < head && fits;
+         i++) {
+        rollup_t rollup;
+        if (!ll_rollupstore_read(tier, i, &rollup) ||
+            rollup.channel >= SENSOR_CHANNEL_COUNT) {
+            continue;
+        }
+        summary_bucket_t *bucket = &buckets[rollup.channel];
+        int64_t start = from + (rollup.start - from) / bucket_ms * bucket_ms;
+        if (bucket->count > 0 && bucket->start != start) {
+            fits = append_bucket(json, size, &len, rollup.channel, bucket);
+        }
+        bucket->start = start;
+        merge_rollup(bucket, &rollup);
+    }
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT && fits; ch++) {
+        fits = append_bucket(json, size, &len, ch, &buckets[ch]);
+        rollup_t current;
+        if (fits && ll_rollupstore_current(rt_Minute, ch, &current)) {
+            summary_bucket_t bucket = {.start = current.start};
+            merge_rollup(&bucket, &current);
+            fits = append_bucket(json, size, &len, ch, &bucket);
+        }
+    }
+    if (!fits || len == empty_len || len + 3 > size) {
+        return 0;
+    }
+    // Replace the trailing comma.
+    len--;
+    len += snprintf(json + len, size - len, "]}}");
+    return len;
+}
+
+// Timestamp of the first sample at or after the position, or -1.
+static int64_t first_timestamp(uploader_t *up, samplelog_pos_t pos) {
+    size_t len = ll_samplelog_read(&pos, up->batch.data, CODEC_BLOCK_SIZE);
+    codec_block_header_t header;
+    if (len == 0 || !ll_codec_read_header(up->batch.data, len, &header)) {
+        return -1;
+    }
+    return header.first_timestamp;
+}
+
+// Called with a backlog of more than UPLOAD_CATCHUP_MIN_BYTES, after an
+// outage or on boot. Oldest first, a dashboard stays stale until the whole
+// backlog is in. Instead a summary of the gap goes first, then the last
+// UPLOAD_CATCHUP_FRESH_MS of the log. The backlog follows oldest first at the
+// usual pace, with new blocks sent as soon as they are logged. The target
+// drops the blocks it gets twice by their log position. Returns false if the
+// summary couldn't be sent.
+static bool start_catchup(uploader_t *up, samplelog_pos_t next) {
+    int64_t now = ll_sampler_now();
+    int64_t from = first_timestamp(up, next);
+    if (from >= 0 && from < now) {
+        char *json = (char *)up->batch.data;
+        size_t len = build_summary(json, sizeof(up->batch.data), from, now);
+        if (len > 0 && !transport_send_summary(up, json, len)) {
+            return false;
+        }
+    }
+    samplelog_pos_t fresh = ll_samplelog_find(now - UPLOAD_CATCHUP_FRESH_MS);
+    up->fresh_from = fresh > next ? fresh : next;
+    up->fresh_next = up->fresh_from;
+    up->catching_up = true;
+    up->catchup_started = esp_timer_get_time();
+    ESP_LOGI(
+        TAG,
+        "Catching up on %llu bytes from %lld ms ago, fresh data from log "
+        "position %llu first",
+        ll_samplelog_head() - next,
+        from >= 0 ? now - from : -1,
+        up->fresh_from);
+    return true;
+}
+
+// Sends the blocks logged since the last call, ahead of the backlog. They
+// take no window slot and don't move acked, the backlog sends them again.
+// Returns false if one couldn't be sent.
+static bool send_fresh(uploader_t *up, samplelog_pos_t head) {
+    while (up->fresh_next < head) {
+        build_batch(up, up->fresh_next);
+        up->batch.metrics[0] = '\0';
+        if (up->batch.len > 0 && transport_send(up) < 0) {
+            return false;
+        }
+        up->fresh_next = up->batch.end;
+    }
+    return true;
+}
+
+static void persist_acked(uploader_t *up) {
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    if (up->acked != up->persisted) {
+        ESP_EC(nvs_set_u64(up->nvs, "acked", up->acked));
+        ESP_EC(nvs_commit(up->nvs));
+        up->persisted = up->acked;
+    }
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+}
+
+static void back_off(uint32_t *retry_ms) {
+    ESP_LOGW(TAG, "Couldn't send, retrying in %lu ms", *retry_ms);
+    // A raised alarm cuts the wait short.
+    ulTaskNotifyTake(pdTRUE, *retry_ms / portTICK_PERIOD_MS);
+    *retry_ms = *retry_ms * 2 > UPLOAD_RETRY_MAX_MS ? UPLOAD_RETRY_MAX_MS
+                                                    : *retry_ms * 2;
+}
+
+static void uploader_task(void *arg) {
+    uploader_t *up = (uploader_t *)arg;
+    const TickType_t poll_ticks = UPLOAD_POLL_MS / portTICK_PERIOD_MS;
+    TickType_t pending_since = 0;
+    bool pending = false;
+    uint32_t retry_ms = UPLOAD_RETRY_MIN_MS;
+
+    while (true) {
+        persist_acked(up);
+        if (!transport_ready(up)) {
+            ulTaskNotifyTake(pdTRUE, poll_ticks);
+            continue;
+        }
+        if (!send_alarms(up)) {
+            ulTaskNotifyTake(pdTRUE, poll_ticks);
+            continue;
+        }
+
+        POSIX_EC(pthread_mutex_lock(&up->mutex));
+        samplelog_pos_t next = up->next;
+        bool window_full = up->inflight_count >= up->window;
+        bool flush = up->flush;
+        POSIX_EC(pthread_mutex_unlock(&up->mutex));
+        if (window_full) {
+            // Woken up by the transport when a batch is confirmed.
+            ulTaskNotifyTake(pdTRUE, poll_ticks);
+            continue;
+        }
+
+        samplelog_pos_t head = ll_samplelog_head();
+        if (!up->catching_up && head - next >= UPLOAD_CATCHUP_MIN_BYTES &&
+            !start_catchup(up, next)) {
+            back_off(&retry_ms);
+            continue;
+        }
+        if (up->catching_up && next >= up->fresh_from) {
+            up->catching_up = false;
+            ESP_LOGI(
+                TAG,
+                "Caught up in %lld ms",
+                (esp_timer_get_time() - up->catchup_started) / 1000);
+        }
+        if (up->catching_up && !send_fresh(up, head)) {
+            back_off(&retry_ms);
+            continue;
+        }
+        if (head <= next) {
+            pending = false;
+            ulTaskNotifyTake(pdTRUE, poll_ticks);
+            continue;
+        }
+        if (!pending) {
+            pending = true;
+            pending_since = xTaskGetTickCount();
+        }
+
+        // Hold off until either a full batch is waiting or the oldest pending
+        // data has waited long enough.
+        bool full = head - next >= UPLOAD_BATCH_MAX_BYTES;
+        bool due = flush || xTaskGetTickCount() - pending_since >=
+                               UPLOAD_MAX_DELAY_MS / portTICK_PERIOD_MS;
+        if (!full && !due) {
+            ulTaskNotifyTake(pdTRUE, poll_ticks);
+            continue;
+        }
+
+        build_batch(up, next);
+        if (up->batch.len == 0) {
+            // Only skipped over sector padding or overwritten data.
+            skip_empty(up, next, up->batch.end);
+            continue;
+        }
+        // Every so often a metrics snapshot rides along with the batch.
+        bool metrics_due = esp_timer_get_time() - up->metrics_at >=
+                           METRICS_SNAPSHOT_INTERVAL_MS * 1000LL;
+        up->batch.metrics[0] = '\0';
+        if (metrics_due) {
+            ll_metrics_snapshot(up->batch.metrics, sizeof(up->batch.metrics));
+        }
+        if (!send_batch(up, next)) {
+            back_off(&retry_ms);
+            continue;
+        }
+        retry_ms = UPLOAD_RETRY_MIN_MS;
+        if (metrics_due) {
+            up->metrics_at = esp_timer_get_time();
+        }
+        // The target is reachable right now, ask it for config changes. Once
+        // per upload cycle, not for every batch of a backlog.
+        if (esp_timer_get_time() - up->polled_at >=
+            REMOTE_POLL_INTERVAL_MS * 1000LL) {
+            up->polled_at = esp_timer_get_time();
+            ll_remote_poll();
+        }
+
+        if (head - up->batch.end >= UPLOAD_BATCH_MAX_BYTES) {
+            // Draining a backlog, pace it so it doesn't hog the link.
+            vTaskDelay(UPLOAD_DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+        } else {
+            // Restart the delay window for whatever is still left in the log.
+            pending = false;
+        }
+    }
+}
+
+// Runs on the uploader task, from ll_remote_poll between batches.
+static void remote_changed(
+    const remote_config_t *config, uint32_t changed, void *ctx) {
+    uploader_t *up = (uploader_t *)ctx;
+    copy_netinfo(&up->info, &config->netinfo);
+    if (up->transport == ut_Http) {
+        ll_upload_http_retarget(&up->info);
+    }
+    ESP_LOGI(
+        TAG,
+        "Uploading to %s as %s from now on",
+        up->info.target,
+        up->info.devname);
+}
+
+void ll_uploader_start(const network_info_t *netinfo) {
+    NPC(netinfo);
+    uploader_t *up = &glob_uploader;
+    NOT_NPC(up->task);
+    copy_netinfo(&up->info, netinfo);
+
+    ESP_EC(nvs_open(UPLOAD_NVS_NAMESPACE, NVS_READWRITE, &up->nvs));
+    up->acked = 0;
+    esp_err_t err = nvs_get_u64(up->nvs, "acked", &up->acked);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_EC(err);
+    }
+    up->persisted = up->acked;
+    // NVS outlives a reformatted sample log, a position past the head is
+    // from the old log. The clamped position is persisted by the task.
+    samplelog_pos_t tail = ll_samplelog_tail();
+    samplelog_pos_t head = ll_samplelog_head();
+    if (up->acked > head) {
+        ESP_LOGW(
+            TAG,
+            "Log position %llu is past the log's head %llu, starting over",
+            up->acked,
+            head);
+        up->acked = tail;
+    } else if (up->acked < tail) {
+        up->acked = tail;
+    }
+    up->next = up->acked;
+    up->inflight_head = 0;
+    up->inflight_count = 0;
+    up->early_ack = -1;
+    // The first batch after boot carries a snapshot.
+    up->metrics_at = -METRICS_SNAPSHOT_INTERVAL_MS * 1000LL;
+    // The first poll too, a duty cycle wake uploads only once.
+    up->polled_at = -REMOTE_POLL_INTERVAL_MS * 1000LL;
+    up->alarms = xQueueCreate(ALARM_QUEUE_LEN, sizeof(alarm_event_t));
+    NPC(up->alarms);
+
+    if (strncmp(up->info.target, "mqtt", 4) == 0) {
+        up->transport = ut_Mqtt;
+        up->window = MQTT_WINDOW;
+        ll_upload_mqtt_init(&up->info);
+    } else {
+        up->transport = ut_Http;
+        up->window = 1;
+        ll_upload_http_init(&up->info);
+    }
+    ll_remote_subscribe(rk_Target | rk_Devname, remote_changed, up);
+
+    ESP_LOGI(
+        TAG,
+        "Uploading to %s as %s from log position %llu",
+        up->info.target,
+        up->info.devname,
+        up->acked);
+    if (xTaskCreate(
+            uploader_task,
+            "ll_uploader",
+            UPLOADER_STACK_SIZE,
+            up,
+            3,
+            &up->task) != pdPASS) {
+        ESP_LOGE(TAG, "Couldn't create uploader task!");
+        abort();
+    }
+    ll_metrics_register_task(up->task);
+}
+
+void ll_uploader_get_stats(uploader_stats_t *stats) {
+    NPC(stats);
+    POSIX_EC(pthread_mutex_lock(&glob_uploader.mutex));
+    *stats = glob_uploader.stats;
+    POSIX_EC(pthread_mutex_unlock(&glob_uploader.mutex));
+}
+
+void ll_uploader_batch_done(int id) {
+    uploader_t *up = &glob_uploader;
+
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    upload_inflight_t *match = NULL;
+    for (int i = 0; i < up->inflight_count; i++) {
+        upload_inflight_t *entry = inflight_at(up, i);
+        if (entry->id == id && !entry->done) {
+            match = entry;
+            break;
+        }
+    }
+    if (match != NULL) {
+        match->done = true;
+        advance_acked(up);
+    } else if (!alarm_done(up, id)) {
+        // Either the batch or alarm being sent was confirmed before its send
+        // call returned, or this was neither (a summary or fresh data).
+        up->early_ack = id;
+    }
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+
+    if (up->task != NULL) {
+        xTaskNotifyGive(up->task);
+    }
+}
+
+void ll_uploader_rewind() {
+    uploader_t *up = &glob_uploader;
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    if (up->inflight_count > 0) {
+        ESP_LOGW(
+            TAG,
+            "Rewinding %d unconfirmed batches to log position %llu",
+            up->inflight_count,
+            up->acked);
+    }
+    up->inflight_count = 0;
+    up->next = up->acked;
+    // Unconfirmed alarms go out again, oldest first. One may reach the
+    // target twice, like a batch.
+    for (int i = up->alarms_inflight_count - 1; i >= 0; i--) {
+        const alarm_event_t *event = &up->alarms_inflight[i].event;
+        if (xQueueSendToFront(up->alarms, event, 0) != pdTRUE) {
+            ESP_LOGE(TAG, "Alarm queue full, dropping alarm %s!", event->rule);
+        }
+    }
+    up->alarms_inflight_count = 0;
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+
+    if (up->task != NULL) {
+        xTaskNotifyGive(up->task);
+    }
+}
+
+void ll_uploader_alarm(const alarm_event_t *event) {
+    NPC(event);
+    uploader_t *up = &glob_uploader;
+    NPC(up->alarms);
+    ESP_LOGW(
+        TAG,
+        "Alarm %s %s at value %ld",
+        event->rule,
+        event->active ? "raised" : "cleared",
+        event->value);
+    if (xQueueSend(up->alarms, event, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Alarm queue full, dropping alarm %s!", event->rule);
+        return;
+    }
+    xTaskNotifyGive(up->task);
+}
+
+bool ll_uploader_drain(uint32_t timeout_ms) {
+    uploader_t *up = &glob_uploader;
+    NPC(up->task);
+    samplelog_pos_t target = ll_samplelog_head();
+    TickType_t started = xTaskGetTickCount();
+
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    up->flush = true;
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+    xTaskNotifyGive(up->task);
+
+    bool drained = false;
+    while (xTaskGetTickCount() - started < timeout_ms / portTICK_PERIOD_MS) {
+        POSIX_EC(pthread_mutex_lock(&up->mutex));
+        drained = up->acked >= target && up->alarms_inflight_count == 0 &&
+                  uxQueueMessagesWaiting(up->alarms) == 0;
+        POSIX_EC(pthread_mutex_unlock(&up->mutex));
+        if (drained) {
+            break;
+        }
+        vTaskDelay(UPLOAD_DRAIN_POLL_MS / portTICK_PERIOD_MS);
+    }
+    // Make sure the acked position is on flash before anyone cuts the power.
+    persist_acked(up);
+
+    POSIX_EC(pthread_mutex_lock(&up->mutex));
+    up->flush = false;
+    POSIX_EC(pthread_mutex_unlock(&up->mutex));
+    return drained;
+}